@@ -0,0 +1,779 @@
+/* Simple Plugin API
+ * Copyright (C) 2017 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_GRAPH_SCHEDULER_H__
+#define __SPA_GRAPH_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <spa/graph/graph.h>
+
+/* Parallel scheduler
+ *
+ * The nodes of the graph are kept in a flat plan, sorted so that each node
+ * comes after the nodes it depends on, see spa_graph_compile(). The plan is
+ * rebuilt before a cycle when nodes or links changed.
+ *
+ * A cycle is started with need_input or have_output on a node. The nodes
+ * that take part in the cycle are collected first with one linear walk over
+ * the plan, upstream of the node for need_input and downstream for
+ * have_output.
+ *
+ * Without worker threads, the collected nodes are then processed in plan
+ * order. With workers, each collected node gets a counter with the number of
+ * collected nodes it depends on. Nodes without pending dependencies are
+ * placed on a ready queue that is drained by the calling thread and the
+ * workers. When a node completes, the counters of its peers are decremented
+ * and the peers that reach 0 are queued. Independent branches of the graph,
+ * like the inputs of a mixer, are this way processed concurrently.
+ *
+ * The counters and the ready queue are updated with atomic operations, no
+ * thread ever blocks on a lock held by another thread. Idle workers sleep
+ * on a futex and are only woken when more nodes became ready than the
+ * thread that queued them can process. The calling thread sleeps until the
+ * last node of the cycle completed when it has nothing left to process.
+ * Cycles with more nodes than fit in the ready queue are processed without
+ * the workers.
+ *
+ * Nodes that are linked to the graph but not added to it are processed
+ * before or after the nodes in the plan.
+ *
+ * When the graph has a driver, only the driver starts cycles. A driver
+ * cycle runs every node of the plan once in dependency order, nodes
+ * without active inputs produce output and the others consume their
+ * input. need_input and have_output from other nodes of the graph are
+ * ignored, they are served by the next driver cycle.
+ *
+ * The calling thread returns when all nodes of the cycle completed. Each
+ * node is processed at most once per cycle.
+ */
+
+#define SPA_GRAPH_MAX_WORKERS		32
+#define SPA_GRAPH_QUEUE_SIZE		1024	/**< size of the ready queue, power of 2 */
+
+#define SPA_GRAPH_ACTION_NONE		0	/**< node only completes */
+#define SPA_GRAPH_ACTION_IN		1	/**< call process_input */
+#define SPA_GRAPH_ACTION_OUT		2	/**< call process_output */
+
+struct spa_graph_queue_cell {
+	uint32_t seq;			/**< position + 1 when node is queued */
+	struct spa_graph_node *node;
+};
+
+struct spa_graph_data {
+	struct spa_graph *graph;
+	uint32_t busy;			/**< set while a cycle runs */
+	struct spa_list ready;		/**< nodes that can start the cycle */
+	struct spa_graph_node *node;	/**< node that started the cycle */
+	struct spa_list extra;		/**< nodes in the cycle that are not in
+					  *  the plan of the graph */
+	uint32_t cycle;			/**< current cycle */
+	uint32_t lo, hi;		/**< range of the plan used by the cycle */
+	bool running;			/**< if the workers are running */
+	uint32_t n_workers;		/**< number of worker threads */
+	pthread_t workers[SPA_GRAPH_MAX_WORKERS];
+	int priority;			/**< realtime priority of workers, 0 for none */
+
+	uint32_t n_pending __attribute__ ((aligned (64)));	/**< nodes in the cycle not
+								  *  completed yet */
+	uint32_t waiting;		/**< the thread of the cycle waits on n_pending */
+	uint32_t head __attribute__ ((aligned (64)));	/**< next cell to dequeue */
+	uint32_t tail __attribute__ ((aligned (64)));	/**< next cell to queue */
+	uint32_t wakeup __attribute__ ((aligned (64)));	/**< changed to wake up workers */
+	uint32_t n_sleeping;		/**< workers waiting on wakeup */
+	struct spa_graph_queue_cell queue[SPA_GRAPH_QUEUE_SIZE];
+};
+
+static inline void spa_graph_data_init(struct spa_graph_data *data,
+				       struct spa_graph *graph)
+{
+	uint32_t i;
+
+	data->graph = graph;
+	data->busy = 0;
+	spa_list_init(&data->ready);
+	spa_list_init(&data->extra);
+	data->node = NULL;
+	data->cycle = 0;
+	data->lo = data->hi = 0;
+	data->running = false;
+	data->n_workers = 0;
+	data->priority = 0;
+	data->n_pending = 0;
+	data->waiting = 0;
+	data->head = data->tail = 0;
+	data->wakeup = 0;
+	data->n_sleeping = 0;
+	for (i = 0; i < SPA_GRAPH_QUEUE_SIZE; i++)
+		data->queue[i].seq = 0;
+}
+
+static inline void spa_graph_data_futex_wait(uint32_t *addr, uint32_t val)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+static inline void spa_graph_data_futex_wake(uint32_t *addr, int n)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+/* Add a ready node to the queue, safe to call from any thread. A cycle
+ * queues each of its nodes once and completes before the next cycle
+ * starts, the queue can't overflow for cycles of at most
+ * SPA_GRAPH_QUEUE_SIZE nodes. */
+static inline void spa_graph_data_queue(struct spa_graph_data *data,
+					struct spa_graph_node *node)
+{
+	uint32_t pos = __atomic_fetch_add(&data->tail, 1, __ATOMIC_RELAXED);
+	struct spa_graph_queue_cell *cell = &data->queue[pos & (SPA_GRAPH_QUEUE_SIZE - 1)];
+
+	cell->node = node;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Take a node from the queue, safe to call from any thread.
+ * \return a ready node or NULL when the queue is empty */
+static inline struct spa_graph_node *spa_graph_data_dequeue(struct spa_graph_data *data)
+{
+	struct spa_graph_queue_cell *cell;
+	struct spa_graph_node *node;
+	uint32_t pos = __atomic_load_n(&data->head, __ATOMIC_RELAXED);
+	int32_t diff;
+
+	while (true) {
+		cell = &data->queue[pos & (SPA_GRAPH_QUEUE_SIZE - 1)];
+		diff = (int32_t) (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff < 0)
+			return NULL;
+		if (diff > 0) {
+			pos = __atomic_load_n(&data->head, __ATOMIC_RELAXED);
+			continue;
+		}
+		node = cell->node;
+		if (__atomic_compare_exchange_n(&data->head, &pos, pos + 1, true,
+						__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			return node;
+	}
+}
+
+/* wake up at most \a n sleeping workers after nodes were queued */
+static inline void spa_graph_data_wake_workers(struct spa_graph_data *data, uint32_t n)
+{
+	/* pairs with the fence in spa_graph_data_worker() */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&data->n_sleeping, __ATOMIC_RELAXED) == 0)
+		return;
+	__atomic_add_fetch(&data->wakeup, 1, __ATOMIC_RELEASE);
+	spa_graph_data_futex_wake(&data->wakeup, SPA_MIN(n, (uint32_t) INT_MAX));
+}
+
+static inline bool spa_graph_port_is_active(struct spa_graph_port *port)
+{
+	return port->peer != NULL && !(port->peer->flags & SPA_GRAPH_PORT_FLAG_DISABLED);
+}
+
+static inline bool spa_graph_node_in_plan(struct spa_graph *graph,
+					  struct spa_graph_node *node)
+{
+	return node->graph == graph && node->order < graph->n_plan &&
+		graph->plan[node->order] == node;
+}
+
+static inline void spa_graph_data_collect(struct spa_graph_data *data,
+					  struct spa_graph_node *node, int action)
+{
+	node->cycle = data->cycle;
+	node->pending = 0;
+	node->state = action;
+	data->n_pending++;
+
+	if (spa_graph_node_in_plan(data->graph, node)) {
+		data->lo = SPA_MIN(data->lo, node->order);
+		data->hi = SPA_MAX(data->hi, node->order);
+	} else if (node != data->node)
+		spa_list_append(&data->extra, &node->sched_link);
+}
+
+/* start a new cycle for \a node. Only called by the thread that set busy. */
+static inline int spa_graph_data_begin(struct spa_graph_data *data,
+				       struct spa_graph_node *node, int action)
+{
+	int res;
+
+	if (data->graph->dirty &&
+	    (res = spa_graph_compile(data->graph)) < 0)
+		return res;
+
+	data->cycle++;
+	data->node = node;
+	spa_list_init(&data->extra);
+	data->n_pending = 0;
+	/* the last worker of the previous cycle can still look at this */
+	__atomic_store_n(&data->waiting, 0, __ATOMIC_RELAXED);
+	data->lo = UINT32_MAX;
+	data->hi = 0;
+	spa_graph_data_collect(data, node, action);
+
+	return 0;
+}
+
+/* count the dependencies of a node and queue the node when it can
+ * start right away. The node that started the cycle runs last for a
+ * pull and first for a push, links that go against this are ignored so
+ * that loops in the graph can't stall the cycle. A driver is ordered in
+ * the plan, its links only count when they follow the plan. */
+static inline void spa_graph_data_prepare(struct spa_graph_data *data,
+					  struct spa_graph_node *node,
+					  enum spa_direction direction)
+{
+	struct spa_graph_node *pnode;
+	struct spa_graph_port *p;
+
+	if (direction == SPA_DIRECTION_INPUT || node != data->node) {
+		spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+			if (!spa_graph_port_is_active(p))
+				continue;
+
+			pnode = p->peer->node;
+			if (pnode->cycle != data->cycle)
+				continue;
+			if (direction == SPA_DIRECTION_INPUT && pnode == data->node &&
+			    !(pnode == data->graph->driver && pnode->order < node->order &&
+			      spa_graph_node_in_plan(data->graph, node)))
+				continue;
+
+			node->pending++;
+		}
+	}
+	if (node->pending == 0)
+		spa_list_append(&data->ready, &node->ready_link);
+}
+
+/* check if all required inputs of a node have data */
+static inline bool spa_graph_node_has_input(struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+	uint32_t ready = 0;
+
+	if (spa_list_is_empty(&node->ports[SPA_DIRECTION_INPUT]))
+		return true;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (!spa_graph_port_is_active(p))
+			continue;
+		if (p->io->status == SPA_STATUS_HAVE_BUFFER)
+			ready++;
+		else if (!(p->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
+			return false;
+	}
+	return ready > 0;
+}
+
+static inline uint64_t spa_graph_data_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return SPA_TIMESPEC_TO_TIME(&ts);
+}
+
+/* call process_input or process_output on \a node. Reading the clock costs
+ * more than many nodes take to process, only nodes with the profile flag
+ * are timed. */
+static inline int spa_graph_data_call(struct spa_graph_node *node, int action)
+{
+	uint64_t start;
+	int res;
+
+	if (SPA_LIKELY(!(node->flags & SPA_GRAPH_NODE_FLAG_PROFILE)))
+		return action == SPA_GRAPH_ACTION_IN ?
+			spa_node_process_input(node->implementation) :
+			spa_node_process_output(node->implementation);
+
+	start = spa_graph_data_now();
+	if (action == SPA_GRAPH_ACTION_IN)
+		res = spa_node_process_input(node->implementation);
+	else
+		res = spa_node_process_output(node->implementation);
+	spa_graph_node_update_stats(node, spa_graph_data_now() - start);
+
+	return res;
+}
+
+static inline void spa_graph_data_process(struct spa_graph_data *data,
+					  struct spa_graph_node *node)
+{
+	switch (node->state) {
+	case SPA_GRAPH_ACTION_IN:
+		if (spa_graph_node_has_input(node))
+			node->state = spa_graph_data_call(node, SPA_GRAPH_ACTION_IN);
+		else
+			node->state = SPA_STATUS_NEED_BUFFER;
+		spa_debug("node %p processed in %d", node, node->state);
+		break;
+	case SPA_GRAPH_ACTION_OUT:
+		node->state = spa_graph_data_call(node, SPA_GRAPH_ACTION_OUT);
+		spa_debug("node %p processed out %d", node, node->state);
+		break;
+	default:
+		node->state = SPA_STATUS_HAVE_BUFFER;
+		break;
+	}
+}
+
+/* Remove one pending dependency of \a node. Links that were ignored in
+ * spa_graph_data_prepare() can make this happen more often than there were
+ * dependencies, the counter never goes below 0.
+ * \return true when this was the last dependency */
+static inline bool spa_graph_data_release(struct spa_graph_node *node)
+{
+	int32_t pending = __atomic_load_n(&node->pending, __ATOMIC_RELAXED);
+
+	do {
+		if (pending <= 0)
+			return false;
+	} while (!__atomic_compare_exchange_n(&node->pending, &pending, pending - 1, true,
+					      __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	return pending == 1;
+}
+
+/* Mark a node as completed and queue the peers that became ready. The
+ * calling thread goes on with one of them, workers are woken for the
+ * others. */
+static inline void spa_graph_data_complete(struct spa_graph_data *data,
+					   struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+	uint32_t n_ready = 0;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		struct spa_graph_node *pnode;
+
+		if (!spa_graph_port_is_active(p))
+			continue;
+
+		pnode = p->peer->node;
+		if (pnode->cycle != data->cycle)
+			continue;
+
+		if (spa_graph_data_release(pnode)) {
+			spa_graph_data_queue(data, pnode);
+			n_ready++;
+		}
+	}
+	if (n_ready > 1)
+		spa_graph_data_wake_workers(data, n_ready - 1);
+
+	if (__atomic_sub_fetch(&data->n_pending, 1, __ATOMIC_SEQ_CST) == 0 &&
+	    __atomic_load_n(&data->waiting, __ATOMIC_SEQ_CST))
+		spa_graph_data_futex_wake(&data->n_pending, 1);
+}
+
+/* Process nodes from the queue until the cycle completed */
+static inline void spa_graph_data_wait(struct spa_graph_data *data)
+{
+	struct spa_graph_node *n;
+	uint32_t pending;
+
+	while ((pending = __atomic_load_n(&data->n_pending, __ATOMIC_ACQUIRE)) > 0) {
+		if ((n = spa_graph_data_dequeue(data)) != NULL) {
+			spa_graph_data_process(data, n);
+			spa_graph_data_complete(data, n);
+			continue;
+		}
+		/* the workers are busy with the remaining nodes, the last
+		 * one to complete wakes us up */
+		__atomic_store_n(&data->waiting, 1, __ATOMIC_SEQ_CST);
+		spa_graph_data_futex_wait(&data->n_pending, pending);
+	}
+}
+
+/* Run the cycle until all nodes completed. The node that started the
+ * cycle and the extra nodes are not in the plan and are handled
+ * separately, they are the first or last nodes of the cycle. */
+static inline void spa_graph_data_run(struct spa_graph_data *data,
+				      enum spa_direction direction)
+{
+	struct spa_graph *graph = data->graph;
+	struct spa_graph_node *n, *node = data->node;
+	bool in_plan = spa_graph_node_in_plan(graph, node);
+	uint32_t i, n_ready = 0;
+
+	if (data->n_workers == 0 || data->n_pending > SPA_GRAPH_QUEUE_SIZE) {
+		if (direction == SPA_DIRECTION_OUTPUT) {
+			if (!in_plan)
+				spa_graph_data_process(data, node);
+		} else {
+			spa_list_for_each(n, &data->extra, sched_link)
+				spa_graph_data_process(data, n);
+		}
+
+		for (i = data->lo; i <= data->hi && i < graph->n_plan; i++) {
+			n = graph->plan[i];
+			if (n->cycle == data->cycle)
+				spa_graph_data_process(data, n);
+		}
+
+		if (direction == SPA_DIRECTION_OUTPUT) {
+			spa_list_for_each(n, &data->extra, sched_link)
+				spa_graph_data_process(data, n);
+		} else {
+			if (!in_plan)
+				spa_graph_data_process(data, node);
+		}
+		data->n_pending = 0;
+		return;
+	}
+
+	if (!in_plan)
+		spa_graph_data_prepare(data, node, direction);
+
+	spa_list_for_each(n, &data->extra, sched_link)
+		spa_graph_data_prepare(data, n, direction);
+
+	for (i = data->lo; i <= data->hi && i < graph->n_plan; i++) {
+		n = graph->plan[i];
+		if (n->cycle == data->cycle)
+			spa_graph_data_prepare(data, n, direction);
+	}
+
+	/* all counters are set before the first node can complete */
+	while (!spa_list_is_empty(&data->ready)) {
+		n = spa_list_first(&data->ready, struct spa_graph_node, ready_link);
+		spa_list_remove(&n->ready_link);
+		n->ready_link.next = NULL;
+		spa_graph_data_queue(data, n);
+		n_ready++;
+	}
+	if (n_ready > 1)
+		spa_graph_data_wake_workers(data, n_ready - 1);
+
+	spa_graph_data_wait(data);
+}
+
+static inline void *spa_graph_data_worker(void *user_data)
+{
+	struct spa_graph_data *data = user_data;
+
+	if (data->priority > 0) {
+		struct sched_param sp = { .sched_priority = data->priority };
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp) != 0)
+			spa_debug("graph %p: can't set worker priority", data->graph);
+	}
+
+	while (__atomic_load_n(&data->running, __ATOMIC_SEQ_CST)) {
+		struct spa_graph_node *n;
+
+		if ((n = spa_graph_data_dequeue(data)) == NULL) {
+			uint32_t seq = __atomic_load_n(&data->wakeup, __ATOMIC_SEQ_CST);
+
+			/* check the queue again after announcing that we sleep,
+			 * pairs with the fence in spa_graph_data_wake_workers() */
+			__atomic_add_fetch(&data->n_sleeping, 1, __ATOMIC_SEQ_CST);
+			__atomic_thread_fence(__ATOMIC_SEQ_CST);
+			if ((n = spa_graph_data_dequeue(data)) == NULL &&
+			    __atomic_load_n(&data->running, __ATOMIC_SEQ_CST))
+				spa_graph_data_futex_wait(&data->wakeup, seq);
+			__atomic_sub_fetch(&data->n_sleeping, 1, __ATOMIC_RELAXED);
+
+			if (n == NULL)
+				continue;
+		}
+		spa_graph_data_process(data, n);
+		spa_graph_data_complete(data, n);
+	}
+	return NULL;
+}
+
+/** Start \a n_workers worker threads with realtime \a priority, 0 for
+ * no realtime priority. Without workers, the cycle is processed on the
+ * calling thread only. */
+static inline int spa_graph_data_start(struct spa_graph_data *data,
+				       uint32_t n_workers, int priority)
+{
+	uint32_t i;
+	int res = 0;
+
+	if (data->running)
+		return 0;
+
+	data->running = true;
+	data->priority = priority;
+
+	n_workers = SPA_MIN(n_workers, SPA_GRAPH_MAX_WORKERS);
+	for (i = 0; i < n_workers; i++) {
+		if ((res = pthread_create(&data->workers[i], NULL,
+					  spa_graph_data_worker, data)) != 0)
+			break;
+	}
+	data->n_workers = i;
+
+	return -res;
+}
+
+/** Stop and join the worker threads */
+static inline void spa_graph_data_stop(struct spa_graph_data *data)
+{
+	uint32_t i;
+
+	__atomic_store_n(&data->running, false, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&data->wakeup, 1, __ATOMIC_SEQ_CST);
+	spa_graph_data_futex_wake(&data->wakeup, INT_MAX);
+
+	for (i = 0; i < data->n_workers; i++)
+		pthread_join(data->workers[i], NULL);
+	data->n_workers = 0;
+}
+
+/* Ask the peers of \a node for data. Nodes with inputs are asked to produce
+ * output, which makes them request input from their peers. Nodes without
+ * inputs are the sources of the cycle and produce their output later,
+ * possibly in parallel. */
+static inline void spa_graph_data_pull(struct spa_graph_data *data,
+				       struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		struct spa_graph_port *pport;
+		struct spa_graph_node *pnode;
+		int res;
+
+		if (!spa_graph_port_is_active(p))
+			continue;
+
+		pport = p->peer;
+		pnode = pport->node;
+
+		if (pnode->cycle == data->cycle || pport->io->status != SPA_STATUS_NEED_BUFFER)
+			continue;
+
+		if (spa_list_is_empty(&pnode->ports[SPA_DIRECTION_INPUT])) {
+			spa_graph_data_collect(data, pnode, SPA_GRAPH_ACTION_OUT);
+		} else {
+			res = spa_graph_data_call(pnode, SPA_GRAPH_ACTION_OUT);
+			spa_debug("peer %p processed out %d", pnode, res);
+			spa_graph_data_collect(data, pnode, res == SPA_STATUS_NEED_BUFFER ?
+					SPA_GRAPH_ACTION_IN : SPA_GRAPH_ACTION_NONE);
+		}
+	}
+}
+
+/* Collect everything downstream of \a node, the nodes that don't
+ * get input in this cycle are skipped when they are processed */
+static inline void spa_graph_data_push(struct spa_graph_data *data,
+				       struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_OUTPUT], link) {
+		struct spa_graph_node *pnode;
+
+		if (!spa_graph_port_is_active(p))
+			continue;
+
+		pnode = p->peer->node;
+		if (pnode->cycle != data->cycle)
+			spa_graph_data_collect(data, pnode, SPA_GRAPH_ACTION_IN);
+	}
+}
+
+static inline bool spa_graph_node_has_active_input(struct spa_graph_node *node)
+{
+	struct spa_graph_port *p;
+
+	spa_list_for_each(p, &node->ports[SPA_DIRECTION_INPUT], link) {
+		if (spa_graph_port_is_active(p))
+			return true;
+	}
+	return false;
+}
+
+/* Run all nodes of the graph once. \a produced is true when the driver
+ * already produced its output. */
+static inline int spa_graph_data_drive(struct spa_graph_data *data,
+				       struct spa_graph_node *driver, bool produced)
+{
+	struct spa_graph *graph = data->graph;
+	struct spa_graph_node *n;
+	uint32_t i;
+	int res;
+
+	if ((res = spa_graph_data_begin(data, driver, produced ?
+					SPA_GRAPH_ACTION_NONE : SPA_GRAPH_ACTION_IN)) < 0)
+		return res;
+
+	for (i = 0; i < graph->n_plan; i++) {
+		n = graph->plan[i];
+		if (n == driver) {
+			if (!produced && !spa_graph_node_has_active_input(n))
+				n->state = SPA_GRAPH_ACTION_OUT;
+			continue;
+		}
+		spa_graph_data_collect(data, n, spa_graph_node_has_active_input(n) ?
+				SPA_GRAPH_ACTION_IN : SPA_GRAPH_ACTION_OUT);
+	}
+
+	/* the nodes after the driver in the plan wait for it to complete,
+	 * a driver that has inputs waits for the nodes before it */
+	spa_graph_data_run(data, SPA_DIRECTION_INPUT);
+
+	return 0;
+}
+
+/* Check if \a node starts a cycle. With a driver, the other nodes of the
+ * graph only run in the cycles of the driver. */
+static inline bool spa_graph_data_can_start(struct spa_graph_data *data,
+					    struct spa_graph_node *node)
+{
+	struct spa_graph_node *driver = data->graph->driver;
+	return driver == NULL || driver == node || node->graph != data->graph;
+}
+
+static inline int spa_graph_impl_need_input(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = data;
+	struct spa_graph *graph = d->graph;
+	struct spa_graph_node *n;
+	uint32_t i;
+	int res;
+
+	if (!spa_graph_data_can_start(d, node))
+		return 0;
+
+	spa_debug("node %p start pull", node);
+
+	/* a node that starts a cycle while it is processed */
+	if (__atomic_exchange_n(&d->busy, 1, __ATOMIC_ACQUIRE))
+		return -EBUSY;
+
+	if (node == graph->driver) {
+		res = spa_graph_data_drive(d, node, false);
+		goto done;
+	}
+	if ((res = spa_graph_data_begin(d, node, SPA_GRAPH_ACTION_IN)) < 0)
+		goto done;
+
+	/* walk the plan upstream, peers are always before a node in the plan */
+	spa_graph_data_pull(d, node);
+	for (i = SPA_MIN(d->hi + 1, graph->n_plan); i > 0; i--) {
+		n = graph->plan[i - 1];
+		if (n != node && n->cycle == d->cycle && n->state == SPA_GRAPH_ACTION_IN)
+			spa_graph_data_pull(d, n);
+	}
+	spa_list_for_each(n, &d->extra, sched_link) {
+		if (n->state == SPA_GRAPH_ACTION_IN)
+			spa_graph_data_pull(d, n);
+	}
+
+	if (d->n_pending > 1)
+		spa_graph_data_run(d, SPA_DIRECTION_INPUT);
+
+      done:
+	__atomic_store_n(&d->busy, 0, __ATOMIC_RELEASE);
+
+	spa_debug("node %p end pull", node);
+	return res;
+}
+
+static inline int spa_graph_impl_have_output(void *data, struct spa_graph_node *node)
+{
+	struct spa_graph_data *d = data;
+	struct spa_graph *graph = d->graph;
+	struct spa_graph_node *n;
+	uint32_t i;
+	int res;
+
+	if (!spa_graph_data_can_start(d, node))
+		return 0;
+
+	spa_debug("node %p start push", node);
+
+	/* a node that starts a cycle while it is processed */
+	if (__atomic_exchange_n(&d->busy, 1, __ATOMIC_ACQUIRE))
+		return -EBUSY;
+
+	if (node == graph->driver) {
+		res = spa_graph_data_drive(d, node, true);
+		goto done;
+	}
+	if ((res = spa_graph_data_begin(d, node, SPA_GRAPH_ACTION_NONE)) < 0)
+		goto done;
+
+	/* without workers, the nodes are processed in the same walk that
+	 * collects them */
+	if (d->n_workers == 0) {
+		spa_graph_data_process(d, node);
+		spa_graph_data_push(d, node);
+		for (i = d->lo; i < graph->n_plan; i++) {
+			n = graph->plan[i];
+			if (n != node && n->cycle == d->cycle) {
+				spa_graph_data_process(d, n);
+				spa_graph_data_push(d, n);
+			}
+		}
+		spa_list_for_each(n, &d->extra, sched_link) {
+			spa_graph_data_process(d, n);
+			spa_graph_data_push(d, n);
+		}
+		d->n_pending = 0;
+		goto done;
+	}
+
+	/* walk the plan downstream, peers are always after a node in the plan */
+	spa_graph_data_push(d, node);
+	for (i = d->lo; i < graph->n_plan; i++) {
+		n = graph->plan[i];
+		if (n != node && n->cycle == d->cycle)
+			spa_graph_data_push(d, n);
+	}
+	spa_list_for_each(n, &d->extra, sched_link)
+		spa_graph_data_push(d, n);
+
+	spa_graph_data_run(d, SPA_DIRECTION_OUTPUT);
+
+      done:
+	__atomic_store_n(&d->busy, 0, __ATOMIC_RELEASE);
+
+	spa_debug("node %p end push", node);
+	return res;
+}
+
+static const struct spa_graph_callbacks spa_graph_impl_default = {
+	SPA_VERSION_GRAPH_CALLBACKS,
+	.need_input = spa_graph_impl_need_input,
+	.have_output = spa_graph_impl_have_output,
+};
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_GRAPH_SCHEDULER_H__ */
@@ -24,6 +24,9 @@
 extern "C" {
 #endif
 
+#include <errno.h>
+#include <stdlib.h>
+
 #include <spa/utils/defs.h>
 #include <spa/utils/list.h>
 #include <spa/node/node.h>
@@ -49,22 +52,53 @@ struct spa_graph {
 	struct spa_list nodes;
 	const struct spa_graph_callbacks *callbacks;
 	void *callbacks_data;
+	bool dirty;				/**< the plan needs to be rebuilt */
+	struct spa_graph_node **plan;		/**< nodes in topological order */
+	uint32_t n_plan;			/**< number of nodes in plan */
+	uint32_t max_plan;			/**< allocated size of plan */
+	bool fixed_plan;			/**< plan comes from spa_graph_set_plan() and
+						  *  is never reallocated */
+	struct spa_graph_node *driver;		/**< node that paces the cycles or NULL */
+
+	/* only used by the thread that calls spa_graph_reserve() */
+	struct spa_graph_node **reserved_plan;	/**< last plan made by spa_graph_reserve() */
+	uint32_t reserved_size;			/**< size of reserved_plan */
+	uint32_t n_reserved;			/**< number of reserved nodes */
 };
 
 #define spa_graph_need_input(g,n)	((g)->callbacks->need_input((g)->callbacks_data, (n)))
 #define spa_graph_have_output(g,n)	((g)->callbacks->have_output((g)->callbacks_data, (n)))
 #define spa_graph_reuse_buffer(g,n,p,i)	((g)->callbacks->reuse_buffer((g)->callbacks_data, (n),(p),(i)))
 
+/** Profiling counters of a node, times are in nanoseconds */
+struct spa_graph_node_stats {
+	uint64_t cycles;		/**< number of times the node was processed */
+	uint64_t last_time;		/**< last process time */
+	uint64_t avg_time;		/**< moving average of the process time */
+	uint64_t max_time;		/**< max process time */
+	uint64_t deadline;		/**< max allowed process time, 0 for none */
+	uint64_t xruns;			/**< number of missed deadlines */
+};
+
 struct spa_graph_node {
 	struct spa_list link;		/**< link in graph nodes list */
 	struct spa_graph *graph;	/**< owner graph */
 	struct spa_list ports[2];	/**< list of input and output ports */
 	struct spa_list ready_link;	/**< link for scheduler */
+	struct spa_list sched_link;	/**< link in scheduler cycle */
 #define SPA_GRAPH_NODE_FLAG_ASYNC	(1 << 0)
+#define SPA_GRAPH_NODE_FLAG_DRIVER	(1 << 1)	/**< node can drive the graph */
+#define SPA_GRAPH_NODE_FLAG_PROFILE	(1 << 2)	/**< time the processing of the node
+							  *  and update its stats */
 	uint32_t flags;			/**< node flags */
 	uint32_t required[2];		/**< required number of ports */
 	uint32_t ready[2];		/**< number of ports with data */
 	int state;			/**< state of the node */
+	uint32_t cycle;			/**< last scheduler cycle of the node */
+	int32_t pending;		/**< pending dependencies in the cycle */
+	uint32_t order;			/**< index of the node in the graph plan */
+	struct spa_graph_node_stats stats;	/**< profiling counters, only updated
+						  *  with SPA_GRAPH_NODE_FLAG_PROFILE */
 	struct spa_node *implementation;/**< node implementation */
 	void *scheduler_data;		/**< scheduler private data */
 };
@@ -84,6 +118,161 @@ struct spa_graph_port {
 static inline void spa_graph_init(struct spa_graph *graph)
 {
 	spa_list_init(&graph->nodes);
+	graph->dirty = true;
+	graph->plan = NULL;
+	graph->n_plan = graph->max_plan = 0;
+	graph->fixed_plan = false;
+	graph->driver = NULL;
+	graph->reserved_plan = NULL;
+	graph->reserved_size = graph->n_reserved = 0;
+}
+
+static inline void spa_graph_clear(struct spa_graph *graph)
+{
+	/* with reservations, an older plan still in use is freed by the
+	 * thread that reserved */
+	if (graph->reserved_plan)
+		free(graph->reserved_plan);
+	else
+		free(graph->plan);
+	graph->plan = graph->reserved_plan = NULL;
+	graph->n_plan = graph->max_plan = 0;
+	graph->reserved_size = graph->n_reserved = 0;
+	graph->fixed_plan = false;
+	graph->dirty = true;
+}
+
+/** Reserve room in the plan for \a n_nodes more nodes, or release room with
+ * a negative \a n_nodes.
+ *
+ * Call this from a thread that can allocate, before the nodes are added to
+ * the graph. When the plan needs to grow, a new plan is returned in \a plan.
+ * The thread of the graph installs it with spa_graph_set_plan(), the previous
+ * plan is returned in \a old and can be freed when the thread of the graph
+ * stopped using it. spa_graph_compile() never allocates for a graph with
+ * a reserved plan.
+ *
+ * \return the size of the new plan when \a plan was allocated, 0 when the
+ *         plan is big enough, -ENOMEM when the plan could not be allocated */
+static inline int spa_graph_reserve(struct spa_graph *graph, int32_t n_nodes,
+				    struct spa_graph_node ***plan,
+				    struct spa_graph_node ***old)
+{
+	uint32_t n_reserved, size;
+
+	*plan = *old = NULL;
+
+	if (n_nodes < 0 && (uint32_t) -n_nodes > graph->n_reserved)
+		n_reserved = 0;
+	else
+		n_reserved = graph->n_reserved + n_nodes;
+
+	if (n_nodes > 0 && n_reserved > graph->reserved_size) {
+		size = SPA_MAX(n_reserved, graph->reserved_size * 2);
+		if ((*plan = malloc(size * sizeof(struct spa_graph_node *))) == NULL)
+			return -ENOMEM;
+		*old = graph->reserved_plan;
+		graph->reserved_plan = *plan;
+		graph->reserved_size = size;
+	}
+	graph->n_reserved = n_reserved;
+
+	return *plan ? (int) graph->reserved_size : 0;
+}
+
+/** Install a plan of \a size nodes made by spa_graph_reserve(). Must be
+ * called from the thread of the graph, the plan is rebuilt before the next
+ * cycle. */
+static inline void spa_graph_set_plan(struct spa_graph *graph,
+				      struct spa_graph_node **plan, uint32_t size)
+{
+	graph->plan = plan;
+	graph->max_plan = size;
+	graph->n_plan = 0;
+	graph->fixed_plan = true;
+	graph->dirty = true;
+}
+
+/* mark the plan of the graph of \a node for rebuild */
+static inline void spa_graph_node_changed(struct spa_graph_node *node)
+{
+	if (node != NULL && node->graph != NULL)
+		node->graph->dirty = true;
+}
+
+/** Sort the nodes of the graph in a flat plan where each node comes after
+ * the nodes that link to its inputs. Nodes that are part of a loop are
+ * placed at the end of the plan.
+ *
+ * Schedulers call this before a cycle when the graph changed. The plan is
+ * reallocated when it is too small, unless it was set with
+ * spa_graph_set_plan().
+ *
+ * \return 0 on success, -ENOMEM when the plan could not be allocated,
+ *         -ENOSPC when more nodes were added than reserved */
+static inline int spa_graph_compile(struct spa_graph *graph)
+{
+	struct spa_graph_node *n, *pnode;
+	struct spa_graph_port *p;
+	uint32_t i, n_nodes = 0, head = 0, tail = 0;
+
+	spa_list_for_each(n, &graph->nodes, link)
+		n_nodes++;
+
+	if (n_nodes > graph->max_plan) {
+		uint32_t max_plan = SPA_MAX(n_nodes, graph->max_plan * 2);
+		struct spa_graph_node **plan;
+
+		if (graph->fixed_plan)
+			return -ENOSPC;
+
+		plan = realloc(graph->plan, max_plan * sizeof(struct spa_graph_node *));
+		if (plan == NULL)
+			return -ENOMEM;
+
+		graph->plan = plan;
+		graph->max_plan = max_plan;
+	}
+
+	spa_list_for_each(n, &graph->nodes, link) {
+		n->order = SPA_ID_INVALID;
+		n->pending = 0;
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
+			if (p->peer && p->peer->node && p->peer->node->graph == graph)
+				n->pending++;
+		}
+		if (n->pending == 0) {
+			n->order = tail;
+			graph->plan[tail++] = n;
+		}
+	}
+	while (head < tail) {
+		n = graph->plan[head++];
+		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
+			if (p->peer == NULL || (pnode = p->peer->node) == NULL ||
+			    pnode->graph != graph || pnode->order != SPA_ID_INVALID)
+				continue;
+			if (--pnode->pending == 0) {
+				pnode->order = tail;
+				graph->plan[tail++] = pnode;
+			}
+		}
+	}
+	spa_list_for_each(n, &graph->nodes, link) {
+		if (n->order == SPA_ID_INVALID) {
+			n->order = tail;
+			graph->plan[tail++] = n;
+		}
+	}
+	for (i = 0; i < tail; i++)
+		graph->plan[i]->pending = 0;
+
+	graph->n_plan = tail;
+	graph->dirty = false;
+
+	spa_debug("graph %p compiled %d nodes", graph, tail);
+
+	return 0;
 }
 
 static inline void
@@ -100,12 +289,32 @@ spa_graph_node_init(struct spa_graph_node *node)
 {
 	spa_list_init(&node->ports[SPA_DIRECTION_INPUT]);
 	spa_list_init(&node->ports[SPA_DIRECTION_OUTPUT]);
+	node->graph = NULL;
 	node->flags = 0;
 	node->required[SPA_DIRECTION_INPUT] = node->ready[SPA_DIRECTION_INPUT] = 0;
 	node->required[SPA_DIRECTION_OUTPUT] = node->ready[SPA_DIRECTION_OUTPUT] = 0;
+	spa_zero(node->stats);
 	spa_debug("node %p init", node);
 }
 
+/** Account \a elapsed nanoseconds of processing time to \a node */
+static inline void
+spa_graph_node_update_stats(struct spa_graph_node *node, uint64_t elapsed)
+{
+	struct spa_graph_node_stats *stats = &node->stats;
+
+	if (stats->cycles++ == 0)
+		stats->avg_time = elapsed;
+	else
+		stats->avg_time = stats->avg_time - (stats->avg_time >> 3) + (elapsed >> 3);
+
+	stats->last_time = elapsed;
+	if (elapsed > stats->max_time)
+		stats->max_time = elapsed;
+	if (stats->deadline > 0 && elapsed > stats->deadline)
+		stats->xruns++;
+}
+
 static inline void
 spa_graph_node_set_implementation(struct spa_graph_node *node,
 				  struct spa_node *implementation)
@@ -120,7 +329,13 @@ spa_graph_node_add(struct spa_graph *graph,
 	node->graph = graph;
 	node->state = SPA_STATUS_OK;
 	node->ready_link.next = NULL;
+	node->cycle = 0;
+	node->pending = 0;
+	node->order = SPA_ID_INVALID;
 	spa_list_append(&graph->nodes, &node->link);
+	if (graph->driver == NULL && (node->flags & SPA_GRAPH_NODE_FLAG_DRIVER))
+		graph->driver = node;
+	graph->dirty = true;
 	spa_debug("node %p add", node);
 }
 
@@ -132,6 +347,7 @@ spa_graph_port_init(struct spa_graph_port *port,
 		    struct spa_io_buffers *io)
 {
 	spa_debug("port %p init type %d id %d", port, direction, port_id);
+	port->node = NULL;
 	port->direction = direction;
 	port->port_id = port_id;
 	port->flags = flags;
@@ -147,20 +363,38 @@ spa_graph_port_add(struct spa_graph_node *node,
 	spa_list_append(&node->ports[port->direction], &port->link);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL))
 		node->required[port->direction]++;
+	spa_graph_node_changed(node);
 }
 
 static inline void spa_graph_node_remove(struct spa_graph_node *node)
 {
+	struct spa_graph *graph = node->graph;
+	struct spa_graph_node *n;
+
 	spa_debug("node %p remove", node);
+	spa_graph_node_changed(node);
 	spa_list_remove(&node->link);
 	if (node->ready_link.next)
 		spa_list_remove(&node->ready_link);
+	node->graph = NULL;
+
+	if (graph != NULL && graph->driver == node) {
+		/* hand over to the next node that can drive */
+		graph->driver = NULL;
+		spa_list_for_each(n, &graph->nodes, link) {
+			if (n->flags & SPA_GRAPH_NODE_FLAG_DRIVER) {
+				graph->driver = n;
+				break;
+			}
+		}
+	}
 }
 
 static inline void spa_graph_port_remove(struct spa_graph_port *port)
 {
 	spa_debug("port %p remove", port);
 	spa_list_remove(&port->link);
+	spa_graph_node_changed(port->node);
 	if (!(port->flags & SPA_PORT_INFO_FLAG_OPTIONAL) &&
 	    port->node->required[port->direction] > 0) {
 		port->node->required[port->direction]--;
@@ -173,6 +407,8 @@ spa_graph_port_link(struct spa_graph_port *out, struct spa_graph_port *in)
 	spa_debug("port %p link to %p", out, in);
 	out->peer = in;
 	in->peer = out;
+	spa_graph_node_changed(out->node);
+	spa_graph_node_changed(in->node);
 }
 
 static inline void
@@ -180,6 +416,8 @@ spa_graph_port_unlink(struct spa_graph_port *port)
 {
 	spa_debug("port %p unlink from %p", port, port->peer);
 	if (port->peer) {
+		spa_graph_node_changed(port->node);
+		spa_graph_node_changed(port->peer->node);
 		port->peer->peer = NULL;
 		port->peer = NULL;
 	}
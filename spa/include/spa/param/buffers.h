@@ -35,6 +35,14 @@ extern "C" {
 #define SPA_TYPE_PARAM_BUFFERS__stride		SPA_TYPE_PARAM_BUFFERS_BASE "stride"
 #define SPA_TYPE_PARAM_BUFFERS__buffers		SPA_TYPE_PARAM_BUFFERS_BASE "buffers"
 #define SPA_TYPE_PARAM_BUFFERS__align		SPA_TYPE_PARAM_BUFFERS_BASE "align"
+#define SPA_TYPE_PARAM_BUFFERS__memory		SPA_TYPE_PARAM_BUFFERS_BASE "memory"
+
+/** flags for the memory of the buffers, in the memory property */
+enum spa_param_buffers_memory {
+	SPA_PARAM_BUFFERS_MEMORY_LOCKED = (1 << 0),	/**< memory is locked in RAM and faulted
+							  *  in, no page faults when processing */
+	SPA_PARAM_BUFFERS_MEMORY_HUGEPAGES = (1 << 1),	/**< use huge pages when available */
+};
 
 struct spa_type_param_buffers {
 	uint32_t Buffers;
@@ -42,6 +50,7 @@ struct spa_type_param_buffers {
 	uint32_t stride;
 	uint32_t buffers;
 	uint32_t align;
+	uint32_t memory;
 };
 
 static inline void
@@ -54,6 +63,7 @@ spa_type_param_buffers_map(struct spa_type_map *map,
 		type->stride = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__stride);
 		type->buffers = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__buffers);
 		type->align = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__align);
+		type->memory = spa_type_map_get_id(map, SPA_TYPE_PARAM_BUFFERS__memory);
 	}
 }
 
@@ -143,6 +143,26 @@ struct spa_loop_control {
 #define spa_loop_control_leave(l)		(l)->leave(l)
 
 
+#define SPA_LOOP_STATS_BUCKETS	32
+
+/** Dispatch statistics of a loop, all times are in nanoseconds */
+struct spa_loop_stats {
+	uint64_t count;		/**< number of samples */
+	uint64_t total;		/**< sum of all samples */
+	uint64_t max;		/**< largest sample */
+	/** log2 histogram, bucket i counts the samples in [2^i, 2^(i+1)) */
+	uint32_t buckets[SPA_LOOP_STATS_BUCKETS];
+};
+
+/** The statistics that can be queried with spa_loop_utils::get_stats */
+enum spa_loop_stats_type {
+	SPA_LOOP_STATS_DISPATCH,	/**< time spent in the callback of a source */
+	SPA_LOOP_STATS_LATENCY,		/**< time between the expiration of a timer
+					  *  and the dispatch of its callback */
+	SPA_LOOP_STATS_INVOKE,		/**< time spent in invoke callbacks, only
+					  *  for the loop, source must be NULL */
+};
+
 typedef void (*spa_source_io_func_t) (void *data, int fd, enum spa_io mask);
 typedef void (*spa_source_idle_func_t) (void *data);
 typedef void (*spa_source_event_func_t) (void *data, uint64_t count);
@@ -155,7 +175,7 @@ typedef void (*spa_source_signal_func_t) (void *data, int signal_number);
 struct spa_loop_utils {
 	/* the version of this structure. This can be used to expand this
 	 * structure in the future */
-#define SPA_VERSION_LOOP_UTILS	0
+#define SPA_VERSION_LOOP_UTILS	1
 	uint32_t version;
 
 	struct spa_source *(*add_io) (struct spa_loop_utils *utils,
@@ -189,6 +209,20 @@ struct spa_loop_utils {
 	 * should only be called when the loop is not running or from the
 	 * context of the running loop */
 	void (*destroy_source) (struct spa_source *source);
+
+	/** get the statistics of a source or of the loop. Statistics are
+	 * only collected when the loop was created with the "loop.profile"
+	 * info key. This function can be called from any thread, the
+	 * values are not an atomic snapshot. Since version 1.
+	 * \param source a source of the loop or NULL for the loop
+	 * \param type a spa_loop_stats_type
+	 * \param stats result
+	 * \return 0 on success, -ENOTSUP when profiling is disabled,
+	 *         -ENOENT when nothing is known about source */
+	int (*get_stats) (struct spa_loop_utils *utils,
+			  struct spa_source *source,
+			  uint32_t type,
+			  struct spa_loop_stats *stats);
 };
 
 #define spa_loop_utils_add_io(l,...)		(l)->add_io(l,__VA_ARGS__)
@@ -201,6 +235,7 @@ struct spa_loop_utils {
 #define spa_loop_utils_update_timer(l,...)	(l)->update_timer(__VA_ARGS__)
 #define spa_loop_utils_add_signal(l,...)	(l)->add_signal(l,__VA_ARGS__)
 #define spa_loop_utils_destroy_source(l,...)	(l)->destroy_source(__VA_ARGS__)
+#define spa_loop_utils_get_stats(l,...)		(l)->get_stats(l,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
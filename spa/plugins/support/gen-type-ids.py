@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+#
+# Collects the type names that the SPA headers define and writes them to a
+# C header, in the order of type-ids.txt. The mapper registers them first so
+# that the well known types get the same ids in every process and in every
+# version. A type that is missing from type-ids.txt is an error, it must be
+# added at the end of the list.
+#
+# gen-type-ids.py --headers INCLUDEDIR          list the headers with types
+# gen-type-ids.py INCLUDEDIR LIST OUTPUT        write the header
+
+import os
+import re
+import sys
+
+DEFINE = re.compile(r'^#define\s+(SPA_TYPE[A-Za-z0-9_]*__[A-Za-z0-9_]+)\s')
+
+# headers that need other libraries
+SKIP = [ 'spa/support/dbus.h' ]
+
+def scan(incdir):
+    types = {}
+    for root, dirs, files in os.walk(os.path.join(incdir, 'spa')):
+        dirs.sort()
+        for f in sorted(files):
+            if not f.endswith('.h'):
+                continue
+            path = os.path.join(root, f)
+            if os.path.relpath(path, incdir) in SKIP:
+                continue
+            with open(path) as h:
+                for line in h:
+                    m = DEFINE.match(line)
+                    if m:
+                        types.setdefault(m.group(1), os.path.relpath(path, incdir))
+    return types
+
+def read_list(path):
+    names = []
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if line and not line.startswith('#'):
+                names.append(line)
+    return names
+
+def main(argv):
+    if len(argv) == 3 and argv[1] == '--headers':
+        for h in sorted(set(scan(argv[2]).values())):
+            print(os.path.join(argv[2], h))
+        return 0
+    if len(argv) != 4:
+        sys.stderr.write('usage: %s [--headers] INCLUDEDIR [LIST OUTPUT]\n' % argv[0])
+        return 1
+
+    types = scan(argv[1])
+    names = read_list(argv[2])
+
+    missing = sorted(set(types) - set(names))
+    if missing:
+        for t in missing:
+            sys.stderr.write('%s: %s is not in %s, add it at the end\n' %
+                             (argv[0], t, argv[2]))
+        return 1
+
+    out = []
+    out.append('/* generated by gen-type-ids.py, do not edit */\n')
+    out.append('\n')
+    for h in sorted(set(types.values())):
+        out.append('#include <%s>\n' % h)
+    out.append('\n')
+    out.append('static const char * const type_ids[] = {\n')
+    for t in names:
+        if t in types:
+            out.append('\t%s,\n' % t)
+        else:
+            # removed from the headers, keep the id unused
+            out.append('\t"removed:%s",\n' % t)
+    out.append('};\n')
+
+    with open(argv[3], 'w') as f:
+        f.writelines(out)
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,217 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_INVOKE_QUEUE_H__
+#define __SPA_INVOKE_QUEUE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <spa/support/loop.h>
+#include <spa/utils/defs.h>
+
+#include "loop-stats.h"
+
+/* Multi producer, single consumer queue for loop_invoke.
+ *
+ * Producers reserve space by moving write_index with a compare and
+ * exchange, copy their item and then publish it by storing the index of
+ * the item in the stamp of its first chunk. The consumer runs the items
+ * in order and stops at the first one that is reserved but not yet
+ * published. It only ever looks at the items that were queued when it
+ * started so that a busy producer can't keep it in the loop.
+ *
+ * Space is handed out in chunks so that every item starts on a chunk
+ * and has a stamp. The consumer clears the stamp before it releases
+ * the space, a stamp never matches unless the item was published.
+ *
+ * Only the first producer after the consumer started draining gets
+ * true from invoke_queue_push() and should wake up the consumer, the
+ * others are picked up in the same pass. */
+
+#define INVOKE_QUEUE_SIZE	(4096 * 8)
+#define INVOKE_QUEUE_CHUNK	64
+#define INVOKE_QUEUE_CHUNKS	(INVOKE_QUEUE_SIZE / INVOKE_QUEUE_CHUNK)
+#define INVOKE_QUEUE_NO_STAMP	SPA_ID_INVALID
+
+/** a blocking caller waits on this until the consumer ran its item */
+struct invoke_wait {
+	int res;
+	uint32_t done;
+};
+
+/** the item header, must fit in one chunk */
+struct invoke_item {
+	uint32_t item_size;
+	uint32_t seq;
+	spa_invoke_func_t func;
+	void *data;
+	size_t size;
+	void *user_data;
+	struct invoke_wait *wait;
+};
+
+struct invoke_queue {
+	uint32_t write_index __attribute__ ((aligned (64)));
+	uint32_t read_index __attribute__ ((aligned (64)));
+	uint32_t wakeup __attribute__ ((aligned (64)));
+	uint32_t stamp[INVOKE_QUEUE_CHUNKS];
+	uint8_t data[INVOKE_QUEUE_SIZE] __attribute__ ((aligned (64)));
+};
+
+static inline void invoke_queue_init(struct invoke_queue *q)
+{
+	uint32_t i;
+
+	q->write_index = 0;
+	q->read_index = 0;
+	q->wakeup = 0;
+	for (i = 0; i < INVOKE_QUEUE_CHUNKS; i++)
+		q->stamp[i] = INVOKE_QUEUE_NO_STAMP;
+}
+
+/** Queue an item, safe to call from any number of threads.
+ * \return 1 when the consumer needs a wakeup, 0 when a wakeup is
+ *         pending, -EPIPE when the queue is full */
+static inline int
+invoke_queue_push(struct invoke_queue *q,
+		  spa_invoke_func_t func,
+		  uint32_t seq,
+		  const void *data,
+		  size_t size,
+		  struct invoke_wait *wait,
+		  void *user_data)
+{
+	struct invoke_item *item;
+	uint32_t idx, offset, l0, need, item_size;
+
+	need = SPA_ROUND_UP_N(sizeof(struct invoke_item) + size, INVOKE_QUEUE_CHUNK);
+	if (need > INVOKE_QUEUE_SIZE)
+		return -EPIPE;
+
+	idx = __atomic_load_n(&q->write_index, __ATOMIC_RELAXED);
+	do {
+		offset = idx & (INVOKE_QUEUE_SIZE - 1);
+		l0 = INVOKE_QUEUE_SIZE - offset;
+
+		/* when the item does not fit before the end, the header
+		 * stays at the end and the data goes to the start */
+		if (l0 >= need)
+			item_size = need;
+		else
+			item_size = l0 + SPA_ROUND_UP_N(size, INVOKE_QUEUE_CHUNK);
+
+		if (idx + item_size - __atomic_load_n(&q->read_index, __ATOMIC_ACQUIRE) >
+		    INVOKE_QUEUE_SIZE)
+			return -EPIPE;
+	} while (!__atomic_compare_exchange_n(&q->write_index, &idx, idx + item_size,
+					      true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	item = SPA_MEMBER(q->data, offset, struct invoke_item);
+	item->item_size = item_size;
+	item->seq = seq;
+	item->func = func;
+	item->size = size;
+	item->user_data = user_data;
+	item->wait = wait;
+	if (l0 >= need)
+		item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
+	else
+		item->data = q->data;
+	if (size > 0)
+		memcpy(item->data, data, size);
+
+	__atomic_store_n(&q->stamp[offset / INVOKE_QUEUE_CHUNK], idx, __ATOMIC_RELEASE);
+
+	return __atomic_exchange_n(&q->wakeup, 1, __ATOMIC_SEQ_CST) == 0 ? 1 : 0;
+}
+
+static inline void invoke_wait_done(struct invoke_wait *wait, int res)
+{
+	wait->res = res;
+	__atomic_store_n(&wait->done, 1, __ATOMIC_RELEASE);
+	syscall(SYS_futex, &wait->done, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static inline int invoke_wait_for(struct invoke_wait *wait)
+{
+	while (__atomic_load_n(&wait->done, __ATOMIC_ACQUIRE) == 0)
+		syscall(SYS_futex, &wait->done, FUTEX_WAIT_PRIVATE, 0, NULL, NULL, 0);
+	return wait->res;
+}
+
+/** Run the queued items, only call this from the consumer thread.
+ * \param stats when not NULL, the time spent in each item is added
+ * \return the number of items that were run */
+static inline uint32_t invoke_queue_dispatch(struct invoke_queue *q, struct spa_loop *loop,
+					     struct spa_loop_stats *stats)
+{
+	uint32_t idx, end, chunk, n_items = 0;
+
+	/* clear before looking at the stamps, a producer that publishes
+	 * after this will send a new wakeup */
+	__atomic_exchange_n(&q->wakeup, 0, __ATOMIC_SEQ_CST);
+
+	idx = q->read_index;
+	end = __atomic_load_n(&q->write_index, __ATOMIC_ACQUIRE);
+
+	while (idx != end) {
+		struct invoke_item *item;
+		struct invoke_wait *wait;
+		int res;
+
+		chunk = (idx & (INVOKE_QUEUE_SIZE - 1)) / INVOKE_QUEUE_CHUNK;
+		if (__atomic_load_n(&q->stamp[chunk], __ATOMIC_ACQUIRE) != idx)
+			break;
+
+		item = SPA_MEMBER(q->data, chunk * INVOKE_QUEUE_CHUNK, struct invoke_item);
+		if (SPA_UNLIKELY(stats != NULL)) {
+			uint64_t start = loop_stats_get_time();
+			res = item->func(loop, true, item->seq, item->data, item->size,
+					 item->user_data);
+			loop_stats_add(stats, loop_stats_get_time() - start);
+		} else {
+			res = item->func(loop, true, item->seq, item->data, item->size,
+					 item->user_data);
+		}
+		wait = item->wait;
+
+		q->stamp[chunk] = INVOKE_QUEUE_NO_STAMP;
+		idx += item->item_size;
+		__atomic_store_n(&q->read_index, idx, __ATOMIC_RELEASE);
+
+		if (wait)
+			invoke_wait_done(wait, res);
+		n_items++;
+	}
+	return n_items;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_INVOKE_QUEUE_H__ */
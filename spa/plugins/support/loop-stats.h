@@ -0,0 +1,85 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef __SPA_LOOP_STATS_H__
+#define __SPA_LOOP_STATS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <time.h>
+
+#include <spa/support/loop.h>
+
+/* The statistics are only written from the loop thread. The fields are
+ * stored with relaxed atomics so that other threads can read them
+ * without tearing. */
+
+static inline uint64_t loop_stats_get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static inline void loop_stats_add(struct spa_loop_stats *stats, uint64_t ns)
+{
+	uint32_t bucket = 63 - __builtin_clzll(ns | 1);
+
+	if (bucket >= SPA_LOOP_STATS_BUCKETS)
+		bucket = SPA_LOOP_STATS_BUCKETS - 1;
+
+	__atomic_store_n(&stats->count, stats->count + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->total, stats->total + ns, __ATOMIC_RELAXED);
+	if (ns > stats->max)
+		__atomic_store_n(&stats->max, ns, __ATOMIC_RELAXED);
+	__atomic_store_n(&stats->buckets[bucket], stats->buckets[bucket] + 1, __ATOMIC_RELAXED);
+}
+
+static inline void loop_stats_read(const struct spa_loop_stats *stats, struct spa_loop_stats *res)
+{
+	uint32_t i;
+
+	res->count = __atomic_load_n(&stats->count, __ATOMIC_RELAXED);
+	res->total = __atomic_load_n(&stats->total, __ATOMIC_RELAXED);
+	res->max = __atomic_load_n(&stats->max, __ATOMIC_RELAXED);
+	for (i = 0; i < SPA_LOOP_STATS_BUCKETS; i++)
+		res->buckets[i] = __atomic_load_n(&stats->buckets[i], __ATOMIC_RELAXED);
+}
+
+/** the smallest value below which at least \a pct percent of the samples are */
+static inline uint64_t loop_stats_percentile(const struct spa_loop_stats *stats, uint32_t pct)
+{
+	uint64_t target = (stats->count * pct + 99) / 100, sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < SPA_LOOP_STATS_BUCKETS; i++) {
+		sum += stats->buckets[i];
+		if (sum >= target)
+			return 2ull << i;
+	}
+	return stats->max;
+}
+
+#ifdef __cplusplus
+}  /* extern "C" */
+#endif
+
+#endif /* __SPA_LOOP_STATS_H__ */
@@ -23,6 +23,7 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <inttypes.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
 #include <sys/eventfd.h>
@@ -34,25 +35,15 @@
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
 #include <spa/utils/list.h>
-#include <spa/utils/ringbuffer.h>
+#include <spa/utils/dict.h>
 
-#define NAME "loop"
+#include "invoke-queue.h"
+#include "loop-stats.h"
 
-#define DATAS_SIZE (4096 * 8)
+#define NAME "loop"
 
 /** \cond */
 
-struct invoke_item {
-	size_t item_size;
-	spa_invoke_func_t func;
-	uint32_t seq;
-	void *data;
-	size_t size;
-	bool block;
-	void *user_data;
-	int res;
-};
-
 struct type {
 	uint32_t loop;
 	uint32_t loop_control;
@@ -86,10 +77,17 @@ struct impl {
 	pthread_t thread;
 
 	struct spa_source *wakeup;
-	int ack_fd;
+	struct invoke_queue queue;
 
-	struct spa_ringbuffer buffer;
-	uint8_t buffer_data[DATAS_SIZE];
+	struct spa_source *timer;
+	struct source_impl **timers;
+	uint32_t n_timers;
+	uint32_t max_timers;
+	uint32_t n_queued;
+	uint64_t armed;
+	uint64_t slack;
+
+	struct profile *profile;
 };
 
 struct source_impl {
@@ -108,6 +106,38 @@ struct source_impl {
 	} func;
 	int signal_number;
 	bool enabled;
+
+	uint64_t deadline;
+	uint64_t interval;
+	uint64_t expirations;
+	uint32_t heap_pos;
+};
+
+#define PROFILE_SIZE		256
+#define PROFILE_REMOVED		((struct spa_source *) 1)
+
+struct source_stats {
+	struct spa_source *source;
+	void *func;
+	void *data;
+	struct spa_loop_stats dispatch;
+	struct spa_loop_stats latency;
+};
+
+/* Only allocated when profiling is enabled. The source stats are kept in
+ * an open addressing hash table on the source pointer. Removed entries
+ * are marked and the table is rebuilt into the spare table when there
+ * are too many of them, readers in other threads always see a complete
+ * table. */
+struct profile {
+	uint64_t warn;
+	struct spa_loop_stats invoke;
+
+	struct source_stats *table;
+	struct source_stats *spare;
+	uint32_t n_used;
+	uint32_t n_removed;
+	struct source_stats tables[2][PROFILE_SIZE];
 };
 /** \endcond */
 
@@ -143,6 +173,150 @@ static inline enum spa_io spa_epoll_to_io(uint32_t events)
 	return mask;
 }
 
+static void source_io_func(struct spa_source *source);
+static void source_idle_func(struct spa_source *source);
+static void source_event_func(struct spa_source *source);
+static void source_timer_func(struct spa_source *source);
+static void source_signal_func(struct spa_source *source);
+
+/* the callback of the user, for sources made with the loop utils */
+static inline void *source_callback(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	if (source->func == source_io_func ||
+	    source->func == source_idle_func ||
+	    source->func == source_event_func ||
+	    source->func == source_timer_func ||
+	    source->func == source_signal_func)
+		return impl->func.io;
+	return source->func;
+}
+
+static inline uint32_t profile_hash(struct spa_source *source)
+{
+	return (uint32_t) (((uintptr_t) source * 0x9e3779b97f4a7c15ull) >> 32) & (PROFILE_SIZE - 1);
+}
+
+static struct source_stats *
+profile_lookup(struct source_stats *table, struct spa_source *source, struct source_stats **free)
+{
+	uint32_t i, h = profile_hash(source);
+
+	for (i = 0; i < PROFILE_SIZE; i++) {
+		struct source_stats *e = &table[(h + i) & (PROFILE_SIZE - 1)];
+		struct spa_source *s = __atomic_load_n(&e->source, __ATOMIC_ACQUIRE);
+
+		if (s == source)
+			return e;
+		if (free && *free == NULL && (s == NULL || s == PROFILE_REMOVED))
+			*free = e;
+		if (s == NULL)
+			break;
+	}
+	return NULL;
+}
+
+static void profile_rebuild(struct profile *p)
+{
+	struct source_stats *table = p->spare;
+	uint32_t i;
+
+	memset(table, 0, sizeof(p->tables[0]));
+	for (i = 0; i < PROFILE_SIZE; i++) {
+		struct source_stats *e = &p->table[i], *free = NULL;
+
+		if (e->source == NULL || e->source == PROFILE_REMOVED)
+			continue;
+		profile_lookup(table, e->source, &free);
+		*free = *e;
+	}
+	p->spare = p->table;
+	p->n_used -= p->n_removed;
+	p->n_removed = 0;
+	__atomic_store_n(&p->table, table, __ATOMIC_RELEASE);
+}
+
+/* only called from the loop thread */
+static struct source_stats *profile_get(struct profile *p, struct spa_source *source)
+{
+	struct source_stats *e, *free = NULL;
+
+	if ((e = profile_lookup(p->table, source, &free)) != NULL)
+		return e;
+
+	if (p->n_removed > PROFILE_SIZE / 4) {
+		profile_rebuild(p);
+		free = NULL;
+		profile_lookup(p->table, source, &free);
+	}
+	if (free == NULL || p->n_used >= PROFILE_SIZE - 1)
+		return NULL;
+
+	if (free->source == PROFILE_REMOVED)
+		p->n_removed--;
+	else
+		p->n_used++;
+
+	memset(&free->dispatch, 0, sizeof(free->dispatch));
+	memset(&free->latency, 0, sizeof(free->latency));
+	free->func = source_callback(source);
+	free->data = source->data;
+	__atomic_store_n(&free->source, source, __ATOMIC_RELEASE);
+
+	return free;
+}
+
+static void profile_log(struct impl *impl, const char *what, void *id,
+			const struct spa_loop_stats *stats)
+{
+	if (stats->count == 0)
+		return;
+
+	spa_log_info(impl->log, NAME " %p: %s %p: count %" PRIu64 " avg %" PRIu64
+		     " p99 < %" PRIu64 " max %" PRIu64 " ns", impl, what, id, stats->count,
+		     stats->total / stats->count, loop_stats_percentile(stats, 99), stats->max);
+}
+
+static void profile_remove(struct impl *impl, struct spa_source *source)
+{
+	struct profile *p = impl->profile;
+	struct source_stats *e;
+
+	if ((e = profile_lookup(p->table, source, NULL)) == NULL)
+		return;
+
+	profile_log(impl, "dispatch", e->func, &e->dispatch);
+	profile_log(impl, "latency", e->func, &e->latency);
+
+	__atomic_store_n(&e->source, PROFILE_REMOVED, __ATOMIC_RELEASE);
+	p->n_removed++;
+}
+
+static void profile_dispatch(struct impl *impl, struct spa_source *source)
+{
+	struct profile *p = impl->profile;
+	struct source_stats *e;
+	uint64_t start, elapsed;
+
+	profile_get(p, source);
+
+	start = loop_stats_get_time();
+	source->func(source);
+	elapsed = loop_stats_get_time() - start;
+
+	/* the source can be removed from its own callback and adding a
+	 * source can rebuild the table, look up the entry again */
+	if ((e = profile_lookup(p->table, source, NULL)) == NULL)
+		return;
+
+	loop_stats_add(&e->dispatch, elapsed);
+
+	if (p->warn && elapsed > p->warn)
+		spa_log_warn(impl->log, NAME " %p: source %p func %p data %p took %" PRIu64 " us",
+			     impl, source, e->func, e->data, (uint64_t) (elapsed / SPA_NSEC_PER_USEC));
+}
+
 static int loop_add_source(struct spa_loop *loop, struct spa_source *source)
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
@@ -188,6 +362,9 @@ static void loop_remove_source(struct spa_source *source)
 	if (source->fd != -1)
 		epoll_ctl(impl->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
 
+	if (SPA_UNLIKELY(impl->profile != NULL))
+		profile_remove(impl, source);
+
 	source->loop = NULL;
 }
 
@@ -202,65 +379,27 @@ loop_invoke(struct spa_loop *loop,
 {
 	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
 	bool in_thread = pthread_equal(impl->thread, pthread_self());
-	struct invoke_item *item;
+	struct invoke_wait wait = { 0, };
 	int res;
 
 	if (in_thread) {
 		res = func(loop, false, seq, data, size, user_data);
 	} else {
-		int32_t filled, avail;
-		uint32_t idx, offset, l0;
-
-		filled = spa_ringbuffer_get_write_index(&impl->buffer, &idx);
-		if (filled < 0 || filled > DATAS_SIZE) {
-			spa_log_warn(impl->log, NAME " %p: queue xrun %d", impl, filled);
-			return -EPIPE;
-		}
-		avail = DATAS_SIZE - filled;
-		if (avail < sizeof(struct invoke_item)) {
-			spa_log_warn(impl->log, NAME " %p: queue full %d", impl, avail);
-			return -EPIPE;
-		}
-		offset = idx & (DATAS_SIZE - 1);
-
-		l0 = DATAS_SIZE - offset;
-
-		item = SPA_MEMBER(impl->buffer_data, offset, struct invoke_item);
-		item->func = func;
-		item->seq = seq;
-		item->size = size;
-		item->block = block;
-		item->user_data = user_data;
-
-		if (l0 > sizeof(struct invoke_item) + size) {
-			item->data = SPA_MEMBER(item, sizeof(struct invoke_item), void);
-			item->item_size = sizeof(struct invoke_item) + size;
-			if (l0 < sizeof(struct invoke_item) + item->item_size)
-				item->item_size = l0;
-		} else {
-			item->data = impl->buffer_data;
-			item->item_size = l0 + size;
-		}
-		memcpy(item->data, data, size);
-
-		spa_ringbuffer_write_update(&impl->buffer, idx + item->item_size);
-
-		spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
-
-		if (block) {
-			uint64_t count = 1;
-			if (read(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to read event fd: %s",
-						impl, strerror(errno));
-
-			res = item->res;
-		}
-		else {
-			if (seq != SPA_ID_INVALID)
-				res = SPA_RESULT_RETURN_ASYNC(seq);
-			else
-				res = 0;
+		res = invoke_queue_push(&impl->queue, func, seq, data, size,
+					block ? &wait : NULL, user_data);
+		if (res < 0) {
+			spa_log_warn(impl->log, NAME " %p: queue full", impl);
+			return res;
 		}
+		if (res > 0)
+			spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+
+		if (block)
+			res = invoke_wait_for(&wait);
+		else if (seq != SPA_ID_INVALID)
+			res = SPA_RESULT_RETURN_ASYNC(seq);
+		else
+			res = 0;
 	}
 	return res;
 }
@@ -268,22 +407,8 @@ loop_invoke(struct spa_loop *loop,
 static void wakeup_func(void *data, uint64_t count)
 {
 	struct impl *impl = data;
-	uint32_t index;
-
-	while (spa_ringbuffer_get_read_index(&impl->buffer, &index) > 0) {
-		struct invoke_item *item =
-		    SPA_MEMBER(impl->buffer_data, index & (DATAS_SIZE - 1), struct invoke_item);
-		item->res = item->func(&impl->loop, true, item->seq, item->data, item->size,
-			   item->user_data);
-		spa_ringbuffer_read_update(&impl->buffer, index + item->item_size);
-
-		if (item->block) {
-			uint64_t count = 1;
-			if (write(impl->ack_fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
-				spa_log_warn(impl->log, NAME " %p: failed to write event fd: %s",
-						impl, strerror(errno));
-		}
-	}
+	invoke_queue_dispatch(&impl->queue, &impl->loop,
+			      impl->profile ? &impl->profile->invoke : NULL);
 }
 
 static int loop_get_fd(struct spa_loop_control *ctrl)
@@ -343,7 +468,10 @@ static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
 	for (i = 0; i < nfds; i++) {
 		struct spa_source *s = ep[i].data.ptr;
 		if (s->rmask && s->fd != -1) {
-			s->func(s);
+			if (SPA_UNLIKELY(impl->profile != NULL))
+				profile_dispatch(impl, s);
+			else
+				s->func(s);
 		}
 	}
 	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link)
@@ -496,16 +624,148 @@ static void loop_signal_event(struct spa_source *source)
 				source, source->fd, strerror(errno));
 }
 
-static void source_timer_func(struct spa_source *source)
+/* All timers of the loop share one timerfd. The armed timers are kept in
+ * a binary min-heap on their deadline, heap_pos is the 1-based position
+ * in the heap or 0 when the timer is not armed. The heap has no lock,
+ * timers are only added, updated and destroyed from the thread of the
+ * loop or while the loop is not running. */
+
+#define HEAP_PARENT(i)	(((i) - 1) / 2)
+
+static inline void heap_set(struct impl *impl, uint32_t i, struct source_impl *t)
 {
-	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
-	uint64_t expirations;
+	impl->timers[i] = t;
+	t->heap_pos = i + 1;
+}
 
-	if (read(source->fd, &expirations, sizeof(uint64_t)) != sizeof(uint64_t))
-		spa_log_warn(impl->impl->log, NAME " %p: failed to read timer fd %d: %s",
-				source, source->fd, strerror(errno));
+static void heap_sift_up(struct impl *impl, uint32_t i)
+{
+	struct source_impl *t = impl->timers[i];
+
+	while (i > 0 && impl->timers[HEAP_PARENT(i)]->deadline > t->deadline) {
+		heap_set(impl, i, impl->timers[HEAP_PARENT(i)]);
+		i = HEAP_PARENT(i);
+	}
+	heap_set(impl, i, t);
+}
+
+static void heap_sift_down(struct impl *impl, uint32_t i)
+{
+	struct source_impl *t = impl->timers[i];
+	uint32_t c, n = impl->n_queued;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && impl->timers[c + 1]->deadline < impl->timers[c]->deadline)
+			c++;
+		if (impl->timers[c]->deadline >= t->deadline)
+			break;
+		heap_set(impl, i, impl->timers[c]);
+		i = c;
+	}
+	heap_set(impl, i, t);
+}
+
+static void heap_remove(struct impl *impl, struct source_impl *t)
+{
+	uint32_t i = t->heap_pos - 1;
+	struct source_impl *last = impl->timers[--impl->n_queued];
+
+	t->heap_pos = 0;
+	if (last == t)
+		return;
+
+	heap_set(impl, i, last);
+	if (i > 0 && impl->timers[HEAP_PARENT(i)]->deadline > last->deadline)
+		heap_sift_up(impl, i);
+	else
+		heap_sift_down(impl, i);
+}
+
+static void heap_update(struct impl *impl, struct source_impl *t)
+{
+	if (t->heap_pos == 0) {
+		impl->timers[impl->n_queued++] = t;
+		heap_sift_up(impl, impl->n_queued - 1);
+	} else {
+		heap_sift_up(impl, t->heap_pos - 1);
+		heap_sift_down(impl, t->heap_pos - 1);
+	}
+}
 
-	impl->func.timer(source->data, expirations);
+/* Make the timerfd expire for the first timer. A later deadline leaves
+ * the timerfd alone, it wakes up early once and is armed again then. */
+static int timers_arm(struct impl *impl)
+{
+	struct itimerspec its;
+	uint64_t target;
+
+	if (impl->n_queued == 0)
+		return 0;
+
+	target = impl->timers[0]->deadline + impl->slack;
+	if (impl->armed != 0 && impl->armed <= target)
+		return 0;
+
+	spa_zero(its);
+	its.it_value.tv_sec = target / SPA_NSEC_PER_SEC;
+	its.it_value.tv_nsec = target % SPA_NSEC_PER_SEC;
+	if (timerfd_settime(impl->timer->fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		return errno;
+
+	impl->armed = target;
+	return 0;
+}
+
+static void timers_func(void *data, int fd, enum spa_io mask)
+{
+	struct impl *impl = data;
+	uint64_t count, now;
+	uint32_t n;
+
+	if (read(fd, &count, sizeof(uint64_t)) != sizeof(uint64_t) && errno != EAGAIN)
+		spa_log_warn(impl->log, NAME " %p: failed to read timer fd %d: %s",
+				impl, fd, strerror(errno));
+
+	impl->armed = 0;
+	now = loop_stats_get_time();
+
+	/* timers that are armed again from their callback run in the next
+	 * iteration */
+	for (n = impl->n_queued; n > 0 && impl->n_queued > 0; n--) {
+		struct source_impl *t = impl->timers[0];
+		uint64_t expired;
+
+		if (t->deadline > now)
+			break;
+
+		if (t->interval) {
+			t->expirations = 1 + (now - t->deadline) / t->interval;
+			expired = t->deadline + (t->expirations - 1) * t->interval;
+			t->deadline += t->expirations * t->interval;
+			heap_sift_down(impl, 0);
+		} else {
+			t->expirations = 1;
+			expired = t->deadline;
+			t->deadline = 0;
+			heap_remove(impl, t);
+		}
+
+		if (SPA_UNLIKELY(impl->profile != NULL)) {
+			struct source_stats *e = profile_get(impl->profile, &t->source);
+			if (e)
+				loop_stats_add(&e->latency, now - expired);
+			profile_dispatch(impl, &t->source);
+		} else {
+			t->source.func(&t->source);
+		}
+	}
+	timers_arm(impl);
+}
+
+static void source_timer_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.timer(source->data, impl->expirations);
 }
 
 static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
@@ -514,6 +774,17 @@ static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
 	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
 	struct source_impl *source;
 
+	if (impl->n_timers == impl->max_timers) {
+		uint32_t max = SPA_MAX(impl->max_timers * 2, 16u);
+		struct source_impl **timers;
+
+		timers = realloc(impl->timers, max * sizeof(struct source_impl *));
+		if (timers == NULL)
+			return NULL;
+		impl->timers = timers;
+		impl->max_timers = max;
+	}
+
 	source = calloc(1, sizeof(struct source_impl));
 	if (source == NULL)
 		return NULL;
@@ -521,13 +792,11 @@ static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
 	source->source.loop = &impl->loop;
 	source->source.func = source_timer_func;
 	source->source.data = data;
-	source->source.fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-	source->source.mask = SPA_IO_IN;
+	source->source.fd = -1;
 	source->impl = impl;
-	source->close = true;
 	source->func.timer = func;
 
-	spa_loop_add_source(&impl->loop, &source->source);
+	impl->n_timers++;
 
 	spa_list_insert(&impl->source_list, &source->link);
 
@@ -538,25 +807,29 @@ static int
 loop_update_timer(struct spa_source *source,
 		  struct timespec *value, struct timespec *interval, bool absolute)
 {
-	struct itimerspec its;
-	int flags = 0;
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct impl *loop_impl = impl->impl;
+	uint64_t deadline = 0;
 
-	spa_zero(its);
+	/* same semantics as timerfd_settime() */
 	if (value) {
-		its.it_value = *value;
+		deadline = SPA_TIMESPEC_TO_TIME(value);
+		if (deadline != 0 && !absolute)
+			deadline += loop_stats_get_time();
 	} else if (interval) {
-		its.it_value = *interval;
-		absolute = true;
+		deadline = SPA_TIMESPEC_TO_TIME(interval);
 	}
-	if (interval)
-		its.it_interval = *interval;
-	if (absolute)
-		flags |= TFD_TIMER_ABSTIME;
+	impl->interval = interval ? SPA_TIMESPEC_TO_TIME(interval) : 0;
+	impl->deadline = deadline;
 
-	if (timerfd_settime(source->fd, flags, &its, NULL) < 0)
-		return errno;
+	if (deadline == 0) {
+		if (impl->heap_pos != 0)
+			heap_remove(loop_impl, impl);
+		return 0;
+	}
+	heap_update(loop_impl, impl);
 
-	return 0;
+	return timers_arm(loop_impl);
 }
 
 static void source_signal_func(struct spa_source *source)
@@ -614,6 +887,12 @@ static void loop_destroy_source(struct spa_source *source)
 
 	spa_list_remove(&impl->link);
 
+	if (source->func == source_timer_func) {
+		if (impl->heap_pos != 0)
+			heap_remove(loop_impl, impl);
+		loop_impl->n_timers--;
+	}
+
 	spa_loop_remove_source(source->loop, source);
 
 	if (source->fd != -1 && impl->close) {
@@ -624,6 +903,42 @@ static void loop_destroy_source(struct spa_source *source)
 	spa_list_insert(&loop_impl->destroy_list, &impl->link);
 }
 
+static int loop_get_stats(struct spa_loop_utils *utils,
+			  struct spa_source *source,
+			  uint32_t type,
+			  struct spa_loop_stats *stats)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct profile *p = impl->profile;
+	struct source_stats *e;
+
+	if (p == NULL)
+		return -ENOTSUP;
+
+	if (source == NULL) {
+		if (type != SPA_LOOP_STATS_INVOKE)
+			return -EINVAL;
+		loop_stats_read(&p->invoke, stats);
+		return 0;
+	}
+
+	e = profile_lookup(__atomic_load_n(&p->table, __ATOMIC_ACQUIRE), source, NULL);
+	if (e == NULL)
+		return -ENOENT;
+
+	switch (type) {
+	case SPA_LOOP_STATS_DISPATCH:
+		loop_stats_read(&e->dispatch, stats);
+		break;
+	case SPA_LOOP_STATS_LATENCY:
+		loop_stats_read(&e->latency, stats);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
 static const struct spa_loop impl_loop = {
 	SPA_VERSION_LOOP,
 	loop_add_source,
@@ -653,6 +968,7 @@ static const struct spa_loop_utils impl_loop_utils = {
 	loop_update_timer,
 	loop_add_signal,
 	loop_destroy_source,
+	loop_get_stats,
 };
 
 static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id, void **interface)
@@ -690,7 +1006,12 @@ static int impl_clear(struct spa_handle *handle)
 	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link)
 		free(source);
 
-	close(impl->ack_fd);
+	if (impl->profile) {
+		profile_log(impl, "invoke", impl, &impl->profile->invoke);
+		free(impl->profile);
+	}
+	free(impl->timers);
+
 	close(impl->epoll_fd);
 
 	return 0;
@@ -705,6 +1026,9 @@ impl_init(const struct spa_handle_factory *factory,
 {
 	struct impl *impl;
 	uint32_t i;
+	const char *str;
+	bool profile = false;
+	uint64_t warn = 0;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -729,18 +1053,42 @@ impl_init(const struct spa_handle_factory *factory,
 	}
 	init_type(&impl->type, impl->map);
 
+	if (info && (str = spa_dict_lookup(info, "loop.profile")))
+		profile = strcmp(str, "true") == 0 || atoi(str) == 1;
+	if (info && (str = spa_dict_lookup(info, "loop.profile.warn"))) {
+		warn = atoi(str) * SPA_NSEC_PER_USEC;
+		profile = true;
+	}
+	if (info && (str = spa_dict_lookup(info, "loop.timer-slack")))
+		impl->slack = atoi(str) * SPA_NSEC_PER_USEC;
+
 	impl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
 	if (impl->epoll_fd == -1)
 		return errno;
 
+	if (profile) {
+		impl->profile = calloc(1, sizeof(struct profile));
+		if (impl->profile == NULL) {
+			close(impl->epoll_fd);
+			return -ENOMEM;
+		}
+		impl->profile->warn = warn;
+		impl->profile->table = impl->profile->tables[0];
+		impl->profile->spare = impl->profile->tables[1];
+		spa_log_info(impl->log, NAME " %p: profiling enabled, warn %" PRIu64 " us",
+			     impl, (uint64_t) (warn / SPA_NSEC_PER_USEC));
+	}
+
 	spa_list_init(&impl->source_list);
 	spa_list_init(&impl->destroy_list);
 	spa_hook_list_init(&impl->hooks_list);
 
-	spa_ringbuffer_init(&impl->buffer);
+	invoke_queue_init(&impl->queue);
 
 	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
-	impl->ack_fd = eventfd(0, EFD_CLOEXEC);
+	impl->timer = spa_loop_utils_add_io(&impl->utils,
+					    timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK),
+					    SPA_IO_IN, true, timers_func, impl);
 
 	spa_log_info(impl->log, NAME " %p: initialized", impl);
 
@@ -27,6 +27,8 @@
 #include <spa/support/type-map.h>
 #include <spa/support/plugin.h>
 
+#include "type-ids.h"
+
 #define NAME "mapper"
 
 struct type {
@@ -44,6 +46,13 @@ struct array {
 	void *data;
 };
 
+/* an open addressing hash table on the type names, the string is only
+ * compared when the hash matches */
+struct entry {
+	uint32_t hash;
+	uint32_t id;
+};
+
 struct impl {
 	struct spa_handle handle;
 	struct spa_type_map map;
@@ -52,6 +61,9 @@ struct impl {
 
 	struct array types;
 	struct array strings;
+
+	struct entry *table;
+	uint32_t table_mask;
 };
 
 static inline void * alloc_size(struct array *array, size_t size, size_t extend)
@@ -66,23 +78,88 @@ static inline void * alloc_size(struct array *array, size_t size, size_t extend)
 	return res;
 }
 
+/* FNV-1a, also returns the length of the string */
+static inline uint32_t hash_string(const char *str, uint32_t *len)
+{
+	uint32_t h = 2166136261u;
+	const char *p;
+
+	for (p = str; *p; p++)
+		h = (h ^ (uint8_t) *p) * 16777619u;
+	*len = p - str;
+	return h;
+}
+
+static inline const char *get_string(struct impl *impl, uint32_t id)
+{
+	off_t o = ((off_t *)impl->types.data)[id];
+	return SPA_MEMBER(impl->strings.data, o, char);
+}
+
+static struct entry *find_entry(struct impl *impl, const char *type, uint32_t hash)
+{
+	uint32_t i = hash & impl->table_mask;
+
+	while (true) {
+		struct entry *e = &impl->table[i];
+
+		if (e->id == SPA_ID_INVALID ||
+		    (e->hash == hash && strcmp(get_string(impl, e->id), type) == 0))
+			return e;
+
+		i = (i + 1) & impl->table_mask;
+	}
+}
+
+static int grow_table(struct impl *impl)
+{
+	struct entry *old = impl->table;
+	uint32_t i, size = old ? (impl->table_mask + 1) * 2 : 1024;
+
+	impl->table = malloc(size * sizeof(struct entry));
+	if (impl->table == NULL) {
+		impl->table = old;
+		return -ENOMEM;
+	}
+	memset(impl->table, 0xff, size * sizeof(struct entry));
+	impl->table_mask = size - 1;
+
+	if (old) {
+		for (i = 0; i < size / 2; i++) {
+			if (old[i].id != SPA_ID_INVALID)
+				*find_entry(impl, get_string(impl, old[i].id), old[i].hash) = old[i];
+		}
+		free(old);
+	}
+	return 0;
+}
+
 static uint32_t
 impl_type_map_get_id(struct spa_type_map *map, const char *type)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
-	uint32_t i, len;
+	uint32_t i, len, hash, n_types;
+	struct entry *e;
 	void *p;
-	off_t o, *off;
+	off_t *off;
 
 	if (type == NULL)
 		return SPA_ID_INVALID;
 
-	for (i = 0; i < impl->types.size / sizeof(off_t); i++) {
-		o = ((off_t *)impl->types.data)[i];
-		if (strcmp(SPA_MEMBER(impl->strings.data, o, char), type) == 0)
-			return i;
+	hash = hash_string(type, &len);
+
+	e = find_entry(impl, type, hash);
+	if (e->id != SPA_ID_INVALID)
+		return e->id;
+
+	/* keep the load factor below one half */
+	n_types = impl->types.size / sizeof(off_t);
+	if (n_types + 1 > (impl->table_mask + 1) / 2) {
+		if (grow_table(impl) < 0)
+			return SPA_ID_INVALID;
+		e = find_entry(impl, type, hash);
 	}
-	len = strlen(type);
+
 	p = alloc_size(&impl->strings, len+1, 1024);
 	memcpy(p, type, len + 1);
 
@@ -90,8 +167,10 @@ impl_type_map_get_id(struct spa_type_map *map, const char *type)
 	*off = SPA_PTRDIFF(p, impl->strings.data);
 	i = SPA_PTRDIFF(off, impl->types.data) / sizeof(off_t);
 
-	return i;
+	e->hash = hash;
+	e->id = i;
 
+	return i;
 }
 
 static const char *
@@ -99,10 +178,8 @@ impl_type_map_get_type(const struct spa_type_map *map, uint32_t id)
 {
 	struct impl *impl = SPA_CONTAINER_OF(map, struct impl, map);
 
-	if (id < impl->types.size / sizeof(off_t)) {
-		off_t o = ((off_t *)impl->types.data)[id];
-		return SPA_MEMBER(impl->strings.data, o, char);
-	}
+	if (id < impl->types.size / sizeof(off_t))
+		return get_string(impl, id);
 	return NULL;
 }
 
@@ -150,6 +227,7 @@ static int impl_clear(struct spa_handle *handle)
 		free(impl->types.data);
 	if (impl->strings.data)
 		free(impl->strings.data);
+	free(impl->table);
 
 	return 0;
 }
@@ -162,6 +240,7 @@ impl_init(const struct spa_handle_factory *factory,
 	  uint32_t n_support)
 {
 	struct impl *impl;
+	uint32_t i;
 
 	spa_return_val_if_fail(factory != NULL, -EINVAL);
 	spa_return_val_if_fail(handle != NULL, -EINVAL);
@@ -173,8 +252,18 @@ impl_init(const struct spa_handle_factory *factory,
 
 	impl->map = impl_type_map;
 
+	if (grow_table(impl) < 0)
+		return -ENOMEM;
+
 	init_type(&impl->type, &impl->map);
 
+	/* the types of the SPA headers get the same ids in every process,
+	 * in the order of type-ids.txt, where new types are only appended.
+	 * The type map keeps id 0 so that a 0 id still means unmapped in
+	 * the type structures. */
+	for (i = 0; i < SPA_N_ELEMENTS(type_ids); i++)
+		spa_type_map_get_id(&impl->map, type_ids[i]);
+
 	return 0;
 }
 
@@ -0,0 +1,1357 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* A loop with the same interfaces as the epoll loop that is built on
+ * io_uring. Fds are polled with one-shot polls, events and signals are
+ * polled and then read without blocking. The timers are kept in a heap and
+ * share one timeout in the ring. Everything that was queued while
+ * dispatching is submitted together with the wait for the next events, an
+ * iteration is one syscall. */
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/types.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <pthread.h>
+#include <linux/io_uring.h>
+
+#include <spa/support/loop.h>
+#include <spa/support/log.h>
+#include <spa/support/type-map.h>
+#include <spa/support/plugin.h>
+#include <spa/utils/list.h>
+
+#include "invoke-queue.h"
+
+#define NAME "uring-loop"
+
+#define RING_ENTRIES	256
+#define MAX_CQES	64
+
+#ifndef __NR_io_uring_setup
+#define __NR_io_uring_setup	425
+#endif
+#ifndef __NR_io_uring_enter
+#define __NR_io_uring_enter	426
+#endif
+
+/** \cond */
+
+struct type {
+	uint32_t loop;
+	uint32_t loop_control;
+	uint32_t loop_utils;
+};
+
+static void loop_signal_event(struct spa_source *source);
+
+static inline void init_type(struct type *type, struct spa_type_map *map)
+{
+	type->loop = spa_type_map_get_id(map, SPA_TYPE__Loop);
+	type->loop_control = spa_type_map_get_id(map, SPA_TYPE__LoopControl);
+	type->loop_utils = spa_type_map_get_id(map, SPA_TYPE__LoopUtils);
+}
+
+struct ring {
+	int fd;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned sq_entries;
+	struct io_uring_sqe *sqes;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	void *sq_ptr;
+	size_t sq_size;
+	void *cq_ptr;
+	size_t cq_size;
+	size_t sqes_size;
+
+	pthread_mutex_t lock;		/**< also protects the lists of sources and
+					  *  entries and the state of the entries */
+	unsigned to_submit;
+};
+
+enum op {
+	OP_POLL,
+	OP_TIMEOUT,
+};
+
+/* A source in the ring. There is at most one operation of the current
+ * generation in flight, cancelled operations still complete with the old
+ * generation and are ignored. The entry is freed when none of its
+ * operations are in flight.
+ *
+ * Sources are added and removed from other threads while the loop runs,
+ * the lists and the pending, armed, gen and removed fields of the entries
+ * only change with the lock of the ring held. The callbacks run without
+ * the lock. */
+struct entry {
+	struct spa_list link;
+	struct spa_source *source;
+	enum op op;
+	uint16_t gen;
+	uint32_t pending;
+	bool armed;
+	bool removed;
+
+	struct __kernel_timespec ts;
+};
+
+/* the entry in the low bits of the user_data and its generation in the top
+ * 16 bits, which user space pointers don't use */
+#define USER_DATA(e)		((uint64_t)(uintptr_t)(e) | ((uint64_t)(e)->gen << 48))
+#define USER_DATA_ENTRY(u)	((struct entry *)(uintptr_t)((u) & ((1ULL << 48) - 1)))
+#define USER_DATA_GEN(u)	((uint16_t)((u) >> 48))
+
+struct impl {
+	struct spa_handle handle;
+	struct spa_loop loop;
+	struct spa_loop_control control;
+	struct spa_loop_utils utils;
+
+        struct spa_log *log;
+        struct type type;
+        struct spa_type_map *map;
+
+	struct spa_list source_list;
+	struct spa_list destroy_list;
+	struct spa_list entry_list;	/**< entries of sources added with add_source */
+	struct spa_list removed_list;	/**< removed entries with operations in flight */
+	struct spa_list idle_list;	/**< enabled idle sources */
+	struct spa_hook_list hooks_list;
+
+	struct ring ring;
+	bool flush;			/**< submit after iterate, the fd is polled */
+	pthread_t thread;
+
+	struct spa_source *wakeup;
+	struct invoke_queue queue;
+
+	struct entry timer;		/**< the timeout of the first timer */
+	uint64_t armed;			/**< deadline of the timeout, 0 when not armed */
+	struct source_impl **timers;	/**< heap of the armed timers */
+	uint32_t n_queued;
+	uint32_t n_timers;
+	uint32_t max_timers;
+};
+
+struct source_impl {
+	struct spa_source source;
+
+	struct impl *impl;
+	struct spa_list link;
+
+	bool close;
+	union {
+		spa_source_io_func_t io;
+		spa_source_idle_func_t idle;
+		spa_source_event_func_t event;
+		spa_source_timer_func_t timer;
+		spa_source_signal_func_t signal;
+	} func;
+	int signal_number;
+	bool enabled;
+
+	struct entry entry;
+	struct spa_list idle_link;
+	uint64_t deadline;
+	uint64_t interval;
+	uint64_t expirations;
+	uint32_t heap_pos;
+};
+
+struct completion {
+	struct entry *entry;
+	uint16_t gen;
+	int32_t res;
+};
+/** \endcond */
+
+static int ring_init(struct ring *r, unsigned entries)
+{
+	struct io_uring_params p;
+
+	spa_zero(p);
+	if ((r->fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return -errno;
+
+	/* waiting with a timeout and not losing completions */
+	if (!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP)) {
+		close(r->fd);
+		return -ENOTSUP;
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		r->sq_size = r->cq_size = SPA_MAX(r->sq_size, r->cq_size);
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto error_close;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto error_unmap_sq;
+	}
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto error_unmap_cq;
+
+	r->sq_head = SPA_MEMBER(r->sq_ptr, p.sq_off.head, unsigned);
+	r->sq_tail = SPA_MEMBER(r->sq_ptr, p.sq_off.tail, unsigned);
+	r->sq_mask = SPA_MEMBER(r->sq_ptr, p.sq_off.ring_mask, unsigned);
+	r->sq_array = SPA_MEMBER(r->sq_ptr, p.sq_off.array, unsigned);
+	r->sq_entries = p.sq_entries;
+	r->cq_head = SPA_MEMBER(r->cq_ptr, p.cq_off.head, unsigned);
+	r->cq_tail = SPA_MEMBER(r->cq_ptr, p.cq_off.tail, unsigned);
+	r->cq_mask = SPA_MEMBER(r->cq_ptr, p.cq_off.ring_mask, unsigned);
+	r->cqes = SPA_MEMBER(r->cq_ptr, p.cq_off.cqes, struct io_uring_cqe);
+
+	pthread_mutex_init(&r->lock, NULL);
+	r->to_submit = 0;
+
+	return 0;
+
+      error_unmap_cq:
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+      error_unmap_sq:
+	munmap(r->sq_ptr, r->sq_size);
+      error_close:
+	close(r->fd);
+	return -ENOMEM;
+}
+
+static void ring_clear(struct ring *r)
+{
+	munmap(r->sqes, r->sqes_size);
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+	pthread_mutex_destroy(&r->lock);
+}
+
+static int ring_enter(struct ring *r, unsigned to_submit, unsigned min_complete,
+		      unsigned flags, const struct __kernel_timespec *ts)
+{
+	struct io_uring_getevents_arg arg;
+	int res;
+
+	spa_zero(arg);
+	arg.ts = (uintptr_t) ts;
+
+	res = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+		      flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+	return res < 0 ? -errno : res;
+}
+
+/* with the lock held */
+static struct io_uring_sqe *ring_get_sqe(struct ring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *r->sq_tail;
+
+	if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries) {
+		/* full, let the kernel take what we have */
+		ring_enter(r, r->to_submit, 0, 0, NULL);
+		r->to_submit = 0;
+		if (tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE) >= r->sq_entries)
+			return NULL;
+	}
+	sqe = &r->sqes[tail & *r->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	return sqe;
+}
+
+/* with the lock held */
+static void ring_push_sqe(struct ring *r, struct io_uring_sqe *sqe)
+{
+	unsigned tail = *r->sq_tail;
+
+	r->sq_array[tail & *r->sq_mask] = sqe - r->sqes;
+	__atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	r->to_submit++;
+}
+
+static inline uint32_t spa_io_to_poll(enum spa_io mask)
+{
+	uint32_t events = 0;
+
+	if (mask & SPA_IO_IN)
+		events |= POLLIN;
+	if (mask & SPA_IO_OUT)
+		events |= POLLOUT;
+	if (mask & SPA_IO_ERR)
+		events |= POLLERR;
+	if (mask & SPA_IO_HUP)
+		events |= POLLHUP;
+
+	return events;
+}
+
+static inline enum spa_io spa_poll_to_io(uint32_t events)
+{
+	enum spa_io mask = 0;
+
+	if (events & POLLIN)
+		mask |= SPA_IO_IN;
+	if (events & POLLOUT)
+		mask |= SPA_IO_OUT;
+	if (events & POLLHUP)
+		mask |= SPA_IO_HUP;
+	if (events & POLLERR)
+		mask |= SPA_IO_ERR;
+
+	return mask;
+}
+
+static inline bool in_thread(struct impl *impl)
+{
+	return impl->thread == 0 || pthread_equal(impl->thread, pthread_self());
+}
+
+/* operations queued from another thread than the one running the loop are
+ * submitted right away, the loop doesn't see them while it waits */
+static void queue_done(struct impl *impl)
+{
+	struct ring *r = &impl->ring;
+
+	if (!in_thread(impl) && r->to_submit > 0) {
+		ring_enter(r, r->to_submit, 0, 0, NULL);
+		r->to_submit = 0;
+	}
+}
+
+/* Submit everything now. The kernel looks up the fd of an operation when
+ * it is submitted, this has to happen before the fd is closed and its
+ * number reused. */
+static void ring_flush(struct impl *impl)
+{
+	struct ring *r = &impl->ring;
+
+	pthread_mutex_lock(&r->lock);
+	if (r->to_submit > 0) {
+		ring_enter(r, r->to_submit, 0, 0, NULL);
+		r->to_submit = 0;
+	}
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* with the lock held */
+static int entry_arm_locked(struct impl *impl, struct entry *e)
+{
+	struct ring *r = &impl->ring;
+	struct spa_source *s = e->source;
+	struct io_uring_sqe *sqe;
+	uint32_t events;
+
+	/* a source that is destroyed is not armed again */
+	if (e->removed)
+		return 0;
+
+	if ((sqe = ring_get_sqe(r)) == NULL) {
+		spa_log_error(impl->log, NAME " %p: submission queue full", impl);
+		return -EBUSY;
+	}
+
+	switch (e->op) {
+	case OP_POLL:
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = s->fd;
+		events = spa_io_to_poll(s->mask);
+#if __BYTE_ORDER == __BIG_ENDIAN
+		events = (events << 16) | (events >> 16);
+#endif
+		sqe->poll32_events = events;
+		break;
+	case OP_TIMEOUT:
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t) &e->ts;
+		sqe->len = 1;
+		sqe->timeout_flags = IORING_TIMEOUT_ABS;
+		break;
+	}
+	sqe->user_data = USER_DATA(e);
+	ring_push_sqe(r, sqe);
+	e->pending++;
+	e->armed = true;
+	queue_done(impl);
+
+	return 0;
+}
+
+static int entry_arm(struct impl *impl, struct entry *e)
+{
+	int res;
+
+	pthread_mutex_lock(&impl->ring.lock);
+	res = entry_arm_locked(impl, e);
+	pthread_mutex_unlock(&impl->ring.lock);
+
+	return res;
+}
+
+/* arm a one-shot poll again after its completion of generation \a gen was
+ * dispatched, unless the source was changed or removed in the meantime */
+static int entry_rearm(struct impl *impl, struct entry *e, uint16_t gen)
+{
+	int res = 0;
+
+	pthread_mutex_lock(&impl->ring.lock);
+	if (!e->armed && e->gen == gen)
+		res = entry_arm_locked(impl, e);
+	pthread_mutex_unlock(&impl->ring.lock);
+
+	return res;
+}
+
+static void entry_disarm(struct impl *impl, struct entry *e)
+{
+	struct ring *r = &impl->ring;
+	struct io_uring_sqe *sqe;
+
+	pthread_mutex_lock(&r->lock);
+	if (!e->armed) {
+		pthread_mutex_unlock(&r->lock);
+		return;
+	}
+	if ((sqe = ring_get_sqe(r)) != NULL) {
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = USER_DATA(e);
+		sqe->user_data = 0;
+		ring_push_sqe(r, sqe);
+		queue_done(impl);
+	}
+	/* the completion of the cancelled operation is now stale */
+	e->gen++;
+	e->armed = false;
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* with the lock held */
+static struct entry *find_entry(struct impl *impl, struct spa_source *source)
+{
+	struct entry *e;
+
+	spa_list_for_each(e, &impl->entry_list, link)
+		if (e->source == source)
+			return e;
+	return NULL;
+}
+
+static int loop_add_source(struct spa_loop *loop, struct spa_source *source)
+{
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+	struct entry *e;
+
+	source->loop = loop;
+
+	if (source->fd != -1) {
+		if ((e = calloc(1, sizeof(struct entry))) == NULL)
+			return -ENOMEM;
+		e->source = source;
+		e->op = OP_POLL;
+		pthread_mutex_lock(&impl->ring.lock);
+		spa_list_append(&impl->entry_list, &e->link);
+		pthread_mutex_unlock(&impl->ring.lock);
+		return entry_arm(impl, e);
+	}
+	return 0;
+}
+
+static int loop_update_source(struct spa_source *source)
+{
+	struct spa_loop *loop = source->loop;
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+	struct entry *e;
+
+	if (source->fd == -1)
+		return 0;
+
+	pthread_mutex_lock(&impl->ring.lock);
+	e = find_entry(impl, source);
+	pthread_mutex_unlock(&impl->ring.lock);
+
+	if (e != NULL) {
+		entry_disarm(impl, e);
+		return entry_arm(impl, e);
+	}
+	return 0;
+}
+
+static void loop_remove_source(struct spa_source *source)
+{
+	struct spa_loop *loop = source->loop;
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+	struct entry *e;
+
+	if (source->fd != -1) {
+		pthread_mutex_lock(&impl->ring.lock);
+		if ((e = find_entry(impl, source)) != NULL) {
+			/* a completion of the entry can still be dispatched in
+			 * this iteration, it is freed after it */
+			e->removed = true;
+			spa_list_remove(&e->link);
+			spa_list_append(&impl->removed_list, &e->link);
+		}
+		pthread_mutex_unlock(&impl->ring.lock);
+
+		if (e != NULL) {
+			entry_disarm(impl, e);
+			ring_flush(impl);
+		}
+	}
+	source->loop = NULL;
+}
+
+static int
+loop_invoke(struct spa_loop *loop,
+	    spa_invoke_func_t func,
+	    uint32_t seq,
+	    const void *data,
+	    size_t size,
+	    bool block,
+	    void *user_data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(loop, struct impl, loop);
+	bool in_thread = pthread_equal(impl->thread, pthread_self());
+	struct invoke_wait wait = { 0, };
+	int res;
+
+	if (in_thread) {
+		res = func(loop, false, seq, data, size, user_data);
+	} else {
+		res = invoke_queue_push(&impl->queue, func, seq, data, size,
+					block ? &wait : NULL, user_data);
+		if (res < 0) {
+			spa_log_warn(impl->log, NAME " %p: queue full", impl);
+			return res;
+		}
+		if (res > 0)
+			spa_loop_utils_signal_event(&impl->utils, impl->wakeup);
+
+		if (block)
+			res = invoke_wait_for(&wait);
+		else if (seq != SPA_ID_INVALID)
+			res = SPA_RESULT_RETURN_ASYNC(seq);
+		else
+			res = 0;
+	}
+	return res;
+}
+
+static void wakeup_func(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	invoke_queue_dispatch(&impl->queue, &impl->loop, NULL);
+}
+
+static int loop_get_fd(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+
+	/* the fd is readable when there are completions, operations queued
+	 * while dispatching must then be submitted before returning */
+	impl->flush = true;
+
+	return impl->ring.fd;
+}
+
+static void
+loop_add_hooks(struct spa_loop_control *ctrl,
+	       struct spa_hook *hook,
+	       const struct spa_loop_control_hooks *hooks,
+	       void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+
+	spa_hook_list_append(&impl->hooks_list, hook, hooks, data);
+}
+
+static void loop_enter(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+	impl->thread = pthread_self();
+}
+
+static void loop_leave(struct spa_loop_control *ctrl)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+	impl->thread = 0;
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void timers_func(struct impl *impl);
+
+static void dispatch(struct impl *impl, struct completion *c)
+{
+	struct entry *e = c->entry;
+	struct spa_source *s = e->source;
+
+	/* removed or changed by an earlier callback */
+	if (e->removed || e->gen != c->gen)
+		return;
+
+	switch (e->op) {
+	case OP_POLL:
+		if (s->rmask && s->fd != -1)
+			s->func(s);
+		break;
+
+	case OP_TIMEOUT:
+		if (c->res == -ETIME)
+			timers_func(impl);
+		break;
+	}
+
+	/* one-shot polls are armed again, unless the callback did that or
+	 * removed the source */
+	if (e->op == OP_POLL)
+		entry_rearm(impl, e, c->gen);
+}
+
+/* with the lock held */
+static void free_removed(struct impl *impl)
+{
+	struct source_impl *source, *tmp;
+	struct entry *e, *t;
+
+	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link) {
+		if (source->entry.pending == 0) {
+			spa_list_remove(&source->link);
+			free(source);
+		}
+	}
+	spa_list_for_each_safe(e, t, &impl->removed_list, link) {
+		if (e->pending == 0) {
+			spa_list_remove(&e->link);
+			free(e);
+		}
+	}
+}
+
+static int loop_iterate(struct spa_loop_control *ctrl, int timeout)
+{
+	struct impl *impl = SPA_CONTAINER_OF(ctrl, struct impl, control);
+	struct ring *r = &impl->ring;
+	struct completion c[MAX_CQES];
+	struct __kernel_timespec ts;
+	struct source_impl *source, *tmp;
+	unsigned head, tail, to_submit;
+	int i, n, res;
+
+	if (!spa_list_is_empty(&impl->idle_list))
+		timeout = 0;
+	if (timeout >= 0) {
+		ts.tv_sec = timeout / 1000;
+		ts.tv_nsec = (timeout % 1000) * SPA_NSEC_PER_MSEC;
+	}
+
+	spa_hook_list_call(&impl->hooks_list, struct spa_loop_control_hooks, before);
+
+	pthread_mutex_lock(&r->lock);
+	to_submit = r->to_submit;
+	r->to_submit = 0;
+	pthread_mutex_unlock(&r->lock);
+
+	res = ring_enter(r, to_submit, timeout == 0 ? 0 : 1, IORING_ENTER_GETEVENTS,
+			 timeout >= 0 ? &ts : NULL);
+
+	spa_hook_list_call(&impl->hooks_list, struct spa_loop_control_hooks, after);
+
+	if (SPA_UNLIKELY(res < 0 && res != -ETIME))
+		return -res;
+
+	pthread_mutex_lock(&r->lock);
+	head = *r->cq_head;
+	tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+	for (n = 0; head != tail && n < MAX_CQES; head++) {
+		struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+		struct entry *e;
+
+		if (cqe->user_data == 0)
+			continue;
+
+		e = USER_DATA_ENTRY(cqe->user_data);
+		e->pending--;
+		if (e->removed || USER_DATA_GEN(cqe->user_data) != e->gen)
+			continue;
+
+		e->armed = false;
+		c[n].entry = e;
+		c[n].gen = e->gen;
+		c[n].res = cqe->res;
+		n++;
+	}
+	__atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&r->lock);
+
+	/* first we set all the rmasks, then call the callbacks. The reason is that
+	 * some callback might also want to look at other sources it manages and
+	 * can then reset the rmask to suppress the callback */
+	for (i = 0; i < n; i++) {
+		if (c[i].entry->op == OP_POLL)
+			c[i].entry->source->rmask = c[i].res < 0 ? SPA_IO_ERR :
+						     spa_poll_to_io(c[i].res);
+	}
+	for (i = 0; i < n; i++)
+		dispatch(impl, &c[i]);
+
+	spa_list_for_each_safe(source, tmp, &impl->idle_list, idle_link)
+		source->func.idle(source->source.data);
+
+	pthread_mutex_lock(&r->lock);
+	free_removed(impl);
+	pthread_mutex_unlock(&r->lock);
+
+	if (impl->flush)
+		ring_flush(impl);
+
+	return 0;
+}
+
+static struct source_impl *source_new(struct impl *impl, int fd, enum spa_io mask,
+				      spa_source_func_t func, void *data, enum op op)
+{
+	struct source_impl *source;
+
+	source = calloc(1, sizeof(struct source_impl));
+	if (source == NULL)
+		return NULL;
+
+	source->source.loop = &impl->loop;
+	source->source.func = func;
+	source->source.data = data;
+	source->source.fd = fd;
+	source->source.mask = mask;
+	source->impl = impl;
+	source->entry.source = &source->source;
+	source->entry.op = op;
+
+	pthread_mutex_lock(&impl->ring.lock);
+	spa_list_insert(&impl->source_list, &source->link);
+	pthread_mutex_unlock(&impl->ring.lock);
+
+	return source;
+}
+
+static void source_io_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.io(source->data, source->fd, source->rmask);
+}
+
+static struct spa_source *loop_add_io(struct spa_loop_utils *utils,
+				      int fd,
+				      enum spa_io mask,
+				      bool close, spa_source_io_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	source = source_new(impl, fd, mask, source_io_func, data, OP_POLL);
+	if (source == NULL)
+		return NULL;
+
+	source->close = close;
+	source->func.io = func;
+
+	if (fd != -1)
+		entry_arm(impl, &source->entry);
+
+	return &source->source;
+}
+
+static int loop_update_io(struct spa_source *source, enum spa_io mask)
+{
+	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	/* the loop reads the mask when it arms the poll again */
+	pthread_mutex_lock(&s->impl->ring.lock);
+	source->mask = mask;
+	pthread_mutex_unlock(&s->impl->ring.lock);
+	if (source->fd == -1)
+		return 0;
+
+	entry_disarm(s->impl, &s->entry);
+	return entry_arm(s->impl, &s->entry);
+}
+
+static struct spa_source *loop_add_idle(struct spa_loop_utils *utils,
+					bool enabled, spa_source_idle_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	/* idle sources don't need an fd, they are dispatched in every
+	 * iteration while enabled */
+	source = source_new(impl, -1, 0, NULL, data, OP_POLL);
+	if (source == NULL)
+		return NULL;
+
+	source->func.idle = func;
+	spa_list_init(&source->idle_link);
+
+	if (enabled)
+		spa_loop_utils_enable_idle(&impl->utils, &source->source, true);
+
+	return &source->source;
+}
+
+static void loop_enable_idle(struct spa_source *source, bool enabled)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+
+	if (enabled && !impl->enabled) {
+		spa_list_append(&impl->impl->idle_list, &impl->idle_link);
+	} else if (!enabled && impl->enabled) {
+		spa_list_remove(&impl->idle_link);
+	}
+
+	impl->enabled = enabled;
+}
+
+/* a read in the ring would block an io worker of the kernel until the fd
+ * is readable, the fd is polled and read here */
+static void source_event_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t count;
+
+	if (read(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t)) {
+		if (errno != EAGAIN)
+			spa_log_warn(impl->impl->log, NAME " %p: failed to read event fd %d: %s",
+					source, source->fd, strerror(errno));
+		return;
+	}
+	impl->func.event(source->data, count);
+}
+
+static struct spa_source *loop_add_event(struct spa_loop_utils *utils,
+					 spa_source_event_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	source = source_new(impl, eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK), SPA_IO_IN,
+			    source_event_func, data, OP_POLL);
+	if (source == NULL)
+		return NULL;
+
+	source->close = true;
+	source->func.event = func;
+
+	entry_arm(impl, &source->entry);
+
+	return &source->source;
+}
+
+static void loop_signal_event(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	uint64_t count = 1;
+
+	if (write(source->fd, &count, sizeof(uint64_t)) != sizeof(uint64_t))
+		spa_log_warn(impl->impl->log, NAME " %p: failed to write event fd %d: %s",
+				source, source->fd, strerror(errno));
+}
+
+/* All timers of the loop share one timeout in the ring, a timeout per
+ * timer costs a kernel timer and a completion for each of them. The armed
+ * timers are kept in a binary min-heap on their deadline, heap_pos is the
+ * 1-based position in the heap or 0 when the timer is not armed. */
+
+#define HEAP_PARENT(i)	(((i) - 1) / 2)
+
+static inline void heap_set(struct impl *impl, uint32_t i, struct source_impl *t)
+{
+	impl->timers[i] = t;
+	t->heap_pos = i + 1;
+}
+
+static void heap_sift_up(struct impl *impl, uint32_t i)
+{
+	struct source_impl *t = impl->timers[i];
+
+	while (i > 0 && impl->timers[HEAP_PARENT(i)]->deadline > t->deadline) {
+		heap_set(impl, i, impl->timers[HEAP_PARENT(i)]);
+		i = HEAP_PARENT(i);
+	}
+	heap_set(impl, i, t);
+}
+
+static void heap_sift_down(struct impl *impl, uint32_t i)
+{
+	struct source_impl *t = impl->timers[i];
+	uint32_t c, n = impl->n_queued;
+
+	while ((c = 2 * i + 1) < n) {
+		if (c + 1 < n && impl->timers[c + 1]->deadline < impl->timers[c]->deadline)
+			c++;
+		if (impl->timers[c]->deadline >= t->deadline)
+			break;
+		heap_set(impl, i, impl->timers[c]);
+		i = c;
+	}
+	heap_set(impl, i, t);
+}
+
+static void heap_remove(struct impl *impl, struct source_impl *t)
+{
+	uint32_t i = t->heap_pos - 1;
+	struct source_impl *last = impl->timers[--impl->n_queued];
+
+	t->heap_pos = 0;
+	if (last == t)
+		return;
+
+	heap_set(impl, i, last);
+	if (i > 0 && impl->timers[HEAP_PARENT(i)]->deadline > last->deadline)
+		heap_sift_up(impl, i);
+	else
+		heap_sift_down(impl, i);
+}
+
+static void heap_update(struct impl *impl, struct source_impl *t)
+{
+	if (t->heap_pos == 0) {
+		impl->timers[impl->n_queued++] = t;
+		heap_sift_up(impl, impl->n_queued - 1);
+	} else {
+		heap_sift_up(impl, t->heap_pos - 1);
+		heap_sift_down(impl, t->heap_pos - 1);
+	}
+}
+
+/* Make the timeout expire for the first timer. A later deadline leaves
+ * the timeout alone, it completes early once and is armed again then. */
+static int timers_arm(struct impl *impl)
+{
+	struct entry *e = &impl->timer;
+	uint64_t target;
+
+	if (impl->n_queued == 0)
+		return 0;
+
+	target = impl->timers[0]->deadline;
+	if (impl->armed != 0 && impl->armed <= target)
+		return 0;
+
+	entry_disarm(impl, e);
+	e->ts.tv_sec = target / SPA_NSEC_PER_SEC;
+	e->ts.tv_nsec = target % SPA_NSEC_PER_SEC;
+	impl->armed = target;
+
+	return entry_arm(impl, e);
+}
+
+static void timers_func(struct impl *impl)
+{
+	uint64_t now;
+	uint32_t n;
+
+	impl->armed = 0;
+	now = get_time();
+
+	/* timers that are armed again from their callback run in the next
+	 * iteration */
+	for (n = impl->n_queued; n > 0 && impl->n_queued > 0; n--) {
+		struct source_impl *t = impl->timers[0];
+
+		if (t->deadline > now)
+			break;
+
+		if (t->interval) {
+			t->expirations = 1 + (now - t->deadline) / t->interval;
+			t->deadline += t->expirations * t->interval;
+			heap_sift_down(impl, 0);
+		} else {
+			t->expirations = 1;
+			t->deadline = 0;
+			heap_remove(impl, t);
+		}
+		t->source.func(&t->source);
+	}
+	timers_arm(impl);
+}
+
+static void source_timer_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	impl->func.timer(source->data, impl->expirations);
+}
+
+static struct spa_source *loop_add_timer(struct spa_loop_utils *utils,
+					 spa_source_timer_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+
+	if (impl->n_timers == impl->max_timers) {
+		uint32_t max = SPA_MAX(impl->max_timers * 2, 16u);
+		struct source_impl **timers;
+
+		timers = realloc(impl->timers, max * sizeof(struct source_impl *));
+		if (timers == NULL)
+			return NULL;
+		impl->timers = timers;
+		impl->max_timers = max;
+	}
+
+	/* timers don't need an fd or an entry in the ring */
+	source = source_new(impl, -1, 0, source_timer_func, data, OP_TIMEOUT);
+	if (source == NULL)
+		return NULL;
+
+	source->func.timer = func;
+	impl->n_timers++;
+
+	return &source->source;
+}
+
+static int
+loop_update_timer(struct spa_source *source,
+		  struct timespec *value, struct timespec *interval, bool absolute)
+{
+	struct source_impl *s = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct impl *impl = s->impl;
+	uint64_t deadline = 0;
+
+	/* the same as timerfd_settime() */
+	if (value) {
+		deadline = SPA_TIMESPEC_TO_TIME(value);
+	} else if (interval) {
+		deadline = SPA_TIMESPEC_TO_TIME(interval);
+		absolute = true;
+	}
+	if (deadline > 0 && !absolute)
+		deadline += get_time();
+
+	s->interval = interval ? SPA_TIMESPEC_TO_TIME(interval) : 0;
+	s->deadline = deadline;
+
+	if (deadline == 0) {
+		if (s->heap_pos != 0)
+			heap_remove(impl, s);
+		return 0;
+	}
+	heap_update(impl, s);
+
+	return timers_arm(impl);
+}
+
+static void source_signal_func(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct signalfd_siginfo signal_info;
+	int len;
+
+	len = read(source->fd, &signal_info, sizeof signal_info);
+	if (len != sizeof signal_info) {
+		if (!(len == -1 && errno == EAGAIN))
+			spa_log_warn(impl->impl->log, NAME " %p: failed to read signal fd %d: %s",
+					source, source->fd, strerror(errno));
+		return;
+	}
+	impl->func.signal(source->data, impl->signal_number);
+}
+
+static struct spa_source *loop_add_signal(struct spa_loop_utils *utils,
+					  int signal_number,
+					  spa_source_signal_func_t func, void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(utils, struct impl, utils);
+	struct source_impl *source;
+	sigset_t mask;
+	int fd;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, signal_number);
+	fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	source = source_new(impl, fd, SPA_IO_IN, source_signal_func, data, OP_POLL);
+	if (source == NULL)
+		return NULL;
+
+	source->close = true;
+	source->func.signal = func;
+	source->signal_number = signal_number;
+
+	entry_arm(impl, &source->entry);
+
+	return &source->source;
+}
+
+static void loop_destroy_source(struct spa_source *source)
+{
+	struct source_impl *impl = SPA_CONTAINER_OF(source, struct source_impl, source);
+	struct impl *loop_impl = impl->impl;
+
+	/* not armed again from now on */
+	pthread_mutex_lock(&loop_impl->ring.lock);
+	spa_list_remove(&impl->link);
+	impl->entry.removed = true;
+	pthread_mutex_unlock(&loop_impl->ring.lock);
+
+	if (impl->enabled)
+		spa_list_remove(&impl->idle_link);
+	impl->enabled = false;
+
+	if (source->func == source_timer_func) {
+		if (impl->heap_pos != 0)
+			heap_remove(loop_impl, impl);
+		loop_impl->n_timers--;
+	}
+
+	entry_disarm(loop_impl, &impl->entry);
+	source->loop = NULL;
+
+	if (source->fd != -1) {
+		ring_flush(loop_impl);
+		if (impl->close) {
+			close(source->fd);
+			source->fd = -1;
+		}
+	}
+
+	/* freed by the loop when no operation is in flight anymore */
+	pthread_mutex_lock(&loop_impl->ring.lock);
+	spa_list_insert(&loop_impl->destroy_list, &impl->link);
+	pthread_mutex_unlock(&loop_impl->ring.lock);
+}
+
+static int loop_get_stats(struct spa_loop_utils *utils,
+			  struct spa_source *source,
+			  uint32_t type,
+			  struct spa_loop_stats *stats)
+{
+	return -ENOTSUP;
+}
+
+static const struct spa_loop impl_loop = {
+	SPA_VERSION_LOOP,
+	loop_add_source,
+	loop_update_source,
+	loop_remove_source,
+	loop_invoke,
+};
+
+static const struct spa_loop_control impl_loop_control = {
+	SPA_VERSION_LOOP_CONTROL,
+	loop_get_fd,
+	loop_add_hooks,
+	loop_enter,
+	loop_leave,
+	loop_iterate,
+};
+
+static const struct spa_loop_utils impl_loop_utils = {
+	SPA_VERSION_LOOP_UTILS,
+	loop_add_io,
+	loop_update_io,
+	loop_add_idle,
+	loop_enable_idle,
+	loop_add_event,
+	loop_signal_event,
+	loop_add_timer,
+	loop_update_timer,
+	loop_add_signal,
+	loop_destroy_source,
+	loop_get_stats,
+};
+
+static int impl_get_interface(struct spa_handle *handle, uint32_t interface_id, void **interface)
+{
+	struct impl *impl;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+	spa_return_val_if_fail(interface != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	if (interface_id == impl->type.loop)
+		*interface = &impl->loop;
+	else if (interface_id == impl->type.loop_control)
+		*interface = &impl->control;
+	else if (interface_id == impl->type.loop_utils)
+		*interface = &impl->utils;
+	else
+		return -ENOENT;
+
+	return 0;
+}
+
+static int impl_clear(struct spa_handle *handle)
+{
+	struct impl *impl;
+	struct source_impl *source, *tmp;
+	struct entry *e, *t;
+
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	impl = (struct impl *) handle;
+
+	spa_list_for_each_safe(source, tmp, &impl->source_list, link)
+		loop_destroy_source(&source->source);
+
+	/* closing the ring cancels everything that is still in flight */
+	ring_clear(&impl->ring);
+
+	spa_list_for_each_safe(source, tmp, &impl->destroy_list, link)
+		free(source);
+	spa_list_for_each_safe(e, t, &impl->removed_list, link)
+		free(e);
+	spa_list_for_each_safe(e, t, &impl->entry_list, link)
+		free(e);
+	free(impl->timers);
+
+	return 0;
+}
+
+static int
+impl_init(const struct spa_handle_factory *factory,
+	  struct spa_handle *handle,
+	  const struct spa_dict *info,
+	  const struct spa_support *support,
+	  uint32_t n_support)
+{
+	struct impl *impl;
+	uint32_t i;
+	int res;
+
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(handle != NULL, -EINVAL);
+
+	handle->get_interface = impl_get_interface;
+	handle->clear = impl_clear;
+
+	impl = (struct impl *) handle;
+	impl->loop = impl_loop;
+	impl->control = impl_loop_control;
+	impl->utils = impl_loop_utils;
+
+	for (i = 0; i < n_support; i++) {
+		if (strcmp(support[i].type, SPA_TYPE__TypeMap) == 0)
+			impl->map = support[i].data;
+		else if (strcmp(support[i].type, SPA_TYPE__Log) == 0)
+			impl->log = support[i].data;
+	}
+	if (impl->map == NULL) {
+		spa_log_error(impl->log, NAME " %p: a type-map is needed", impl);
+		return -EINVAL;
+	}
+	init_type(&impl->type, impl->map);
+
+	if ((res = ring_init(&impl->ring, RING_ENTRIES)) < 0) {
+		spa_log_error(impl->log, NAME " %p: can't set up io_uring: %s",
+				impl, strerror(-res));
+		return res;
+	}
+
+	spa_list_init(&impl->source_list);
+	spa_list_init(&impl->destroy_list);
+	spa_list_init(&impl->entry_list);
+	spa_list_init(&impl->removed_list);
+	spa_list_init(&impl->idle_list);
+	spa_hook_list_init(&impl->hooks_list);
+
+	invoke_queue_init(&impl->queue);
+
+	impl->timer.op = OP_TIMEOUT;
+
+	impl->wakeup = spa_loop_utils_add_event(&impl->utils, wakeup_func, impl);
+
+	spa_log_info(impl->log, NAME " %p: initialized", impl);
+
+	return 0;
+}
+
+static const struct spa_interface_info impl_interfaces[] = {
+	{SPA_TYPE__Loop,},
+	{SPA_TYPE__LoopControl,},
+	{SPA_TYPE__LoopUtils,},
+};
+
+static int
+impl_enum_interface_info(const struct spa_handle_factory *factory,
+			 const struct spa_interface_info **info,
+			 uint32_t *index)
+{
+	spa_return_val_if_fail(factory != NULL, -EINVAL);
+	spa_return_val_if_fail(info != NULL, -EINVAL);
+	spa_return_val_if_fail(index != NULL, -EINVAL);
+
+	if (*index >= SPA_N_ELEMENTS(impl_interfaces))
+		return 0;
+
+	*info = &impl_interfaces[(*index)++];
+	return 1;
+}
+
+static const struct spa_handle_factory uring_loop_factory = {
+	SPA_VERSION_HANDLE_FACTORY,
+	NAME,
+	NULL,
+	sizeof(struct impl),
+	impl_init,
+	impl_enum_interface_info
+};
+
+int spa_handle_factory_register(const struct spa_handle_factory *factory);
+
+static void reg(void) __attribute__ ((constructor));
+static void reg(void)
+{
+	spa_handle_factory_register(&uring_loop_factory);
+}
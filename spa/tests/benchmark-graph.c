@@ -0,0 +1,441 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Runs one of the graph schedulers on synthetic topologies and reports
+ * the time per cycle and per node. The scheduler is selected at compile
+ * time with -DSCHEDULER=<n> because all schedulers share the same names.
+ *
+ * The nodes only move the io status around, like fakesrc, fakesink and
+ * audiomixer without data, so that the cost of the scheduler itself is
+ * measured. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/graph/graph.h>
+
+#ifndef SCHEDULER
+#define SCHEDULER 6
+#endif
+
+#if SCHEDULER == 1
+#include <spa/graph/graph-scheduler1.h>
+#elif SCHEDULER == 3
+#include <spa/graph/graph-scheduler3.h>
+#elif SCHEDULER == 6
+#include <spa/graph/graph-scheduler6.h>
+#elif SCHEDULER == 7
+#include <spa/graph/graph-scheduler7.h>
+#else
+#error "unsupported scheduler"
+#endif
+
+#if SCHEDULER == 3
+/* scheduler 3 keeps no state of its own */
+struct spa_graph_data {
+	struct spa_graph *graph;
+};
+static inline void spa_graph_data_init(struct spa_graph_data *data,
+				       struct spa_graph *graph)
+{
+	data->graph = graph;
+}
+#endif
+
+enum topology {
+	TOPOLOGY_CHAIN,		/* src -> filter -> ... -> filter -> sink */
+	TOPOLOGY_FAN_IN,	/* n src -> mixer -> sink */
+	TOPOLOGY_FAN_OUT,	/* src -> tee -> n sink */
+	TOPOLOGY_DIAMOND,	/* src -> tee -> n filter -> mixer -> sink */
+	TOPOLOGY_LAST,
+};
+
+static const char *topology_names[] = {
+	"chain",
+	"fan-in",
+	"fan-out",
+	"diamond",
+};
+
+#if SCHEDULER == 1
+/* scheduler 1 can't handle nodes with more than one output */
+static const bool topology_supported[] = { true, true, false, false };
+#else
+static const bool topology_supported[] = { true, true, true, true };
+#endif
+
+struct node {
+	struct spa_node node;
+	struct spa_graph_node gnode;
+	struct spa_graph_port *ports[2];
+	uint32_t n_ports[2];
+	uint32_t count;
+};
+
+struct link {
+	struct spa_io_buffers io;
+};
+
+struct data {
+	struct spa_graph graph;
+	struct spa_graph_data graph_data;
+
+	enum topology topology;
+	uint32_t n_nodes;
+	uint32_t cycles;
+	uint32_t n_workers;
+
+	struct node *nodes;
+	uint32_t n_used;
+	struct link *links;
+	uint32_t n_links;
+
+	struct node *source;
+	struct node *sink;
+
+	int perf_fd;
+};
+
+/* like fakesink and audiomixer: consume the input buffers and, when
+ * there are outputs, produce a new buffer on all of them. Sinks behave
+ * like an async fakesink, they start the next cycle themselves. */
+static int impl_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	struct spa_graph_port *p;
+	uint32_t i;
+
+	for (i = 0; i < n->n_ports[SPA_DIRECTION_OUTPUT]; i++) {
+		if (n->ports[SPA_DIRECTION_OUTPUT][i].io->status == SPA_STATUS_HAVE_BUFFER)
+			return SPA_STATUS_HAVE_BUFFER;
+	}
+
+	for (i = 0; i < n->n_ports[SPA_DIRECTION_INPUT]; i++) {
+		p = &n->ports[SPA_DIRECTION_INPUT][i];
+		if (p->io->status == SPA_STATUS_HAVE_BUFFER) {
+			p->io->buffer_id = SPA_ID_INVALID;
+			p->io->status = SPA_STATUS_NEED_BUFFER;
+		}
+	}
+	n->count++;
+
+	if (n->n_ports[SPA_DIRECTION_OUTPUT] == 0)
+		return SPA_STATUS_OK;
+
+	for (i = 0; i < n->n_ports[SPA_DIRECTION_OUTPUT]; i++) {
+		p = &n->ports[SPA_DIRECTION_OUTPUT][i];
+		p->io->buffer_id = 0;
+		p->io->status = SPA_STATUS_HAVE_BUFFER;
+	}
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+/* like fakesrc and audiomixer: produce a buffer when the outputs need
+ * one, ask for more input when there are inputs */
+static int impl_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	struct spa_graph_port *p;
+	uint32_t i;
+	int res = SPA_STATUS_OK;
+
+	for (i = 0; i < n->n_ports[SPA_DIRECTION_OUTPUT]; i++) {
+		if (n->ports[SPA_DIRECTION_OUTPUT][i].io->status == SPA_STATUS_HAVE_BUFFER)
+			return SPA_STATUS_HAVE_BUFFER;
+	}
+
+	if (n->n_ports[SPA_DIRECTION_INPUT] > 0) {
+		for (i = 0; i < n->n_ports[SPA_DIRECTION_INPUT]; i++)
+			n->ports[SPA_DIRECTION_INPUT][i].io->status = SPA_STATUS_NEED_BUFFER;
+		return SPA_STATUS_NEED_BUFFER;
+	}
+
+	for (i = 0; i < n->n_ports[SPA_DIRECTION_OUTPUT]; i++) {
+		p = &n->ports[SPA_DIRECTION_OUTPUT][i];
+		if (p->io->status == SPA_STATUS_NEED_BUFFER) {
+			p->io->buffer_id = 0;
+			p->io->status = SPA_STATUS_HAVE_BUFFER;
+			res = SPA_STATUS_HAVE_BUFFER;
+		}
+	}
+	if (res == SPA_STATUS_HAVE_BUFFER)
+		n->count++;
+	return res;
+}
+
+static struct node *make_node(struct data *data, uint32_t n_inputs, uint32_t n_outputs)
+{
+	struct node *n = &data->nodes[data->n_used++];
+
+	n->node.version = SPA_VERSION_NODE;
+	n->node.process_input = impl_process_input;
+	n->node.process_output = impl_process_output;
+	n->ports[SPA_DIRECTION_INPUT] = calloc(n_inputs + 1, sizeof(struct spa_graph_port));
+	n->ports[SPA_DIRECTION_OUTPUT] = calloc(n_outputs + 1, sizeof(struct spa_graph_port));
+
+	spa_graph_node_init(&n->gnode);
+	spa_graph_node_set_implementation(&n->gnode, &n->node);
+	spa_graph_node_add(&data->graph, &n->gnode);
+
+	return n;
+}
+
+static void link_nodes(struct data *data, struct node *out, struct node *in)
+{
+	struct link *l = &data->links[data->n_links++];
+	struct spa_graph_port *op, *ip;
+	uint32_t oid = out->n_ports[SPA_DIRECTION_OUTPUT]++;
+	uint32_t iid = in->n_ports[SPA_DIRECTION_INPUT]++;
+
+	l->io = SPA_IO_BUFFERS_INIT;
+	l->io.status = SPA_STATUS_NEED_BUFFER;
+
+	op = &out->ports[SPA_DIRECTION_OUTPUT][oid];
+	ip = &in->ports[SPA_DIRECTION_INPUT][iid];
+
+	spa_graph_port_init(op, SPA_DIRECTION_OUTPUT, oid, 0, &l->io);
+	spa_graph_port_add(&out->gnode, op);
+	spa_graph_port_init(ip, SPA_DIRECTION_INPUT, iid, 0, &l->io);
+	spa_graph_port_add(&in->gnode, ip);
+	spa_graph_port_link(op, ip);
+}
+
+static int make_topology(struct data *data)
+{
+	struct node *n, *prev, *tee, *mix;
+	uint32_t i, inner;
+
+	if (data->n_nodes < 4)
+		return -EINVAL;
+
+	data->nodes = calloc(data->n_nodes, sizeof(struct node));
+	data->links = calloc(data->n_nodes * 2, sizeof(struct link));
+	if (data->nodes == NULL || data->links == NULL)
+		return -ENOMEM;
+
+	switch (data->topology) {
+	case TOPOLOGY_CHAIN:
+		inner = data->n_nodes - 2;
+		prev = data->source = make_node(data, 0, 1);
+		for (i = 0; i < inner; i++) {
+			n = make_node(data, 1, 1);
+			link_nodes(data, prev, n);
+			prev = n;
+		}
+		data->sink = make_node(data, 1, 0);
+		link_nodes(data, prev, data->sink);
+		break;
+
+	case TOPOLOGY_FAN_IN:
+		inner = data->n_nodes - 2;
+		mix = make_node(data, inner, 1);
+		for (i = 0; i < inner; i++) {
+			n = make_node(data, 0, 1);
+			link_nodes(data, n, mix);
+			if (data->source == NULL)
+				data->source = n;
+		}
+		data->sink = make_node(data, 1, 0);
+		link_nodes(data, mix, data->sink);
+		break;
+
+	case TOPOLOGY_FAN_OUT:
+		inner = data->n_nodes - 2;
+		data->source = make_node(data, 0, 1);
+		tee = make_node(data, 1, inner);
+		link_nodes(data, data->source, tee);
+		for (i = 0; i < inner; i++) {
+			n = make_node(data, 1, 0);
+			link_nodes(data, tee, n);
+			if (data->sink == NULL)
+				data->sink = n;
+		}
+		break;
+
+	case TOPOLOGY_DIAMOND:
+		inner = data->n_nodes - 4;
+		data->source = make_node(data, 0, 1);
+		tee = make_node(data, 1, inner);
+		mix = make_node(data, inner, 1);
+		link_nodes(data, data->source, tee);
+		for (i = 0; i < inner; i++) {
+			n = make_node(data, 1, 1);
+			link_nodes(data, tee, n);
+			link_nodes(data, n, mix);
+		}
+		data->sink = make_node(data, 1, 0);
+		link_nodes(data, mix, data->sink);
+		break;
+
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static void free_topology(struct data *data)
+{
+	uint32_t i;
+
+	for (i = 0; i < data->n_used; i++) {
+		free(data->nodes[i].ports[SPA_DIRECTION_INPUT]);
+		free(data->nodes[i].ports[SPA_DIRECTION_OUTPUT]);
+	}
+	free(data->nodes);
+	free(data->links);
+}
+
+static int open_cache_misses(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void run_cycle(struct data *data)
+{
+	if (data->topology == TOPOLOGY_FAN_OUT) {
+		/* sources with many consumers push */
+		spa_node_process_output(&data->source->node);
+		spa_graph_have_output(&data->graph, &data->source->gnode);
+	} else {
+		data->sink->gnode.state = SPA_STATUS_NEED_BUFFER;
+		spa_graph_need_input(&data->graph, &data->sink->gnode);
+	}
+}
+
+static void run_benchmark(struct data *data)
+{
+	uint64_t start, stop, misses = 0;
+	uint32_t i;
+
+	/* warm up, this also compiles the plan of scheduler 7 */
+	for (i = 0; i < 16; i++)
+		run_cycle(data);
+	data->sink->count = 0;
+
+	if (data->perf_fd >= 0) {
+		ioctl(data->perf_fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(data->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	start = get_time();
+
+	for (i = 0; i < data->cycles; i++)
+		run_cycle(data);
+
+	stop = get_time();
+	if (data->perf_fd >= 0) {
+		ioctl(data->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(data->perf_fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = 0;
+	}
+
+	printf("scheduler%d %-8s nodes %4d cycles %8d: %10.1f ns/cycle %8.1f ns/node",
+			SCHEDULER, topology_names[data->topology], data->n_nodes, data->cycles,
+			(double)(stop - start) / data->cycles,
+			(double)(stop - start) / data->cycles / data->n_nodes);
+	if (data->perf_fd >= 0)
+		printf(" %8.1f misses/cycle", (double) misses / data->cycles);
+	else
+		printf("     n/a misses/cycle");
+	printf(" (sink %d)\n", data->sink->count);
+}
+
+static int run_topology(struct data *data, enum topology topology)
+{
+	int res;
+
+	if (!topology_supported[topology]) {
+		printf("scheduler%d %-8s not supported\n", SCHEDULER, topology_names[topology]);
+		return 0;
+	}
+
+	data->topology = topology;
+	data->source = data->sink = NULL;
+	data->n_used = data->n_links = 0;
+
+	spa_graph_init(&data->graph);
+	spa_graph_data_init(&data->graph_data, &data->graph);
+	spa_graph_set_callbacks(&data->graph, &spa_graph_impl_default, &data->graph_data);
+#if SCHEDULER == 7
+	if ((res = spa_graph_data_start(&data->graph_data, data->n_workers, 0)) < 0)
+		return res;
+#endif
+
+	if ((res = make_topology(data)) < 0)
+		return res;
+
+	run_benchmark(data);
+
+#if SCHEDULER == 7
+	spa_graph_data_stop(&data->graph_data);
+	spa_graph_clear(&data->graph);
+#endif
+	free_topology(data);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	int res, i;
+
+	data.n_nodes = argc > 1 ? atoi(argv[1]) : 16;
+	data.cycles = argc > 2 ? atoi(argv[2]) : 100000;
+	data.n_workers = argc > 3 ? atoi(argv[3]) : 0;
+
+	data.perf_fd = open_cache_misses();
+
+	for (i = 0; i < TOPOLOGY_LAST; i++) {
+		if ((res = run_topology(&data, i)) < 0) {
+			printf("can't run %s: %s\n", topology_names[i], strerror(-res));
+			return -1;
+		}
+	}
+
+	if (data.perf_fd >= 0)
+		close(data.perf_fd);
+
+	return 0;
+}
@@ -0,0 +1,278 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Compares the loop implementations of the support plugin.
+ *
+ * events: n event sources are signalled and dispatched every round
+ * io:     n pipes are written and their io sources dispatched every round
+ * timers: n timers expire every round
+ *
+ * benchmark-loop [ROUNDS] [SOURCES] [PLUGIN] */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+
+#include <spa/support/log-impl.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+#include <spa/utils/dict.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+#define MAX_SOURCES	1024
+
+static const struct spa_dict_item profile_items[] = {
+	{ "loop.profile", "true" },
+};
+static const struct spa_dict profile_info = { profile_items, 1 };
+
+static const struct {
+	const char *label;
+	const char *name;
+	const struct spa_dict *info;
+} loops[] = {
+	{ "loop", "loop", NULL },
+	{ "loop+profile", "loop", &profile_info },
+	{ "uring-loop", "uring-loop", NULL },
+};
+
+struct data {
+	struct spa_support support[2];
+	uint32_t n_support;
+	struct spa_type_map *map;
+
+	struct spa_loop_control *control;
+	struct spa_loop_utils *utils;
+
+	uint32_t rounds;
+	uint32_t n_sources;
+	struct spa_source *sources[MAX_SOURCES];
+	int pipes[MAX_SOURCES][2];
+	uint32_t dispatched;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static int make_loop(struct data *data, void *hnd, const char *name,
+		     const struct spa_dict *info, struct spa_handle **handle)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	uint32_t i;
+	void *iface;
+	int res;
+
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -errno;
+	}
+
+	for (i = 0;;) {
+		if ((res = enum_func(&factory, &i)) <= 0)
+			return res == 0 ? -ENOENT : res;
+		if (strcmp(factory->name, name) == 0)
+			break;
+	}
+
+	*handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, *handle, info,
+					   data->support, data->n_support)) < 0) {
+		free(*handle);
+		return res;
+	}
+	spa_handle_get_interface(*handle,
+			spa_type_map_get_id(data->map, SPA_TYPE__LoopControl), &iface);
+	data->control = iface;
+	spa_handle_get_interface(*handle,
+			spa_type_map_get_id(data->map, SPA_TYPE__LoopUtils), &iface);
+	data->utils = iface;
+
+	return 0;
+}
+
+static void on_event(void *_data, uint64_t count)
+{
+	struct data *data = _data;
+	data->dispatched++;
+}
+
+static void on_io(void *_data, int fd, enum spa_io mask)
+{
+	struct data *data = _data;
+	uint8_t b;
+
+	if (read(fd, &b, 1) != 1)
+		printf("read failed: %m\n");
+	data->dispatched++;
+}
+
+static void on_timer(void *_data, uint64_t expirations)
+{
+	struct data *data = _data;
+	data->dispatched++;
+}
+
+static void dispatch_all(struct data *data)
+{
+	while (data->dispatched < data->n_sources)
+		spa_loop_control_iterate(data->control, -1);
+	data->dispatched = 0;
+}
+
+static double run_events(struct data *data)
+{
+	uint64_t start, stop;
+	uint32_t i, j;
+
+	for (i = 0; i < data->n_sources; i++)
+		data->sources[i] = spa_loop_utils_add_event(data->utils, on_event, data);
+
+	start = get_time();
+	for (i = 0; i < data->rounds; i++) {
+		for (j = 0; j < data->n_sources; j++)
+			spa_loop_utils_signal_event(data->utils, data->sources[j]);
+		dispatch_all(data);
+	}
+	stop = get_time();
+
+	for (i = 0; i < data->n_sources; i++)
+		spa_loop_utils_destroy_source(data->utils, data->sources[i]);
+
+	return (double)(stop - start) / data->rounds;
+}
+
+static double run_io(struct data *data)
+{
+	uint64_t start, stop;
+	uint32_t i, j;
+	uint8_t b = 0;
+
+	for (i = 0; i < data->n_sources; i++) {
+		if (pipe(data->pipes[i]) < 0)
+			return 0.0;
+		data->sources[i] = spa_loop_utils_add_io(data->utils, data->pipes[i][0],
+							 SPA_IO_IN, true, on_io, data);
+	}
+
+	start = get_time();
+	for (i = 0; i < data->rounds; i++) {
+		for (j = 0; j < data->n_sources; j++) {
+			if (write(data->pipes[j][1], &b, 1) != 1)
+				printf("write failed: %m\n");
+		}
+		dispatch_all(data);
+	}
+	stop = get_time();
+
+	for (i = 0; i < data->n_sources; i++) {
+		spa_loop_utils_destroy_source(data->utils, data->sources[i]);
+		close(data->pipes[i][1]);
+	}
+
+	return (double)(stop - start) / data->rounds;
+}
+
+static double run_timers(struct data *data)
+{
+	struct timespec value;
+	uint64_t start, stop;
+	uint32_t i, j;
+
+	for (i = 0; i < data->n_sources; i++)
+		data->sources[i] = spa_loop_utils_add_timer(data->utils, on_timer, data);
+
+	/* a timer in the past expires right away */
+	value.tv_sec = 0;
+	value.tv_nsec = 1;
+
+	start = get_time();
+	for (i = 0; i < data->rounds; i++) {
+		for (j = 0; j < data->n_sources; j++)
+			spa_loop_utils_update_timer(data->utils, data->sources[j],
+						    &value, NULL, true);
+		dispatch_all(data);
+	}
+	stop = get_time();
+
+	for (i = 0; i < data->n_sources; i++)
+		spa_loop_utils_destroy_source(data->utils, data->sources[i]);
+
+	return (double)(stop - start) / data->rounds;
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct spa_handle *handle = NULL;
+	const char *lib;
+	void *hnd;
+	uint32_t i;
+	int res;
+
+	data.rounds = argc > 1 ? atoi(argv[1]) : 10000;
+	data.n_sources = argc > 2 ? SPA_MIN(atoi(argv[2]), MAX_SOURCES) : 16;
+	lib = argc > 3 ? argv[3] : "build/spa/plugins/support/libspa-support.so";
+
+	data.map = &default_map.map;
+	data.support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, data.map);
+	data.support[1] = SPA_SUPPORT_INIT(SPA_TYPE__Log, &default_log.log);
+	data.n_support = 2;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -1;
+	}
+
+	/* the profiled loop logs its statistics on exit */
+	default_log.log.level = SPA_LOG_LEVEL_WARN;
+
+	for (i = 0; i < SPA_N_ELEMENTS(loops); i++) {
+		double events, io, timers;
+
+		if ((res = make_loop(&data, hnd, loops[i].name, loops[i].info, &handle)) < 0) {
+			printf("%-12s not available: %s\n", loops[i].label, strerror(-res));
+			continue;
+		}
+		spa_loop_control_enter(data.control);
+		events = run_events(&data);
+		io = run_io(&data);
+		timers = run_timers(&data);
+		spa_loop_control_leave(data.control);
+
+		printf("%-12s %u sources: events %8.1f ns/source  io %8.1f ns/source  "
+		       "timers %8.1f ns/source\n", loops[i].label, data.n_sources,
+		       events / data.n_sources, io / data.n_sources, timers / data.n_sources);
+
+		spa_handle_clear(handle);
+		free(handle);
+	}
+	return 0;
+}
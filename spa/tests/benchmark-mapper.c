@@ -0,0 +1,201 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Measures the type map lookups of plugin startup. Every plugin maps all
+ * the type structures of the SPA headers into a fresh copy, like the
+ * plugins do in their init function. The map first gets EXTRA custom types
+ * to show the effect of a process that knows many types.
+ *
+ * The linear map is the strcmp scan of type-map-impl.h, the same search
+ * that the mapper plugin used to do.
+ *
+ * benchmark-mapper [PLUGINS] [EXTRA] [PLUGIN] */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <time.h>
+
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+#include <spa/buffer/buffer.h>
+#include <spa/buffer/meta.h>
+#include <spa/monitor/monitor.h>
+#include <spa/node/command.h>
+#include <spa/node/event.h>
+#include <spa/node/io.h>
+#include <spa/param/param.h>
+#include <spa/param/buffers.h>
+#include <spa/param/meta.h>
+#include <spa/param/io.h>
+#include <spa/param/video-padding.h>
+#include <spa/param/format-utils.h>
+#include <spa/param/audio/format-utils.h>
+#include <spa/param/video/format-utils.h>
+
+#define MAX_EXTRA	4096
+
+static SPA_TYPE_MAP_IMPL(linear_map, MAX_EXTRA + 1024);
+
+static char extra_names[MAX_EXTRA][32];
+
+/* all the types a plugin could map */
+struct types {
+	struct spa_type_data data;
+	struct spa_type_meta meta;
+	struct spa_type_monitor monitor;
+	struct spa_type_command_node command_node;
+	struct spa_type_event_node event_node;
+	struct spa_type_io io;
+	struct spa_type_param param;
+	struct spa_type_param_buffers param_buffers;
+	struct spa_type_param_meta param_meta;
+	struct spa_type_param_io param_io;
+	struct spa_type_param_video_padding param_video_padding;
+	struct spa_type_media_type media_type;
+	struct spa_type_media_subtype media_subtype;
+	struct spa_type_media_subtype_video media_subtype_video;
+	struct spa_type_media_subtype_audio media_subtype_audio;
+	struct spa_type_format_audio format_audio;
+	struct spa_type_format_video format_video;
+	struct spa_type_audio_format audio_format;
+	struct spa_type_video_format video_format;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static void map_types(struct spa_type_map *map, struct types *t)
+{
+	spa_type_data_map(map, &t->data);
+	spa_type_meta_map(map, &t->meta);
+	spa_type_monitor_map(map, &t->monitor);
+	spa_type_command_node_map(map, &t->command_node);
+	spa_type_event_node_map(map, &t->event_node);
+	spa_type_io_map(map, &t->io);
+	spa_type_param_map(map, &t->param);
+	spa_type_param_buffers_map(map, &t->param_buffers);
+	spa_type_param_meta_map(map, &t->param_meta);
+	spa_type_param_io_map(map, &t->param_io);
+	spa_type_param_video_padding_map(map, &t->param_video_padding);
+	spa_type_media_type_map(map, &t->media_type);
+	spa_type_media_subtype_map(map, &t->media_subtype);
+	spa_type_media_subtype_video_map(map, &t->media_subtype_video);
+	spa_type_media_subtype_audio_map(map, &t->media_subtype_audio);
+	spa_type_format_audio_map(map, &t->format_audio);
+	spa_type_format_video_map(map, &t->format_video);
+	spa_type_audio_format_map(map, &t->audio_format);
+	spa_type_video_format_map(map, &t->video_format);
+}
+
+static void run(const char *name, struct spa_type_map *map, uint64_t init,
+		uint32_t n_plugins, uint32_t n_extra)
+{
+	struct types t;
+	uint64_t start, extra, plugins;
+	uint32_t i;
+
+	start = get_time();
+	for (i = 0; i < n_extra; i++)
+		spa_type_map_get_id(map, extra_names[i]);
+	extra = get_time() - start;
+
+	start = get_time();
+	for (i = 0; i < n_plugins; i++) {
+		memset(&t, 0, sizeof(t));
+		map_types(map, &t);
+	}
+	plugins = get_time() - start;
+
+	printf("%-8s %5zd types: init %8.1f us  extra %8.1f us  plugin init %8.1f us\n",
+	       name, spa_type_map_get_size(map), init / 1000.0, extra / 1000.0,
+	       plugins / 1000.0 / n_plugins);
+}
+
+static int make_mapper(const char *lib, struct spa_handle **handle, struct spa_type_map **map)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	uint32_t i;
+	void *hnd, *iface;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -ENOENT;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -ENOENT;
+	}
+	for (i = 0;;) {
+		if ((res = enum_func(&factory, &i)) <= 0)
+			return res == 0 ? -ENOENT : res;
+		if (strcmp(factory->name, "mapper") == 0)
+			break;
+	}
+
+	*handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, *handle, NULL, NULL, 0)) < 0)
+		return res;
+
+	/* like pipewire, without a type map the mapper interface is id 0 */
+	if ((res = spa_handle_get_interface(*handle, 0, &iface)) < 0)
+		return res;
+	*map = iface;
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct spa_handle *handle;
+	struct spa_type_map *map;
+	uint32_t i, n_plugins, n_extra;
+	const char *lib;
+	uint64_t start;
+	int res;
+
+	n_plugins = argc > 1 ? atoi(argv[1]) : 100;
+	n_extra = argc > 2 ? SPA_MIN(atoi(argv[2]), MAX_EXTRA) : 1000;
+	lib = argc > 3 ? argv[3] : "build/spa/plugins/support/libspa-support.so";
+
+	for (i = 0; i < n_extra; i++)
+		snprintf(extra_names[i], sizeof(extra_names[i]), "Spa:Benchmark:Type%u", i);
+
+	run("linear", &linear_map.map, 0, n_plugins, n_extra);
+
+	start = get_time();
+	if ((res = make_mapper(lib, &handle, &map)) < 0) {
+		printf("can't make mapper: %s\n", strerror(-res));
+		return -1;
+	}
+	run("mapper", map, get_time() - start, n_plugins, n_extra);
+
+	spa_handle_clear(handle);
+	free(handle);
+
+	return 0;
+}
@@ -0,0 +1,328 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Measures the cost of sharing the client-node transport area between two
+ * cores with the packed layout of the first transport version and with the
+ * cache line aligned layout. The areas below mirror pw_client_node_area
+ * with its io areas and ringbuffer indexes.
+ *
+ * ports:    each thread updates the io area of its own port
+ * stream:   one thread writes messages, the other reads them
+ * pingpong: a process message and its reply, like a cycle of a node
+ *
+ * Run it on a machine with at least two cores, the threads are pinned to
+ * the first two cores when possible. */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <spa/utils/defs.h>
+#include <spa/utils/ringbuffer.h>
+#include <spa/node/io.h>
+
+#define CACHE_LINE	64
+#define RING_SIZE	4096
+#define MESSAGE_SIZE	16
+
+/* version 0, everything packed */
+struct packed_area {
+	uint32_t state[2];
+	struct spa_io_buffers io[2];
+	struct spa_ringbuffer ring[2];
+	uint8_t data[2][RING_SIZE];
+};
+
+/* version 1, the parts written by different threads on their own cache line */
+struct aligned_state {
+	uint32_t state;
+} SPA_ALIGNED(CACHE_LINE);
+
+struct aligned_io {
+	struct spa_io_buffers io;
+} SPA_ALIGNED(CACHE_LINE);
+
+struct aligned_ring {
+	uint32_t readindex SPA_ALIGNED(CACHE_LINE);
+	uint32_t writeindex SPA_ALIGNED(CACHE_LINE);
+};
+
+struct aligned_area {
+	struct aligned_state state[2];
+	struct aligned_io io[2];
+	struct aligned_ring ring[2];
+	uint8_t data[2][RING_SIZE];
+};
+
+/* pointers into one of the areas */
+struct layout {
+	const char *name;
+	uint32_t *state[2];
+	struct spa_io_buffers *io[2];
+	uint32_t *readindex[2];
+	uint32_t *writeindex[2];
+	uint8_t *data[2];
+};
+
+enum test {
+	TEST_PORTS,
+	TEST_STREAM,
+	TEST_PINGPONG,
+	TEST_LAST,
+};
+
+static const char *test_names[] = {
+	"ports",
+	"stream",
+	"pingpong",
+};
+
+struct data {
+	struct layout *layout;
+	enum test test;
+	uint32_t count;
+	int n_cpus;
+	pthread_barrier_t barrier;
+};
+
+/* with one cpu, the other side only runs when we yield */
+static bool yield_wait;
+
+static inline void wait_peer(void)
+{
+	if (yield_wait)
+		sched_yield();
+}
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static uint64_t get_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return 0;
+#endif
+}
+
+static void layout_packed(struct layout *l, struct packed_area *a)
+{
+	int i;
+
+	l->name = "packed";
+	for (i = 0; i < 2; i++) {
+		l->state[i] = &a->state[i];
+		l->io[i] = &a->io[i];
+		l->readindex[i] = &a->ring[i].readindex;
+		l->writeindex[i] = &a->ring[i].writeindex;
+		l->data[i] = a->data[i];
+	}
+}
+
+static void layout_aligned(struct layout *l, struct aligned_area *a)
+{
+	int i;
+
+	l->name = "aligned";
+	for (i = 0; i < 2; i++) {
+		l->state[i] = &a->state[i].state;
+		l->io[i] = &a->io[i].io;
+		l->readindex[i] = &a->ring[i].readindex;
+		l->writeindex[i] = &a->ring[i].writeindex;
+		l->data[i] = a->data[i];
+	}
+}
+
+static void pin_thread(struct data *data, int cpu)
+{
+	cpu_set_t set;
+
+	if (data->n_cpus < 2)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+static void write_message(struct layout *l, int ring, uint32_t value)
+{
+	uint32_t index, msg[MESSAGE_SIZE / 4] = { value, };
+
+	index = __atomic_load_n(l->writeindex[ring], __ATOMIC_RELAXED);
+	while ((int32_t) (index - __atomic_load_n(l->readindex[ring], __ATOMIC_ACQUIRE)) >
+	       RING_SIZE - MESSAGE_SIZE)
+		wait_peer();
+	spa_ringbuffer_write_data(NULL, l->data[ring], RING_SIZE,
+				  index & (RING_SIZE - 1), msg, MESSAGE_SIZE);
+	__atomic_store_n(l->writeindex[ring], index + MESSAGE_SIZE, __ATOMIC_RELEASE);
+}
+
+static uint32_t read_message(struct layout *l, int ring)
+{
+	uint32_t index, msg[MESSAGE_SIZE / 4];
+
+	index = __atomic_load_n(l->readindex[ring], __ATOMIC_RELAXED);
+	while ((int32_t) (__atomic_load_n(l->writeindex[ring], __ATOMIC_ACQUIRE) - index) <
+	       MESSAGE_SIZE)
+		wait_peer();
+	spa_ringbuffer_read_data(NULL, l->data[ring], RING_SIZE,
+				 index & (RING_SIZE - 1), msg, MESSAGE_SIZE);
+	__atomic_store_n(l->readindex[ring], index + MESSAGE_SIZE, __ATOMIC_RELEASE);
+
+	return msg[0];
+}
+
+/* side 0 is the server, side 1 the client */
+static void run_side(struct data *data, int side)
+{
+	struct layout *l = data->layout;
+	struct spa_io_buffers *io = l->io[side];
+	uint32_t i;
+
+	switch (data->test) {
+	case TEST_PORTS:
+		for (i = 0; i < data->count; i++) {
+			__atomic_store_n(&io->buffer_id, i, __ATOMIC_RELAXED);
+			__atomic_store_n(&io->status, SPA_STATUS_HAVE_BUFFER, __ATOMIC_RELEASE);
+			__atomic_store_n(l->state[side], i & 1, __ATOMIC_RELAXED);
+		}
+		break;
+
+	case TEST_STREAM:
+		for (i = 0; i < data->count; i++) {
+			if (side == 0)
+				write_message(l, 0, i);
+			else
+				read_message(l, 0);
+		}
+		break;
+
+	case TEST_PINGPONG:
+		for (i = 0; i < data->count; i++) {
+			if (side == 0) {
+				__atomic_store_n(&io->buffer_id, i, __ATOMIC_RELAXED);
+				write_message(l, 0, i);
+				read_message(l, 1);
+			} else {
+				read_message(l, 0);
+				__atomic_store_n(&io->buffer_id,
+						 __atomic_load_n(&l->io[0]->buffer_id,
+								 __ATOMIC_RELAXED),
+						 __ATOMIC_RELAXED);
+				write_message(l, 1, i);
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+static void *client_thread(void *user_data)
+{
+	struct data *data = user_data;
+
+	pin_thread(data, 1);
+	pthread_barrier_wait(&data->barrier);
+	run_side(data, 1);
+
+	return NULL;
+}
+
+static void run_test(struct data *data, struct layout *layout, enum test test)
+{
+	pthread_t thread;
+	uint64_t start, stop, cstart, cstop;
+
+	data->layout = layout;
+	data->test = test;
+
+	pthread_barrier_init(&data->barrier, NULL, 2);
+	pthread_create(&thread, NULL, client_thread, data);
+
+	pin_thread(data, 0);
+	pthread_barrier_wait(&data->barrier);
+
+	start = get_time();
+	cstart = get_cycles();
+
+	run_side(data, 0);
+	pthread_join(thread, NULL);
+
+	cstop = get_cycles();
+	stop = get_time();
+
+	pthread_barrier_destroy(&data->barrier);
+
+	printf("%-8s %-8s count %8d: %8.1f ns/op", test_names[test], layout->name,
+			data->count, (double)(stop - start) / data->count);
+	if (cstop != cstart)
+		printf(" %8.1f cycles/op\n", (double)(cstop - cstart) / data->count);
+	else
+		printf("      n/a cycles/op\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	struct packed_area *packed;
+	struct aligned_area *aligned;
+	struct layout layouts[2];
+	int i, j;
+
+	data.count = argc > 1 ? atoi(argv[1]) : 1000000;
+	data.n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if ((yield_wait = data.n_cpus < 2))
+		printf("only one cpu, the numbers don't show the cross-core cost\n");
+
+	if (posix_memalign((void **) &packed, CACHE_LINE, sizeof(*packed)) != 0 ||
+	    posix_memalign((void **) &aligned, CACHE_LINE, sizeof(*aligned)) != 0) {
+		printf("can't allocate areas\n");
+		return -1;
+	}
+
+	for (i = 0; i < TEST_LAST; i++) {
+		memset(packed, 0, sizeof(*packed));
+		memset(aligned, 0, sizeof(*aligned));
+		layout_packed(&layouts[0], packed);
+		layout_aligned(&layouts[1], aligned);
+
+		for (j = 0; j < 2; j++)
+			run_test(&data, &layouts[j], i);
+	}
+
+	free(packed);
+	free(aligned);
+
+	return 0;
+}
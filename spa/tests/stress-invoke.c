@@ -0,0 +1,278 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Stress test for spa_loop_invoke from many threads at once.
+ *
+ * Every writer thread invokes messages of varying size with an increasing
+ * counter, every 64th message is blocking. The loop thread checks that the
+ * messages of each writer arrive in order with intact contents.
+ *
+ * stress-invoke [WRITERS] [SECONDS] [FACTORY] [PLUGIN] */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <spa/support/log-impl.h>
+#include <spa/support/loop.h>
+#include <spa/support/type-map-impl.h>
+#include <spa/support/plugin.h>
+
+static SPA_TYPE_MAP_IMPL(default_map, 4096);
+static SPA_LOG_IMPL(default_log);
+
+#define MAX_WRITERS	64
+#define MAX_PAYLOAD	512
+
+struct message {
+	uint32_t writer;
+	uint32_t count;
+	uint8_t payload[MAX_PAYLOAD];
+};
+
+struct writer {
+	struct data *data;
+	pthread_t thread;
+	uint32_t id;
+	uint32_t count;
+	unsigned long full;
+};
+
+struct data {
+	struct spa_support support[2];
+	uint32_t n_support;
+	struct spa_type_map *map;
+	struct spa_handle *handle;
+
+	struct spa_loop *loop;
+	struct spa_loop_control *control;
+
+	bool running;
+	bool looping;
+	uint32_t n_writers;
+	struct writer writers[MAX_WRITERS];
+
+	unsigned long failures;
+
+	/* only touched from the loop thread */
+	uint32_t expected[MAX_WRITERS];
+	unsigned long received;
+};
+
+static inline size_t message_size(uint32_t count)
+{
+	return offsetof(struct message, payload) + (count * 7) % MAX_PAYLOAD;
+}
+
+static int make_loop(struct data *data, const char *lib, const char *name)
+{
+	spa_handle_factory_enum_func_t enum_func;
+	const struct spa_handle_factory *factory;
+	uint32_t i;
+	void *hnd, *iface;
+	int res;
+
+	if ((hnd = dlopen(lib, RTLD_NOW)) == NULL) {
+		printf("can't load %s: %s\n", lib, dlerror());
+		return -ENOENT;
+	}
+	if ((enum_func = dlsym(hnd, SPA_HANDLE_FACTORY_ENUM_FUNC_NAME)) == NULL) {
+		printf("can't find enum function\n");
+		return -ENOENT;
+	}
+
+	for (i = 0;;) {
+		if ((res = enum_func(&factory, &i)) <= 0)
+			return res == 0 ? -ENOENT : res;
+		if (strcmp(factory->name, name) == 0)
+			break;
+	}
+
+	data->handle = calloc(1, factory->size);
+	if ((res = spa_handle_factory_init(factory, data->handle, NULL,
+					   data->support, data->n_support)) < 0)
+		return res;
+
+	spa_handle_get_interface(data->handle,
+			spa_type_map_get_id(data->map, SPA_TYPE__Loop), &iface);
+	data->loop = iface;
+	spa_handle_get_interface(data->handle,
+			spa_type_map_get_id(data->map, SPA_TYPE__LoopControl), &iface);
+	data->control = iface;
+
+	return 0;
+}
+
+static int
+do_message(struct spa_loop *loop, bool async, uint32_t seq,
+	   const void *_data, size_t size, void *user_data)
+{
+	struct data *data = user_data;
+	const struct message *m = _data;
+	size_t i;
+
+	if (size != message_size(m->count) || m->writer >= data->n_writers ||
+	    m->count != data->expected[m->writer]) {
+		printf("writer %u: got message %u of size %zd, expected %u\n",
+		       m->writer, m->count, size, data->expected[m->writer]);
+		__atomic_add_fetch(&data->failures, 1, __ATOMIC_RELAXED);
+		data->expected[m->writer] = m->count;
+	}
+	for (i = 0; i < size - offsetof(struct message, payload); i++) {
+		if (m->payload[i] != (uint8_t) (m->count + i)) {
+			printf("writer %u: message %u corrupted at %zd\n", m->writer, m->count, i);
+			__atomic_add_fetch(&data->failures, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	data->expected[m->writer]++;
+	data->received++;
+
+	return m->count;
+}
+
+static void *writer_start(void *arg)
+{
+	struct writer *w = arg;
+	struct data *data = w->data;
+	struct message m;
+	size_t i, size;
+	int res;
+
+	m.writer = w->id;
+
+	while (__atomic_load_n(&data->running, __ATOMIC_RELAXED)) {
+		bool block = (w->count & 63) == 63;
+
+		m.count = w->count;
+		size = message_size(m.count);
+		for (i = 0; i < size - offsetof(struct message, payload); i++)
+			m.payload[i] = m.count + i;
+
+		res = spa_loop_invoke(data->loop, do_message, SPA_ID_INVALID,
+				      &m, size, block, data);
+		if (res == -EPIPE) {
+			w->full++;
+			sched_yield();
+			continue;
+		}
+		if (block && res != (int) m.count) {
+			printf("writer %u: blocking message %u returned %d\n",
+			       w->id, m.count, res);
+			__atomic_add_fetch(&data->failures, 1, __ATOMIC_RELAXED);
+		}
+		w->count++;
+	}
+	return NULL;
+}
+
+static int do_stop(struct spa_loop *loop, bool async, uint32_t seq,
+		   const void *_data, size_t size, void *user_data)
+{
+	struct data *data = user_data;
+	data->looping = false;
+	return 0;
+}
+
+static void *loop_start(void *arg)
+{
+	struct data *data = arg;
+
+	printf("loop started on cpu: %d\n", sched_getcpu());
+
+	spa_loop_control_enter(data->control);
+	while (data->looping)
+		spa_loop_control_iterate(data->control, -1);
+	spa_loop_control_leave(data->control);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	pthread_t loop_thread;
+	const char *lib, *factory;
+	unsigned long sent = 0, full = 0;
+	uint32_t i, seconds;
+	int res;
+
+	data.n_writers = argc > 1 ? SPA_MIN(atoi(argv[1]), MAX_WRITERS) : 4;
+	seconds = argc > 2 ? atoi(argv[2]) : 5;
+	factory = argc > 3 ? argv[3] : "loop";
+	lib = argc > 4 ? argv[4] : "build/spa/plugins/support/libspa-support.so";
+
+	printf("starting invoke stress test: %u writers, %u seconds, %s\n",
+	       data.n_writers, seconds, factory);
+
+	/* a full queue is expected here, don't log it */
+	default_log.log.level = SPA_LOG_LEVEL_ERROR;
+
+	data.map = &default_map.map;
+	data.support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, data.map);
+	data.support[1] = SPA_SUPPORT_INIT(SPA_TYPE__Log, &default_log.log);
+	data.n_support = 2;
+
+	if ((res = make_loop(&data, lib, factory)) < 0) {
+		printf("can't make %s: %s\n", factory, strerror(-res));
+		return -1;
+	}
+
+	data.running = data.looping = true;
+	pthread_create(&loop_thread, NULL, loop_start, &data);
+	/* wait for the loop thread to enter so that invokes get queued */
+	usleep(100 * 1000);
+
+	for (i = 0; i < data.n_writers; i++) {
+		data.writers[i].data = &data;
+		data.writers[i].id = i;
+		pthread_create(&data.writers[i].thread, NULL, writer_start, &data.writers[i]);
+	}
+
+	for (i = 0; i < seconds; i++) {
+		sleep(1);
+		printf("%u: received %lu messages, %lu failures\n",
+		       i + 1, __atomic_load_n(&data.received, __ATOMIC_RELAXED),
+		       __atomic_load_n(&data.failures, __ATOMIC_RELAXED));
+	}
+
+	__atomic_store_n(&data.running, false, __ATOMIC_RELAXED);
+	for (i = 0; i < data.n_writers; i++) {
+		pthread_join(data.writers[i].thread, NULL);
+		sent += data.writers[i].count;
+		full += data.writers[i].full;
+	}
+	/* runs after all queued messages */
+	spa_loop_invoke(data.loop, do_stop, SPA_ID_INVALID, NULL, 0, true, &data);
+	pthread_join(loop_thread, NULL);
+
+	printf("sent %lu received %lu, queue full %lu times, %lu failures\n",
+	       sent, data.received, full, data.failures);
+
+	spa_handle_clear(data.handle);
+	free(data.handle);
+
+	return (data.failures == 0 && sent == data.received) ? 0 : -1;
+}
@@ -0,0 +1,206 @@
+/* Spa
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Checks that the consumers of a source driver only run after the driver
+ * produced its output in the cycle, with worker threads.
+ *
+ * The driver writes the number of the cycle in the buffer of each link,
+ * slowly, so that a consumer that runs too early sees a half written or
+ * an old buffer.
+ *
+ * test-graph-driver [CONSUMERS] [CYCLES] [WORKERS] */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sched.h>
+
+#include <spa/node/node.h>
+#include <spa/node/io.h>
+#include <spa/graph/graph.h>
+#include <spa/graph/graph-scheduler7.h>
+
+#define MAX_CONSUMERS	64
+#define BUFFER_WORDS	64
+
+struct link {
+	struct spa_io_buffers io;
+	struct spa_graph_port out, in;
+	uint32_t buffer[BUFFER_WORDS];
+};
+
+struct node {
+	struct data *data;
+	struct spa_node node;
+	struct spa_graph_node gnode;
+	struct link *link;
+	uint32_t count;
+};
+
+struct data {
+	struct spa_graph graph;
+	struct spa_graph_data graph_data;
+
+	uint32_t n_consumers;
+	uint32_t cycle;
+	uint32_t producing;
+	unsigned long failures;
+
+	struct node driver;
+	struct node consumers[MAX_CONSUMERS];
+	struct link links[MAX_CONSUMERS];
+};
+
+/* the consumers take the buffer of their link */
+static int consumer_process_input(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	struct data *data = n->data;
+	struct link *l = n->link;
+	uint32_t i;
+
+	if (__atomic_load_n(&data->producing, __ATOMIC_ACQUIRE)) {
+		printf("consumer %p: runs while the driver produces\n", n);
+		__atomic_add_fetch(&data->failures, 1, __ATOMIC_RELAXED);
+	}
+	for (i = 0; i < BUFFER_WORDS; i++) {
+		if (l->buffer[i] != data->cycle) {
+			printf("consumer %p: got %u at %u in cycle %u\n",
+			       n, l->buffer[i], i, data->cycle);
+			__atomic_add_fetch(&data->failures, 1, __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	l->io.status = SPA_STATUS_NEED_BUFFER;
+	n->count++;
+
+	return SPA_STATUS_OK;
+}
+
+static int consumer_process_output(struct spa_node *node)
+{
+	return SPA_STATUS_NEED_BUFFER;
+}
+
+/* the driver fills the buffers of all links for the cycle */
+static int driver_process_output(struct spa_node *node)
+{
+	struct node *n = SPA_CONTAINER_OF(node, struct node, node);
+	struct data *data = n->data;
+	uint32_t i, j;
+
+	__atomic_store_n(&data->producing, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < data->n_consumers; i++) {
+		struct link *l = &data->links[i];
+
+		for (j = 0; j < BUFFER_WORDS; j++) {
+			l->buffer[j] = data->cycle;
+			if ((j & 15) == 0)
+				sched_yield();
+		}
+		l->io.buffer_id = 0;
+		l->io.status = SPA_STATUS_HAVE_BUFFER;
+	}
+	__atomic_store_n(&data->producing, 0, __ATOMIC_RELEASE);
+	n->count++;
+
+	return SPA_STATUS_HAVE_BUFFER;
+}
+
+static int driver_process_input(struct spa_node *node)
+{
+	return SPA_STATUS_OK;
+}
+
+static void init_node(struct data *data, struct node *n,
+		      int (*process_input) (struct spa_node *node),
+		      int (*process_output) (struct spa_node *node))
+{
+	n->data = data;
+	n->node.version = SPA_VERSION_NODE;
+	n->node.process_input = process_input;
+	n->node.process_output = process_output;
+	spa_graph_node_init(&n->gnode);
+	spa_graph_node_set_implementation(&n->gnode, &n->node);
+}
+
+static void make_graph(struct data *data)
+{
+	uint32_t i;
+
+	init_node(data, &data->driver, driver_process_input, driver_process_output);
+	data->driver.gnode.flags |= SPA_GRAPH_NODE_FLAG_DRIVER;
+	spa_graph_node_add(&data->graph, &data->driver.gnode);
+
+	for (i = 0; i < data->n_consumers; i++) {
+		struct node *n = &data->consumers[i];
+		struct link *l = &data->links[i];
+
+		init_node(data, n, consumer_process_input, consumer_process_output);
+		spa_graph_node_add(&data->graph, &n->gnode);
+
+		l->io = SPA_IO_BUFFERS_INIT;
+		l->io.status = SPA_STATUS_NEED_BUFFER;
+		spa_graph_port_init(&l->out, SPA_DIRECTION_OUTPUT, i, 0, &l->io);
+		spa_graph_port_add(&data->driver.gnode, &l->out);
+		spa_graph_port_init(&l->in, SPA_DIRECTION_INPUT, 0, 0, &l->io);
+		spa_graph_port_add(&n->gnode, &l->in);
+		spa_graph_port_link(&l->out, &l->in);
+		n->link = l;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	uint32_t i, cycles, n_workers, missed = 0;
+	int res;
+
+	data.n_consumers = argc > 1 ? SPA_MIN(atoi(argv[1]), MAX_CONSUMERS) : 8;
+	cycles = argc > 2 ? atoi(argv[2]) : 10000;
+	n_workers = argc > 3 ? atoi(argv[3]) : 4;
+
+	printf("starting driver test: %u consumers, %u cycles, %u workers\n",
+	       data.n_consumers, cycles, n_workers);
+
+	spa_graph_init(&data.graph);
+	spa_graph_data_init(&data.graph_data, &data.graph);
+	spa_graph_set_callbacks(&data.graph, &spa_graph_impl_default, &data.graph_data);
+	if ((res = spa_graph_data_start(&data.graph_data, n_workers, 0)) < 0) {
+		printf("can't start workers: %s\n", strerror(-res));
+		return -1;
+	}
+
+	make_graph(&data);
+
+	for (data.cycle = 1; data.cycle <= cycles; data.cycle++)
+		spa_graph_need_input(&data.graph, &data.driver.gnode);
+
+	spa_graph_data_stop(&data.graph_data);
+	spa_graph_clear(&data.graph);
+
+	for (i = 0; i < data.n_consumers; i++)
+		missed += cycles - data.consumers[i].count;
+
+	printf("driver ran %u cycles, consumers missed %u cycles, %lu failures\n",
+	       data.driver.count, missed, data.failures);
+
+	return (data.failures == 0 && missed == 0 && data.driver.count == cycles) ? 0 : -1;
+}
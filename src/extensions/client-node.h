@@ -27,6 +27,7 @@ extern "C" {
 #include <spa/utils/defs.h>
 #include <spa/param/param.h>
 #include <spa/node/node.h>
+#include <spa/node/io.h>
 
 #include <pipewire/proxy.h>
 
@@ -38,12 +39,53 @@ struct pw_client_node_proxy;
 
 struct pw_client_node_message;
 
+/** Callback for the messages of \ref pw_client_node_transport_read_messages */
+typedef void (*pw_client_node_message_func_t) (void *data, struct pw_client_node_message *message);
+
+/** Version of the layout of the shared area, a transport with a different
+ * layout is refused \memberof pw_client_node */
+#define PW_CLIENT_NODE_AREA_VERSION		1
+
+/** Size of a cache line, the parts of the shared area that are written by
+ * different threads are kept on separate cache lines \memberof pw_client_node */
+#define PW_CLIENT_NODE_CACHE_LINE		64
+
+/** Activation state of the reader of one side of the transport. A reader
+ * that is awake reads all messages before it sleeps again, a writer only
+ * needs to signal the eventfd when the reader is sleeping. A reader that
+ * never sets the state is always woken up. \memberof pw_client_node */
+struct pw_client_node_activation {
+#define PW_CLIENT_NODE_ACTIVATION_SLEEPING	0	/**< wake up with the eventfd */
+#define PW_CLIENT_NODE_ACTIVATION_AWAKE		1	/**< reads before sleeping */
+	uint32_t state;
+} SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);
+
+/** The io area of a port. Each port has its own cache line so that nodes
+ * processing different ports don't write to the same line.
+ * \memberof pw_client_node */
+struct pw_client_node_port_io {
+	struct spa_io_buffers io;
+} SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);
+
+/** Indexes of a ringbuffer of the transport. The reader only writes the
+ * read index and the writer only writes the write index, each is on its
+ * own cache line. \memberof pw_client_node */
+struct pw_client_node_ring {
+	uint32_t readindex SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);	/**< the current read index */
+	uint32_t writeindex SPA_ALIGNED(PW_CLIENT_NODE_CACHE_LINE);	/**< the current write index */
+};
+
 /** Shared structure between client and server \memberof pw_client_node */
 struct pw_client_node_area {
+	uint32_t version;		/**< PW_CLIENT_NODE_AREA_VERSION */
 	uint32_t max_input_ports;	/**< max input ports of the node */
 	uint32_t n_input_ports;		/**< number of input ports of the node */
 	uint32_t max_output_ports;	/**< max output ports of the node */
 	uint32_t n_output_ports;	/**< number of output ports of the node */
+	uint32_t ring_size;		/**< size of the ringbuffers, 0 when the
+					  *  segment has no ringbuffers */
+	struct pw_client_node_activation activation[2];	/**< server and client reader, each
+							  *  on its own cache line */
 };
 
 /** \class pw_client_node_transport
@@ -53,15 +95,22 @@ struct pw_client_node_area {
  * The transport object contains shared data and ringbuffers to exchange
  * events and data between the server and the client in a low-latency and
  * lockfree way.
+ *
+ * A transport can grow with extra segments. A segment holds the io areas
+ * of the ports after those of the previous segment and optionally larger
+ * ringbuffers that replace the current ones.
  */
 struct pw_client_node_transport {
 	struct pw_client_node_area *area;	/**< the transport area */
-	struct spa_io_buffers *inputs;		/**< array of buffer input io */
-	struct spa_io_buffers *outputs;		/**< array of buffer output io */
+	struct pw_client_node_port_io *inputs;	/**< array of buffer input io */
+	struct pw_client_node_port_io *outputs;	/**< array of buffer output io */
 	void *input_data;			/**< input memory for ringbuffer */
-	struct spa_ringbuffer *input_buffer;	/**< ringbuffer for input memory */
+	struct pw_client_node_ring *input_buffer;	/**< ringbuffer for input memory */
 	void *output_data;			/**< output memory for ringbuffer */
-	struct spa_ringbuffer *output_buffer;	/**< ringbuffer for output memory */
+	struct pw_client_node_ring *output_buffer;	/**< ringbuffer for output memory */
+	struct pw_client_node_activation *activation;		/**< reader of the input */
+	struct pw_client_node_activation *peer_activation;	/**< reader of the output */
+	struct pw_client_node_transport *next;	/**< next segment or NULL */
 
 	/** Destroy a transport
 	 * \param trans a transport to destroy
@@ -100,12 +149,102 @@ struct pw_client_node_transport {
 	 * Use this function after \ref next_message().
 	 */
 	int (*parse_message) (struct pw_client_node_transport *trans, void *message);
+
+	/** Read all pending messages on transport
+	 * \param trans the transport to read from
+	 * \param func called for each message
+	 * \param data user data for \a func
+	 * \return the number of messages read or < 0 on error
+	 *
+	 * The messages are passed to \a func in place, they are only valid
+	 * during the call. The read index is updated once after the last
+	 * message.
+	 */
+	int (*read_messages) (struct pw_client_node_transport *trans,
+			      pw_client_node_message_func_t func, void *data);
+
+	/** Add a segment to the transport
+	 * \param trans the transport to grow
+	 * \param segment the segment, \a trans takes ownership
+	 * \return 0 on success, < 0 on error
+	 *
+	 * When the segment has ringbuffers, the client continues writing
+	 * in the new ringbuffer and the server follows. Call this from the
+	 * thread that adds messages.
+	 */
+	int (*add_segment) (struct pw_client_node_transport *trans,
+			    struct pw_client_node_transport *segment);
 };
 
 #define pw_client_node_transport_destroy(t)		((t)->destroy((t)))
 #define pw_client_node_transport_add_message(t,m)	((t)->add_message((t), (m)))
 #define pw_client_node_transport_next_message(t,m)	((t)->next_message((t), (m)))
 #define pw_client_node_transport_parse_message(t,m)	((t)->parse_message((t), (m)))
+#define pw_client_node_transport_read_messages(t,f,d)	((t)->read_messages((t), (f), (d)))
+#define pw_client_node_transport_add_segment(t,s)	((t)->add_segment((t), (s)))
+
+/** Get the io area of input port \a port_id or NULL when the transport has
+ * no room for the port \memberof pw_client_node_transport */
+static inline struct spa_io_buffers *
+pw_client_node_transport_get_input(struct pw_client_node_transport *trans, uint32_t port_id)
+{
+	for (; trans; trans = __atomic_load_n(&trans->next, __ATOMIC_ACQUIRE)) {
+		if (port_id < trans->area->max_input_ports)
+			return &trans->inputs[port_id].io;
+		port_id -= trans->area->max_input_ports;
+	}
+	return NULL;
+}
+
+/** Get the io area of output port \a port_id or NULL when the transport has
+ * no room for the port \memberof pw_client_node_transport */
+static inline struct spa_io_buffers *
+pw_client_node_transport_get_output(struct pw_client_node_transport *trans, uint32_t port_id)
+{
+	for (; trans; trans = __atomic_load_n(&trans->next, __ATOMIC_ACQUIRE)) {
+		if (port_id < trans->area->max_output_ports)
+			return &trans->outputs[port_id].io;
+		port_id -= trans->area->max_output_ports;
+	}
+	return NULL;
+}
+
+/** Get the number of ports with an io area in all segments of \a trans
+ * \memberof pw_client_node_transport */
+static inline void
+pw_client_node_transport_get_max_ports(struct pw_client_node_transport *trans,
+				       uint32_t *max_input_ports, uint32_t *max_output_ports)
+{
+	*max_input_ports = *max_output_ports = 0;
+	for (; trans; trans = __atomic_load_n(&trans->next, __ATOMIC_ACQUIRE)) {
+		*max_input_ports += trans->area->max_input_ports;
+		*max_output_ports += trans->area->max_output_ports;
+	}
+}
+
+/** Mark the reader of \a trans awake or sleeping. When going to sleep,
+ * read the messages that arrived before sleeping.
+ * \memberof pw_client_node_transport */
+static inline void
+pw_client_node_transport_set_awake(struct pw_client_node_transport *trans, bool awake)
+{
+	__atomic_store_n(&trans->activation->state, awake ?
+			 PW_CLIENT_NODE_ACTIVATION_AWAKE :
+			 PW_CLIENT_NODE_ACTIVATION_SLEEPING, __ATOMIC_SEQ_CST);
+	/* order against reading the ringbuffer */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/** Check if the peer needs to be signaled after adding messages to \a trans
+ * \memberof pw_client_node_transport */
+static inline bool
+pw_client_node_transport_need_wakeup(struct pw_client_node_transport *trans)
+{
+	/* order against writing the ringbuffer */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&trans->peer_activation->state, __ATOMIC_SEQ_CST) !=
+		PW_CLIENT_NODE_ACTIVATION_AWAKE;
+}
 
 enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT,		/*< signal that the node has output */
@@ -113,6 +252,8 @@ enum pw_client_node_message_type {
 	PW_CLIENT_NODE_MESSAGE_PROCESS_INPUT,		/*< instruct the node to process input */
 	PW_CLIENT_NODE_MESSAGE_PROCESS_OUTPUT,		/*< instruct the node output is processed */
 	PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER,	/*< reuse a buffer */
+	PW_CLIENT_NODE_MESSAGE_SWITCH,			/*< continue in the ringbuffer of the next
+							 *  segment, handled by the transport */
 };
 
 struct pw_client_node_message_body {
@@ -299,7 +440,9 @@ pw_client_node_proxy_destroy(struct pw_client_node_proxy *p)
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_USE_BUFFERS	8
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_COMMAND		9
 #define PW_CLIENT_NODE_PROXY_EVENT_PORT_SET_IO		10
-#define PW_CLIENT_NODE_PROXY_EVENT_NUM			11
+#define PW_CLIENT_NODE_PROXY_EVENT_PORT_PEER		11
+#define PW_CLIENT_NODE_PROXY_EVENT_TRANSPORT_SEGMENT	12
+#define PW_CLIENT_NODE_PROXY_EVENT_NUM			13
 
 /** \ref pw_client_node events */
 struct pw_client_node_proxy_events {
@@ -446,6 +589,41 @@ struct pw_client_node_proxy_events {
 			     uint32_t mem_id,
 			     uint32_t offset,
 			     uint32_t size);
+	/**
+	 * Connect a port directly to the peer client node
+	 *
+	 * When the port is linked to a port of another client node, the
+	 * server can hand both clients a shared transport. The output
+	 * client places its buffers in the first output io area of the
+	 * transport and both clients exchange the process messages over
+	 * it, waking each other up with the given fds without going
+	 * through the server.
+	 *
+	 * \param direction the direction of the port
+	 * \param port_id the port id
+	 * \param readfd fd signaled when the peer added messages
+	 * \param writefd fd to signal the peer
+	 * \param transport the shared transport or NULL when the
+	 *	direct connection is removed
+	 */
+	void (*port_peer) (void *object,
+			   enum spa_direction direction,
+			   uint32_t port_id,
+			   int readfd,
+			   int writefd,
+			   struct pw_client_node_transport *transport);
+	/**
+	 * The transport grew
+	 *
+	 * The server added a segment to the transport because the node got
+	 * more ports. The client should add the segment to its transport
+	 * with \ref pw_client_node_transport_add_segment() from the thread
+	 * that processes the messages.
+	 *
+	 * \param segment the new segment of the transport
+	 */
+	void (*transport_segment) (void *object,
+				   struct pw_client_node_transport *segment);
 };
 
 static inline void
@@ -479,6 +657,10 @@ pw_client_node_proxy_add_listener(struct pw_client_node_proxy *p,
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_command,__VA_ARGS__)
 #define pw_client_node_resource_port_set_io(r,...)	\
 	pw_resource_notify(r,struct pw_client_node_proxy_events,port_set_io,__VA_ARGS__)
+#define pw_client_node_resource_port_peer(r,...)	\
+	pw_resource_notify(r,struct pw_client_node_proxy_events,port_peer,__VA_ARGS__)
+#define pw_client_node_resource_transport_segment(r,...)	\
+	pw_resource_notify(r,struct pw_client_node_proxy_events,transport_segment,__VA_ARGS__)
 
 #ifdef __cplusplus
 }  /* extern "C" */
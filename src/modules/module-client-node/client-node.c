@@ -100,6 +100,9 @@ struct proxy {
 
 	struct spa_source data_source;
 	int writefd;
+	struct spa_hook loop_hook;	/**< tracks if we sleep in the data loop */
+	bool hooked;
+	bool flush_pending;		/**< messages were added in this cycle */
 
 	uint32_t max_inputs;
 	uint32_t n_inputs;
@@ -115,10 +118,33 @@ struct proxy {
 	uint32_t seq;
 };
 
+/** a port of the node we watch for links to other client nodes */
+struct port_data {
+	struct spa_list link;
+	struct impl *impl;
+	struct pw_port *port;
+	struct spa_hook port_listener;
+};
+
+/** a link from one of our output ports to a client node input port. When
+ * both ports have no other links, the clients get a shared transport and
+ * signal each other directly. */
+struct peer_link {
+	struct spa_list peer_link;	/**< link in the output impl peer_list */
+	struct impl *impl;		/**< the output client node */
+	struct impl *peer;		/**< the input client node */
+	struct pw_link *link;
+	struct spa_hook link_listener;
+
+	struct pw_client_node_transport *transport;
+	int fds[2];			/**< signal input side, signal output side */
+};
+
 struct impl {
 	struct pw_client_node this;
 
 	bool client_reuse;
+	bool client_direct;		/**< client can be linked directly to its peer */
 
 	struct pw_core *core;
 	struct pw_type *t;
@@ -126,6 +152,7 @@ struct impl {
 	struct proxy proxy;
 
 	struct pw_client_node_transport *transport;
+	bool transport_sent;		/**< the client has the transport */
 
 	struct spa_hook node_listener;
 	struct spa_hook resource_listener;
@@ -135,6 +162,9 @@ struct impl {
 
 	uint32_t input_ready;
 	bool out_pending;
+
+	struct spa_list port_list;
+	struct spa_list peer_list;
 };
 
 /** \endcond */
@@ -197,12 +227,26 @@ static int spa_proxy_node_set_param(struct spa_node *node, uint32_t id, uint32_t
 	return SPA_RESULT_RETURN_ASYNC(this->seq++);
 }
 
-static inline void do_flush(struct proxy *this)
+static inline void do_wakeup(struct proxy *this)
 {
 	uint64_t cmd = 1;
+
+	/* the client reads the transport before it sleeps */
+	if (!pw_client_node_transport_need_wakeup(this->impl->transport))
+		return;
+
 	if (write(this->writefd, &cmd, 8) != 8)
 		spa_log_warn(this->log, "proxy %p: error flushing : %s", this, strerror(errno));
+}
 
+static inline void do_flush(struct proxy *this)
+{
+	/* all messages of the cycle are sent with one wakeup, right before
+	 * the data loop sleeps */
+	if (this->hooked)
+		__atomic_store_n(&this->flush_pending, true, __ATOMIC_RELEASE);
+	else
+		do_wakeup(this);
 }
 
 static int spa_proxy_node_send_command(struct spa_node *node, const struct spa_command *command)
@@ -304,6 +348,55 @@ spa_proxy_node_get_port_ids(struct spa_node *node,
 	return 0;
 }
 
+/* the io areas are only allocated for the ports that exist, the transport
+ * grows when ports are added later */
+static void setup_transport(struct impl *impl)
+{
+	struct proxy *this = &impl->proxy;
+	uint32_t i, n_inputs = 0, n_outputs = 0;
+
+	for (i = 0; i < MAX_INPUTS; i++)
+		if (this->in_ports[i].valid)
+			n_inputs = i + 1;
+	for (i = 0; i < MAX_OUTPUTS; i++)
+		if (this->out_ports[i].valid)
+			n_outputs = i + 1;
+
+	impl->transport = pw_client_node_transport_new(n_inputs, n_outputs);
+	impl->transport->area->n_input_ports = this->n_inputs;
+	impl->transport->area->n_output_ports = this->n_outputs;
+}
+
+static void grow_transport(struct impl *impl, enum spa_direction direction, uint32_t port_id)
+{
+	struct pw_client_node_transport *segment;
+	uint32_t max_inputs, max_outputs, n_inputs = 0, n_outputs = 0;
+
+	if (impl->transport == NULL)
+		return;
+
+	pw_client_node_transport_get_max_ports(impl->transport, &max_inputs, &max_outputs);
+
+	/* double the io areas so that adding many ports does not grow
+	 * the transport for each of them */
+	if (direction == SPA_DIRECTION_INPUT && port_id >= max_inputs)
+		n_inputs = SPA_MIN(SPA_MAX(port_id + 1, max_inputs * 2), MAX_INPUTS) - max_inputs;
+	else if (direction == SPA_DIRECTION_OUTPUT && port_id >= max_outputs)
+		n_outputs = SPA_MIN(SPA_MAX(port_id + 1, max_outputs * 2), MAX_OUTPUTS) - max_outputs;
+	else
+		return;
+
+	pw_log_debug("client-node %p: grow transport with %u %u ports", impl, n_inputs, n_outputs);
+
+	segment = pw_client_node_transport_grow(impl->transport, n_inputs, n_outputs);
+	if (segment == NULL) {
+		pw_log_error("client-node %p: can't grow transport: %m", impl);
+		return;
+	}
+	if (impl->transport_sent)
+		pw_client_node_resource_transport_segment(impl->this.resource, segment);
+}
+
 static void
 do_update_port(struct proxy *this,
 	       enum spa_direction direction,
@@ -349,6 +442,8 @@ do_update_port(struct proxy *this,
 			this->n_inputs++;
 		else
 			this->n_outputs++;
+
+		grow_transport(this->impl, direction, port_id);
 	}
 }
 
@@ -631,6 +726,10 @@ spa_proxy_node_port_use_buffers(struct spa_node *node,
 		mb[i].offset = SPA_PTRDIFF(baseptr, m->ptr + m->offset);
 		mb[i].size = data_size;
 
+		/* the client keeps its mapping of the fd, the block can't be
+		 * handed out again by the pool */
+		m->flags &= ~PW_MEMBLOCK_FLAG_POOL;
+
 		pw_client_node_resource_add_mem(this->resource,
 						mb[i].mem_id,
 						t->data.MemFd,
@@ -772,7 +871,7 @@ static int spa_proxy_node_process_input(struct spa_node *node)
 			struct spa_io_buffers *io = p->io;
 
 			pw_log_trace("set io status to %d %d", io->status, io->buffer_id);
-			impl->transport->inputs[p->port_id] = *io;
+			*pw_client_node_transport_get_input(impl->transport, p->port_id) = *io;
 
 			/* explicitly recycle buffers when the client is not going to do it */
 			if (!client_reuse && (pp = p->peer))
@@ -807,12 +906,13 @@ static int spa_proxy_node_process_output(struct spa_node *node)
 
 	spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
 		struct spa_io_buffers *io = p->io;
+		struct spa_io_buffers *tio;
 
-		impl->transport->outputs[p->port_id] = *io;
+		tio = pw_client_node_transport_get_output(impl->transport, p->port_id);
+		*tio = *io;
 
 		pw_log_trace("%d %d -> %d %d", io->status, io->buffer_id,
-				impl->transport->outputs[p->port_id].status,
-				impl->transport->outputs[p->port_id].buffer_id);
+				tio->status, tio->buffer_id);
 	}
 
       done:
@@ -834,7 +934,7 @@ static int handle_node_message(struct proxy *this, struct pw_client_node_message
 	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
 	case PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT:
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_OUTPUT], link) {
-			*p->io = impl->transport->outputs[p->port_id];
+			*p->io = *pw_client_node_transport_get_output(impl->transport, p->port_id);
 			pw_log_trace("have output %d %d", p->io->status, p->io->buffer_id);
 		}
 		impl->out_pending = false;
@@ -843,7 +943,7 @@ static int handle_node_message(struct proxy *this, struct pw_client_node_message
 
 	case PW_CLIENT_NODE_MESSAGE_NEED_INPUT:
 		spa_list_for_each(p, &n->ports[SPA_DIRECTION_INPUT], link) {
-			*p->io = impl->transport->inputs[p->port_id];
+			*p->io = *pw_client_node_transport_get_input(impl->transport, p->port_id);
 			pw_log_trace("need input %d %d", p->io->status, p->io->buffer_id);
 		}
 		impl->input_ready++;
@@ -866,17 +966,6 @@ static int handle_node_message(struct proxy *this, struct pw_client_node_message
 	return 0;
 }
 
-static void setup_transport(struct impl *impl)
-{
-	uint32_t max_inputs = 0, max_outputs = 0, n_inputs = 0, n_outputs = 0;
-
-	spa_node_get_n_ports(&impl->proxy.node, &n_inputs, &max_inputs, &n_outputs, &max_outputs);
-
-	impl->transport = pw_client_node_transport_new(max_inputs, max_outputs);
-	impl->transport->area->n_input_ports = n_inputs;
-	impl->transport->area->n_output_ports = n_outputs;
-}
-
 static void
 client_node_done(void *data, int seq, int res)
 {
@@ -979,10 +1068,19 @@ static struct pw_client_node_proxy_methods client_node_methods = {
 	.destroy = client_node_destroy,
 };
 
+static void proxy_on_message(void *data, struct pw_client_node_message *message)
+{
+	handle_node_message(data, message);
+}
+
+static void proxy_read_messages(struct proxy *this)
+{
+	pw_client_node_transport_read_messages(this->impl->transport, proxy_on_message, this);
+}
+
 static void proxy_on_data_fd_events(struct spa_source *source)
 {
 	struct proxy *this = source->data;
-	struct impl *impl = this->impl;
 
 	if (source->rmask & (SPA_IO_ERR | SPA_IO_HUP)) {
 		spa_log_warn(this->log, "proxy %p: got error", this);
@@ -990,21 +1088,67 @@ static void proxy_on_data_fd_events(struct spa_source *source)
 	}
 
 	if (source->rmask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
 
 		if (read(this->data_source.fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			spa_log_warn(this->log, "proxy %p: error reading message: %s",
 					this, strerror(errno));
 
-		while (pw_client_node_transport_next_message(impl->transport, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->transport, msg);
-			handle_node_message(this, msg);
-		}
+		proxy_read_messages(this);
 	}
 }
 
+static void proxy_flush_pending(struct proxy *this)
+{
+	if (__atomic_exchange_n(&this->flush_pending, false, __ATOMIC_ACQ_REL))
+		do_wakeup(this);
+}
+
+static void proxy_loop_before(void *data)
+{
+	struct proxy *this = data;
+
+	proxy_flush_pending(this);
+
+	/* the client signals us from now on, read what it sent while
+	 * we were awake, that can start new cycles */
+	pw_client_node_transport_set_awake(this->impl->transport, false);
+	proxy_read_messages(this);
+
+	proxy_flush_pending(this);
+}
+
+static void proxy_loop_after(void *data)
+{
+	struct proxy *this = data;
+	pw_client_node_transport_set_awake(this->impl->transport, true);
+}
+
+static const struct spa_loop_control_hooks proxy_loop_hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.before = proxy_loop_before,
+	.after = proxy_loop_after,
+};
+
+static int
+do_add_hook(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	pw_loop_add_hook(impl->this.node->data_loop, &impl->proxy.loop_hook,
+			 &proxy_loop_hooks, &impl->proxy);
+	return 0;
+}
+
+static int
+do_remove_hook(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct impl *impl = user_data;
+	spa_hook_remove(&impl->proxy.loop_hook);
+	return 0;
+}
+
 static const struct spa_node proxy_node = {
 	SPA_VERSION_NODE,
 	NULL,
@@ -1092,6 +1236,10 @@ static void client_node_resource_destroy(void *data)
 
 	if (proxy->data_source.fd != -1)
 		spa_loop_remove_source(proxy->data_loop, &proxy->data_source);
+	if (proxy->hooked) {
+		pw_loop_invoke(this->node->data_loop, do_remove_hook, 1, NULL, 0, false, impl);
+		proxy->hooked = false;
+	}
 
 	pw_node_destroy(this->node);
 }
@@ -1102,6 +1250,7 @@ static void node_initialized(void *data)
 	struct impl *impl = data;
 	struct pw_client_node *this = &impl->this;
 	struct pw_node *node = this->node;
+	struct pw_client_node_transport *segment;
 
 	if (this->resource == NULL)
 		return;
@@ -1116,11 +1265,233 @@ static void node_initialized(void *data)
 	spa_loop_add_source(impl->proxy.data_loop, &impl->proxy.data_source);
 	pw_log_debug("client-node %p: transport fd %d %d", node, impl->fds[0], impl->fds[1]);
 
+	pw_loop_invoke(node->data_loop, do_add_hook, 1, NULL, 0, false, impl);
+	impl->proxy.hooked = true;
+
 	pw_client_node_resource_transport(this->resource,
 					  pw_global_get_id(pw_node_get_global(node)),
 					  impl->other_fds[0],
 					  impl->other_fds[1],
 					  impl->transport);
+	/* ports added since the transport was made */
+	for (segment = impl->transport->next; segment; segment = segment->next)
+		pw_client_node_resource_transport_segment(this->resource, segment);
+	impl->transport_sent = true;
+}
+
+static struct impl *get_client_node(struct pw_node *node)
+{
+	struct proxy *proxy;
+
+	if (node->node == NULL || node->node->process_input != spa_proxy_node_process_input)
+		return NULL;
+
+	proxy = SPA_CONTAINER_OF(node->node, struct proxy, node);
+	return proxy->impl;
+}
+
+static struct peer_link *find_peer_link(struct pw_link *link)
+{
+	struct impl *impl;
+	struct peer_link *pl;
+
+	if ((impl = get_client_node(link->output->node)) == NULL)
+		return NULL;
+
+	spa_list_for_each(pl, &impl->peer_list, peer_link) {
+		if (pl->link == link)
+			return pl;
+	}
+	return NULL;
+}
+
+static void peer_link_deactivate(struct peer_link *pl)
+{
+	struct pw_link *link = pl->link;
+
+	if (pl->transport == NULL)
+		return;
+
+	pw_log_debug("client-node %p: remove direct link %p", pl->impl, link);
+
+	if (pl->impl->this.resource)
+		pw_client_node_resource_port_peer(pl->impl->this.resource,
+						  SPA_DIRECTION_OUTPUT, link->output->port_id,
+						  -1, -1, NULL);
+	if (pl->peer->this.resource)
+		pw_client_node_resource_port_peer(pl->peer->this.resource,
+						  SPA_DIRECTION_INPUT, link->input->port_id,
+						  -1, -1, NULL);
+
+	pw_client_node_transport_destroy(pl->transport);
+	pl->transport = NULL;
+	close(pl->fds[0]);
+	close(pl->fds[1]);
+	pl->fds[0] = pl->fds[1] = -1;
+}
+
+static void peer_link_activate(struct peer_link *pl)
+{
+	struct pw_link *link = pl->link;
+
+	if (pl->transport != NULL)
+		return;
+
+	if ((pl->transport = pw_client_node_transport_new(1, 1)) == NULL)
+		return;
+
+	pl->fds[0] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	pl->fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (pl->fds[0] == -1 || pl->fds[1] == -1)
+		goto no_fds;
+
+	pw_log_debug("client-node %p: direct link %p to %p, fds %d %d", pl->impl, link,
+		     pl->peer, pl->fds[0], pl->fds[1]);
+
+	pw_client_node_resource_port_peer(pl->impl->this.resource,
+					  SPA_DIRECTION_OUTPUT, link->output->port_id,
+					  pl->fds[1], pl->fds[0], pl->transport);
+	pw_client_node_resource_port_peer(pl->peer->this.resource,
+					  SPA_DIRECTION_INPUT, link->input->port_id,
+					  pl->fds[0], pl->fds[1], pl->transport);
+	return;
+
+      no_fds:
+	/* the data keeps going through the server */
+	pw_log_error("client-node %p: can't create eventfd for direct link: %m", pl->impl);
+	if (pl->fds[0] != -1)
+		close(pl->fds[0]);
+	if (pl->fds[1] != -1)
+		close(pl->fds[1]);
+	pl->fds[0] = pl->fds[1] = -1;
+	pw_client_node_transport_destroy(pl->transport);
+	pl->transport = NULL;
+}
+
+static inline bool has_one_link(struct spa_list *links)
+{
+	return !spa_list_is_empty(links) && links->next == links->prev;
+}
+
+static void peer_link_update(struct peer_link *pl)
+{
+	struct pw_link *link = pl->link;
+
+	if (link->state >= PW_LINK_STATE_PAUSED &&
+	    pl->impl->this.resource != NULL &&
+	    pl->peer->this.resource != NULL &&
+	    has_one_link(&link->output->links) &&
+	    has_one_link(&link->input->links))
+		peer_link_activate(pl);
+	else
+		peer_link_deactivate(pl);
+}
+
+static void
+peer_link_state_changed(void *data, enum pw_link_state old,
+			enum pw_link_state state, const char *error)
+{
+	peer_link_update(data);
+}
+
+static void peer_link_destroy(void *data)
+{
+	struct peer_link *pl = data;
+
+	peer_link_deactivate(pl);
+	spa_hook_remove(&pl->link_listener);
+	spa_list_remove(&pl->peer_link);
+	free(pl);
+}
+
+static const struct pw_link_events peer_link_events = {
+	PW_VERSION_LINK_EVENTS,
+	.destroy = peer_link_destroy,
+	.state_changed = peer_link_state_changed,
+};
+
+static void update_port_links(struct pw_port *port)
+{
+	struct pw_link *link;
+	struct peer_link *pl;
+
+	if (port->direction == PW_DIRECTION_OUTPUT) {
+		spa_list_for_each(link, &port->links, output_link)
+			if ((pl = find_peer_link(link)))
+				peer_link_update(pl);
+	} else {
+		spa_list_for_each(link, &port->links, input_link)
+			if ((pl = find_peer_link(link)))
+				peer_link_update(pl);
+	}
+}
+
+static void port_link_added(void *data, struct pw_link *link)
+{
+	struct port_data *pd = data;
+	struct impl *impl = pd->impl;
+	struct impl *peer;
+	struct peer_link *pl;
+
+	if (pd->port->direction == PW_DIRECTION_OUTPUT &&
+	    impl->client_direct &&
+	    (peer = get_client_node(link->input->node)) != NULL &&
+	    peer->client_direct) {
+		pl = calloc(1, sizeof(struct peer_link));
+		if (pl != NULL) {
+			pl->impl = impl;
+			pl->peer = peer;
+			pl->link = link;
+			pl->fds[0] = pl->fds[1] = -1;
+			spa_list_append(&impl->peer_list, &pl->peer_link);
+			pw_link_add_listener(link, &pl->link_listener, &peer_link_events, pl);
+		}
+	}
+	/* an extra link on the port means the data has to go through the
+	 * server again */
+	update_port_links(pd->port);
+}
+
+static void port_link_removed(void *data, struct pw_link *link)
+{
+	struct port_data *pd = data;
+	update_port_links(pd->port);
+}
+
+static const struct pw_port_events port_events = {
+	PW_VERSION_PORT_EVENTS,
+	.link_added = port_link_added,
+	.link_removed = port_link_removed,
+};
+
+static void node_port_added(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct port_data *pd;
+
+	pd = calloc(1, sizeof(struct port_data));
+	if (pd == NULL)
+		return;
+
+	pd->impl = impl;
+	pd->port = port;
+	spa_list_append(&impl->port_list, &pd->link);
+	pw_port_add_listener(port, &pd->port_listener, &port_events, pd);
+}
+
+static void node_port_removed(void *data, struct pw_port *port)
+{
+	struct impl *impl = data;
+	struct port_data *pd;
+
+	spa_list_for_each(pd, &impl->port_list, link) {
+		if (pd->port == port) {
+			spa_hook_remove(&pd->port_listener);
+			spa_list_remove(&pd->link);
+			free(pd);
+			break;
+		}
+	}
 }
 
 static void node_free(void *data)
@@ -1146,6 +1517,8 @@ static const struct pw_node_events node_events = {
 	PW_VERSION_NODE_EVENTS,
 	.free = node_free,
 	.initialized = node_initialized,
+	.port_added = node_port_added,
+	.port_removed = node_port_removed,
 };
 
 static const struct pw_resource_events resource_events = {
@@ -1185,9 +1558,11 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	impl->core = core;
 	impl->t = pw_core_get_type(core);
 	impl->fds[0] = impl->fds[1] = -1;
+	spa_list_init(&impl->port_list);
+	spa_list_init(&impl->peer_list);
 	pw_log_debug("client-node %p: new", impl);
 
-	support = pw_core_get_support(impl->core, &n_support);
+	support = pw_core_get_node_support(impl->core, properties, &n_support);
 
 	proxy_init(&impl->proxy, NULL, support, n_support);
 	impl->proxy.impl = impl;
@@ -1207,6 +1582,9 @@ struct pw_client_node *pw_client_node_new(struct pw_resource *resource,
 	str = pw_properties_get(properties, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
 
+	str = pw_properties_get(properties, "pipewire.client.direct");
+	impl->client_direct = str && pw_properties_parse_bool(str);
+
 	pw_resource_add_listener(this->resource,
 				 &impl->resource_listener,
 				 &resource_events,
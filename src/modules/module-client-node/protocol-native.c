@@ -208,6 +208,33 @@ static int client_node_demarshal_transport(void *object, void *data, size_t size
 	return 0;
 }
 
+static int client_node_demarshal_transport_segment(void *object, void *data, size_t size)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_parser prs;
+	uint32_t memfd_idx;
+	struct pw_client_node_transport_info info;
+	struct pw_client_node_transport *segment;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &memfd_idx,
+			"i", &info.offset,
+			"i", &info.size, NULL) < 0)
+		return -EINVAL;
+
+	info.memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+	if (info.memfd == -1)
+		return -EINVAL;
+
+	if ((segment = pw_client_node_transport_new_from_info(&info)) == NULL)
+		return -errno;
+
+	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, transport_segment, segment);
+	return 0;
+}
+
 static int client_node_demarshal_set_param(void *object, void *data, size_t size)
 {
 	struct pw_proxy *proxy = object;
@@ -429,6 +456,46 @@ static int client_node_demarshal_port_set_io(void *object, void *data, size_t si
 	return 0;
 }
 
+static int client_node_demarshal_port_peer(void *object, void *data, size_t size)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_parser prs;
+	uint32_t direction, port_id, ridx, widx, memfd_idx;
+	int readfd = -1, writefd = -1;
+	struct pw_client_node_transport_info info;
+	struct pw_client_node_transport *transport = NULL;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &direction,
+			"i", &port_id,
+			"i", &ridx,
+			"i", &widx,
+			"i", &memfd_idx,
+			"i", &info.offset,
+			"i", &info.size, NULL) < 0)
+		return -EINVAL;
+
+	if (memfd_idx != SPA_ID_INVALID) {
+		readfd = pw_protocol_native_get_proxy_fd(proxy, ridx);
+		writefd = pw_protocol_native_get_proxy_fd(proxy, widx);
+		info.memfd = pw_protocol_native_get_proxy_fd(proxy, memfd_idx);
+
+		if (readfd == -1 || writefd == -1 || info.memfd == -1)
+			return -EINVAL;
+
+		transport = pw_client_node_transport_new_peer(&info, direction);
+		if (transport == NULL)
+			return -errno;
+	}
+
+	pw_proxy_notify(proxy, struct pw_client_node_proxy_events, port_peer,
+							direction, port_id,
+							readfd, writefd, transport);
+	return 0;
+}
+
 static void
 client_node_marshal_add_mem(void *object,
 			    uint32_t mem_id,
@@ -471,6 +538,25 @@ static void client_node_marshal_transport(void *object, uint32_t node_id, int re
 	pw_protocol_native_end_resource(resource, b);
 }
 
+static void client_node_marshal_transport_segment(void *object,
+						  struct pw_client_node_transport *segment)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_builder *b;
+	struct pw_client_node_transport_info info;
+
+	pw_client_node_transport_get_info(segment, &info);
+
+	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_NODE_PROXY_EVENT_TRANSPORT_SEGMENT);
+
+	spa_pod_builder_struct(b,
+			       "i", pw_protocol_native_add_resource_fd(resource, info.memfd),
+			       "i", info.offset,
+			       "i", info.size);
+
+	pw_protocol_native_end_resource(resource, b);
+}
+
 static void
 client_node_marshal_set_param(void *object, uint32_t seq, uint32_t id, uint32_t flags,
 			      const struct spa_pod *param)
@@ -671,6 +757,40 @@ client_node_marshal_port_set_io(void *object,
 	pw_protocol_native_end_resource(resource, b);
 }
 
+static void
+client_node_marshal_port_peer(void *object,
+			      enum spa_direction direction,
+			      uint32_t port_id,
+			      int readfd,
+			      int writefd,
+			      struct pw_client_node_transport *transport)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_builder *b;
+	struct pw_client_node_transport_info info = { -1, 0, 0 };
+	uint32_t ridx = SPA_ID_INVALID, widx = SPA_ID_INVALID, memfd_idx = SPA_ID_INVALID;
+
+	b = pw_protocol_native_begin_resource(resource, PW_CLIENT_NODE_PROXY_EVENT_PORT_PEER);
+
+	if (transport) {
+		pw_client_node_transport_get_info(transport, &info);
+		ridx = pw_protocol_native_add_resource_fd(resource, readfd);
+		widx = pw_protocol_native_add_resource_fd(resource, writefd);
+		memfd_idx = pw_protocol_native_add_resource_fd(resource, info.memfd);
+	}
+
+	spa_pod_builder_struct(b,
+			       "i", direction,
+			       "i", port_id,
+			       "i", ridx,
+			       "i", widx,
+			       "i", memfd_idx,
+			       "i", info.offset,
+			       "i", info.size);
+
+	pw_protocol_native_end_resource(resource, b);
+}
+
 
 static int client_node_demarshal_done(void *object, void *data, size_t size)
 {
@@ -842,6 +962,8 @@ static const struct pw_client_node_proxy_events pw_protocol_native_client_node_e
 	&client_node_marshal_port_use_buffers,
 	&client_node_marshal_port_command,
 	&client_node_marshal_port_set_io,
+	&client_node_marshal_port_peer,
+	&client_node_marshal_transport_segment,
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_event_demarshal[] = {
@@ -856,6 +978,8 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_client_node_
 	{ &client_node_demarshal_port_use_buffers, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_command, PW_PROTOCOL_NATIVE_REMAP },
 	{ &client_node_demarshal_port_set_io, PW_PROTOCOL_NATIVE_REMAP },
+	{ &client_node_demarshal_port_peer, 0 },
+	{ &client_node_demarshal_transport_segment, 0 },
 };
 
 static const struct pw_protocol_marshal pw_protocol_native_client_node_marshal = {
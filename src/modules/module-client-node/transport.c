@@ -30,8 +30,8 @@
 
 /** \cond */
 
-#define INPUT_BUFFER_SIZE       (1<<12)
-#define OUTPUT_BUFFER_SIZE      (1<<12)
+#define MIN_RING_SIZE		(1<<12)
+#define RING_SIZE_PER_PORT	(1<<7)	/* a reuse_buffer message for two cycles */
 
 struct transport {
 	struct pw_client_node_transport trans;
@@ -39,21 +39,65 @@ struct transport {
 	struct pw_memblock *mem;
 	size_t offset;
 
+	uint32_t index;			/**< index of the segment */
+	bool client;			/**< client view with swapped ringbuffers */
+
+	struct transport *in_seg;	/**< segment of the input ringbuffer */
+	uint32_t in_size;
+	struct transport *out_seg;	/**< segment of the output ringbuffer */
+	uint32_t out_size;
+	uint32_t out_target;		/**< index of the segment to write to */
+
 	struct pw_client_node_message current;
 	uint32_t current_index;
 };
 /** \endcond */
 
+static uint32_t ring_size_for_ports(uint32_t n_ports)
+{
+	uint32_t size = MIN_RING_SIZE;
+
+	while (size < n_ports * RING_SIZE_PER_PORT)
+		size <<= 1;
+	return size;
+}
+
+/* the indexes of the ringbuffers are on separate cache lines, the data is
+ * copied with the spa_ringbuffer functions that don't use the indexes */
+static inline int32_t ring_get_read_index(struct pw_client_node_ring *ring, uint32_t *index)
+{
+	*index = __atomic_load_n(&ring->readindex, __ATOMIC_RELAXED);
+	return (int32_t) (__atomic_load_n(&ring->writeindex, __ATOMIC_ACQUIRE) - *index);
+}
+
+static inline void ring_read_update(struct pw_client_node_ring *ring, uint32_t index)
+{
+	__atomic_store_n(&ring->readindex, index, __ATOMIC_RELEASE);
+}
+
+static inline int32_t ring_get_write_index(struct pw_client_node_ring *ring, uint32_t *index)
+{
+	*index = __atomic_load_n(&ring->writeindex, __ATOMIC_RELAXED);
+	return (int32_t) (*index - __atomic_load_n(&ring->readindex, __ATOMIC_ACQUIRE));
+}
+
+static inline void ring_write_update(struct pw_client_node_ring *ring, uint32_t index)
+{
+	__atomic_store_n(&ring->writeindex, index, __ATOMIC_RELEASE);
+}
+
 static size_t area_get_size(struct pw_client_node_area *area)
 {
 	size_t size;
 	size = sizeof(struct pw_client_node_area);
-	size += area->max_input_ports * sizeof(struct spa_io_buffers);
-	size += area->max_output_ports * sizeof(struct spa_io_buffers);
-	size += sizeof(struct spa_ringbuffer);
-	size += INPUT_BUFFER_SIZE;
-	size += sizeof(struct spa_ringbuffer);
-	size += OUTPUT_BUFFER_SIZE;
+	size += area->max_input_ports * sizeof(struct pw_client_node_port_io);
+	size += area->max_output_ports * sizeof(struct pw_client_node_port_io);
+	if (area->ring_size > 0) {
+		size += sizeof(struct pw_client_node_ring);
+		size += area->ring_size;
+		size += sizeof(struct pw_client_node_ring);
+		size += area->ring_size;
+	}
 	return size;
 }
 
@@ -62,25 +106,52 @@ static void transport_setup_area(void *p, struct pw_client_node_transport *trans
 	struct pw_client_node_area *a;
 
 	trans->area = a = p;
-	p = SPA_MEMBER(p, sizeof(struct pw_client_node_area), struct spa_io_buffers);
+	trans->activation = &a->activation[0];
+	trans->peer_activation = &a->activation[1];
+	p = SPA_MEMBER(p, sizeof(struct pw_client_node_area), void);
 
 	trans->inputs = p;
-	p = SPA_MEMBER(p, a->max_input_ports * sizeof(struct spa_io_buffers), void);
+	p = SPA_MEMBER(p, a->max_input_ports * sizeof(struct pw_client_node_port_io), void);
 
 	trans->outputs = p;
-	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct spa_io_buffers), void);
+	p = SPA_MEMBER(p, a->max_output_ports * sizeof(struct pw_client_node_port_io), void);
+
+	if (a->ring_size == 0)
+		return;
 
 	trans->input_buffer = p;
-	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
+	p = SPA_MEMBER(p, sizeof(struct pw_client_node_ring), void);
 
 	trans->input_data = p;
-	p = SPA_MEMBER(p, INPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, a->ring_size, void);
 
 	trans->output_buffer = p;
-	p = SPA_MEMBER(p, sizeof(struct spa_ringbuffer), void);
+	p = SPA_MEMBER(p, sizeof(struct pw_client_node_ring), void);
 
 	trans->output_data = p;
-	p = SPA_MEMBER(p, OUTPUT_BUFFER_SIZE, void);
+	p = SPA_MEMBER(p, a->ring_size, void);
+}
+
+static void transport_setup_rings(struct transport *impl)
+{
+	struct pw_client_node_transport *trans = &impl->trans;
+	void *tmp;
+
+	if (impl->client) {
+		tmp = trans->output_buffer;
+		trans->output_buffer = trans->input_buffer;
+		trans->input_buffer = tmp;
+
+		tmp = trans->output_data;
+		trans->output_data = trans->input_data;
+		trans->input_data = tmp;
+
+		tmp = trans->peer_activation;
+		trans->peer_activation = trans->activation;
+		trans->activation = tmp;
+	}
+	impl->in_seg = impl->out_seg = impl;
+	impl->in_size = impl->out_size = trans->area->ring_size;
 }
 
 static void transport_reset_area(struct pw_client_node_transport *trans)
@@ -89,15 +160,19 @@ static void transport_reset_area(struct pw_client_node_transport *trans)
 	struct pw_client_node_area *a = trans->area;
 
 	for (i = 0; i < a->max_input_ports; i++) {
-		trans->inputs[i].status = SPA_STATUS_OK;
-		trans->inputs[i].buffer_id = SPA_ID_INVALID;
+		trans->inputs[i].io.status = SPA_STATUS_OK;
+		trans->inputs[i].io.buffer_id = SPA_ID_INVALID;
 	}
 	for (i = 0; i < a->max_output_ports; i++) {
-		trans->outputs[i].status = SPA_STATUS_OK;
-		trans->outputs[i].buffer_id = SPA_ID_INVALID;
+		trans->outputs[i].io.status = SPA_STATUS_OK;
+		trans->outputs[i].io.buffer_id = SPA_ID_INVALID;
+	}
+	if (a->ring_size > 0) {
+		trans->input_buffer->readindex = trans->input_buffer->writeindex = 0;
+		trans->output_buffer->readindex = trans->output_buffer->writeindex = 0;
 	}
-	spa_ringbuffer_init(trans->input_buffer);
-	spa_ringbuffer_init(trans->output_buffer);
+	a->activation[0].state = PW_CLIENT_NODE_ACTIVATION_SLEEPING;
+	a->activation[1].state = PW_CLIENT_NODE_ACTIVATION_SLEEPING;
 }
 
 static void destroy(struct pw_client_node_transport *trans)
@@ -106,33 +181,137 @@ static void destroy(struct pw_client_node_transport *trans)
 
 	pw_log_debug("transport %p: destroy", trans);
 
+	if (trans->next)
+		destroy(trans->next);
+
 	pw_memblock_free(impl->mem);
 	free(impl);
 }
 
-static int add_message(struct pw_client_node_transport *trans, struct pw_client_node_message *message)
+/* the next segment with ringbuffers */
+static struct transport *next_ring_segment(struct transport *seg)
 {
-	struct transport *impl = (struct transport *) trans;
+	struct pw_client_node_transport *t = &seg->trans;
+
+	while ((t = __atomic_load_n(&t->next, __ATOMIC_ACQUIRE)) != NULL) {
+		if (t->area->ring_size > 0)
+			return (struct transport *) t;
+	}
+	return NULL;
+}
+
+static int write_message(struct transport *impl, struct pw_client_node_message *message)
+{
+	struct pw_client_node_transport *trans = &impl->trans;
 	int32_t filled, avail;
 	uint32_t size, index;
 
-	if (impl == NULL || message == NULL)
-		return -EINVAL;
-
-	filled = spa_ringbuffer_get_write_index(trans->output_buffer, &index);
-	avail = OUTPUT_BUFFER_SIZE - filled;
+	filled = ring_get_write_index(trans->output_buffer, &index);
+	avail = impl->out_size - filled;
 	size = SPA_POD_SIZE(message);
 	if (avail < size)
 		return -ENOSPC;
 
-	spa_ringbuffer_write_data(trans->output_buffer,
-				  trans->output_data, OUTPUT_BUFFER_SIZE,
-				  index & (OUTPUT_BUFFER_SIZE - 1), message, size);
-	spa_ringbuffer_write_update(trans->output_buffer, index + size);
+	spa_ringbuffer_write_data(NULL,
+				  trans->output_data, impl->out_size,
+				  index & (impl->out_size - 1), message, size);
+	ring_write_update(trans->output_buffer, index + size);
 
 	return 0;
 }
 
+/* move the output to the segments up to out_target, the reader follows
+ * when it reads the switch message */
+static int switch_output(struct transport *impl)
+{
+	struct pw_client_node_transport *trans = &impl->trans;
+	struct transport *seg;
+	int res;
+
+	while (impl->out_seg->index < impl->out_target) {
+		if ((seg = next_ring_segment(impl->out_seg)) == NULL ||
+		    seg->index > impl->out_target)
+			break;
+
+		if ((res = write_message(impl,
+				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_SWITCH))) < 0)
+			return res;
+
+		pw_log_debug("transport %p: output to segment %u", impl, seg->index);
+
+		impl->out_seg = seg;
+		impl->out_size = seg->trans.area->ring_size;
+		trans->output_buffer = seg->trans.output_buffer;
+		trans->output_data = seg->trans.output_data;
+	}
+	return 0;
+}
+
+static void switch_input(struct transport *impl)
+{
+	struct pw_client_node_transport *trans = &impl->trans;
+	struct transport *seg;
+
+	if ((seg = next_ring_segment(impl->in_seg)) == NULL) {
+		pw_log_warn("transport %p: switch to unknown segment", impl);
+		return;
+	}
+	pw_log_debug("transport %p: input from segment %u", impl, seg->index);
+
+	impl->in_seg = seg;
+	impl->in_size = seg->trans.area->ring_size;
+	trans->input_buffer = seg->trans.input_buffer;
+	trans->input_data = seg->trans.input_data;
+
+	/* follow with our output once the peer switched */
+	if (impl->out_target < seg->index) {
+		impl->out_target = seg->index;
+		switch_output(impl);
+	}
+}
+
+static int add_segment(struct pw_client_node_transport *trans,
+		       struct pw_client_node_transport *segment)
+{
+	struct transport *impl = (struct transport *) trans;
+	struct transport *seg = (struct transport *) segment;
+	struct pw_client_node_transport *t;
+
+	if (impl == NULL || seg == NULL)
+		return -EINVAL;
+
+	for (t = trans; t->next; t = t->next);
+
+	seg->index = ((struct transport *) t)->index + 1;
+	__atomic_store_n(&t->next, segment, __ATOMIC_RELEASE);
+
+	pw_log_debug("transport %p: add segment %u %p, %u %u ports, ring %u", impl,
+		     seg->index, seg, segment->area->max_input_ports,
+		     segment->area->max_output_ports, segment->area->ring_size);
+
+	/* the client switches right away, the server when it reads the
+	 * switch message of the client */
+	if (impl->client && segment->area->ring_size > 0) {
+		impl->out_target = seg->index;
+		return switch_output(impl);
+	}
+	return 0;
+}
+
+static int add_message(struct pw_client_node_transport *trans, struct pw_client_node_message *message)
+{
+	struct transport *impl = (struct transport *) trans;
+
+	if (impl == NULL || message == NULL)
+		return -EINVAL;
+
+	/* a switch that did not fit in the old ringbuffer */
+	if (SPA_UNLIKELY(impl->out_seg->index < impl->out_target))
+		switch_output(impl);
+
+	return write_message(impl, message);
+}
+
 static int next_message(struct pw_client_node_transport *trans, struct pw_client_node_message *message)
 {
 	struct transport *impl = (struct transport *) trans;
@@ -141,13 +320,13 @@ static int next_message(struct pw_client_node_transport *trans, struct pw_client
 	if (impl == NULL || message == NULL)
 		return -EINVAL;
 
-	avail = spa_ringbuffer_get_read_index(trans->input_buffer, &impl->current_index);
+	avail = ring_get_read_index(trans->input_buffer, &impl->current_index);
 	if (avail < sizeof(struct pw_client_node_message))
 		return 0;
 
-	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1),
+	spa_ringbuffer_read_data(NULL,
+				 trans->input_data, impl->in_size,
+				 impl->current_index & (impl->in_size - 1),
 				 &impl->current, sizeof(struct pw_client_node_message));
 
 	if (avail < SPA_POD_SIZE(&impl->current))
@@ -168,37 +347,105 @@ static int parse_message(struct pw_client_node_transport *trans, void *message)
 
 	size = SPA_POD_SIZE(&impl->current);
 
-	spa_ringbuffer_read_data(trans->input_buffer,
-				 trans->input_data, INPUT_BUFFER_SIZE,
-				 impl->current_index & (INPUT_BUFFER_SIZE - 1), message, size);
-	spa_ringbuffer_read_update(trans->input_buffer, impl->current_index + size);
+	spa_ringbuffer_read_data(NULL,
+				 trans->input_data, impl->in_size,
+				 impl->current_index & (impl->in_size - 1), message, size);
+	ring_read_update(trans->input_buffer, impl->current_index + size);
 
 	return 0;
 }
 
-/** Create a new transport
- * \param max_input_ports maximum number of input_ports
- * \param max_output_ports maximum number of output_ports
- * \return a newly allocated \ref pw_client_node_transport
- * \memberof pw_client_node_transport
- */
-struct pw_client_node_transport *
-pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+static int read_messages(struct pw_client_node_transport *trans,
+			 pw_client_node_message_func_t func, void *data)
+{
+	struct transport *impl = (struct transport *) trans;
+	struct pw_client_node_message *message, header;
+	int32_t avail;
+	uint32_t index, offset, size, ring_size;
+	int count = 0, n_read;
+
+	if (impl == NULL || func == NULL)
+		return -EINVAL;
+
+      again:
+	ring_size = impl->in_size;
+	avail = ring_get_read_index(trans->input_buffer, &index);
+	n_read = 0;
+
+	while (avail >= sizeof(struct pw_client_node_message)) {
+		offset = index & (ring_size - 1);
+
+		if (offset + sizeof(struct pw_client_node_message) <= ring_size) {
+			message = SPA_MEMBER(trans->input_data, offset, struct pw_client_node_message);
+		} else {
+			spa_ringbuffer_read_data(NULL,
+						 trans->input_data, ring_size,
+						 offset, &header, sizeof(header));
+			message = &header;
+		}
+		size = SPA_POD_SIZE(message);
+		if (avail < size)
+			break;
+
+		index += size;
+		avail -= size;
+		n_read++;
+
+		if (PW_CLIENT_NODE_MESSAGE_TYPE(message) == PW_CLIENT_NODE_MESSAGE_SWITCH) {
+			/* the rest is in the ringbuffer of the next segment */
+			ring_read_update(trans->input_buffer, index);
+			switch_input(impl);
+			goto again;
+		}
+
+		/* only messages that wrap around are copied */
+		if (offset + size > ring_size) {
+			message = alloca(size);
+			spa_ringbuffer_read_data(NULL,
+						 trans->input_data, ring_size,
+						 offset, message, size);
+		}
+		func(data, message);
+		count++;
+	}
+	if (n_read > 0)
+		ring_read_update(trans->input_buffer, index);
+
+	return count;
+}
+
+static void transport_init(struct transport *impl)
+{
+	struct pw_client_node_transport *trans = &impl->trans;
+
+	trans->destroy = destroy;
+	trans->add_message = add_message;
+	trans->next_message = next_message;
+	trans->parse_message = parse_message;
+	trans->read_messages = read_messages;
+	trans->add_segment = add_segment;
+}
+
+static struct transport *
+transport_new(uint32_t max_input_ports, uint32_t max_output_ports, uint32_t ring_size)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
 	struct pw_client_node_area area = { 0 };
 
+	area.version = PW_CLIENT_NODE_AREA_VERSION;
 	area.max_input_ports = max_input_ports;
 	area.n_input_ports = 0;
 	area.max_output_ports = max_output_ports;
 	area.n_output_ports = 0;
+	area.ring_size = ring_size;
 
 	impl = calloc(1, sizeof(struct transport));
 	if (impl == NULL)
 		return NULL;
 
-	pw_log_debug("transport %p: new %d %d", impl, max_input_ports, max_output_ports);
+	pw_log_debug("transport %p: new %d %d, ring %d", impl, max_input_ports,
+		     max_output_ports, ring_size);
 
 	trans = &impl->trans;
 	impl->offset = 0;
@@ -207,27 +454,88 @@ pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports
 			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
 			  PW_MEMBLOCK_FLAG_SEAL,
 			  area_get_size(&area),
-			  &impl->mem) < 0)
+			  &impl->mem) < 0) {
+		free(impl);
 		return NULL;
+	}
 
 	memcpy(impl->mem->ptr, &area, sizeof(struct pw_client_node_area));
 	transport_setup_area(impl->mem->ptr, trans);
 	transport_reset_area(trans);
+	transport_setup_rings(impl);
+	transport_init(impl);
 
-	trans->destroy = destroy;
-	trans->add_message = add_message;
-	trans->next_message = next_message;
-	trans->parse_message = parse_message;
+	return impl;
+}
 
-	return trans;
+/** Create a new transport
+ * \param max_input_ports maximum number of input_ports
+ * \param max_output_ports maximum number of output_ports
+ * \return a newly allocated \ref pw_client_node_transport
+ *
+ * The ringbuffers are sized for the number of ports, use
+ * \ref pw_client_node_transport_grow() to make room for more ports later.
+ *
+ * \memberof pw_client_node_transport
+ */
+struct pw_client_node_transport *
+pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports)
+{
+	struct transport *impl;
+
+	impl = transport_new(max_input_ports, max_output_ports,
+			     ring_size_for_ports(max_input_ports + max_output_ports));
+	return impl ? &impl->trans : NULL;
 }
 
+/** Grow a transport
+ * \param trans the transport to grow
+ * \param n_input_ports number of input ports to add
+ * \param n_output_ports number of output ports to add
+ * \return the new segment of \a trans or NULL on error
+ *
+ * Add a segment with the io areas of \a n_input_ports and \a n_output_ports
+ * after the existing ports. When the ringbuffers are too small for the new
+ * number of ports, the segment also holds larger ringbuffers. The existing
+ * io areas stay where they are.
+ *
+ * The segment is owned by \a trans and should be passed to the client, the
+ * new ringbuffers are used after the client switched to them.
+ *
+ * \memberof pw_client_node_transport
+ */
 struct pw_client_node_transport *
-pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info)
+pw_client_node_transport_grow(struct pw_client_node_transport *trans,
+			      uint32_t n_input_ports, uint32_t n_output_ports)
+{
+	struct transport *impl = (struct transport *) trans, *seg;
+	struct pw_client_node_transport *t;
+	uint32_t max_input_ports, max_output_ports, ring_size, last_size = 0;
+
+	pw_client_node_transport_get_max_ports(trans, &max_input_ports, &max_output_ports);
+
+	for (t = trans; t; t = t->next)
+		if (t->area->ring_size > 0)
+			last_size = t->area->ring_size;
+
+	ring_size = ring_size_for_ports(max_input_ports + n_input_ports +
+					max_output_ports + n_output_ports);
+	if (ring_size <= last_size)
+		ring_size = 0;
+
+	if ((seg = transport_new(n_input_ports, n_output_ports, ring_size)) == NULL)
+		return NULL;
+
+	add_segment(&impl->trans, &seg->trans);
+
+	return &seg->trans;
+}
+
+static struct pw_client_node_transport *
+transport_new_from_info(struct pw_client_node_transport_info *info, bool swap)
 {
 	struct transport *impl;
 	struct pw_client_node_transport *trans;
-	void *tmp;
 	int res;
 
 	impl = calloc(1, sizeof(struct transport));
@@ -248,30 +556,54 @@ pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *inf
 	}
 
 	impl->offset = info->offset;
+	impl->client = swap;
 
-	transport_setup_area(impl->mem->ptr, trans);
-
-	tmp = trans->output_buffer;
-	trans->output_buffer = trans->input_buffer;
-	trans->input_buffer = tmp;
-
-	tmp = trans->output_data;
-	trans->output_data = trans->input_data;
-	trans->input_data = tmp;
+	if (info->size < sizeof(struct pw_client_node_area) ||
+	    ((struct pw_client_node_area *) impl->mem->ptr)->version != PW_CLIENT_NODE_AREA_VERSION) {
+		pw_log_error("transport %p: unsupported transport layout", impl);
+		res = -EPROTO;
+		goto version_mismatch;
+	}
 
-	trans->destroy = destroy;
-	trans->add_message = add_message;
-	trans->next_message = next_message;
-	trans->parse_message = parse_message;
+	transport_setup_area(impl->mem->ptr, trans);
+	transport_setup_rings(impl);
+	transport_init(impl);
 
 	return trans;
 
+      version_mismatch:
+	pw_memblock_free(impl->mem);
       mmap_failed:
 	free(impl);
 	errno = -res;
 	return NULL;
 }
 
+struct pw_client_node_transport *
+pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info)
+{
+	return transport_new_from_info(info, true);
+}
+
+/** Map a transport shared between two linked clients
+ * \param info the transport info
+ * \param direction the direction of the port using the transport
+ * \return a newly allocated \ref pw_client_node_transport
+ *
+ * The output side uses the transport as it was allocated, the input
+ * side sees the ringbuffers swapped so that the messages written by
+ * one end are read by the other. The io area of the link is the first
+ * output io of the transport.
+ *
+ * \memberof pw_client_node_transport
+ */
+struct pw_client_node_transport *
+pw_client_node_transport_new_peer(struct pw_client_node_transport_info *info,
+				  enum spa_direction direction)
+{
+	return transport_new_from_info(info, direction == SPA_DIRECTION_INPUT);
+}
+
 /** Get transport info
  * \param trans the transport to get info of
  * \param[out] info transport info
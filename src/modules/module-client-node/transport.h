@@ -40,9 +40,17 @@ struct pw_client_node_transport_info {
 struct pw_client_node_transport *
 pw_client_node_transport_new(uint32_t max_input_ports, uint32_t max_output_ports);
 
+struct pw_client_node_transport *
+pw_client_node_transport_grow(struct pw_client_node_transport *trans,
+			      uint32_t n_input_ports, uint32_t n_output_ports);
+
 struct pw_client_node_transport *
 pw_client_node_transport_new_from_info(struct pw_client_node_transport_info *info);
 
+struct pw_client_node_transport *
+pw_client_node_transport_new_peer(struct pw_client_node_transport_info *info,
+				  enum spa_direction direction);
+
 int
 pw_client_node_transport_get_info(struct pw_client_node_transport *trans,
 				  struct pw_client_node_transport_info *info);
@@ -21,6 +21,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <sys/stat.h>
@@ -75,6 +76,7 @@ struct client {
 
         bool disconnecting;
 	bool flush_signaled;
+	bool blocked;		/**< waiting for the socket to become writable */
         struct spa_source *flush_event;
 };
 
@@ -88,34 +90,39 @@ struct server {
 	struct pw_loop *loop;
 	struct spa_source *source;
 	struct spa_hook hook;
+
+	struct spa_list flush_list;	/**< clients with queued messages */
 };
 
 struct client_data {
+	struct server *server;
 	struct pw_client *client;
 	struct spa_hook client_listener;
 	struct spa_source *source;
 	struct pw_protocol_native_connection *connection;
+	struct spa_hook conn_listener;
+	struct spa_list flush_link;
+	bool flush_pending;
+	bool blocked;		/**< waiting for the socket to become writable */
 	bool busy;
 };
 
-static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_map *types)
+/* messages of peers that use our type ids are not remapped at all, see
+ * struct pw_type_remap */
+static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_type_remap *types)
 {
-	void *t;
-
 	switch (type) {
 	case SPA_POD_TYPE_ID:
-		if ((t = pw_map_lookup(types, *(int32_t *) body)) == NULL)
+		if (!pw_type_remap_id(types, (uint32_t *) body))
 			return false;
-		*(int32_t *) body = PW_MAP_PTR_TO_ID(t);
 		break;
 
 	case SPA_POD_TYPE_PROP:
 	{
 		struct spa_pod_prop_body *b = body;
 
-		if ((t = pw_map_lookup(types, b->key)) == NULL)
+		if (!pw_type_remap_id(types, &b->key))
 			return false;
-		b->key = PW_MAP_PTR_TO_ID(t);
 
 		if (b->value.type == SPA_POD_TYPE_ID) {
 			void *alt;
@@ -134,14 +141,11 @@ static bool pod_remap_data(uint32_t type, void *body, uint32_t size, struct pw_m
 		struct spa_pod_object_body *b = body;
 		struct spa_pod *p;
 
-		if ((t = pw_map_lookup(types, b->id)) != NULL)
-			b->id = PW_MAP_PTR_TO_ID(t);
-		else
+		if (!pw_type_remap_id(types, &b->id))
 			b->id = SPA_ID_INVALID;
 
-		if ((t = pw_map_lookup(types, b->type)) == NULL)
+		if (!pw_type_remap_id(types, &b->type))
 			return false;
-		b->type = PW_MAP_PTR_TO_ID(t);
 
 		SPA_POD_OBJECT_BODY_FOREACH(b, size, p)
 			if (!pod_remap_data(p->type, SPA_POD_BODY(p), p->size, types))
@@ -218,7 +222,7 @@ process_messages(struct client_data *data)
 			continue;
 		}
 
-		if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP)
+		if ((demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP) && !client->types.identity)
 			if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &client->types))
 				goto invalid_message;
 
@@ -241,20 +245,51 @@ process_messages(struct client_data *data)
 	goto done;
 }
 
+static void update_io_mask(struct client_data *c)
+{
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (!c->busy)
+		mask |= SPA_IO_IN;
+	if (c->blocked)
+		mask |= SPA_IO_OUT;
+
+	pw_loop_update_io(c->client->core->main_loop, c->source, mask);
+}
+
+static void flush_client(struct client_data *c)
+{
+	int res;
+
+	if (c->flush_pending) {
+		spa_list_remove(&c->flush_link);
+		c->flush_pending = false;
+	}
+
+	res = pw_protocol_native_connection_flush(c->connection);
+	if (res == -EAGAIN) {
+		if (!c->blocked) {
+			pw_log_debug("protocol-native %p: client %p blocked",
+				     c->client->protocol, c->client);
+			c->blocked = true;
+			update_io_mask(c);
+		}
+	} else if (c->blocked) {
+		c->blocked = false;
+		update_io_mask(c);
+	}
+}
+
 static void
 client_busy_changed(void *data, bool busy)
 {
 	struct client_data *c = data;
 	struct pw_client *client = c->client;
-	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
 
 	c->busy = busy;
 
-	if (!busy)
-		mask |= SPA_IO_IN;
-
 	pw_log_debug("protocol-native %p: busy changed %d", client->protocol, busy);
-	pw_loop_update_io(client->core->main_loop, c->source, mask);
+	update_io_mask(c);
 
 	if (!busy)
 		process_messages(c);
@@ -273,6 +308,9 @@ connection_data(void *data, int fd, enum spa_io mask)
 		return;
 	}
 
+	if (mask & SPA_IO_OUT)
+		flush_client(this);
+
 	if (mask & SPA_IO_IN)
 		process_messages(this);
 }
@@ -281,9 +319,17 @@ static void client_free(void *data)
 {
 	struct client_data *this = data;
 	struct pw_client *client = this->client;
+	struct pw_protocol_native_connection_stats *stats = &this->connection->stats;
 
 	pw_loop_destroy_source(client->protocol->core->main_loop, this->source);
 	spa_list_remove(&client->protocol_link);
+	if (this->flush_pending)
+		spa_list_remove(&this->flush_link);
+
+	pw_log_debug("protocol-native %p: client %p out %"PRIu64" messages %"PRIu64" bytes "
+		     "%"PRIu64" writes, in %"PRIu64" messages %"PRIu64" bytes %"PRIu64" reads",
+		     client->protocol, client, stats->messages_out, stats->bytes_out,
+		     stats->writes, stats->messages_in, stats->bytes_in, stats->reads);
 
 	pw_protocol_native_connection_destroy(this->connection);
 }
@@ -294,6 +340,23 @@ static const struct pw_client_events client_events = {
 	.busy_changed = client_busy_changed,
 };
 
+/* queued messages are written for all clients at once before the loop
+ * goes to sleep, see on_before_hook() */
+static void client_need_flush(void *data)
+{
+	struct client_data *c = data;
+
+	if (!c->flush_pending && !c->blocked) {
+		c->flush_pending = true;
+		spa_list_append(&c->server->flush_list, &c->flush_link);
+	}
+}
+
+static const struct pw_protocol_native_connection_events client_conn_events = {
+	PW_VERSION_PROTOCOL_NATIVE_CONNECTION_EVENTS,
+	.need_flush = client_need_flush,
+};
+
 static struct pw_client *client_new(struct server *s, int fd)
 {
 	struct client_data *this;
@@ -325,6 +388,7 @@ static struct pw_client *client_new(struct server *s, int fd)
 		goto no_client;
 
 	this = pw_client_get_user_data(client);
+	this->server = s;
 	this->client = client;
 	this->source = pw_loop_add_io(pw_core_get_main_loop(core),
 				      fd, SPA_IO_ERR | SPA_IO_HUP, true, connection_data, this);
@@ -335,6 +399,11 @@ static struct pw_client *client_new(struct server *s, int fd)
 	if (this->connection == NULL)
 		goto no_connection;
 
+	pw_protocol_native_connection_add_listener(this->connection,
+						   &this->conn_listener,
+						   &client_conn_events,
+						   this);
+
 	client->protocol = protocol;
 	spa_list_append(&s->this.client_list, &client->protocol_link);
 
@@ -547,6 +616,29 @@ static int impl_steal_fd(struct pw_protocol_client *client)
 	return fd;
 }
 
+static void flush_remote(struct client *impl)
+{
+	struct pw_remote *remote = impl->this.remote;
+	int res;
+	bool blocked;
+
+	if (impl->connection == NULL)
+		return;
+
+	res = pw_protocol_native_connection_flush(impl->connection);
+	if (res < 0 && res != -EAGAIN) {
+		impl->this.disconnect(&impl->this);
+		return;
+	}
+	blocked = res == -EAGAIN;
+	if (blocked != impl->blocked && impl->source) {
+		impl->blocked = blocked;
+		pw_loop_update_io(remote->core->main_loop, impl->source,
+				  SPA_IO_IN | SPA_IO_HUP | SPA_IO_ERR |
+				  (blocked ? SPA_IO_OUT : 0));
+	}
+}
+
 static void
 on_remote_data(void *data, int fd, enum spa_io mask)
 {
@@ -563,6 +655,9 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 		return;
         }
 
+	if (mask & SPA_IO_OUT)
+		flush_remote(impl);
+
         if (mask & SPA_IO_IN) {
                 uint8_t opcode;
                 uint32_t id;
@@ -598,7 +693,8 @@ on_remote_data(void *data, int fd, enum spa_io mask)
 				continue;
 			}
 
-			if (demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP) {
+			if ((demarshal[opcode].flags & PW_PROTOCOL_NATIVE_REMAP) &&
+			    !this->types.identity) {
 				if (!pod_remap_data(SPA_POD_TYPE_STRUCT, message, size, &this->types)) {
                                         pw_log_error
                                             ("protocol-native %p: invalid message received %u for %u", this,
@@ -620,9 +716,7 @@ static void do_flush_event(void *data, uint64_t count)
 {
         struct client *impl = data;
 	impl->flush_signaled = false;
-        if (impl->connection)
-                if (!pw_protocol_native_connection_flush(impl->connection))
-                        impl->this.disconnect(&impl->this);
+	flush_remote(impl);
 }
 
 static void on_need_flush(void *data)
@@ -630,7 +724,7 @@ static void on_need_flush(void *data)
         struct client *impl = data;
         struct pw_remote *remote = impl->this.remote;
 
-	if (!impl->flush_signaled) {
+	if (!impl->flush_signaled && !impl->blocked) {
 		impl->flush_signaled = true;
 		pw_loop_signal_event(remote->core->main_loop, impl->flush_event);
 	}
@@ -647,6 +741,7 @@ static int impl_connect_fd(struct pw_protocol_client *client, int fd)
 	struct pw_remote *remote = client->remote;
 
 	impl->disconnecting = false;
+	impl->blocked = false;
 
 	impl->connection = pw_protocol_native_connection_new(fd);
 	if (impl->connection == NULL)
@@ -755,14 +850,10 @@ static void destroy_server(struct pw_protocol_server *server)
 static void on_before_hook(void *_data)
 {
 	struct server *server = _data;
-	struct pw_protocol_server *this = &server->this;
-	struct pw_client *client, *tmp;
-	struct client_data *data;
+	struct client_data *data, *tmp;
 
-	spa_list_for_each_safe(client, tmp, &this->client_list, protocol_link) {
-		data = client->user_data;
-		pw_protocol_native_connection_flush(data->connection);
-	}
+	spa_list_for_each_safe(data, tmp, &server->flush_list, flush_link)
+		flush_client(data);
 }
 
 static const struct spa_loop_control_hooks impl_hooks = {
@@ -802,6 +893,7 @@ impl_add_server(struct pw_protocol *protocol,
 	this->protocol = protocol;
 	spa_list_init(&this->client_list);
 	this->destroy = destroy_server;
+	spa_list_init(&s->flush_list);
 
 	spa_list_append(&protocol->server_list, &this->link);
 
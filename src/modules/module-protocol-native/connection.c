@@ -23,7 +23,10 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <spa/lib/debug.h>
 
@@ -35,14 +38,38 @@
 #define MAX_BUFFER_SIZE (1024 * 32)
 #define MAX_FDS 28
 
+/* The fds of a connection are numbered in the order they are sent, the
+ * messages refer to them with this number. The fds of a sendmsg can arrive
+ * in the same recvmsg as the end of the previous sendmsg, or a partial
+ * write can leave messages that use fds that were already sent, so the
+ * receiver keeps the fds of the last two sendmsg calls. */
+#define FD_WINDOW 64
+#define FD_INDEX_MASK 0x7fffffff
+
+/* payloads larger than this are passed in a memfd that is sealed against
+ * writes, the message on the socket only has the index of the fd and the
+ * size */
+#define LARGE_MESSAGE_SIZE (1024 * 16)
+#define OPCODE_FLAG_LARGE (1 << 7)
+
+#ifndef F_GET_SEALS
+#define F_LINUX_SPECIFIC_BASE 1024
+#define F_GET_SEALS (F_LINUX_SPECIFIC_BASE + 10)
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_WRITE 0x0008
+#endif
+
 static bool debug_messages = 0;
 
 struct buffer {
 	uint8_t *buffer_data;
 	size_t buffer_size;
 	size_t buffer_maxsize;
-	int fds[MAX_FDS];
+	int fds[FD_WINDOW];
 	uint32_t n_fds;
+	uint32_t fd_base;		/**< number of fds[0] */
+	struct pw_memblock *large[MAX_FDS];	/**< memfds of large messages */
+	uint32_t n_large;
 
 	off_t offset;
 	void *data;
@@ -59,10 +86,22 @@ struct impl {
 	uint32_t dest_id;
 	uint8_t opcode;
 	struct spa_pod_builder builder;
+	struct pw_memblock *large;	/**< memfd of the message being built */
+
+	void *in_map;			/**< mapping of the current large message */
+	size_t in_map_size;
 };
 
 /** \endcond */
 
+static int *find_in_fd(struct buffer *buf, uint32_t index)
+{
+	if (((index - buf->fd_base) & FD_INDEX_MASK) >= buf->n_fds)
+		return NULL;
+
+	return &buf->fds[index % FD_WINDOW];
+}
+
 /** Get an fd from a connection
  *
  * \param conn the connection
@@ -74,11 +113,12 @@ struct impl {
 int pw_protocol_native_connection_get_fd(struct pw_protocol_native_connection *conn, uint32_t index)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
+	int *fd;
 
-	if (index >= impl->in.n_fds)
+	if ((fd = find_in_fd(&impl->in, index)) == NULL)
 		return -1;
 
-	return impl->in.fds[index];
+	return *fd;
 }
 
 /** Add an fd to a connection
@@ -96,7 +136,7 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 
 	for (i = 0; i < impl->out.n_fds; i++) {
 		if (impl->out.fds[i] == fd)
-			return i;
+			return (impl->out.fd_base + i) & FD_INDEX_MASK;
 	}
 
 	index = impl->out.n_fds;
@@ -108,7 +148,7 @@ uint32_t pw_protocol_native_connection_add_fd(struct pw_protocol_native_connecti
 	impl->out.fds[index] = fd;
 	impl->out.n_fds++;
 
-	return index;
+	return (impl->out.fd_base + index) & FD_INDEX_MASK;
 }
 
 static void *connection_ensure_size(struct pw_protocol_native_connection *conn, struct buffer *buf, size_t size)
@@ -134,6 +174,8 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 	struct msghdr msg = { 0 };
 	struct iovec iov[1];
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	uint32_t i, n_fds = 0;
+	int *fds;
 
 	iov[0].iov_base = buf->buffer_data + buf->buffer_size;
 	iov[0].iov_len = buf->buffer_maxsize - buf->buffer_size;
@@ -145,28 +187,39 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 
 	while (true) {
 		len = recvmsg(conn->fd, &msg, msg.msg_flags);
+		conn->stats.reads++;
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
-			if (errno != EAGAIN || errno != EWOULDBLOCK)
-				goto recv_error;
+			/* the rest of the message comes later */
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return false;
+			goto recv_error;
 		}
 		break;
 	}
 
 	buf->buffer_size += len;
+	conn->stats.bytes_in += len;
 
-	/* handle control messages */
+	/* handle control messages, the new fds replace the oldest ones */
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
 		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
 			continue;
 
-		buf->n_fds =
-		    (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
-		memcpy(buf->fds, CMSG_DATA(cmsg), buf->n_fds * sizeof(int));
+		n_fds = (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
+		fds = (int *) CMSG_DATA(cmsg);
+		for (i = 0; i < n_fds; i++) {
+			if (buf->n_fds == FD_WINDOW) {
+				buf->fd_base = (buf->fd_base + 1) & FD_INDEX_MASK;
+				buf->n_fds--;
+			}
+			buf->fds[(buf->fd_base + buf->n_fds) % FD_WINDOW] = fds[i];
+			buf->n_fds++;
+		}
 	}
 	pw_log_trace("connection %p: %d read %zd bytes and %d fds", conn, conn->fd, len,
-		     buf->n_fds);
+		     n_fds);
 
 	return true;
 
@@ -176,9 +229,27 @@ static bool refill_buffer(struct pw_protocol_native_connection *conn, struct buf
 	return false;
 }
 
+static void free_large(struct buffer *buf)
+{
+	uint32_t i;
+
+	for (i = 0; i < buf->n_large; i++)
+		pw_memblock_free(buf->large[i]);
+	buf->n_large = 0;
+}
+
+static void unmap_large(struct impl *impl)
+{
+	if (impl->in_map) {
+		munmap(impl->in_map, impl->in_map_size);
+		impl->in_map = NULL;
+	}
+}
+
+/* the fds are kept, the next data can still use them */
 static void clear_buffer(struct buffer *buf)
 {
-	buf->n_fds = 0;
+	free_large(buf);
 	buf->offset = 0;
 	buf->size = 0;
 	buf->buffer_size = 0;
@@ -241,11 +312,51 @@ void pw_protocol_native_connection_destroy(struct pw_protocol_native_connection
 
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, destroy);
 
+	free_large(&impl->out);
+	if (impl->large)
+		pw_memblock_free(impl->large);
+	unmap_large(impl);
 	free(impl->out.buffer_data);
 	free(impl->in.buffer_data);
 	free(impl);
 }
 
+static void *map_large(struct impl *impl, uint32_t index, uint32_t size)
+{
+	struct pw_protocol_native_connection *conn = &impl->this;
+	struct stat st;
+	int fd, seals;
+	void *data;
+
+	if ((fd = pw_protocol_native_connection_get_fd(conn, index)) < 0) {
+		pw_log_error("connection %p: large message without fd %u", conn, index);
+		return NULL;
+	}
+	*find_in_fd(&impl->in, index) = -1;
+
+	/* the sender must not be able to shrink the memfd under our mapping
+	 * or change the message while we parse it */
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+	    fstat(fd, &st) < 0 || st.st_size < size) {
+		pw_log_error("connection %p: invalid memfd for large message", conn);
+		close(fd);
+		return NULL;
+	}
+
+	/* private, the receiver remaps the ids in the payload in place */
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		pw_log_error("connection %p: can't map large message: %m", conn);
+		return NULL;
+	}
+	impl->in_map = data;
+	impl->in_map_size = size;
+
+	return data;
+}
+
 /** Move to the next packet in the connection
  *
  * \param conn the connection
@@ -277,6 +388,7 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 
 	/* move to next packet */
 	buf->offset += buf->size;
+	unmap_large(impl);
 
       again:
 	if (buf->update) {
@@ -322,8 +434,17 @@ pw_protocol_native_connection_get_next(struct pw_protocol_native_connection *con
 	buf->data = data;
 	buf->offset += 8;
 
-	*dt = buf->data;
-	*sz = buf->size;
+	if (*opcode & OPCODE_FLAG_LARGE) {
+		*opcode &= ~OPCODE_FLAG_LARGE;
+		if (len < 8 || (data = map_large(impl, ((uint32_t *) data)[0],
+						 ((uint32_t *) data)[1])) == NULL)
+			return false;
+		len = impl->in_map_size;
+	}
+
+	*dt = data;
+	*sz = len;
+	conn->stats.messages_in++;
 
 	if (debug_messages) {
 		printf("<<<<<<<<< in: %d %d %zd\n", *dest_id, *opcode, len);
@@ -345,20 +466,60 @@ static inline void *begin_write(struct pw_protocol_native_connection *conn, uint
 	return p + 2;
 }
 
+/* continue the message in a memfd, \a used bytes are copied from \a data */
+static void *begin_write_large(struct impl *impl, void *data, uint32_t used, uint32_t size)
+{
+	struct pw_memblock *mem;
+
+	/* sealed with pw_memblock_seal() when the message is complete */
+	if (pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
+			      PW_MEMBLOCK_FLAG_MAP_READWRITE, size, &mem) < 0) {
+		spa_hook_list_call(&impl->this.listener_list,
+				   struct pw_protocol_native_connection_events, error, -ENOMEM);
+		return NULL;
+	}
+	if (used > 0)
+		memcpy(mem->ptr, data, used);
+	if (impl->large)
+		pw_memblock_free(impl->large);
+	impl->large = mem;
+
+	return mem->ptr;
+}
+
 static uint32_t write_pod(struct spa_pod_builder *b, const void *data, uint32_t size)
 {
 	struct impl *impl = SPA_CONTAINER_OF(b, struct impl, builder);
 	uint32_t ref = b->state.offset;
 
-        if (b->size <= ref) {
-                b->size = SPA_ROUND_UP_N(ref + size, 4096);
-                b->data = begin_write(&impl->this, b->size);
+	if (b->data == NULL && b->size > 0)
+		return ref;
+
+        if (ref + size > b->size) {
+		if (ref + size > LARGE_MESSAGE_SIZE) {
+			b->size = SPA_ROUND_UP_N((ref + size) * 2, 4096);
+			b->data = begin_write_large(impl, b->data, ref, b->size);
+		} else {
+			b->size = SPA_ROUND_UP_N(ref + size, 4096);
+			b->data = begin_write(&impl->this, b->size);
+		}
+		if (b->data == NULL)
+			return ref;
         }
         memcpy(b->data + ref, data, size);
 
         return ref;
 }
 
+static void reset_builder(struct impl *impl)
+{
+	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
+	if (impl->large) {
+		pw_memblock_free(impl->large);
+		impl->large = NULL;
+	}
+}
+
 struct spa_pod_builder *
 pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connection *conn,
 					     struct pw_resource *resource,
@@ -383,7 +544,7 @@ pw_protocol_native_connection_begin_resource(struct pw_protocol_native_connectio
 
 	impl->dest_id = resource->id;
 	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
+	reset_builder(impl);
 
 	return &impl->builder;
 }
@@ -412,7 +573,7 @@ pw_protocol_native_connection_begin_proxy(struct pw_protocol_native_connection *
 
 	impl->dest_id = proxy->id;
 	impl->opcode = opcode;
-	impl->builder = (struct spa_pod_builder) { NULL, 0, write_pod };
+	reset_builder(impl);
 
 	return &impl->builder;
 }
@@ -422,34 +583,75 @@ pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
 				  struct spa_pod_builder *builder)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
-	uint32_t *p, size = builder->state.offset;
+	uint32_t *p, size = builder->state.offset, index;
 	struct buffer *buf = &impl->out;
 
-	if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+	if (impl->large) {
+		if (buf->n_large < MAX_FDS && impl->out.n_fds < MAX_FDS &&
+		    connection_ensure_size(conn, buf, 16) != NULL) {
+			if (debug_messages) {
+				printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
+				spa_debug_pod((struct spa_pod *)impl->large->ptr, 0);
+			}
+			if (pw_memblock_seal(impl->large) < 0) {
+				pw_log_error("connection %p: can't seal large message: %m", conn);
+				spa_hook_list_call(&conn->listener_list,
+						   struct pw_protocol_native_connection_events, error, -EIO);
+				return;
+			}
+			index = pw_protocol_native_connection_add_fd(conn, impl->large->fd);
+
+			p = (uint32_t *) (buf->buffer_data + buf->buffer_size);
+			*p++ = impl->dest_id;
+			*p++ = ((impl->opcode | OPCODE_FLAG_LARGE) << 24) | 8;
+			p[0] = index;
+			p[1] = size;
+
+			buf->buffer_size += 16;
+			buf->large[buf->n_large++] = impl->large;
+			impl->large = NULL;
+			conn->stats.messages_large++;
+			conn->stats.messages_out++;
+			goto done;
+		}
+		/* no room for another fd, send it inline */
+		if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
+			return;
+		memcpy(p + 2, impl->large->ptr, size);
+		pw_memblock_free(impl->large);
+		impl->large = NULL;
+	}
+	else if ((p = connection_ensure_size(conn, buf, 8 + size)) == NULL)
 		return;
 
 	*p++ = impl->dest_id;
 	*p++ = (impl->opcode << 24) | (size & 0xffffff);
 
 	buf->buffer_size += 8 + size;
+	conn->stats.messages_out++;
 
 	if (debug_messages) {
 		printf(">>>>>>>>> out: %d %d %d\n", impl->dest_id, impl->opcode, size);
 	        spa_debug_pod((struct spa_pod *)p, 0);
 	}
+
+      done:
 	spa_hook_list_call(&conn->listener_list, struct pw_protocol_native_connection_events, need_flush);
 }
 
 /** Flush the connection object
  *
  * \param conn the connection object
- * \return true on success
+ * \return 0 when all messages were written, -EAGAIN when the socket is
+ *         full and messages are left, < 0 on other errors
  *
- * Write the queued messages on the connection to the socket
+ * Write the queued messages on the connection to the socket. When not
+ * everything could be written, the rest stays queued for the next flush,
+ * wait until the socket is writable before trying again.
  *
  * \memberof pw_protocol_native_connection
  */
-bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
+int pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn)
 {
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 	ssize_t len;
@@ -457,13 +659,13 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	struct iovec iov[1];
 	struct cmsghdr *cmsg;
 	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
-	int *cm, i, fds_len;
+	int *cm, i, fds_len, res;
 	struct buffer *buf;
 
 	buf = &impl->out;
 
 	if (buf->buffer_size == 0)
-		return true;
+		return 0;
 
 	fds_len = buf->n_fds * sizeof(int);
 
@@ -490,9 +692,12 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 
 	while (true) {
 		len = sendmsg(conn->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		conn->stats.writes++;
 		if (len < 0) {
 			if (errno == EINTR)
 				continue;
+			else if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return -EAGAIN;
 			else
 				goto send_error;
 		}
@@ -501,15 +706,26 @@ bool pw_protocol_native_connection_flush(struct pw_protocol_native_connection *c
 	pw_log_trace("connection %p: %d written %zd bytes and %u fds", conn, conn->fd, len,
 		     buf->n_fds);
 
+	conn->stats.bytes_out += len;
+
+	/* the fds went out with the first byte, keep the rest of the data. The
+	 * messages that are left still refer to the fds by their number. */
 	buf->buffer_size -= len;
+	buf->fd_base = (buf->fd_base + buf->n_fds) & FD_INDEX_MASK;
 	buf->n_fds = 0;
+	free_large(buf);
+	if (buf->buffer_size > 0) {
+		memmove(buf->buffer_data, buf->buffer_data + len, buf->buffer_size);
+		return -EAGAIN;
+	}
 
-	return true;
+	return 0;
 
 	/* ERRORS */
       send_error:
+	res = -errno;
 	pw_log_error("could not sendmsg: %s", strerror(errno));
-	return false;
+	return res;
 }
 
 /** Clear the connection object
@@ -526,6 +742,7 @@ bool pw_protocol_native_connection_clear(struct pw_protocol_native_connection *c
 	struct impl *impl = SPA_CONTAINER_OF(conn, struct impl, this);
 
 	clear_buffer(&impl->out);
+	impl->out.n_fds = 0;
 	clear_buffer(&impl->in);
 	impl->in.update = true;
 
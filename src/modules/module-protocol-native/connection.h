@@ -36,6 +36,17 @@ struct pw_protocol_native_connection_events {
 	void (*need_flush) (void *data);
 };
 
+/** Traffic counters of a connection */
+struct pw_protocol_native_connection_stats {
+	uint64_t bytes_out;		/**< bytes written to the socket */
+	uint64_t messages_out;		/**< messages queued for writing */
+	uint64_t messages_large;	/**< messages sent in a memfd */
+	uint64_t writes;		/**< sendmsg calls */
+	uint64_t bytes_in;		/**< bytes read from the socket */
+	uint64_t messages_in;		/**< messages read */
+	uint64_t reads;			/**< recvmsg calls */
+};
+
 /** \class pw_protocol_native_connection
  *
  * \brief Manages the connection between client and server
@@ -47,6 +58,8 @@ struct pw_protocol_native_connection {
 	int fd;	/**< the socket */
 
 	struct spa_hook_list listener_list;
+
+	struct pw_protocol_native_connection_stats stats;	/**< traffic counters */
 };
 
 static inline void
@@ -87,7 +100,7 @@ void
 pw_protocol_native_connection_end(struct pw_protocol_native_connection *conn,
                                   struct spa_pod_builder *builder);
 
-bool
+int
 pw_protocol_native_connection_flush(struct pw_protocol_native_connection *conn);
 
 bool
@@ -112,6 +112,34 @@ static void core_marshal_get_registry(void *object, uint32_t version, uint32_t n
 	pw_protocol_native_end_proxy(proxy, b);
 }
 
+static void core_marshal_get_registry_filtered(void *object, uint32_t version,
+					       const struct spa_dict *filter, uint32_t new_id)
+{
+	struct pw_proxy *proxy = object;
+	struct spa_pod_builder *b;
+	uint32_t i, n_items;
+
+	b = pw_protocol_native_begin_proxy(proxy, PW_CORE_PROXY_METHOD_GET_REGISTRY_FILTERED);
+
+	n_items = filter ? filter->n_items : 0;
+
+	spa_pod_builder_add(b,
+			    "["
+			    "i", version,
+			    "i", n_items, NULL);
+
+	for (i = 0; i < n_items; i++) {
+		spa_pod_builder_add(b,
+				    "s", filter->items[i].key,
+				    "s", filter->items[i].value, NULL);
+	}
+	spa_pod_builder_add(b,
+			    "i", new_id,
+			    "]", NULL);
+
+	pw_protocol_native_end_proxy(proxy, b);
+}
+
 static void
 core_marshal_create_object(void *object,
 			   const char *factory_name,
@@ -457,6 +485,34 @@ static int core_demarshal_get_registry(void *object, void *data, size_t size)
 	return 0;
 }
 
+static int core_demarshal_get_registry_filtered(void *object, void *data, size_t size)
+{
+	struct pw_resource *resource = object;
+	struct spa_pod_parser prs;
+	uint32_t version, new_id, i;
+	struct spa_dict filter;
+
+	spa_pod_parser_init(&prs, data, size, 0);
+	if (spa_pod_parser_get(&prs,
+			"["
+			"i", &version,
+			"i", &filter.n_items, NULL) < 0)
+		return -EINVAL;
+
+	filter.items = alloca(filter.n_items * sizeof(struct spa_dict_item));
+	for (i = 0; i < filter.n_items; i++) {
+		if (spa_pod_parser_get(&prs, "ss",
+					&filter.items[i].key, &filter.items[i].value, NULL) < 0)
+			return -EINVAL;
+	}
+	if (spa_pod_parser_get(&prs, "i", &new_id, NULL) < 0)
+		return -EINVAL;
+
+	pw_resource_do(resource, struct pw_core_proxy_methods, get_registry_filtered, version,
+		       &filter, new_id);
+	return 0;
+}
+
 static int core_demarshal_create_object(void *object, void *data, size_t size)
 {
 	struct pw_resource *resource = object;
@@ -979,7 +1035,8 @@ static const struct pw_core_proxy_methods pw_protocol_native_core_method_marshal
 	&core_marshal_get_registry,
 	&core_marshal_client_update,
 	&core_marshal_permissions,
-	&core_marshal_create_object
+	&core_marshal_create_object,
+	&core_marshal_get_registry_filtered
 };
 
 static const struct pw_protocol_native_demarshal pw_protocol_native_core_method_demarshal[PW_CORE_PROXY_METHOD_NUM] = {
@@ -989,7 +1046,8 @@ static const struct pw_protocol_native_demarshal pw_protocol_native_core_method_
 	{ &core_demarshal_get_registry, 0, },
 	{ &core_demarshal_client_update, 0, },
 	{ &core_demarshal_permissions, 0, },
-	{ &core_demarshal_create_object, PW_PROTOCOL_NATIVE_REMAP, }
+	{ &core_demarshal_create_object, PW_PROTOCOL_NATIVE_REMAP, },
+	{ &core_demarshal_get_registry_filtered, 0, }
 };
 
 static const struct pw_core_proxy_events pw_protocol_native_core_event_marshal = {
@@ -34,6 +34,7 @@
 #include <pipewire/log.h>
 #include <pipewire/type.h>
 #include <pipewire/node.h>
+#include <pipewire/private.h>
 
 #include "spa-monitor.h"
 #include "spa-node.h"
@@ -98,7 +99,10 @@ static void add_item(struct pw_spa_monitor *this, struct spa_pod *item)
 		}
 	}
 
-	support = pw_core_get_support(impl->core, &n_support);
+	if (pw_properties_get(props, "media.class") == NULL)
+		pw_properties_set(props, "media.class", klass);
+
+	support = pw_core_get_node_support(impl->core, props, &n_support);
 
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
@@ -137,16 +141,24 @@ static struct monitor_item *find_item(struct pw_spa_monitor *this, const char *i
 	return NULL;
 }
 
-void destroy_item(struct monitor_item *mitem)
+static void free_item(void *data)
 {
-	pw_node_destroy(mitem->node);
-	spa_list_remove(&mitem->link);
+	struct monitor_item *mitem = data;
+
 	spa_handle_clear(mitem->handle);
 	free(mitem->handle);
 	free(mitem->id);
 	free(mitem);
 }
 
+void destroy_item(struct impl *impl, struct monitor_item *mitem)
+{
+	pw_node_destroy(mitem->node);
+	spa_list_remove(&mitem->link);
+	/* the data loop can still run the node until it removed it */
+	pw_core_defer(impl->core, free_item, mitem);
+}
+
 static void remove_item(struct pw_spa_monitor *this, struct spa_pod *item)
 {
 	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
@@ -162,7 +174,7 @@ static void remove_item(struct pw_spa_monitor *this, struct spa_pod *item)
 	pw_log_debug("monitor %p: remove: \"%s\" (%s)", this, name, id);
 	mitem = find_item(this, id);
 	if (mitem)
-		destroy_item(mitem);
+		destroy_item(impl, mitem);
 }
 
 static void on_monitor_event(void *data, struct spa_event *event)
@@ -324,6 +336,14 @@ struct pw_spa_monitor *pw_spa_monitor_load(struct pw_core *core,
 
 }
 
+static void free_monitor(void *data)
+{
+	struct impl *impl = data;
+
+	dlclose(impl->hnd);
+	free(impl);
+}
+
 void pw_spa_monitor_destroy(struct pw_spa_monitor *monitor)
 {
 	struct impl *impl = SPA_CONTAINER_OF(monitor, struct impl, this);
@@ -332,7 +352,7 @@ void pw_spa_monitor_destroy(struct pw_spa_monitor *monitor)
 	pw_log_debug("spa-monitor %p: destroy", impl);
 
 	spa_list_for_each_safe(mitem, tmp, &impl->item_list, link)
-		destroy_item(mitem);
+		destroy_item(impl, mitem);
 
 	spa_handle_clear(monitor->handle);
 	free(monitor->handle);
@@ -340,6 +360,6 @@ void pw_spa_monitor_destroy(struct pw_spa_monitor *monitor)
 	free(monitor->factory_name);
 	free(monitor->system_name);
 
-	dlclose(impl->hnd);
-	free(impl);
+	/* the handles of the items are cleared later */
+	pw_core_defer(impl->core, free_monitor, impl);
 }
@@ -55,12 +55,9 @@ struct impl {
 	void *user_data;
 };
 
-static void pw_spa_node_destroy(void *data)
+static void pw_spa_node_free(void *data)
 {
 	struct impl *impl = data;
-	struct pw_node *node = impl->this;
-
-	pw_log_debug("spa-node %p: destroy", node);
 
 	if (impl->handle) {
 		spa_handle_clear(impl->handle);
@@ -72,6 +69,18 @@ static void pw_spa_node_destroy(void *data)
 		dlclose(impl->hnd);
 }
 
+static void pw_spa_node_destroy(void *data)
+{
+	struct impl *impl = data;
+	struct pw_node *node = impl->this;
+
+	pw_log_debug("spa-node %p: destroy", node);
+
+	/* the data loop can still run the node until it removed it, this
+	 * runs before the node memory is freed */
+	pw_core_defer(node->core, pw_spa_node_free, impl);
+}
+
 static void complete_init(struct impl *impl)
 {
         struct pw_node *this = impl->this;
@@ -275,7 +284,7 @@ struct pw_node *pw_spa_node_load(struct pw_core *core,
 			break;
 	}
 
-	support = pw_core_get_support(core, &n_support);
+	support = pw_core_get_node_support(core, properties, &n_support);
 
 	handle = calloc(1, factory->size);
 	if ((res = spa_handle_factory_init(factory,
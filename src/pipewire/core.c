@@ -20,6 +20,7 @@
 #include <unistd.h>
 #include <time.h>
 #include <stdio.h>
+#include <string.h>
 
 #define spa_debug pw_log_trace
 
@@ -33,13 +34,62 @@
 #include <pipewire/core.h>
 #include <pipewire/data-loop.h>
 
-#include <spa/graph/graph-scheduler6.h>
+#include <spa/graph/graph-scheduler7.h>
+
+#define DEFAULT_DATA_WORKERS	0
+#define DATA_WORKER_PRIORITY	20
 
 /** \cond */
+struct defer_item {
+	struct spa_list link;
+	uint32_t seq;			/**< sync that must be done before calling */
+	void (*func) (void *data);
+	void *data;
+};
+
+/** a data loop with the graph it runs */
+struct data_loop {
+	struct spa_list link;
+	struct impl *impl;
+	char *name;			/**< name of the loop, NULL for the default */
+	struct pw_data_loop *data_loop;
+	struct spa_graph graph;
+	struct spa_graph_data graph_data;
+	struct spa_support support[16];	/**< core support with this loop */
+	uint32_t defer_done;		/**< last sync done by this loop */
+};
+
+enum data_loop_policy {
+	DATA_LOOP_POLICY_SINGLE,
+	DATA_LOOP_POLICY_MEDIA_CLASS,
+};
+
+struct impl {
+	struct pw_core this;
+
+	struct spa_list data_loop_list;	/**< list of \ref data_loop */
+	struct data_loop *default_loop;
+	enum data_loop_policy policy;
+	uint32_t n_workers;
+
+	struct spa_list defer_list;	/**< pending \ref defer_item */
+	struct spa_source *defer_idle;	/**< queues a sync in the data loops */
+	struct spa_source *defer_event;	/**< signaled by the data loops */
+	uint32_t defer_seq;		/**< last queued sync */
+};
+
 struct resource_data {
 	struct spa_hook resource_listener;
 };
 
+struct registry_data {
+	struct spa_hook resource_listener;
+	uint32_t type;			/**< type of the globals or SPA_ID_INVALID */
+	uint32_t event_mask;		/**< mask of PW_REGISTRY_PROXY_EVENT_* */
+	struct pw_properties *props;	/**< properties of the globals or NULL */
+	struct pw_array matched;	/**< bitmap of the global ids that matched */
+};
+
 /** \endcond */
 
 static void registry_bind(void *object, uint32_t id,
@@ -91,7 +141,12 @@ static const struct pw_registry_proxy_methods registry_methods = {
 static void destroy_registry_resource(void *object)
 {
 	struct pw_resource *resource = object;
+	struct registry_data *data = pw_resource_get_user_data(resource);
+
 	spa_list_remove(&resource->link);
+	if (data->props)
+		pw_properties_free(data->props);
+	pw_array_clear(&data->matched);
 }
 
 static const struct pw_resource_events resource_events = {
@@ -99,6 +154,146 @@ static const struct pw_resource_events resource_events = {
 	.destroy = destroy_registry_resource
 };
 
+static uint32_t parse_registry_events(const char *str)
+{
+	const char *state = NULL, *s;
+	size_t len;
+	uint32_t mask = 0;
+
+	while ((s = pw_split_walk(str, ", ", &len, &state))) {
+		if (strncmp(s, "global", len) == 0 && len == strlen("global"))
+			mask |= 1 << PW_REGISTRY_PROXY_EVENT_GLOBAL;
+		else if (strncmp(s, "global-remove", len) == 0 && len == strlen("global-remove"))
+			mask |= 1 << PW_REGISTRY_PROXY_EVENT_GLOBAL_REMOVE;
+		else
+			pw_log_warn("registry: unknown filter event %.*s", (int) len, s);
+	}
+	return mask;
+}
+
+static int parse_registry_filter(struct pw_core *core, struct registry_data *data,
+				 const struct spa_dict *filter)
+{
+	uint32_t i;
+
+	data->type = SPA_ID_INVALID;
+	data->event_mask = (1 << PW_REGISTRY_PROXY_EVENT_NUM) - 1;
+	data->props = NULL;
+	pw_array_init(&data->matched, 64);
+
+	if (filter == NULL)
+		return 0;
+
+	for (i = 0; i < filter->n_items; i++) {
+		const char *key = filter->items[i].key, *value = filter->items[i].value;
+
+		if (strcmp(key, PW_REGISTRY_FILTER_TYPE) == 0) {
+			data->type = spa_type_map_get_id(core->type.map, value);
+		} else if (strcmp(key, PW_REGISTRY_FILTER_EVENTS) == 0) {
+			data->event_mask = parse_registry_events(value);
+		} else {
+			if (data->props == NULL &&
+			    (data->props = pw_properties_new(NULL, NULL)) == NULL)
+				return -ENOMEM;
+			pw_properties_set(data->props, key, value);
+		}
+	}
+	return 0;
+}
+
+static bool registry_filter_match(struct registry_data *data, struct pw_global *global)
+{
+	const struct spa_dict_item *item;
+	const char *value;
+
+	if (data->type != SPA_ID_INVALID && data->type != global->type)
+		return false;
+
+	if (data->props == NULL)
+		return true;
+
+	if (global->properties == NULL)
+		return false;
+
+	spa_dict_for_each(item, &data->props->dict) {
+		if ((value = pw_properties_get(global->properties, item->key)) == NULL ||
+		    strcmp(value, item->value) != 0)
+			return false;
+	}
+	return true;
+}
+
+static bool registry_get_matched(struct registry_data *data, uint32_t id)
+{
+	uint32_t idx = id / 32;
+
+	if (!pw_array_check_index(&data->matched, idx, uint32_t))
+		return false;
+
+	return (*pw_array_get_unchecked(&data->matched, idx, uint32_t) & (1u << (id & 31))) != 0;
+}
+
+static int registry_set_matched(struct registry_data *data, uint32_t id, bool matched)
+{
+	uint32_t idx = id / 32, *bits;
+	size_t len = pw_array_get_len(&data->matched, uint32_t);
+
+	if (idx >= len) {
+		if (!matched)
+			return 0;
+		if ((bits = pw_array_add(&data->matched, (idx + 1 - len) * sizeof(uint32_t))) == NULL)
+			return -ENOMEM;
+		memset(bits, 0, (idx + 1 - len) * sizeof(uint32_t));
+	}
+	bits = pw_array_get_unchecked(&data->matched, idx, uint32_t);
+	if (matched)
+		*bits |= 1u << (id & 31);
+	else
+		*bits &= ~(1u << (id & 31));
+	return 0;
+}
+
+/** Check if a registry wants an event of a global
+ * \param registry a registry resource
+ * \param global the global of the event
+ * \param event the event, PW_REGISTRY_PROXY_EVENT_GLOBAL or
+ *        PW_REGISTRY_PROXY_EVENT_GLOBAL_REMOVE
+ * \return true when the event should be sent to \a registry
+ *
+ * Check the filter of \a registry, the permissions should be checked
+ * separately. This must be called for every global that is added and
+ * removed, the global_remove event is only sent for globals that matched
+ * the filter when they were added.
+ *
+ * \memberof pw_core
+ */
+bool pw_core_registry_match(struct pw_resource *registry, struct pw_global *global, uint32_t event)
+{
+	struct registry_data *data = pw_resource_get_user_data(registry);
+	bool matched;
+
+	/* without a type or properties all globals match */
+	if (data->type == SPA_ID_INVALID && data->props == NULL)
+		return (data->event_mask & (1 << event)) != 0;
+
+	switch (event) {
+	case PW_REGISTRY_PROXY_EVENT_GLOBAL:
+		matched = registry_filter_match(data, global);
+		if (registry_set_matched(data, global->id, matched) < 0) {
+			pw_log_error("registry %p: can't record global %u", registry, global->id);
+			matched = false;
+		}
+		break;
+	case PW_REGISTRY_PROXY_EVENT_GLOBAL_REMOVE:
+		matched = registry_get_matched(data, global->id);
+		registry_set_matched(data, global->id, false);
+		break;
+	default:
+		return false;
+	}
+	return matched && (data->event_mask & (1 << event)) != 0;
+}
+
 static void core_hello(void *object)
 {
 	struct pw_resource *resource = object;
@@ -131,14 +326,15 @@ static void core_sync(void *object, uint32_t seq)
 	pw_core_resource_done(resource, seq);
 }
 
-static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
+static void core_get_registry_filtered(void *object, uint32_t version,
+				       const struct spa_dict *filter, uint32_t new_id)
 {
 	struct pw_resource *resource = object;
 	struct pw_client *client = resource->client;
 	struct pw_core *this = resource->core;
 	struct pw_global *global;
 	struct pw_resource *registry_resource;
-	struct resource_data *data;
+	struct registry_data *data;
 
 	registry_resource = pw_resource_new(client,
 					    new_id,
@@ -150,6 +346,11 @@ static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
 		goto no_mem;
 
 	data = pw_resource_get_user_data(registry_resource);
+	if (parse_registry_filter(this, data, filter) < 0) {
+		pw_resource_destroy(registry_resource);
+		goto no_mem;
+	}
+
 	pw_resource_add_listener(registry_resource,
 				 &data->resource_listener,
 				 &resource_events,
@@ -163,7 +364,9 @@ static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
 
 	spa_list_for_each(global, &this->global_list, link) {
 		uint32_t permissions = pw_global_get_permissions(global, client);
-		if (PW_PERM_IS_R(permissions)) {
+		if (pw_core_registry_match(registry_resource, global,
+					   PW_REGISTRY_PROXY_EVENT_GLOBAL) &&
+		    PW_PERM_IS_R(permissions)) {
 			pw_registry_resource_global(registry_resource,
 						    global->id,
 						    global->parent->id,
@@ -183,6 +386,11 @@ static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
 			       resource->id, -ENOMEM, "no memory");
 }
 
+static void core_get_registry(void *object, uint32_t version, uint32_t new_id)
+{
+	core_get_registry_filtered(object, version, NULL, new_id);
+}
+
 static void
 core_create_object(void *object,
 		   const char *factory_name,
@@ -252,13 +460,9 @@ static void core_update_types(void *object, uint32_t first_id, const char **type
 	struct pw_resource *resource = object;
 	struct pw_core *this = resource->core;
 	struct pw_client *client = resource->client;
-	int i;
 
-	for (i = 0; i < n_types; i++, first_id++) {
-		uint32_t this_id = spa_type_map_get_id(this->type.map, types[i]);
-		if (!pw_map_insert_at(&client->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
-			pw_log_error("can't add type for client");
-	}
+	if (pw_type_remap_update(&client->types, this->type.map, first_id, types, n_types) < 0)
+		pw_log_error("can't add type for client");
 }
 
 static const struct pw_core_proxy_methods core_methods = {
@@ -270,6 +474,7 @@ static const struct pw_core_proxy_methods core_methods = {
 	.client_update = core_client_update,
 	.permissions = core_permissions,
 	.create_object = core_create_object,
+	.get_registry_filtered = core_get_registry_filtered,
 };
 
 static void core_unbind_func(void *data)
@@ -319,6 +524,292 @@ core_bind_func(struct pw_global *global,
 	return -ENOMEM;
 }
 
+static uint32_t defer_done(struct impl *impl)
+{
+	struct data_loop *l;
+	uint32_t done = impl->defer_seq, d;
+
+	/* a sync is done when all loops did it */
+	spa_list_for_each(l, &impl->data_loop_list, link) {
+		d = __atomic_load_n(&l->defer_done, __ATOMIC_ACQUIRE);
+		if ((int32_t) (d - done) < 0)
+			done = d;
+	}
+	return done;
+}
+
+static void defer_flush(struct impl *impl, bool all)
+{
+	struct defer_item *item;
+	uint32_t done = defer_done(impl);
+
+	while (!spa_list_is_empty(&impl->defer_list)) {
+		item = spa_list_first(&impl->defer_list, struct defer_item, link);
+		if (!all && (int32_t) (done - item->seq) < 0)
+			break;
+		spa_list_remove(&item->link);
+		item->func(item->data);
+		free(item);
+	}
+}
+
+static int
+do_defer_sync(struct spa_loop *loop,
+	      bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct data_loop *l = user_data;
+	struct impl *impl = l->impl;
+
+	/* all updates queued before this sync are applied now */
+	__atomic_store_n(&l->defer_done, seq, __ATOMIC_RELEASE);
+	pw_loop_signal_event(impl->this.main_loop, impl->defer_event);
+
+	return 0;
+}
+
+static int
+do_defer_wait(struct spa_loop *loop,
+	      bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	return 0;
+}
+
+static void on_defer_event(void *data, uint64_t count)
+{
+	struct impl *impl = data;
+	defer_flush(impl, false);
+}
+
+static void on_defer_idle(void *data)
+{
+	struct impl *impl = data;
+	struct pw_core *this = &impl->this;
+	struct data_loop *l;
+	int res;
+
+	pw_loop_enable_idle(this->main_loop, impl->defer_idle, false);
+
+	/* one sync for all the items deferred in this iteration, loops that
+	 * already did it when we retry just do it again */
+	spa_list_for_each(l, &impl->data_loop_list, link) {
+		res = pw_loop_invoke(pw_data_loop_get_loop(l->data_loop), do_defer_sync,
+				     impl->defer_seq + 1, NULL, 0, false, l);
+		if (res < 0) {
+			pw_log_warn("core %p: can't queue sync: %s", this, spa_strerror(res));
+			pw_loop_enable_idle(this->main_loop, impl->defer_idle, true);
+			return;
+		}
+	}
+	impl->defer_seq++;
+}
+
+int pw_core_defer(struct pw_core *core, void (*func) (void *data), void *data)
+{
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
+	struct defer_item *item;
+	struct data_loop *l;
+
+	item = calloc(1, sizeof(struct defer_item));
+	if (item == NULL) {
+		/* wait for the data loops instead, keep the order */
+		spa_list_for_each(l, &impl->data_loop_list, link)
+			pw_loop_invoke(pw_data_loop_get_loop(l->data_loop),
+				       do_defer_wait, 0, NULL, 0, true, impl);
+		defer_flush(impl, true);
+		func(data);
+		return 0;
+	}
+
+	item->seq = impl->defer_seq + 1;
+	item->func = func;
+	item->data = data;
+	spa_list_append(&impl->defer_list, &item->link);
+
+	pw_loop_enable_idle(core->main_loop, impl->defer_idle, true);
+
+	return 0;
+}
+
+static struct data_loop *data_loop_new(struct impl *impl, const char *name)
+{
+	struct pw_core *this = &impl->this;
+	struct data_loop *l;
+	struct pw_properties *props;
+	const char *str;
+	char key[256];
+
+	l = calloc(1, sizeof(struct data_loop));
+	if (l == NULL)
+		return NULL;
+
+	l->impl = impl;
+	if (name == NULL) {
+		l->data_loop = pw_data_loop_new(this->properties);
+	} else {
+		l->name = strdup(name);
+		props = pw_properties_new(NULL, NULL);
+		if (props == NULL)
+			goto no_loop;
+		snprintf(key, sizeof(key), "pipewire.data-loop.%s.rt-prio", name);
+		if ((str = pw_properties_get(this->properties, key)) != NULL)
+			pw_properties_set(props, PW_DATA_LOOP_PROP_RT_PRIO, str);
+		snprintf(key, sizeof(key), "pipewire.data-loop.%s.affinity", name);
+		if ((str = pw_properties_get(this->properties, key)) != NULL)
+			pw_properties_set(props, PW_DATA_LOOP_PROP_AFFINITY, str);
+		l->data_loop = pw_data_loop_new(props);
+		pw_properties_free(props);
+	}
+	if (l->data_loop == NULL)
+		goto no_loop;
+
+	/* nodes in this loop get it as their data loop */
+	memcpy(l->support, this->support, sizeof(l->support));
+	l->support[1] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__DataLoop,
+					 pw_data_loop_get_loop(l->data_loop)->loop);
+
+	/* there is nothing to sync for the syncs queued before */
+	l->defer_done = impl->defer_seq;
+
+	spa_graph_init(&l->graph);
+	spa_graph_data_init(&l->graph_data, &l->graph);
+	spa_graph_set_callbacks(&l->graph, &spa_graph_impl_default, &l->graph_data);
+	if (spa_graph_data_start(&l->graph_data, impl->n_workers, DATA_WORKER_PRIORITY) < 0)
+		pw_log_warn("core %p: could not start %u data workers", this, impl->n_workers);
+
+	spa_list_append(&impl->data_loop_list, &l->link);
+
+	pw_log_debug("core %p: new data loop %p \"%s\"", this, l, name ? name : "default");
+
+	return l;
+
+      no_loop:
+	free(l->name);
+	free(l);
+	return NULL;
+}
+
+static void data_loop_free(struct data_loop *l)
+{
+	spa_list_remove(&l->link);
+	spa_graph_data_stop(&l->graph_data);
+	spa_graph_clear(&l->graph);
+	free(l->name);
+	free(l);
+}
+
+/* get the name of the loop for a node with the given properties, NULL
+ * is the default loop */
+static const char *
+data_loop_name(struct impl *impl, const struct pw_properties *properties,
+	       char *buf, size_t size)
+{
+	const char *str, *p;
+
+	if (properties == NULL)
+		return NULL;
+
+	if ((str = pw_properties_get(properties, PW_NODE_PROP_DATA_LOOP)) != NULL)
+		return str;
+
+	if (impl->policy != DATA_LOOP_POLICY_MEDIA_CLASS ||
+	    (str = pw_properties_get(properties, "media.class")) == NULL)
+		return NULL;
+
+	/* Audio/Sink and Stream/Output/Audio both run in the Audio loop */
+	if (strncmp(str, "Stream/", 7) == 0 && (p = strrchr(str, '/')) != NULL)
+		str = p + 1;
+	else if ((p = strchr(str, '/')) != NULL) {
+		snprintf(buf, size, "%.*s", (int) (p - str), str);
+		str = buf;
+	}
+	return str;
+}
+
+static struct data_loop *
+find_data_loop(struct impl *impl, const struct pw_properties *properties)
+{
+	struct data_loop *l;
+	const char *name;
+	char buf[64];
+
+	name = data_loop_name(impl, properties, buf, sizeof(buf));
+	if (name == NULL || *name == '\0' || strcmp(name, "default") == 0)
+		return impl->default_loop;
+
+	spa_list_for_each(l, &impl->data_loop_list, link) {
+		if (l->name && strcmp(l->name, name) == 0)
+			return l;
+	}
+
+	if ((l = data_loop_new(impl, name)) == NULL) {
+		pw_log_warn("core %p: can't make data loop \"%s\"", &impl->this, name);
+		return impl->default_loop;
+	}
+	pw_data_loop_start(l->data_loop);
+
+	return l;
+}
+
+struct set_plan {
+	struct spa_graph_node **plan;
+	uint32_t size;
+};
+
+static int
+do_set_plan(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	const struct set_plan *p = data;
+
+	spa_graph_set_plan(user_data, p->plan, p->size);
+
+	return 0;
+}
+
+int pw_core_reserve_graph(struct pw_core *core, struct pw_loop *loop,
+			  struct spa_graph *graph, int32_t n_nodes)
+{
+	struct spa_graph_node **old;
+	struct set_plan p;
+	uint32_t old_size = graph->reserved_size;
+	int res;
+
+	if ((res = spa_graph_reserve(graph, n_nodes, &p.plan, &old)) <= 0) {
+		if (res < 0)
+			pw_log_error("core %p: can't reserve graph plan: %s",
+				     core, spa_strerror(res));
+		return res;
+	}
+	p.size = res;
+
+	/* the plan is swapped in the data loop, between cycles */
+	res = pw_loop_invoke(loop, do_set_plan, SPA_ID_INVALID, &p, sizeof(p), false, graph);
+	if (res < 0) {
+		pw_log_error("core %p: can't set graph plan: %s", core, spa_strerror(res));
+		graph->reserved_plan = old;
+		graph->reserved_size = old_size;
+		graph->n_reserved -= n_nodes;
+		free(p.plan);
+		return res;
+	}
+	if (old)
+		pw_core_defer(core, free, old);
+
+	return 0;
+}
+
+struct pw_loop *pw_core_select_data_loop(struct pw_core *core,
+					 const struct pw_properties *properties,
+					 struct spa_graph **graph)
+{
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
+	struct data_loop *l = find_data_loop(impl, properties);
+
+	if (graph)
+		*graph = &l->graph;
+	return pw_data_loop_get_loop(l->data_loop);
+}
+
 /** Create a new core object
  *
  * \param main_loop the main loop to use
@@ -329,13 +820,16 @@ core_bind_func(struct pw_global *global,
  */
 struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *properties)
 {
+	struct impl *impl;
 	struct pw_core *this;
-	const char *name;
+	const char *name, *str;
 
-	this = calloc(1, sizeof(struct pw_core));
-	if (this == NULL)
+	impl = calloc(1, sizeof(struct impl));
+	if (impl == NULL)
 		return NULL;
 
+	this = &impl->this;
+
 	pw_log_debug("core %p: new", this);
 
 	if (properties == NULL)
@@ -344,24 +838,32 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 		goto no_mem;
 
 	this->properties = properties;
-
-	this->data_loop_impl = pw_data_loop_new(properties);
-	if (this->data_loop_impl == NULL)
-		goto no_data_loop;
-
-	this->data_loop = pw_data_loop_get_loop(this->data_loop_impl);
 	this->main_loop = main_loop;
 
 	pw_type_init(&this->type);
 	pw_map_init(&this->globals, 128, 32);
 
-	spa_graph_init(&this->rt.graph);
-	spa_graph_set_callbacks(&this->rt.graph, &spa_graph_impl_default, NULL);
+	if ((str = pw_properties_get(properties, PW_CORE_PROP_DATA_WORKERS)) == NULL)
+		str = getenv("PIPEWIRE_DATA_WORKERS");
+	impl->n_workers = str ? atoi(str) : DEFAULT_DATA_WORKERS;
+
+	str = pw_properties_get(properties, PW_CORE_PROP_DATA_LOOP_POLICY);
+	if (str && strcmp(str, "media-class") == 0)
+		impl->policy = DATA_LOOP_POLICY_MEDIA_CLASS;
+	else
+		impl->policy = DATA_LOOP_POLICY_SINGLE;
+
+	spa_list_init(&impl->data_loop_list);
+	spa_list_init(&impl->defer_list);
+	impl->defer_idle = pw_loop_add_idle(main_loop, false, on_defer_idle, impl);
+	impl->defer_event = pw_loop_add_event(main_loop, on_defer_event, impl);
+	if (impl->defer_idle == NULL || impl->defer_event == NULL)
+		goto no_defer;
 
 	spa_debug_set_type_map(this->type.map);
 
 	this->support[0] = SPA_SUPPORT_INIT(SPA_TYPE__TypeMap, this->type.map);
-	this->support[1] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__DataLoop, this->data_loop->loop);
+	this->support[1] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__DataLoop, NULL);
 	this->support[2] = SPA_SUPPORT_INIT(SPA_TYPE_LOOP__MainLoop, this->main_loop->loop);
 	this->support[3] = SPA_SUPPORT_INIT(SPA_TYPE__LoopUtils, this->main_loop->utils);
 	this->support[4] = SPA_SUPPORT_INIT(SPA_TYPE__Log, pw_log_get());
@@ -370,6 +872,14 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	pw_log_debug("%p", this->support[5].data);
 
+	impl->default_loop = data_loop_new(impl, NULL);
+	if (impl->default_loop == NULL)
+		goto no_data_loop;
+
+	this->data_loop_impl = impl->default_loop->data_loop;
+	this->data_loop = pw_data_loop_get_loop(this->data_loop_impl);
+	this->support[1] = impl->default_loop->support[1];
+
 	pw_data_loop_start(this->data_loop_impl);
 
 	spa_list_init(&this->protocol_list);
@@ -422,9 +932,14 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
 
 	return this;
 
-      no_mem:
       no_data_loop:
-	free(this);
+      no_defer:
+	if (impl->defer_idle)
+		pw_loop_destroy_source(main_loop, impl->defer_idle);
+	if (impl->defer_event)
+		pw_loop_destroy_source(main_loop, impl->defer_event);
+      no_mem:
+	free(impl);
 	return NULL;
 }
 
@@ -436,10 +951,12 @@ struct pw_core *pw_core_new(struct pw_loop *main_loop, struct pw_properties *pro
  */
 void pw_core_destroy(struct pw_core *core)
 {
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
 	struct pw_global *global, *t;
 	struct pw_module *module, *tm;
 	struct pw_remote *remote, *tr;
 	struct pw_node *node, *tn;
+	struct data_loop *l, *tl;
 
 	pw_log_debug("core %p: destroy", core);
 	spa_hook_list_call(&core->listener_list, struct pw_core_events, destroy);
@@ -458,14 +975,23 @@ void pw_core_destroy(struct pw_core *core)
 
 	spa_hook_list_call(&core->listener_list, struct pw_core_events, free);
 
-	pw_data_loop_destroy(core->data_loop_impl);
+	spa_list_for_each(l, &impl->data_loop_list, link)
+		pw_data_loop_destroy(l->data_loop);
+
+	/* the data loops are gone, nothing uses the deferred objects anymore */
+	defer_flush(impl, true);
+	pw_loop_destroy_source(core->main_loop, impl->defer_idle);
+	pw_loop_destroy_source(core->main_loop, impl->defer_event);
+
+	spa_list_for_each_safe(l, tl, &impl->data_loop_list, link)
+		data_loop_free(l);
 
 	pw_properties_free(core->properties);
 
 	pw_map_clear(&core->globals);
 
 	pw_log_debug("core %p: free", core);
-	free(core);
+	free(impl);
 }
 
 const struct pw_core_info *pw_core_get_info(struct pw_core *core)
@@ -505,6 +1031,17 @@ const struct spa_support *pw_core_get_support(struct pw_core *core, uint32_t *n_
 	return core->support;
 }
 
+const struct spa_support *pw_core_get_node_support(struct pw_core *core,
+						   const struct pw_properties *properties,
+						   uint32_t *n_support)
+{
+	struct impl *impl = SPA_CONTAINER_OF(core, struct impl, this);
+	struct data_loop *l = find_data_loop(impl, properties);
+
+	*n_support = core->n_support;
+	return l->support;
+}
+
 struct pw_loop *pw_core_get_main_loop(struct pw_core *core)
 {
 	return core->main_loop;
@@ -614,6 +1151,10 @@ struct pw_port *pw_core_find_port(struct pw_core *core,
 		if (other_port->node == n)
 			continue;
 
+		/* links can't cross data loops */
+		if (other_port->node->data_loop != n->data_loop)
+			continue;
+
 		if (core->current_client &&
 		    !PW_PERM_IS_R(pw_global_get_permissions(n->global, core->current_client)))
 			continue;
@@ -115,6 +115,16 @@ struct pw_core_events {
 #define PW_CORE_PROP_VERSION	"pipewire.core.version"
 /** If the core should listen for connections, boolean default false */
 #define PW_CORE_PROP_DAEMON	"pipewire.daemon"
+/** The number of extra threads that process the graph in parallel with
+ * the data loop, default 0 */
+#define PW_CORE_PROP_DATA_WORKERS	"pipewire.core.data-workers"
+/** How nodes are spread over data loops. "single" runs all nodes in one
+ * loop, "media-class" uses a loop per media type of the node class, like
+ * Audio or Video. A node can select a loop with \ref PW_NODE_PROP_DATA_LOOP.
+ * The thread of a loop named <name> is configured with the
+ * pipewire.data-loop.<name>.rt-prio and pipewire.data-loop.<name>.affinity
+ * properties, see \ref PW_DATA_LOOP_PROP_RT_PRIO. Default "single" */
+#define PW_CORE_PROP_DATA_LOOP_POLICY	"pipewire.core.data-loop-policy"
 
 /** Make a new core object for a given main_loop. Ownership of the properties is taken */
 struct pw_core * pw_core_new(struct pw_loop *main_loop, struct pw_properties *props);
@@ -152,6 +162,12 @@ int pw_core_update_properties(struct pw_core *core, const struct spa_dict *dict)
 /** Get the core support objects */
 const struct spa_support *pw_core_get_support(struct pw_core *core, uint32_t *n_support);
 
+/** Get the support objects for the plugin of a node with \a properties.
+ * The data loop is the loop the node will run in. */
+const struct spa_support *pw_core_get_node_support(struct pw_core *core,
+						   const struct pw_properties *properties,
+						   uint32_t *n_support);
+
 /** get the core main loop */
 struct pw_loop *pw_core_get_main_loop(struct pw_core *core);
 
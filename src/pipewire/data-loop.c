@@ -17,8 +17,14 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
 #include <pthread.h>
+#include <sched.h>
 #include <errno.h>
+#include <stdlib.h>
 #include <sys/resource.h>
 
 #include "pipewire/log.h"
@@ -34,7 +40,7 @@ static void make_realtime(struct pw_data_loop *this)
 	int r, rtprio;
 	long long rttime;
 
-	rtprio = 20;
+	rtprio = this->rtprio;
 	rttime = 20000;
 
 	spa_zero(sp);
@@ -69,11 +75,51 @@ static void make_realtime(struct pw_data_loop *this)
 	pw_rtkit_bus_free(system_bus);
 }
 
+static void set_affinity(struct pw_data_loop *this)
+{
+	cpu_set_t set;
+	const char *p = this->affinity;
+	char *end;
+	long first, last;
+	int res;
+
+	CPU_ZERO(&set);
+	while (*p) {
+		first = last = strtol(p, &end, 10);
+		if (end == p)
+			goto invalid;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if (end == p)
+				goto invalid;
+		}
+		if (first < 0 || last < first || last >= CPU_SETSIZE)
+			goto invalid;
+		for (; first <= last; first++)
+			CPU_SET(first, &set);
+		p = end;
+		if (*p == ',')
+			p++;
+		else if (*p != '\0')
+			goto invalid;
+	}
+
+	if ((res = pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) != 0)
+		pw_log_warn("data-loop %p: can't set affinity: %s", this, strerror(res));
+	return;
+
+      invalid:
+	pw_log_warn("data-loop %p: invalid cpu list \"%s\"", this, this->affinity);
+}
+
 static void *do_loop(void *user_data)
 {
 	struct pw_data_loop *this = user_data;
 	int res;
 
+	if (this->affinity)
+		set_affinity(this);
 	make_realtime(this);
 
 	pw_log_debug("data-loop %p: enter thread", this);
@@ -104,6 +150,7 @@ static void do_stop(void *data, uint64_t count)
 struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 {
 	struct pw_data_loop *this;
+	const char *str;
 
 	this = calloc(1, sizeof(struct pw_data_loop));
 	if (this == NULL)
@@ -111,6 +158,14 @@ struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 
 	pw_log_debug("data-loop %p: new", this);
 
+	this->rtprio = 20;
+	if (properties) {
+		if ((str = pw_properties_get(properties, PW_DATA_LOOP_PROP_RT_PRIO)) != NULL)
+			this->rtprio = atoi(str);
+		if ((str = pw_properties_get(properties, PW_DATA_LOOP_PROP_AFFINITY)) != NULL)
+			this->affinity = strdup(str);
+	}
+
 	this->loop = pw_loop_new(properties);
 	if (this->loop == NULL)
 		goto no_loop;
@@ -122,6 +177,7 @@ struct pw_data_loop *pw_data_loop_new(struct pw_properties *properties)
 	return this;
 
       no_loop:
+	free(this->affinity);
 	free(this);
 	return NULL;
 }
@@ -140,6 +196,7 @@ void pw_data_loop_destroy(struct pw_data_loop *loop)
 
 	pw_loop_destroy_source(loop->loop, loop->event);
 	pw_loop_destroy(loop->loop);
+	free(loop->affinity);
 	free(loop);
 }
 
@@ -36,6 +36,11 @@ struct pw_data_loop;
 #include <pipewire/loop.h>
 #include <pipewire/properties.h>
 
+/** Realtime priority of the loop thread, default 20 */
+#define PW_DATA_LOOP_PROP_RT_PRIO	"pipewire.data-loop.rt-prio"
+/** CPUs the loop thread may run on, a list like "0,2-3", default all */
+#define PW_DATA_LOOP_PROP_AFFINITY	"pipewire.data-loop.affinity"
+
 /** Loop events, use \ref pw_data_loop_add_listener to add a listener */
 struct pw_data_loop_events {
 #define PW_VERSION_DATA_LOOP_EVENTS		0
@@ -44,7 +49,8 @@ struct pw_data_loop_events {
 	void (*destroy) (void *data);
 };
 
-/** Make a new loop */
+/** Make a new loop. The properties configure the thread of the loop, the
+ * caller keeps ownership */
 struct pw_data_loop *
 pw_data_loop_new(struct pw_properties *properties);
 
@@ -128,7 +128,8 @@ pw_global_register(struct pw_global *global,
 	spa_list_for_each(registry, &core->registry_resource_list, link) {
 		uint32_t permissions = pw_global_get_permissions(global, registry->client);
 		pw_log_debug("registry %p: global %d %08x", registry, global->id, permissions);
-		if (PW_PERM_IS_R(permissions))
+		if (pw_core_registry_match(registry, global, PW_REGISTRY_PROXY_EVENT_GLOBAL) &&
+		    PW_PERM_IS_R(permissions))
 			pw_registry_resource_global(registry,
 						    global->id,
 						    global->parent->id,
@@ -242,7 +243,9 @@ void pw_global_destroy(struct pw_global *global)
 		spa_list_for_each(registry, &core->registry_resource_list, link) {
 			uint32_t permissions = pw_global_get_permissions(global, registry->client);
 			pw_log_debug("registry %p: global %d %08x", registry, global->id, permissions);
-			if (PW_PERM_IS_R(permissions))
+			if (pw_core_registry_match(registry, global,
+						   PW_REGISTRY_PROXY_EVENT_GLOBAL_REMOVE) &&
+			    PW_PERM_IS_R(permissions))
 				pw_registry_resource_global_remove(registry, global->id);
 		}
 
@@ -73,7 +73,8 @@ struct pw_link_proxy;
 #define PW_CORE_PROXY_METHOD_CLIENT_UPDATE	4
 #define PW_CORE_PROXY_METHOD_PERMISSIONS	5
 #define PW_CORE_PROXY_METHOD_CREATE_OBJECT	6
-#define PW_CORE_PROXY_METHOD_NUM		7
+#define PW_CORE_PROXY_METHOD_GET_REGISTRY_FILTERED	7
+#define PW_CORE_PROXY_METHOD_NUM		8
 
 /**
  * Key to update default permissions of globals without specific
@@ -109,7 +110,7 @@ struct pw_link_proxy;
  * also used for internal features.
  */
 struct pw_core_proxy_methods {
-#define PW_VERSION_CORE_PROXY_METHODS	0
+#define PW_VERSION_CORE_PROXY_METHODS	1
 	uint32_t version;
 	/**
 	 * Start a conversation with the server. This will send
@@ -183,6 +184,19 @@ struct pw_core_proxy_methods {
 			       uint32_t version,
 			       const struct spa_dict *props,
 			       uint32_t new_id);
+	/**
+	 * Get a registry object with a filter
+	 *
+	 * Like get_registry but the registry only gets the events of
+	 * the globals that match \a filter, see \ref page_registry_filter.
+	 * Since version 1.
+	 *
+	 * \param version the client proxy id
+	 * \param filter the events to send
+	 * \param id the client proxy id
+	 */
+	void (*get_registry_filtered) (void *object, uint32_t version,
+				       const struct spa_dict *filter, uint32_t new_id);
 };
 
 static inline void
@@ -211,6 +225,16 @@ pw_core_proxy_get_registry(struct pw_core_proxy *core, uint32_t type, uint32_t v
 	return (struct pw_registry_proxy *) p;
 }
 
+static inline struct pw_registry_proxy *
+pw_core_proxy_get_registry_filtered(struct pw_core_proxy *core, uint32_t type, uint32_t version,
+				    const struct spa_dict *filter, size_t user_data_size)
+{
+	struct pw_proxy *p = pw_proxy_new((struct pw_proxy*)core, type, user_data_size);
+	pw_proxy_do((struct pw_proxy*)core, struct pw_core_proxy_methods, get_registry_filtered, version,
+		    filter, pw_proxy_get_id(p));
+	return (struct pw_registry_proxy *) p;
+}
+
 static inline void
 pw_core_proxy_client_update(struct pw_core_proxy *core, const struct spa_dict *props)
 {
@@ -353,7 +377,27 @@ pw_core_proxy_add_listener(struct pw_core_proxy *core,
  * pipewire session before handing it to another application. You
  * can, for example, hide certain existing or new objects or limit
  * the access permissions on an object.
+ *
+ * \section page_registry_filter Filters
+ *
+ * A client that is only interested in some of the globals can pass a
+ * filter when it gets the registry with
+ * pw_core_proxy_get_registry_filtered(). The server only sends the
+ * events of the globals that match all the items of the filter:
+ *
+ * \li \ref PW_REGISTRY_FILTER_TYPE the interface type name of the global
+ * \li \ref PW_REGISTRY_FILTER_EVENTS the events to send, a comma separated
+ *     list of "global" and "global-remove"
+ * \li any other key is a property of the global that must have the
+ *     given value
+ *
+ * This is a separate method of the core, servers older than version 1
+ * of the core methods don't know it and fail the request.
  */
+
+#define PW_REGISTRY_FILTER_TYPE		"pipewire.filter.type"		/**< interface type name */
+#define PW_REGISTRY_FILTER_EVENTS	"pipewire.filter.events"	/**< events to send */
+
 #define PW_REGISTRY_PROXY_METHOD_BIND		0
 #define PW_REGISTRY_PROXY_METHOD_NUM		1
 
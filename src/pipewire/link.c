@@ -319,6 +319,7 @@ static struct spa_buffer **alloc_buffers(struct pw_link *this,
 					 uint32_t n_datas,
 					 size_t *data_sizes,
 					 ssize_t *data_strides,
+					 uint32_t memory,
 					 struct pw_memblock **mem)
 {
 	struct spa_buffer **buffers, *bp;
@@ -330,6 +331,7 @@ static struct spa_buffer **alloc_buffers(struct pw_link *this,
 	struct spa_meta *metas;
 	struct pw_memblock *m;
 	struct pw_type *t = &this->core->type;
+	enum pw_memblock_flags flags;
 
 	n_metas = data_size = meta_size = 0;
 
@@ -369,9 +371,22 @@ static struct spa_buffer **alloc_buffers(struct pw_link *this,
 	/* pointer to buffer structures */
 	bp = SPA_MEMBER(buffers, n_buffers * sizeof(struct spa_buffer *), struct spa_buffer);
 
-	pw_memblock_alloc(PW_MEMBLOCK_FLAG_WITH_FD |
-			  PW_MEMBLOCK_FLAG_MAP_READWRITE |
-			  PW_MEMBLOCK_FLAG_SEAL, n_buffers * data_size, &m);
+	/* renegotiation allocates the same sizes again, take the memory from
+	 * the pool. The client-node removes the pool flag when it sends the
+	 * memory to a client so that it's never reused for another stream */
+	flags = PW_MEMBLOCK_FLAG_WITH_FD |
+		PW_MEMBLOCK_FLAG_MAP_READWRITE |
+		PW_MEMBLOCK_FLAG_SEAL |
+		PW_MEMBLOCK_FLAG_POOL;
+	if (memory & SPA_PARAM_BUFFERS_MEMORY_LOCKED)
+		flags |= PW_MEMBLOCK_FLAG_LOCK | PW_MEMBLOCK_FLAG_PREFAULT;
+	if (memory & SPA_PARAM_BUFFERS_MEMORY_HUGEPAGES)
+		flags |= PW_MEMBLOCK_FLAG_HUGEPAGES;
+
+	if (pw_memblock_alloc(flags, n_buffers * data_size, &m) < 0) {
+		free(buffers);
+		return NULL;
+	}
 
 	for (i = 0; i < n_buffers; i++) {
 		int j;
@@ -391,6 +406,8 @@ static struct spa_buffer **alloc_buffers(struct pw_link *this,
 			m->type = metas[j].type;
 			m->size = metas[j].size;
 			m->data = p;
+			/* a pooled block has the metadata of its previous use */
+			memset(m->data, 0, m->size);
 			p += m->size;
 		}
 		/* pointer to data structure */
@@ -558,7 +575,7 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 		uint8_t buffer[4096];
 		struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
 		int i, offset, n_params;
-		uint32_t max_buffers;
+		uint32_t max_buffers, memory = 0;
 		size_t minsize = 1024, stride = 0;
 
 		n_params = param_filter(this, input, output, t->param.idBuffers, &b);
@@ -584,7 +601,8 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 			spa_pod_object_parse(param,
 				":", t->param_buffers.size, "i", &qminsize,
 				":", t->param_buffers.stride, "i", &qstride,
-				":", t->param_buffers.buffers, "i", &qmax_buffers, NULL);
+				":", t->param_buffers.buffers, "i", &qmax_buffers,
+				":", t->param_buffers.memory, "?i", &memory, NULL);
 
 			max_buffers =
 			    qmax_buffers == 0 ? max_buffers : SPA_MIN(qmax_buffers,
@@ -636,7 +654,13 @@ static int do_allocation(struct pw_link *this, uint32_t in_state, uint32_t out_s
 						      params,
 						      1,
 						      data_sizes, data_strides,
+						      memory,
 						      &this->buffer_mem);
+			if (this->buffers == NULL) {
+				res = -ENOMEM;
+				asprintf(&error, "can't allocate buffers");
+				goto error;
+			}
 
 			pw_log_debug("link %p: allocating %d buffers %p %zd %zd", this,
 				     this->n_buffers, this->buffers, minsize, stride);
@@ -838,6 +862,11 @@ output_node_async_complete(void *data, uint32_t seq, int res)
 	pw_work_queue_complete(impl->work, node, seq, res);
 }
 
+static bool need_clear_port_buffers(struct pw_link *link, struct pw_port *port)
+{
+	return link->buffer_owner != port && port->n_buffers > 0;
+}
+
 static void clear_port_buffers(struct pw_link *link, struct pw_port *port)
 {
 	if (link->buffer_owner != port)
@@ -861,8 +890,11 @@ static void input_remove(struct pw_link *this, struct pw_port *port)
 	spa_hook_remove(&impl->input_port_listener);
 	spa_hook_remove(&impl->input_node_listener);
 
+	/* only wait for the data loop when the buffers of the port are
+	 * cleared after it */
 	pw_loop_invoke(port->node->data_loop,
-		       do_remove_input, 1, NULL, 0, true, this);
+		       do_remove_input, 1, NULL, 0,
+		       need_clear_port_buffers(this, port), this);
 
 	clear_port_buffers(this, port);
 }
@@ -884,8 +916,11 @@ static void output_remove(struct pw_link *this, struct pw_port *port)
 	spa_hook_remove(&impl->output_port_listener);
 	spa_hook_remove(&impl->output_node_listener);
 
+	/* only wait for the data loop when the buffers of the port are
+	 * cleared after it */
 	pw_loop_invoke(port->node->data_loop,
-		       do_remove_output, 1, NULL, 0, true, this);
+		       do_remove_output, 1, NULL, 0,
+		       need_clear_port_buffers(this, port), this);
 
 	clear_port_buffers(this, port);
 }
@@ -950,7 +985,7 @@ int pw_link_deactivate(struct pw_link *this)
 	impl->active = false;
 	pw_log_debug("link %p: deactivate", this);
 	pw_loop_invoke(this->output->node->data_loop,
-		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, true, this);
+		       do_deactivate_link, SPA_ID_INVALID, NULL, 0, false, this);
 
 	input_node = this->input->node;
 	output_node = this->output->node;
@@ -1083,6 +1118,9 @@ struct pw_link *pw_link_new(struct pw_core *core,
 	if (pw_link_find(output, input))
 		goto link_exists;
 
+	if (output->node->data_loop != input->node->data_loop)
+		goto different_loops;
+
 	impl = calloc(1, sizeof(struct impl) + user_data_size);
 	if (impl == NULL)
 		goto no_mem;
@@ -1176,6 +1214,9 @@ struct pw_link *pw_link_new(struct pw_core *core,
       link_exists:
 	asprintf(error, "link already exists");
 	return NULL;
+      different_loops:
+	asprintf(error, "nodes are in different data loops");
+	return NULL;
       no_mem:
 	asprintf(error, "no memory");
 	return NULL;
@@ -1222,6 +1263,18 @@ int pw_link_register(struct pw_link *link,
 	return 0;
 }
 
+static void link_free(void *data)
+{
+	struct impl *impl = data;
+	struct pw_link *link = &impl->this;
+
+	if (link->buffer_owner == link) {
+		free(link->buffers);
+		pw_memblock_free(link->buffer_mem);
+	}
+	free(impl);
+}
+
 void pw_link_destroy(struct pw_link *link)
 {
 	struct impl *impl = SPA_CONTAINER_OF(link, struct impl, this);
@@ -1261,11 +1314,9 @@ void pw_link_destroy(struct pw_link *link)
 	if (link->info.format)
 		free(link->info.format);
 
-	if (link->buffer_owner == link) {
-		free(link->buffers);
-		pw_memblock_free(link->buffer_mem);
-	}
-	free(impl);
+	/* the data loop can still reach the link and its io until it
+	 * removed the ports */
+	pw_core_defer(link->core, link_free, impl);
 }
 
 void pw_link_add_listener(struct pw_link *link,
@@ -17,7 +17,10 @@
  * Boston, MA 02110-1301, USA.
  */
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <spa/support/loop.h>
 #include <spa/support/type-map.h>
@@ -37,20 +40,72 @@ struct impl {
 };
 /** \endcond */
 
+#define DEFAULT_FACTORY	"loop"
+
+/* properties that are passed to the loop factory */
+static const char *info_keys[] = {
+	"loop.profile",
+	"loop.profile.warn",
+	"loop.timer-slack",
+};
+
+static struct impl *make_impl(const char *factory_name, const struct spa_dict *info,
+			      const struct spa_support *support, uint32_t n_support)
+{
+	int res;
+	struct impl *impl;
+	const struct spa_handle_factory *factory;
+
+	factory = pw_get_support_factory(factory_name);
+	if (factory == NULL) {
+		pw_log_warn("loop: no factory %s", factory_name);
+		return NULL;
+	}
+
+	impl = calloc(1, sizeof(struct impl) + factory->size);
+	if (impl == NULL)
+		return NULL;
+
+	impl->handle = SPA_MEMBER(impl, sizeof(struct impl), struct spa_handle);
+
+	if ((res = spa_handle_factory_init(factory,
+					   impl->handle,
+					   info,
+					   support,
+					   n_support)) < 0) {
+		pw_log_warn("loop: can't make %s instance: %s", factory_name, spa_strerror(res));
+		free(impl);
+		return NULL;
+	}
+	return impl;
+}
+
 /** Create a new loop
+ * \param properties optional properties, "loop.factory" selects the
+ *        support factory to use, the PIPEWIRE_LOOP environment variable
+ *        is used when it is not set. When the factory can't be used the
+ *        default epoll based loop is used. "loop.profile" or the
+ *        PIPEWIRE_LOOP_PROFILE environment variable enable the dispatch
+ *        statistics, "loop.profile.warn" logs callbacks that take longer
+ *        than the given number of microseconds. "loop.timer-slack" lets
+ *        timers expire up to the given number of microseconds late so
+ *        that they can share a wakeup.
  * \returns a newly allocated loop
  * \memberof pw_loop
  */
 struct pw_loop *pw_loop_new(struct pw_properties *properties)
 {
 	int res;
-	struct impl *impl;
+	struct impl *impl = NULL;
 	struct pw_loop *this;
-	const struct spa_handle_factory *factory;
 	struct spa_type_map *map;
 	void *iface;
 	const struct spa_support *support;
 	uint32_t n_support;
+	const char *name = NULL, *str;
+	struct spa_dict_item items[SPA_N_ELEMENTS(info_keys) + 1];
+	struct spa_dict info = SPA_DICT_INIT(items, 0);
+	uint32_t i;
 
 	support = pw_get_support(&n_support);
 	if (support == NULL)
@@ -60,27 +115,30 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	if (map == NULL)
 		return NULL;
 
-	factory = pw_get_support_factory("loop");
-	if (factory == NULL)
-		return NULL;
+	if (properties)
+		name = pw_properties_get(properties, "loop.factory");
+	if (name == NULL)
+		name = getenv("PIPEWIRE_LOOP");
+
+	/* the first item wins, the environment overrides the properties */
+	if ((str = getenv("PIPEWIRE_LOOP_PROFILE")) != NULL)
+		items[info.n_items++] = SPA_DICT_ITEM_INIT("loop.profile", str);
+	for (i = 0; properties && i < SPA_N_ELEMENTS(info_keys); i++) {
+		if ((str = pw_properties_get(properties, info_keys[i])) != NULL)
+			items[info.n_items++] = SPA_DICT_ITEM_INIT(info_keys[i], str);
+	}
 
-	impl = calloc(1, sizeof(struct impl) + factory->size);
+	if (name != NULL && strcmp(name, DEFAULT_FACTORY) != 0) {
+		if ((impl = make_impl(name, &info, support, n_support)) == NULL)
+			pw_log_warn("loop: falling back to %s", DEFAULT_FACTORY);
+	}
+	if (impl == NULL)
+		impl = make_impl(DEFAULT_FACTORY, &info, support, n_support);
 	if (impl == NULL)
 		return NULL;
 
-	impl->handle = SPA_MEMBER(impl, sizeof(struct impl), struct spa_handle);
-
 	this = &impl->this;
 
-	if ((res = spa_handle_factory_init(factory,
-					   impl->handle,
-					   NULL,
-					   support,
-					   n_support)) < 0) {
-		fprintf(stderr, "can't make factory instance: %d\n", res);
-		goto failed;
-	}
-
         if ((res = spa_handle_get_interface(impl->handle,
 					    spa_type_map_get_id(map, SPA_TYPE__Loop),
 					    &iface)) < 0) {
@@ -108,6 +166,7 @@ struct pw_loop *pw_loop_new(struct pw_properties *properties)
 	return this;
 
       failed:
+	spa_handle_clear(impl->handle);
 	free(impl);
 	return NULL;
 }
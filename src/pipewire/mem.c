@@ -32,10 +32,12 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <sys/syscall.h>
+#include <sys/stat.h>
 
 #include <spa/utils/list.h>
 
 #include <pipewire/log.h>
+#include <pipewire/array.h>
 #include <pipewire/mem.h>
 
 #ifndef HAVE_MEMFD_CREATE
@@ -63,6 +65,10 @@ static inline int memfd_create(const char *name, unsigned int flags)
 #define MFD_ALLOW_SEALING 0x0002U
 #endif
 
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB       0x0004U
+#endif
+
 /* fcntl() seals-related flags */
 
 #ifndef F_LINUX_SPECIFIC_BASE
@@ -81,13 +87,97 @@ static inline int memfd_create(const char *name, unsigned int flags)
 
 struct memblock {
 	struct pw_memblock mem;
-	struct spa_list link;
+	enum pw_memblock_flags alloc_flags;	/**< flags as requested, mem.flags loses
+						  *  the flags that could not be honoured */
+	size_t alloc_size;			/**< size as requested, mem.size can be
+						  *  larger */
+	struct spa_list link;		/**< link in the idle list of the pool */
+	bool indexed;
+};
+
+/* the mapped blocks, sorted on their address so that pw_memblock_find()
+ * can do a binary search. The range is kept in the entries to avoid
+ * touching the blocks while searching. */
+struct index_entry {
+	const void *start;
+	const void *end;
+	struct memblock *block;
 };
 
-static struct spa_list _memblocks = SPA_LIST_INIT(&_memblocks);
+static struct pw_array _index = { NULL, 0, 0, 64 * sizeof(struct index_entry) };
+
+#define DEFAULT_POOL_MAX_IDLE	(16 * 1024 * 1024)
+
+/* idle blocks of the pool, most recently freed first */
+static struct {
+	struct spa_list idle;
+	struct pw_memblock_pool_stats stats;
+} _pool = {
+	.idle = { &_pool.idle, &_pool.idle },
+	.stats.max_idle_size = DEFAULT_POOL_MAX_IDLE,
+};
 
 #define USE_MEMFD
 
+/* the number of entries that start at or before \a ptr */
+static uint32_t index_upper_bound(const void *ptr)
+{
+	struct index_entry *entries = _index.data;
+	uint32_t lo = 0, hi = pw_array_get_len(&_index, struct index_entry), mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (entries[mid].start <= ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static void index_add(struct memblock *m)
+{
+	struct index_entry *entries;
+	uint32_t pos, len;
+
+	if (m->indexed || m->mem.ptr == NULL)
+		return;
+
+	pos = index_upper_bound(m->mem.ptr);
+	if (pw_array_add(&_index, sizeof(struct index_entry)) == NULL) {
+		pw_log_warn("memblock %p: can't index", m);
+		return;
+	}
+	entries = _index.data;
+	len = pw_array_get_len(&_index, struct index_entry);
+	memmove(&entries[pos + 1], &entries[pos], (len - pos - 1) * sizeof(struct index_entry));
+	entries[pos].start = m->mem.ptr;
+	entries[pos].end = SPA_MEMBER(m->mem.ptr, m->mem.size, void);
+	entries[pos].block = m;
+	m->indexed = true;
+}
+
+static void index_remove(struct memblock *m)
+{
+	struct index_entry *entries = _index.data;
+	uint32_t pos, len;
+
+	if (!m->indexed)
+		return;
+
+	pos = index_upper_bound(m->mem.ptr);
+	while (pos > 0 && entries[pos - 1].block != m)
+		pos--;
+	if (pos == 0)
+		return;
+	pos--;
+
+	len = pw_array_get_len(&_index, struct index_entry);
+	memmove(&entries[pos], &entries[pos + 1], (len - pos - 1) * sizeof(struct index_entry));
+	_index.size -= sizeof(struct index_entry);
+	m->indexed = false;
+}
+
 /** Map a memblock
  * \param mem a memblock
  * \return 0 on success, < 0 on error
@@ -99,12 +189,15 @@ int pw_memblock_map(struct pw_memblock *mem)
 		return 0;
 
 	if (mem->flags & PW_MEMBLOCK_FLAG_MAP_READWRITE) {
-		int prot = 0;
+		int prot = 0, flags = MAP_SHARED;
+		size_t size = mem->size;
 
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_READ)
 			prot |= PROT_READ;
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_WRITE)
 			prot |= PROT_WRITE;
+		if (mem->flags & (PW_MEMBLOCK_FLAG_PREFAULT | PW_MEMBLOCK_FLAG_LOCK))
+			flags |= MAP_POPULATE;
 
 		if (mem->flags & PW_MEMBLOCK_FLAG_MAP_TWICE) {
 			void *ptr;
@@ -112,35 +205,174 @@ int pw_memblock_map(struct pw_memblock *mem)
 			mem->ptr =
 			    mmap(NULL, mem->size << 1, PROT_NONE, MAP_ANONYMOUS | MAP_PRIVATE, -1,
 				 0);
-			if (mem->ptr == MAP_FAILED)
+			if (mem->ptr == MAP_FAILED) {
+				mem->ptr = NULL;
 				return -errno;
+			}
 
 			ptr =
-			    mmap(mem->ptr, mem->size, prot, MAP_FIXED | MAP_SHARED, mem->fd,
+			    mmap(mem->ptr, mem->size, prot, MAP_FIXED | flags, mem->fd,
 				 mem->offset);
 			if (ptr != mem->ptr) {
 				munmap(mem->ptr, mem->size << 1);
+				mem->ptr = NULL;
 				return -ENOMEM;
 			}
 
 			ptr =
-			    mmap(mem->ptr + mem->size, mem->size, prot, MAP_FIXED | MAP_SHARED,
+			    mmap(mem->ptr + mem->size, mem->size, prot, MAP_FIXED | flags,
 				 mem->fd, mem->offset);
 			if (ptr != mem->ptr + mem->size) {
 				munmap(mem->ptr, mem->size << 1);
+				mem->ptr = NULL;
 				return -ENOMEM;
 			}
+			size <<= 1;
 		} else {
-			mem->ptr = mmap(NULL, mem->size, prot, MAP_SHARED, mem->fd, 0);
-			if (mem->ptr == MAP_FAILED)
+			mem->ptr = mmap(NULL, mem->size, prot, flags, mem->fd, 0);
+			if (mem->ptr == MAP_FAILED) {
+				mem->ptr = NULL;
 				return -ENOMEM;
+			}
+		}
+		/* the pages are already faulted in, locking keeps them there */
+		if ((mem->flags & PW_MEMBLOCK_FLAG_LOCK) && mlock(mem->ptr, size) < 0) {
+			pw_log_warn("memblock %p: failed to lock memory: %s", mem, strerror(errno));
+			mem->flags &= ~PW_MEMBLOCK_FLAG_LOCK;
 		}
+		index_add((struct memblock *) mem);
 	} else {
 		mem->ptr = NULL;
 	}
 	return 0;
 }
 
+/* Pooled blocks are made in size classes so that a block can be reused
+ * for a slightly different size. The size is rounded up to pages and then
+ * to a quarter of its power of two, wasting at most 25%. */
+static size_t pool_class_size(size_t size)
+{
+	static size_t page_size = 0;
+	size_t step;
+
+	if (page_size == 0)
+		page_size = sysconf(_SC_PAGESIZE);
+
+	size = SPA_ROUND_UP_N(SPA_MAX(size, 1), page_size);
+	if (size <= 4 * page_size)
+		return size;
+
+	step = (((size_t) 1) << (sizeof(unsigned long) * 8 - 1 - __builtin_clzl(size))) / 4;
+	return SPA_ROUND_UP_N(size, step);
+}
+
+static struct memblock *pool_take(enum pw_memblock_flags flags, size_t size)
+{
+	struct memblock *m;
+
+	spa_list_for_each(m, &_pool.idle, link) {
+		if (m->alloc_flags == flags && m->alloc_size == size) {
+			spa_list_remove(&m->link);
+			_pool.stats.n_idle--;
+			_pool.stats.idle_size -= m->mem.size;
+			return m;
+		}
+	}
+	return NULL;
+}
+
+static void memblock_destroy(struct memblock *m)
+{
+	struct pw_memblock *mem = &m->mem;
+
+	if (mem->flags & PW_MEMBLOCK_FLAG_WITH_FD) {
+		if (mem->ptr)
+			munmap(mem->ptr, mem->size);
+		if (mem->fd != -1)
+			close(mem->fd);
+	} else {
+		if (mem->ptr && (mem->flags & PW_MEMBLOCK_FLAG_LOCK))
+			munlock(mem->ptr, mem->size);
+		free(mem->ptr);
+	}
+	free(m);
+}
+
+/* free the oldest idle blocks until \a size more fits in the pool */
+static void pool_trim(size_t size)
+{
+	struct memblock *m;
+
+	while (!spa_list_is_empty(&_pool.idle) &&
+	       _pool.stats.idle_size + size > _pool.stats.max_idle_size) {
+		m = spa_list_last(&_pool.idle, struct memblock, link);
+		spa_list_remove(&m->link);
+		_pool.stats.n_idle--;
+		_pool.stats.idle_size -= m->mem.size;
+		_pool.stats.evicted++;
+		memblock_destroy(m);
+	}
+}
+
+/* make the file of \a m with \a size, on hugetlbfs when the flags ask for
+ * huge pages. The size of \a m is rounded up to the page size of the file. */
+static int create_fd(struct pw_memblock *m, size_t size)
+{
+	int res;
+#ifdef USE_MEMFD
+	unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+	struct stat st;
+
+	if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+		flags |= MFD_HUGETLB;
+
+	m->fd = memfd_create("pipewire-memfd", flags);
+	if (m->fd == -1) {
+		res = -errno;
+		if (!(flags & MFD_HUGETLB))
+			pw_log_error("Failed to create memfd: %s\n", strerror(errno));
+		return res;
+	}
+	/* the block size of a file on hugetlbfs is the huge page size */
+	if ((flags & MFD_HUGETLB) && fstat(m->fd, &st) == 0 && st.st_blksize > 0)
+		size = SPA_ROUND_UP_N(size, (size_t) st.st_blksize);
+#else
+	char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
+
+	if (m->flags & PW_MEMBLOCK_FLAG_HUGEPAGES)
+		return -ENOTSUP;
+
+	m->fd = mkostemp(filename, O_CLOEXEC);
+	if (m->fd == -1) {
+		res = -errno;
+		pw_log_error("Failed to create temporary file: %s\n", strerror(errno));
+		return res;
+	}
+	unlink(filename);
+#endif
+
+	if (ftruncate(m->fd, size) < 0) {
+		res = -errno;
+		pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
+		goto error_close;
+	}
+	m->size = size;
+#ifdef USE_MEMFD
+	if (m->flags & PW_MEMBLOCK_FLAG_SEAL) {
+		unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
+		if (fcntl(m->fd, F_ADD_SEALS, seals) == -1) {
+			pw_log_warn("Failed to add seals: %s", strerror(errno));
+		}
+	}
+#endif
+	return 0;
+
+      error_close:
+	close(m->fd);
+	m->fd = -1;
+	return res;
+}
+
 /** Create a new memblock
  * \param flags memblock flags
  * \param size size to allocate
@@ -150,76 +382,92 @@ int pw_memblock_map(struct pw_memblock *mem)
  */
 int pw_memblock_alloc(enum pw_memblock_flags flags, size_t size, struct pw_memblock **mem)
 {
-	struct memblock tmp, *p;
+	struct memblock *p;
 	struct pw_memblock *m;
 	bool use_fd;
+	int res;
 
 	if (mem == NULL)
 		return -EINVAL;
 
-	m = &tmp.mem;
+	if (flags & PW_MEMBLOCK_FLAG_POOL) {
+		size = pool_class_size(size);
+		if ((p = pool_take(flags, size)) != NULL) {
+			_pool.stats.hits++;
+			index_add(p);
+			*mem = &p->mem;
+			return 0;
+		}
+		_pool.stats.misses++;
+	}
+
+	if ((p = calloc(1, sizeof(struct memblock))) == NULL)
+		return -ENOMEM;
+
+	p->alloc_flags = flags;
+	p->alloc_size = size;
+	m = &p->mem;
 	m->offset = 0;
 	m->flags = flags;
 	m->size = size;
 	m->ptr = NULL;
+	m->fd = -1;
 
 	use_fd = ! !(flags & (PW_MEMBLOCK_FLAG_MAP_TWICE | PW_MEMBLOCK_FLAG_WITH_FD));
 
 	if (use_fd) {
-#ifdef USE_MEMFD
-		m->fd = memfd_create("pipewire-memfd", MFD_CLOEXEC | MFD_ALLOW_SEALING);
-		if (m->fd == -1) {
-			pw_log_error("Failed to create memfd: %s\n", strerror(errno));
-			return -errno;
+		/* huge pages need to be reserved by the admin, the mapping fails
+		 * when there are not enough of them */
+		if (flags & PW_MEMBLOCK_FLAG_HUGEPAGES) {
+			if ((res = create_fd(m, size)) == 0 &&
+			    (res = pw_memblock_map(m)) < 0) {
+				close(m->fd);
+				m->fd = -1;
+			}
+			if (res < 0) {
+				pw_log_info("memblock %p: no huge pages, using normal pages: %s",
+					    p, strerror(-res));
+				m->flags &= ~PW_MEMBLOCK_FLAG_HUGEPAGES;
+				m->size = size;
+			}
 		}
-#else
-		char filename[] = "/dev/shm/pipewire-tmpfile.XXXXXX";
-		m->fd = mkostemp(filename, O_CLOEXEC);
 		if (m->fd == -1) {
-			pw_log_error("Failed to create temporary file: %s\n", strerror(errno));
-			return -errno;
-		}
-		unlink(filename);
-#endif
-
-		if (ftruncate(m->fd, size) < 0) {
-			pw_log_warn("Failed to truncate temporary file: %s", strerror(errno));
-			close(m->fd);
-			return -errno;
-		}
-#ifdef USE_MEMFD
-		if (flags & PW_MEMBLOCK_FLAG_SEAL) {
-			unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_SEAL;
-			if (fcntl(m->fd, F_ADD_SEALS, seals) == -1) {
-				pw_log_warn("Failed to add seals: %s", strerror(errno));
-			}
+			if ((res = create_fd(m, size)) < 0)
+				goto error_free;
+			if ((res = pw_memblock_map(m)) != 0)
+				goto error_close;
 		}
-#endif
-		if (pw_memblock_map(m) != 0)
-			goto mmap_failed;
 	} else {
+		m->flags &= ~PW_MEMBLOCK_FLAG_HUGEPAGES;
 		if (size > 0) {
 			m->ptr = malloc(size);
-			if (m->ptr == NULL)
-				return -ENOMEM;
+			if (m->ptr == NULL) {
+				res = -ENOMEM;
+				goto error_free;
+			}
+			if ((flags & PW_MEMBLOCK_FLAG_LOCK) && mlock(m->ptr, size) < 0) {
+				pw_log_warn("memblock %p: failed to lock memory: %s", p, strerror(errno));
+				m->flags &= ~PW_MEMBLOCK_FLAG_LOCK;
+			}
+			if (flags & PW_MEMBLOCK_FLAG_PREFAULT)
+				memset(m->ptr, 0, size);
+			index_add(p);
 		}
-		m->fd = -1;
 	}
 	if (!(flags & PW_MEMBLOCK_FLAG_WITH_FD) && m->fd != -1) {
 		close(m->fd);
 		m->fd = -1;
 	}
 
-	p = calloc(1, sizeof(struct memblock));
-	*p = tmp;
-	spa_list_prepend(&_memblocks, &p->link);
 	*mem = &p->mem;
 
 	return 0;
 
-      mmap_failed:
+      error_close:
 	close(m->fd);
-	return -ENOMEM;
+      error_free:
+	free(p);
+	return res;
 }
 
 int
@@ -251,25 +499,124 @@ void pw_memblock_free(struct pw_memblock *mem)
 	if (mem == NULL)
 		return;
 
-	if (mem->flags & PW_MEMBLOCK_FLAG_WITH_FD) {
-		if (mem->ptr)
-			munmap(mem->ptr, mem->size);
-		if (mem->fd != -1)
-			close(mem->fd);
-	} else {
-		free(mem->ptr);
+	index_remove(m);
+
+	if ((mem->flags & PW_MEMBLOCK_FLAG_POOL) && mem->size <= _pool.stats.max_idle_size) {
+		pool_trim(mem->size);
+		spa_list_prepend(&_pool.idle, &m->link);
+		_pool.stats.n_idle++;
+		_pool.stats.idle_size += mem->size;
+		return;
 	}
-	spa_list_remove(&m->link);
-	free(mem);
+	memblock_destroy(m);
 }
 
-struct pw_memblock * pw_memblock_find(const void *ptr)
+/** Make the contents of a memblock read-only
+ * \param mem a memblock with a memfd
+ * \return 0 on success, < 0 on error
+ *
+ * The block is unmapped and the memfd is sealed against writes and size
+ * changes, a peer that gets the fd can check the seals and rely on the
+ * contents. The block must be allocated without PW_MEMBLOCK_FLAG_SEAL.
+ * \memberof pw_memblock
+ */
+int pw_memblock_seal(struct pw_memblock *mem)
 {
-	struct memblock *m;
+#ifdef USE_MEMFD
+	struct memblock *m = (struct memblock *)mem;
+	unsigned int seals = F_SEAL_GROW | F_SEAL_SHRINK | F_SEAL_WRITE | F_SEAL_SEAL;
+
+	if (mem->fd == -1 || (mem->flags & PW_MEMBLOCK_FLAG_SEAL))
+		return -EINVAL;
 
-	spa_list_for_each(m, &_memblocks, link) {
-		if (ptr >= m->mem.ptr && ptr < m->mem.ptr + m->mem.size)
-			return &m->mem;
+	/* writes can't be sealed while there is a writable mapping */
+	if (mem->ptr) {
+		index_remove(m);
+		munmap(mem->ptr, mem->size);
+		mem->ptr = NULL;
 	}
-	return NULL;
+	if (fcntl(mem->fd, F_ADD_SEALS, seals) == -1)
+		return -errno;
+
+	mem->flags |= PW_MEMBLOCK_FLAG_SEAL;
+	mem->flags &= ~PW_MEMBLOCK_FLAG_MAP_READWRITE;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/** Get the page size of shared memory
+ * \param fd the fd of the memory
+ * \param flags the memblock flags of the memory
+ * \param page_size the normal page size
+ * \return the huge page size for memory on huge pages, \a page_size else
+ *
+ * Mappings of huge page memory need offsets and sizes that are a multiple
+ * of the huge page size.
+ * \memberof pw_memblock
+ */
+uint32_t pw_memblock_get_page_size(int fd, uint32_t flags, uint32_t page_size)
+{
+	struct stat st;
+
+	/* the block size of a file on hugetlbfs is the huge page size */
+	if ((flags & PW_MEMBLOCK_FLAG_HUGEPAGES) && fstat(fd, &st) == 0 &&
+	    st.st_blksize > (blksize_t) page_size)
+		return st.st_blksize;
+
+	return page_size;
+}
+
+/** Find the memblock that contains \a ptr
+ * \param ptr a pointer
+ * \return the mapped memblock with \a ptr or NULL
+ * \memberof pw_memblock
+ */
+struct pw_memblock * pw_memblock_find(const void *ptr)
+{
+	struct index_entry *e;
+	uint32_t pos;
+
+	if ((pos = index_upper_bound(ptr)) == 0)
+		return NULL;
+
+	e = pw_array_get_unchecked(&_index, pos - 1, struct index_entry);
+	if (ptr >= e->end)
+		return NULL;
+
+	return &e->block->mem;
+}
+
+/** Set the maximum size of the idle blocks in the pool
+ * \param max_idle_size the maximum size, 0 disables pooling
+ * \memberof pw_memblock
+ */
+void pw_memblock_pool_set_max_idle(size_t max_idle_size)
+{
+	_pool.stats.max_idle_size = max_idle_size;
+	pool_trim(0);
+}
+
+/** Get the statistics of the memblock pool
+ * \param[out] stats the statistics
+ * \memberof pw_memblock
+ */
+void pw_memblock_pool_get_stats(struct pw_memblock_pool_stats *stats)
+{
+	*stats = _pool.stats;
+}
+
+/** Free all idle blocks of the memblock pool
+ * \memberof pw_memblock
+ */
+void pw_memblock_pool_clear(void)
+{
+	struct memblock *m, *t;
+
+	spa_list_for_each_safe(m, t, &_pool.idle, link)
+		memblock_destroy(m);
+	spa_list_init(&_pool.idle);
+	_pool.stats.n_idle = 0;
+	_pool.stats.idle_size = 0;
 }
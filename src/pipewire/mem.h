@@ -34,6 +34,17 @@ enum pw_memblock_flags {
 	PW_MEMBLOCK_FLAG_MAP_READ = (1 << 2),
 	PW_MEMBLOCK_FLAG_MAP_WRITE = (1 << 3),
 	PW_MEMBLOCK_FLAG_MAP_TWICE = (1 << 4),
+	PW_MEMBLOCK_FLAG_POOL = (1 << 5),	/**< take the block from the pool and give
+						  *  it back when freed, the contents of
+						  *  a reused block are undefined. Remove
+						  *  the flag when the fd is shared with
+						  *  another process */
+	PW_MEMBLOCK_FLAG_HUGEPAGES = (1 << 6),	/**< use huge pages when available, the
+						  *  flag is removed when normal pages
+						  *  are used */
+	PW_MEMBLOCK_FLAG_LOCK = (1 << 7),	/**< lock the memory in RAM, the flag is
+						  *  removed when this fails */
+	PW_MEMBLOCK_FLAG_PREFAULT = (1 << 8),	/**< fault in the memory when mapping */
 };
 
 #define PW_MEMBLOCK_FLAG_MAP_READWRITE (PW_MEMBLOCK_FLAG_MAP_READ | PW_MEMBLOCK_FLAG_MAP_WRITE)
@@ -62,9 +73,34 @@ pw_memblock_map(struct pw_memblock *mem);
 void
 pw_memblock_free(struct pw_memblock *mem);
 
+int
+pw_memblock_seal(struct pw_memblock *mem);
+
+uint32_t
+pw_memblock_get_page_size(int fd, uint32_t flags, uint32_t page_size);
+
 /** Find memblock for given \a ptr */
 struct pw_memblock * pw_memblock_find(const void *ptr);
 
+/** Statistics of the memblock pool \memberof pw_memblock */
+struct pw_memblock_pool_stats {
+	uint64_t hits;		/**< allocations served with an idle block */
+	uint64_t misses;	/**< allocations that made a new block */
+	uint64_t evicted;	/**< idle blocks freed to stay below the limit */
+	uint32_t n_idle;	/**< number of idle blocks */
+	size_t idle_size;	/**< total size of the idle blocks */
+	size_t max_idle_size;	/**< limit on the size of the idle blocks */
+};
+
+/** Set the maximum amount of memory kept in idle blocks, 0 disables the pool */
+void pw_memblock_pool_set_max_idle(size_t max_idle_size);
+
+/** Get the statistics of the memblock pool */
+void pw_memblock_pool_get_stats(struct pw_memblock_pool_stats *stats);
+
+/** Free all idle blocks in the pool */
+void pw_memblock_pool_clear(void);
+
 /** parameters to map a memory range */
 struct pw_map_range {
 	uint32_t start;		/** offset in first page with start of data */
@@ -80,7 +116,7 @@ static inline void pw_map_range_init(struct pw_map_range *range,
 {
 	range->offset = SPA_ROUND_DOWN_N(offset, page_size);
 	range->start = offset - range->offset;
-	range->size = offset + size - range->offset;
+	range->size = SPA_ROUND_UP_N(offset + size - range->offset, page_size);
 }
 
 
@@ -35,10 +35,18 @@
 #include "pipewire/work-queue.h"
 
 /** \cond */
+#define PROFILE_INTERVAL_SEC	1
+
 struct impl {
 	struct pw_node this;
 
 	struct pw_work_queue *work;
+
+	struct spa_source *profile_timer;
+	struct spa_graph_node_stats stats;	/**< last published counters */
+	struct spa_graph_node_stats rt_stats;	/**< counters copied in the data loop */
+	bool stats_pending;
+	bool reserved;				/**< has a place in the plan of the graph */
 };
 
 struct resource_data {
@@ -163,8 +171,9 @@ static void update_port_map(struct pw_node *node, enum pw_direction direction,
 					pw_direction_as_string(direction), ids[n]);
 
 			if (port == NULL)
-				if ((port = pw_port_new(direction, ids[n], NULL, 0)))
-					pw_port_add(port, node);
+				if ((port = pw_port_new(direction, ids[n], NULL, 0)) &&
+				    pw_port_add(port, node) < 0)
+					pw_port_destroy(port);
 
 			n++;
 		}
@@ -329,21 +338,104 @@ do_node_add(struct spa_loop *loop,
 	return 0;
 }
 
+static int
+do_copy_stats(struct spa_loop *loop,
+	      bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_node *this = user_data;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+
+	impl->rt_stats = this->rt.node.stats;
+
+	return 0;
+}
+
+static void publish_stats(void *data)
+{
+	struct pw_node *this = data;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+	struct spa_graph_node_stats *stats = &impl->rt_stats;
+	struct spa_dict_item items[5];
+	char cycles[32], last[32], avg[32], max[32], xruns[32];
+
+	impl->stats_pending = false;
+
+	if (this->global == NULL || stats->cycles == impl->stats.cycles)
+		return;
+	impl->stats = *stats;
+
+	snprintf(cycles, sizeof(cycles), "%" PRIu64, stats->cycles);
+	snprintf(last, sizeof(last), "%" PRIu64, stats->last_time);
+	snprintf(avg, sizeof(avg), "%" PRIu64, stats->avg_time);
+	snprintf(max, sizeof(max), "%" PRIu64, stats->max_time);
+	snprintf(xruns, sizeof(xruns), "%" PRIu64, stats->xruns);
+
+	items[0] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_CYCLES, cycles);
+	items[1] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_LAST_TIME, last);
+	items[2] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_AVG_TIME, avg);
+	items[3] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_MAX_TIME, max);
+	items[4] = SPA_DICT_ITEM_INIT(PW_NODE_PROP_PROFILE_XRUNS, xruns);
+
+	pw_node_update_properties(this, &SPA_DICT_INIT(items, 5));
+}
+
+static void on_profile_timeout(void *data, uint64_t expirations)
+{
+	struct pw_node *this = data;
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
+
+	if (this->info.state != PW_NODE_STATE_RUNNING || impl->stats_pending)
+		return;
+
+	/* the counters are only updated from the data thread, take a
+	 * consistent copy there and publish it when the copy is done */
+	if (pw_loop_invoke(this->data_loop, do_copy_stats, 1, NULL, 0, false, this) < 0)
+		return;
+
+	impl->stats_pending = true;
+	pw_core_defer(this->core, publish_stats, this);
+}
+
 int pw_node_register(struct pw_node *this,
 		     struct pw_client *owner,
 		     struct pw_global *parent,
 		     struct pw_properties *properties)
 {
+	struct impl *impl = SPA_CONTAINER_OF(this, struct impl, this);
 	struct pw_core *core = this->core;
 	const char *str;
+	struct timespec interval;
 
 	pw_log_debug("node %p: register", this);
 
 	update_port_ids(this);
 	update_info(this);
 
+	if ((str = pw_properties_get(this->properties, PW_NODE_PROP_PROFILE)) != NULL &&
+	    pw_properties_parse_bool(str))
+		this->rt.node.flags |= SPA_GRAPH_NODE_FLAG_PROFILE;
+	if ((str = pw_properties_get(this->properties, PW_NODE_PROP_DEADLINE)) != NULL) {
+		this->rt.node.stats.deadline = strtoull(str, NULL, 10);
+		this->rt.node.flags |= SPA_GRAPH_NODE_FLAG_PROFILE;
+	}
+	if ((str = pw_properties_get(this->properties, PW_NODE_PROP_DRIVER)) != NULL &&
+	    pw_properties_parse_bool(str))
+		this->rt.node.flags |= SPA_GRAPH_NODE_FLAG_DRIVER;
+
+	if (pw_core_reserve_graph(core, this->data_loop, this->rt.graph, 1) == 0)
+		impl->reserved = true;
 	pw_loop_invoke(this->data_loop, do_node_add, 1, NULL, 0, false, this);
 
+	/* every update of the counters is an info event for all clients */
+	if (this->rt.node.flags & SPA_GRAPH_NODE_FLAG_PROFILE)
+		impl->profile_timer = pw_loop_add_timer(core->main_loop,
+							on_profile_timeout, this);
+	if (impl->profile_timer != NULL) {
+		interval.tv_sec = PROFILE_INTERVAL_SEC;
+		interval.tv_nsec = 0;
+		pw_loop_update_timer(core->main_loop, impl->profile_timer, &interval, &interval, false);
+	}
+
 	if (properties == NULL)
 		properties = pw_properties_new(NULL, NULL);
 	if (properties == NULL)
@@ -399,9 +491,7 @@ struct pw_node *pw_node_new(struct pw_core *core,
 	impl->work = pw_work_queue_new(this->core->main_loop);
 	this->info.name = strdup(name);
 
-	this->data_loop = core->data_loop;
-
-	this->rt.graph = &core->rt.graph;
+	this->data_loop = pw_core_select_data_loop(core, properties, &this->rt.graph);
 
 	spa_list_init(&this->resource_list);
 
@@ -588,7 +678,12 @@ void pw_node_destroy(struct pw_node *node)
 	pw_log_debug("node %p: destroy", impl);
 	spa_hook_list_call(&node->listener_list, struct pw_node_events, destroy);
 
-	pw_loop_invoke(node->data_loop, do_node_remove, 1, NULL, 0, true, node);
+	if (impl->profile_timer)
+		pw_loop_destroy_source(node->core->main_loop, impl->profile_timer);
+
+	pw_loop_invoke(node->data_loop, do_node_remove, 1, NULL, 0, false, node);
+	if (impl->reserved)
+		pw_core_reserve_graph(node->core, node->data_loop, node->rt.graph, -1);
 
 	if (node->global) {
 		spa_list_remove(&node->link);
@@ -623,7 +718,8 @@ void pw_node_destroy(struct pw_node *node)
 
 	clear_info(node);
 
-	free(impl);
+	/* the data loop can still reach the node until it removed it */
+	pw_core_defer(node->core, free, impl);
 }
 
 int pw_node_for_each_port(struct pw_node *node,
@@ -722,7 +818,10 @@ struct pw_port *pw_node_get_free_port(struct pw_node *node, enum pw_direction di
 		port = pw_port_new(direction, port_id, NULL, 0);
 		if (port == NULL)
 			goto no_mem;
-		pw_port_add(port, node);
+		if ((res = pw_port_add(port, node)) < 0) {
+			pw_port_destroy(port);
+			goto no_mem;
+		}
 	} else {
 		port = mixport;
 	}
@@ -93,6 +93,25 @@ struct pw_node_events {
 #define PW_NODE_PROP_AUTOCONNECT	"pipewire.autoconnect"
 /** Try to connect the node to this node id */
 #define PW_NODE_PROP_TARGET_NODE	"pipewire.target.node"
+/** Let this node pace the cycles of the graph, other nodes only run
+ *  when the driver asks for data or produced data */
+#define PW_NODE_PROP_DRIVER		"pipewire.node.driver"
+/** Name of the data loop to run the node in, overrides the
+ *  \ref PW_CORE_PROP_DATA_LOOP_POLICY of the core */
+#define PW_NODE_PROP_DATA_LOOP		"pipewire.node.data-loop"
+/** Time the processing of the node and publish the profiling counters */
+#define PW_NODE_PROP_PROFILE		"pipewire.node.profile"
+/** Max processing time of the node in nanoseconds, longer cycles are
+ *  counted as xruns. Enables profiling. */
+#define PW_NODE_PROP_DEADLINE		"pipewire.node.deadline"
+
+/** Profiling counters, published periodically while a profiled node runs.
+ *  Times are in nanoseconds. */
+#define PW_NODE_PROP_PROFILE_CYCLES	"pipewire.profile.cycles"	/**< number of process calls */
+#define PW_NODE_PROP_PROFILE_LAST_TIME	"pipewire.profile.last-time"	/**< last process time */
+#define PW_NODE_PROP_PROFILE_AVG_TIME	"pipewire.profile.avg-time"	/**< average process time */
+#define PW_NODE_PROP_PROFILE_MAX_TIME	"pipewire.profile.max-time"	/**< max process time */
+#define PW_NODE_PROP_PROFILE_XRUNS	"pipewire.profile.xruns"	/**< number of missed deadlines */
 
 /** Create a new node \memberof pw_node */
 struct pw_node *
@@ -288,6 +288,13 @@ int pw_port_add(struct pw_port *port, struct pw_node *node)
 {
 	uint32_t port_id = port->port_id;
 	struct pw_type *t = &node->core->type;
+	int res;
+
+	/* for the mix node */
+	if ((res = pw_core_reserve_graph(node->core, node->data_loop, node->rt.graph, 1)) < 0) {
+		pw_log_error("port %p: can't add to node %p: %s", port, node, spa_strerror(res));
+		return res;
+	}
 
 	port->node = node;
 
@@ -349,6 +356,17 @@ static int do_remove_port(struct spa_loop *loop,
 	return 0;
 }
 
+static void port_free(void *data)
+{
+	struct pw_port *port = data;
+
+	if (port->allocated) {
+		free(port->buffers);
+		pw_memblock_free(port->buffer_mem);
+	}
+	free(port);
+}
+
 void pw_port_destroy(struct pw_port *port)
 {
 	struct pw_node *node = port->node;
@@ -358,9 +376,11 @@ void pw_port_destroy(struct pw_port *port)
 	spa_hook_list_call(&port->listener_list, struct pw_port_events, destroy);
 
 	if (node) {
-		if (port->rt.graph)
+		if (port->rt.graph) {
 			pw_loop_invoke(port->node->data_loop, do_remove_port,
-				       SPA_ID_INVALID, NULL, 0, true, port);
+				       SPA_ID_INVALID, NULL, 0, false, port);
+			pw_core_reserve_graph(node->core, node->data_loop, port->rt.graph, -1);
+		}
 
 		if (port->direction == PW_DIRECTION_INPUT) {
 			pw_map_remove(&node->input_port_map, port->port_id);
@@ -377,15 +397,15 @@ void pw_port_destroy(struct pw_port *port)
 	pw_log_debug("port %p: free", port);
 	spa_hook_list_call(&port->listener_list, struct pw_port_events, free);
 
-	if (port->allocated) {
-		free(port->buffers);
-		pw_memblock_free(port->buffer_mem);
-	}
-
 	if (port->properties)
 		pw_properties_free(port->properties);
 
-	free(port);
+	/* the data loop can still reach the port and its buffers until it
+	 * removed the port */
+	if (node)
+		pw_core_defer(node->core, port_free, port);
+	else
+		port_free(port);
 }
 
 static int
@@ -39,6 +39,34 @@ extern "C" {
 
 struct pw_command;
 
+/** Translation of the type ids of a peer to our type ids. The peer sends
+ * its type names with update_types, the ids are dense so a flat array is
+ * enough. */
+struct pw_type_remap {
+	struct pw_array ids;	/**< our id for each id of the peer */
+	bool identity;		/**< the peer uses our ids, nothing to remap */
+};
+
+void pw_type_remap_init(struct pw_type_remap *remap);
+
+void pw_type_remap_clear(struct pw_type_remap *remap);
+
+int pw_type_remap_update(struct pw_type_remap *remap, struct spa_type_map *map,
+			 uint32_t first_id, const char **types, uint32_t n_types);
+
+/** Translate \a id of the peer, false when the peer did not send the type */
+static inline bool pw_type_remap_id(struct pw_type_remap *remap, uint32_t *id)
+{
+	uint32_t local;
+
+	if (!pw_array_check_index(&remap->ids, *id, uint32_t))
+		return false;
+	if ((local = *pw_array_get_unchecked(&remap->ids, *id, uint32_t)) == SPA_ID_INVALID)
+		return false;
+	*id = local;
+	return true;
+}
+
 typedef int (*pw_command_func_t) (struct pw_command *command, struct pw_core *core, char **err);
 
 /** \cond */
@@ -86,7 +114,7 @@ struct pw_client {
 
 	struct pw_map objects;		/**< list of resource objects */
 	uint32_t n_types;		/**< number of client types */
-	struct pw_map types;		/**< map of client types */
+	struct pw_type_remap types;	/**< map of client types */
 
 	struct spa_list resource_list;	/**< The list of resources of this client */
 
@@ -147,7 +175,7 @@ struct pw_core {
 	struct spa_hook_list listener_list;
 
 	struct pw_loop *main_loop;	/**< main loop for control */
-	struct pw_loop *data_loop;	/**< data loop for data passing */
+	struct pw_loop *data_loop;	/**< default data loop for data passing */
         struct pw_data_loop *data_loop_impl;
 
 	struct spa_support support[16];	/**< support for spa plugins */
@@ -156,10 +184,6 @@ struct pw_core {
 	struct pw_client *current_client;	/**< client currently executing code in mainloop */
 
 	long sc_pagesize;
-
-	struct {
-		struct spa_graph graph;
-	} rt;
 };
 
 struct pw_data_loop {
@@ -169,6 +193,9 @@ struct pw_data_loop {
 
         struct spa_source *event;
 
+	int rtprio;			/**< realtime priority of the thread */
+	char *affinity;			/**< list of allowed cpus or NULL */
+
         bool running;
         pthread_t thread;
 };
@@ -354,7 +381,7 @@ struct pw_remote {
         struct pw_core_info *info;		/**< info about the remote core */
 
 	uint32_t n_types;			/**< number of client types */
-	struct pw_map types;			/**< client types */
+	struct pw_type_remap types;		/**< client types */
 
 	struct spa_list proxy_list;		/**< list of \ref pw_proxy objects */
 	struct spa_list stream_list;		/**< list of \ref pw_stream objects */
@@ -443,6 +470,27 @@ pw_core_find_port(struct pw_core *core,
 		  struct spa_pod **format_filters,
 		  char **error);
 
+/** Check if \a registry wants \a event of \a global with its filter */
+bool pw_core_registry_match(struct pw_resource *registry, struct pw_global *global, uint32_t event);
+
+/** Call \a func from the main loop once the data loops applied all graph
+ * updates that were queued before. The main loop does not wait for the
+ * data loops, use this to free objects that a data thread might still
+ * use. */
+int pw_core_defer(struct pw_core *core, void (*func) (void *data), void *data);
+
+/** Select the data loop for a node with \a properties, the loop is created
+ * when needed. \a graph is set to the graph that runs in the loop. */
+struct pw_loop *pw_core_select_data_loop(struct pw_core *core,
+					 const struct pw_properties *properties,
+					 struct spa_graph **graph);
+
+/** Make room in the plan of \a graph for \a n_nodes more nodes, or release
+ * room with a negative \a n_nodes. Call this before the nodes are added in
+ * the data \a loop of the graph, the data loop then never allocates. */
+int pw_core_reserve_graph(struct pw_core *core, struct pw_loop *loop,
+			  struct spa_graph *graph, int32_t n_nodes);
+
 /** Create a new port \memberof pw_port
  * \return a newly allocated port */
 struct pw_port *
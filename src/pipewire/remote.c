@@ -50,6 +50,7 @@ struct mem_id {
 	uint32_t id;
 	int fd;
 	uint32_t flags;
+	uint32_t page_size;
 	uint32_t ref;
 };
 
@@ -82,13 +83,19 @@ struct node_data {
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
         struct pw_client_node_transport *trans;
+	struct spa_hook loop_hook;	/**< tracks if we sleep in the data loop */
+	bool hooked;
 
 	struct spa_node out_node_impl;
 	struct spa_graph_node out_node;
 	struct port *out_ports;
+	uint32_t max_output_ports;
+	uint32_t n_output_io;		/**< output ports with an io area */
 	struct spa_node in_node_impl;
 	struct spa_graph_node in_node;
 	struct port *in_ports;
+	uint32_t max_input_ports;
+	uint32_t n_input_io;		/**< input ports with an io area */
 
         struct pw_array mem_ids;
 
@@ -192,13 +199,9 @@ static void
 core_event_update_types(void *data, uint32_t first_id, const char **types, uint32_t n_types)
 {
 	struct pw_remote *this = data;
-	int i;
 
-	for (i = 0; i < n_types; i++, first_id++) {
-		uint32_t this_id = spa_type_map_get_id(this->core->type.map, types[i]);
-		if (!pw_map_insert_at(&this->types, first_id, PW_MAP_ID_TO_PTR(this_id)))
-			pw_log_error("can't add type for client");
-	}
+	if (pw_type_remap_update(&this->types, this->core->type.map, first_id, types, n_types) < 0)
+		pw_log_error("can't add type for client");
 }
 
 static const struct pw_core_proxy_events core_proxy_events = {
@@ -243,7 +246,7 @@ struct pw_remote *pw_remote_new(struct pw_core *core,
 	this->state = PW_REMOTE_STATE_UNCONNECTED;
 
 	pw_map_init(&this->objects, 64, 32);
-	pw_map_init(&this->types, 64, 32);
+	pw_type_remap_init(&this->types);
 
 	spa_list_init(&this->proxy_list);
 	spa_list_init(&this->stream_list);
@@ -431,7 +434,8 @@ int pw_remote_disconnect(struct pw_remote *remote)
 	remote->core_proxy = NULL;
 
 	pw_map_clear(&remote->objects);
-	pw_map_clear(&remote->types);
+	pw_type_remap_clear(&remote->types);
+	pw_type_remap_init(&remote->types);
 	remote->n_types = 0;
 
 	if (remote->info) {
@@ -453,6 +457,10 @@ do_remove_source(struct spa_loop *loop,
 		pw_loop_destroy_source(d->core->data_loop, d->rtsocket_source);
 		d->rtsocket_source = NULL;
 	}
+	if (d->hooked) {
+		spa_hook_remove(&d->loop_hook);
+		d->hooked = false;
+	}
         return 0;
 }
 
@@ -504,11 +512,21 @@ static void handle_rtnode_message(struct pw_proxy *proxy, struct pw_client_node_
 	}
 }
 
+static void on_rtnode_message(void *data, struct pw_client_node_message *message)
+{
+	handle_rtnode_message(data, message);
+}
+
+static void read_rtnode_messages(struct pw_proxy *proxy)
+{
+	struct node_data *data = proxy->user_data;
+	pw_client_node_transport_read_messages(data->trans, on_rtnode_message, proxy);
+}
+
 static void
 on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 {
 	struct pw_proxy *proxy = user_data;
-	struct node_data *data = proxy->user_data;
 
 	if (mask & (SPA_IO_ERR | SPA_IO_HUP)) {
 		pw_log_warn("got error");
@@ -517,7 +535,6 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
@@ -526,15 +543,51 @@ on_rtsocket_condition(void *user_data, int fd, enum spa_io mask)
 		if (cmd > 1)
 			pw_log_warn("proxy %p: %ld messages", proxy, cmd);
 
-
-		while (pw_client_node_transport_next_message(data->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(data->trans, msg);
-			handle_rtnode_message(proxy, msg);
-		}
+		read_rtnode_messages(proxy);
 	}
 }
 
+static void loop_before(void *user_data)
+{
+	struct pw_proxy *proxy = user_data;
+	struct node_data *data = proxy->user_data;
+
+	if (!(data->rtsocket_source->mask & SPA_IO_IN))
+		return;
+
+	/* the server signals us from now on, read what it sent while
+	 * we were awake */
+	pw_client_node_transport_set_awake(data->trans, false);
+	read_rtnode_messages(proxy);
+}
+
+static void loop_after(void *user_data)
+{
+	struct pw_proxy *proxy = user_data;
+	struct node_data *data = proxy->user_data;
+
+	if (data->rtsocket_source->mask & SPA_IO_IN)
+		pw_client_node_transport_set_awake(data->trans, true);
+}
+
+static const struct spa_loop_control_hooks loop_hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.before = loop_before,
+	.after = loop_after,
+};
+
+static int
+do_add_hook(struct spa_loop *loop,
+            bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_proxy *proxy = user_data;
+	struct node_data *d = proxy->user_data;
+
+	pw_loop_add_hook(d->core->data_loop, &d->loop_hook, &loop_hooks, proxy);
+	d->hooked = true;
+	return 0;
+}
+
 static struct mem_id *find_mem(struct pw_array *mem_ids, uint32_t id)
 {
 	struct mem_id *mid;
@@ -578,10 +631,14 @@ static void clean_transport(struct pw_proxy *proxy)
 	unhandle_socket(proxy);
 
 	spa_list_for_each(port, &data->node->input_ports, link) {
+		if (port->port_id >= data->n_input_io)
+			continue;
 		spa_graph_port_remove(&data->in_ports[port->port_id].output);
 		spa_graph_port_remove(&data->in_ports[port->port_id].input);
 	}
 	spa_list_for_each(port, &data->node->output_ports, link) {
+		if (port->port_id >= data->n_output_io)
+			continue;
 		spa_graph_port_remove(&data->out_ports[port->port_id].output);
 		spa_graph_port_remove(&data->out_ports[port->port_id].input);
 	}
@@ -592,6 +649,7 @@ static void clean_transport(struct pw_proxy *proxy)
 
 	free(data->in_ports);
 	free(data->out_ports);
+	data->n_input_io = data->n_output_io = 0;
 	pw_client_node_transport_destroy(data->trans);
 	close(data->rtwritefd);
 
@@ -608,12 +666,12 @@ static void port_init(struct port *port)
 static struct port *find_port(struct node_data *data, enum spa_direction direction, uint32_t port_id)
 {
 	if (direction == SPA_DIRECTION_INPUT) {
-		if (port_id > data->trans->area->max_input_ports)
+		if (port_id >= data->n_input_io)
 			return NULL;
 		return &data->in_ports[port_id];
 	}
 	else {
-		if (port_id > data->trans->area->max_output_ports)
+		if (port_id >= data->n_output_io)
 			return NULL;
 		return &data->out_ports[port_id];
 	}
@@ -640,80 +698,104 @@ static void client_node_add_mem(void *object,
 	m->id = mem_id;
 	m->fd = memfd;
 	m->flags = flags;
+	m->page_size = pw_memblock_get_page_size(memfd, flags,
+						 proxy->remote->core->sc_pagesize);
 	m->ref = 0;
 }
 
-static void client_node_transport(void *object, uint32_t node_id,
-                                  int readfd, int writefd,
-				  struct pw_client_node_transport *transport)
+/* set up the ports that got an io area in the transport since the last call */
+static void setup_ports(struct node_data *data)
 {
-	struct pw_proxy *proxy = object;
-	struct node_data *data = proxy->user_data;
 	struct pw_port *port;
-	int i;
-
-	clean_transport(proxy);
-
-	data->node_id = node_id;
-	data->trans = transport;
-
-	pw_log_info("remote-node %p: create transport %p with fds %d %d for node %u",
-		proxy, data->trans, readfd, writefd, node_id);
-
-	data->in_ports = calloc(data->trans->area->max_input_ports,
-				 sizeof(struct port));
-	data->out_ports = calloc(data->trans->area->max_output_ports,
-				  sizeof(struct port));
+	struct spa_io_buffers *io;
+	uint32_t i, start;
 
-	for (i = 0; i < data->trans->area->max_input_ports; i++) {
+	for (i = start = data->n_input_io; i < data->max_input_ports; i++) {
+		if ((io = pw_client_node_transport_get_input(data->trans, i)) == NULL)
+			break;
 		port_init(&data->in_ports[i]);
-		data->trans->inputs[i] = SPA_IO_BUFFERS_INIT;
+		*io = SPA_IO_BUFFERS_INIT;
 		spa_graph_port_init(&data->in_ports[i].input,
 				    SPA_DIRECTION_INPUT,
 				    i,
 				    0,
-				    &data->trans->inputs[i]);
+				    io);
 		spa_graph_port_init(&data->in_ports[i].output,
 				    SPA_DIRECTION_OUTPUT,
 				    i,
 				    0,
-				    &data->trans->inputs[i]);
+				    io);
 		spa_graph_port_add(&data->in_node, &data->in_ports[i].output);
 		spa_graph_port_link(&data->in_ports[i].output, &data->in_ports[i].input);
-		pw_log_info("transport in %d %p", i, &data->trans->inputs[i]);
+		pw_log_info("transport in %d %p", i, io);
 	}
+	data->n_input_io = i;
+
 	spa_list_for_each(port, &data->node->input_ports, link) {
+		if (port->port_id < start || port->port_id >= data->n_input_io)
+			continue;
 		spa_graph_port_add(&port->rt.mix_node, &data->in_ports[port->port_id].input);
 		data->in_ports[port->port_id].port = port;
 	}
 
-	for (i = 0; i < data->trans->area->max_output_ports; i++) {
+	for (i = start = data->n_output_io; i < data->max_output_ports; i++) {
+		if ((io = pw_client_node_transport_get_output(data->trans, i)) == NULL)
+			break;
 		port_init(&data->out_ports[i]);
-		data->trans->outputs[i] = SPA_IO_BUFFERS_INIT;
+		*io = SPA_IO_BUFFERS_INIT;
 		spa_graph_port_init(&data->out_ports[i].output,
 				    SPA_DIRECTION_OUTPUT,
 				    i,
 				    0,
-				    &data->trans->outputs[i]);
+				    io);
 		spa_graph_port_init(&data->out_ports[i].input,
 				    SPA_DIRECTION_INPUT,
 				    i,
 				    0,
-				    &data->trans->outputs[i]);
+				    io);
 		spa_graph_port_add(&data->out_node, &data->out_ports[i].input);
 		spa_graph_port_link(&data->out_ports[i].output, &data->out_ports[i].input);
-		pw_log_info("transport out %d %p", i, &data->trans->inputs[i]);
+		pw_log_info("transport out %d %p", i, io);
 	}
+	data->n_output_io = i;
+
 	spa_list_for_each(port, &data->node->output_ports, link) {
+		if (port->port_id < start || port->port_id >= data->n_output_io)
+			continue;
 		spa_graph_port_add(&port->rt.mix_node, &data->out_ports[port->port_id].output);
 		data->out_ports[port->port_id].port = port;
 	}
+}
+
+static void client_node_transport(void *object, uint32_t node_id,
+                                  int readfd, int writefd,
+				  struct pw_client_node_transport *transport)
+{
+	struct pw_proxy *proxy = object;
+	struct node_data *data = proxy->user_data;
+
+	clean_transport(proxy);
+
+	data->node_id = node_id;
+	data->trans = transport;
+
+	pw_log_info("remote-node %p: create transport %p with fds %d %d for node %u",
+		proxy, data->trans, readfd, writefd, node_id);
+
+	data->max_input_ports = data->node->info.max_input_ports;
+	data->max_output_ports = data->node->info.max_output_ports;
+	data->in_ports = calloc(data->max_input_ports, sizeof(struct port));
+	data->out_ports = calloc(data->max_output_ports, sizeof(struct port));
+	setup_ports(data);
 
         data->rtwritefd = writefd;
         data->rtsocket_source = pw_loop_add_io(proxy->remote->core->data_loop,
                                                readfd,
                                                SPA_IO_ERR | SPA_IO_HUP,
                                                true, on_rtsocket_condition, proxy);
+        pw_loop_invoke(data->core->data_loop,
+                       do_add_hook, 1, NULL, 0, true, proxy);
+
 	if (data->node->active)
 		pw_client_node_proxy_set_active(data->node_proxy, true);
 }
@@ -796,7 +878,8 @@ static void node_need_input(void *data)
         uint64_t cmd = 1;
 	pw_client_node_transport_add_message(d->trans,
 				&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+	        write(d->rtwritefd, &cmd, 8);
 }
 
 static void node_have_output(void *data)
@@ -805,7 +888,8 @@ static void node_have_output(void *data)
         uint64_t cmd = 1;
         pw_client_node_transport_add_message(d->trans,
                                &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-        write(d->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(d->trans))
+	        write(d->rtwritefd, &cmd, 8);
 }
 
 static void client_node_command(void *object, uint32_t seq, const struct spa_command *command)
@@ -841,8 +925,8 @@ static void client_node_command(void *object, uint32_t seq, const struct spa_com
 
 		/* FIXME we should call process_output on the node and see what its
 		 * status is */
-		for (i = 0; i < data->trans->area->max_input_ports; i++)
-			data->trans->inputs[i].status = SPA_STATUS_NEED_BUFFER;
+		for (i = 0; i < data->n_input_io; i++)
+			data->in_ports[i].input.io->status = SPA_STATUS_NEED_BUFFER;
 		node_need_input(data);
 
 		pw_client_node_proxy_done(data->node_proxy, seq, res);
@@ -982,7 +1066,7 @@ client_node_port_use_buffers(void *object,
 		len = pw_array_get_len(&port->buffer_ids, struct buffer_id);
 		bid = pw_array_add(&port->buffer_ids, sizeof(struct buffer_id));
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, core->sc_pagesize);
+		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, mid->page_size);
 
 		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, mid->fd, bid->map.offset);
 		if (bid->ptr == MAP_FAILED) {
@@ -1117,7 +1201,7 @@ client_node_port_set_io(void *object,
 		pw_log_warn("unknown memory id %u", memid);
 		return;
 	}
-	pw_map_range_init(&r, offset, size, core->sc_pagesize);
+	pw_map_range_init(&r, offset, size, mid->page_size);
 
 	ptr = mmap(NULL, r.size, PROT_READ|PROT_WRITE, MAP_SHARED, mid->fd, r.offset);
 	if (ptr == MAP_FAILED) {
@@ -1135,6 +1219,35 @@ client_node_port_set_io(void *object,
 }
 
 
+static int
+do_add_segment(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct pw_proxy *proxy = user_data;
+	struct node_data *d = proxy->user_data;
+	struct pw_client_node_transport *segment = *(struct pw_client_node_transport **) data;
+
+	pw_client_node_transport_add_segment(d->trans, segment);
+	setup_ports(d);
+	return 0;
+}
+
+static void client_node_transport_segment(void *object,
+					  struct pw_client_node_transport *segment)
+{
+	struct pw_proxy *proxy = object;
+	struct node_data *data = proxy->user_data;
+
+	if (data->trans == NULL) {
+		pw_client_node_transport_destroy(segment);
+		return;
+	}
+	pw_log_info("remote-node %p: add transport segment %p", proxy, segment);
+
+	pw_loop_invoke(data->core->data_loop,
+		       do_add_segment, SPA_ID_INVALID, &segment, sizeof(segment), true, proxy);
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -1148,6 +1261,7 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
 	.port_set_io = client_node_port_set_io,
+	.transport_segment = client_node_transport_segment,
 };
 
 static void do_node_init(struct pw_proxy *proxy)
@@ -1213,9 +1327,9 @@ static void node_proxy_destroy(void *_data)
 	int i;
 
 	if (data->trans) {
-		for (i = 0; i < data->trans->area->max_input_ports; i++)
+		for (i = 0; i < data->n_input_io; i++)
 			clear_port(data, &data->in_ports[i]);
-		for (i = 0; i < data->trans->area->max_output_ports; i++)
+		for (i = 0; i < data->n_output_io; i++)
 			clear_port(data, &data->out_ports[i]);
 	}
 	clean_transport(proxy);
@@ -46,6 +46,7 @@ struct mem_id {
 	uint32_t id;
 	int fd;
 	uint32_t flags;
+	uint32_t page_size;
 	uint32_t ref;
 };
 
@@ -82,6 +83,8 @@ struct stream {
 
 	int rtwritefd;
 	struct spa_source *rtsocket_source;
+	struct spa_hook loop_hook;	/**< tracks if we sleep in the data loop */
+	bool hooked;
 
 	struct pw_client_node_proxy *node_proxy;
 	bool disconnecting;
@@ -90,6 +93,10 @@ struct stream {
 
 	struct pw_client_node_transport *trans;
 
+	struct pw_client_node_transport *peer_trans;	/**< direct link to the peer stream */
+	struct spa_source *peer_source;
+	int peer_writefd;
+
 	struct spa_source *timeout_source;
 
 	struct pw_array mem_ids;
@@ -229,6 +236,7 @@ struct pw_stream *pw_stream_new(struct pw_remote *remote,
 	this->name = strdup(name);
 	impl->type_client_node = spa_type_map_get_id(remote->core->type.map, PW_TYPE_INTERFACE__ClientNode);
 	impl->rtwritefd = -1;
+	impl->peer_writefd = -1;
 
 	str = pw_properties_get(props, "pipewire.client.reuse");
 	impl->client_reuse = str && pw_properties_parse_bool(str);
@@ -289,9 +297,9 @@ do_remove_sources(struct spa_loop *loop,
 		pw_loop_destroy_source(stream->remote->core->data_loop, impl->rtsocket_source);
 		impl->rtsocket_source = NULL;
 	}
-	if (impl->timeout_source) {
-		pw_loop_destroy_source(stream->remote->core->data_loop, impl->timeout_source);
-		impl->timeout_source = NULL;
+	if (impl->hooked) {
+		spa_hook_remove(&impl->loop_hook);
+		impl->hooked = false;
 	}
 	if (impl->rtwritefd != -1) {
 		close(impl->rtwritefd);
@@ -308,6 +316,18 @@ static void unhandle_socket(struct pw_stream *stream)
                        do_remove_sources, 1, NULL, 0, true, impl);
 }
 
+/* the timer is in the main loop and is destroyed from the main thread,
+ * the timers of a loop can't be changed while the loop runs them */
+static void unhandle_timeout(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->timeout_source) {
+		pw_loop_destroy_source(stream->remote->core->main_loop, impl->timeout_source);
+		impl->timeout_source = NULL;
+	}
+}
+
 static void
 set_init_params(struct pw_stream *stream,
 		     int n_init_params,
@@ -433,14 +453,30 @@ static void add_port_update(struct pw_stream *stream, uint32_t change_mask)
 					 &impl->port_info);
 }
 
+static inline void send_peer_message(struct stream *impl, struct pw_client_node_message *message)
+{
+	uint64_t cmd = 1;
+
+	/* the peer does not track if it is awake, always signal it */
+	pw_client_node_transport_add_message(impl->peer_trans, message);
+	write(impl->peer_writefd, &cmd, 8);
+}
+
 static inline void send_need_input(struct pw_stream *stream)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
 
+	if (impl->peer_trans) {
+		send_peer_message(impl,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
+		return;
+	}
+
 	pw_client_node_transport_add_message(impl->trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_NEED_INPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static inline void send_have_output(struct pw_stream *stream)
@@ -450,7 +486,8 @@ static inline void send_have_output(struct pw_stream *stream)
 
 	pw_client_node_transport_add_message(impl->trans,
 			       &PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
@@ -458,9 +495,16 @@ static inline void send_reuse_buffer(struct pw_stream *stream, uint32_t id)
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	uint64_t cmd = 1;
 
+	if (impl->peer_trans) {
+		send_peer_message(impl, (struct pw_client_node_message*)
+			&PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(impl->port_id, id));
+		return;
+	}
+
 	pw_client_node_transport_add_message(impl->trans, (struct pw_client_node_message*)
 			       &PW_CLIENT_NODE_MESSAGE_PORT_REUSE_BUFFER_INIT(impl->port_id, id));
-	write(impl->rtwritefd, &cmd, 8);
+	if (pw_client_node_transport_need_wakeup(impl->trans))
+		write(impl->rtwritefd, &cmd, 8);
 }
 
 static void add_request_clock_update(struct pw_stream *stream)
@@ -559,7 +603,7 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 		int i;
 
 		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
-			struct spa_io_buffers *input = &impl->trans->inputs[i];
+			struct spa_io_buffers *input = &impl->trans->inputs[i].io;
 			struct buffer_id *bid;
 			uint32_t buffer_id;
 
@@ -592,7 +636,7 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 		int i;
 
 		for (i = 0; i < impl->trans->area->n_output_ports; i++) {
-			struct spa_io_buffers *output = &impl->trans->outputs[i];
+			struct spa_io_buffers *output = &impl->trans->outputs[i].io;
 
 			if (output->buffer_id == SPA_ID_INVALID)
 				continue;
@@ -625,6 +669,17 @@ static void handle_rtnode_message(struct pw_stream *stream, struct pw_client_nod
 	}
 }
 
+static void on_rtnode_message(void *data, struct pw_client_node_message *message)
+{
+	handle_rtnode_message(data, message);
+}
+
+static void read_rtnode_messages(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	pw_client_node_transport_read_messages(impl->trans, on_rtnode_message, stream);
+}
+
 static void
 on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 {
@@ -638,20 +693,57 @@ on_rtsocket_condition(void *data, int fd, enum spa_io mask)
 	}
 
 	if (mask & SPA_IO_IN) {
-		struct pw_client_node_message message;
 		uint64_t cmd;
 
 		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
 			pw_log_warn("stream %p: read failed %m", impl);
 
-		while (pw_client_node_transport_next_message(impl->trans, &message) == 1) {
-			struct pw_client_node_message *msg = alloca(SPA_POD_SIZE(&message));
-			pw_client_node_transport_parse_message(impl->trans, msg);
-			handle_rtnode_message(stream, msg);
-		}
+		read_rtnode_messages(stream);
 	}
 }
 
+static void loop_before(void *data)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (!(impl->rtsocket_source->mask & SPA_IO_IN))
+		return;
+
+	/* the server signals us from now on, read what it sent while
+	 * we were awake */
+	pw_client_node_transport_set_awake(impl->trans, false);
+	read_rtnode_messages(stream);
+}
+
+static void loop_after(void *data)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (impl->rtsocket_source->mask & SPA_IO_IN)
+		pw_client_node_transport_set_awake(impl->trans, true);
+}
+
+static const struct spa_loop_control_hooks loop_hooks = {
+	SPA_VERSION_LOOP_CONTROL_HOOKS,
+	.before = loop_before,
+	.after = loop_after,
+};
+
+static int
+do_add_hook(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+
+	if (!impl->hooked)
+		pw_loop_add_hook(impl->this.remote->core->data_loop, &impl->loop_hook,
+				 &loop_hooks, &impl->this);
+	impl->hooked = true;
+	return 0;
+}
+
 static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
@@ -662,8 +754,10 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 					       rtreadfd,
 					       SPA_IO_ERR | SPA_IO_HUP,
 					       true, on_rtsocket_condition, stream);
+        pw_loop_invoke(stream->remote->core->data_loop,
+                       do_add_hook, 1, NULL, 0, true, impl);
 
-	if (impl->flags & PW_STREAM_FLAG_CLOCK_UPDATE) {
+	if ((impl->flags & PW_STREAM_FLAG_CLOCK_UPDATE) && impl->timeout_source == NULL) {
 		impl->timeout_source = pw_loop_add_timer(stream->remote->core->main_loop, on_timeout, stream);
 		interval.tv_sec = 0;
 		interval.tv_nsec = 100000000;
@@ -672,6 +766,146 @@ static void handle_socket(struct pw_stream *stream, int rtreadfd, int rtwritefd)
 	return;
 }
 
+static void on_peer_message(void *data, struct pw_client_node_message *message)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_buffers *io = &impl->peer_trans->outputs[0].io;
+
+	switch (PW_CLIENT_NODE_MESSAGE_TYPE(message)) {
+	case PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT:
+	{
+		struct buffer_id *bid;
+		uint32_t buffer_id = io->buffer_id;
+
+		pw_log_trace("stream %p: peer have output %d %d", stream, io->status, buffer_id);
+
+		if (io->status == SPA_STATUS_HAVE_BUFFER &&
+		    (bid = find_buffer(stream, buffer_id)) != NULL) {
+			if (impl->client_reuse)
+				io->buffer_id = SPA_ID_INVALID;
+
+			bid->used = true;
+			impl->in_new_buffer = true;
+			spa_hook_list_call(&stream->listener_list, struct pw_stream_events,
+					   new_buffer, buffer_id);
+			impl->in_new_buffer = false;
+		}
+		io->status = SPA_STATUS_NEED_BUFFER;
+		send_need_input(stream);
+		break;
+	}
+	case PW_CLIENT_NODE_MESSAGE_NEED_INPUT:
+		pw_log_trace("stream %p: peer need input %d", stream, io->buffer_id);
+
+		if (io->buffer_id != SPA_ID_INVALID) {
+			reuse_buffer(stream, io->buffer_id);
+			io->buffer_id = SPA_ID_INVALID;
+		}
+		impl->in_need_buffer = true;
+		spa_hook_list_call(&stream->listener_list, struct pw_stream_events, need_buffer);
+		impl->in_need_buffer = false;
+		break;
+	default:
+		handle_rtnode_message(stream, message);
+		break;
+	}
+}
+
+static void
+on_peer_condition(void *data, int fd, enum spa_io mask)
+{
+	struct pw_stream *stream = data;
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+
+	if (mask & (SPA_IO_ERR | SPA_IO_HUP)) {
+		pw_log_warn("stream %p: peer error", stream);
+		pw_loop_update_io(stream->remote->core->data_loop, impl->peer_source, 0);
+		return;
+	}
+
+	if (mask & SPA_IO_IN) {
+		uint64_t cmd;
+
+		if (read(fd, &cmd, sizeof(uint64_t)) != sizeof(uint64_t))
+			pw_log_warn("stream %p: read failed %m", impl);
+
+		pw_client_node_transport_read_messages(impl->peer_trans, on_peer_message, stream);
+	}
+}
+
+struct peer_info {
+	int readfd;
+	int writefd;
+	struct pw_client_node_transport *trans;
+};
+
+static int
+do_add_peer(struct spa_loop *loop,
+	    bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	const struct peer_info *info = data;
+	enum spa_io mask = SPA_IO_ERR | SPA_IO_HUP;
+
+	if (stream->state == PW_STREAM_STATE_STREAMING)
+		mask |= SPA_IO_IN;
+
+	impl->peer_writefd = info->writefd;
+	impl->peer_trans = info->trans;
+	impl->peer_source = pw_loop_add_io(stream->remote->core->data_loop,
+					   info->readfd, mask,
+					   true, on_peer_condition, stream);
+
+	/* ask the peer for data, it would otherwise wait for the server */
+	if (impl->direction == SPA_DIRECTION_INPUT &&
+	    stream->state == PW_STREAM_STATE_STREAMING)
+		send_need_input(stream);
+	return 0;
+}
+
+static int
+do_remove_peer(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_stream *stream = &impl->this;
+	struct spa_io_buffers *io = &impl->peer_trans->outputs[0].io;
+
+	pw_loop_destroy_source(stream->remote->core->data_loop, impl->peer_source);
+	impl->peer_source = NULL;
+
+	/* take back the buffer the peer did not recycle yet */
+	if (impl->direction == SPA_DIRECTION_OUTPUT &&
+	    io->buffer_id != SPA_ID_INVALID)
+		reuse_buffer(stream, io->buffer_id);
+
+	impl->peer_trans = NULL;
+
+	/* data comes from the server again */
+	if (impl->direction == SPA_DIRECTION_INPUT &&
+	    stream->state == PW_STREAM_STATE_STREAMING)
+		send_need_input(stream);
+	return 0;
+}
+
+static void unhandle_peer(struct pw_stream *stream)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct pw_client_node_transport *trans = impl->peer_trans;
+
+	if (trans == NULL)
+		return;
+
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_remove_peer, 1, NULL, 0, true, impl);
+
+	close(impl->peer_writefd);
+	impl->peer_writefd = -1;
+	pw_client_node_transport_destroy(trans);
+}
+
 static void
 client_node_set_param(void *data, uint32_t seq, uint32_t id, uint32_t flags,
 		      const struct spa_pod *param)
@@ -698,6 +932,9 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 
 			pw_loop_update_io(stream->remote->core->data_loop,
 					  impl->rtsocket_source, SPA_IO_ERR | SPA_IO_HUP);
+			if (impl->peer_source)
+				pw_loop_update_io(stream->remote->core->data_loop,
+						  impl->peer_source, SPA_IO_ERR | SPA_IO_HUP);
 
 			stream_set_state(stream, PW_STREAM_STATE_PAUSED, NULL);
 		}
@@ -712,10 +949,14 @@ static void client_node_command(void *data, uint32_t seq, const struct spa_comma
 			pw_loop_update_io(stream->remote->core->data_loop,
 					  impl->rtsocket_source,
 					  SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
+			if (impl->peer_source)
+				pw_loop_update_io(stream->remote->core->data_loop,
+						  impl->peer_source,
+						  SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP);
 
 			if (impl->direction == SPA_DIRECTION_INPUT) {
 				for (i = 0; i < impl->trans->area->max_input_ports; i++)
-					impl->trans->inputs[i].status = SPA_STATUS_NEED_BUFFER;
+					impl->trans->inputs[i].io.status = SPA_STATUS_NEED_BUFFER;
 				send_need_input(stream);
 			}
 			else {
@@ -817,6 +1058,8 @@ client_node_add_mem(void *data,
 	m->id = mem_id;
 	m->fd = memfd;
 	m->flags = flags;
+	m->page_size = pw_memblock_get_page_size(memfd, flags,
+						 stream->remote->core->sc_pagesize);
 }
 
 static void
@@ -859,15 +1102,21 @@ client_node_port_use_buffers(void *data,
 
 		b = buffers[i].buffer;
 
-		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, core->sc_pagesize);
+		pw_map_range_init(&bid->map, buffers[i].offset, buffers[i].size, mid->page_size);
 
-		bid->ptr = mmap(NULL, bid->map.size, prot, MAP_SHARED, mid->fd, bid->map.offset);
+		bid->ptr = mmap(NULL, bid->map.size, prot,
+				MAP_SHARED | (mid->flags & PW_MEMBLOCK_FLAG_PREFAULT ? MAP_POPULATE : 0),
+				mid->fd, bid->map.offset);
 		if (bid->ptr == MAP_FAILED) {
 			bid->ptr = NULL;
 			pw_log_warn("Failed to mmap memory %d %p: %s", bid->map.size, mid,
 				    strerror(errno));
 			continue;
 		}
+		/* the daemon locked the memory, don't fault on our side either */
+		if ((mid->flags & PW_MEMBLOCK_FLAG_LOCK) && mlock(bid->ptr, bid->map.size) < 0)
+			pw_log_warn("Failed to mlock memory %u %u: %m",
+					bid->map.offset, bid->map.size);
 
 		{
 			size_t size;
@@ -977,6 +1226,60 @@ static void client_node_transport(void *data, uint32_t node_id,
 	stream_set_state(stream, PW_STREAM_STATE_CONFIGURE, NULL);
 }
 
+static int
+do_add_segment(struct spa_loop *loop,
+	       bool async, uint32_t seq, const void *data, size_t size, void *user_data)
+{
+	struct stream *impl = user_data;
+	struct pw_client_node_transport *segment = *(struct pw_client_node_transport **) data;
+
+	pw_client_node_transport_add_segment(impl->trans, segment);
+	return 0;
+}
+
+static void client_node_transport_segment(void *data,
+					  struct pw_client_node_transport *segment)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+
+	if (impl->trans == NULL) {
+		pw_client_node_transport_destroy(segment);
+		return;
+	}
+	pw_log_info("stream %p: add transport segment %p", stream, segment);
+
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_add_segment, SPA_ID_INVALID, &segment, sizeof(segment), true, impl);
+}
+
+static void client_node_port_peer(void *data,
+				  enum spa_direction direction,
+				  uint32_t port_id,
+				  int readfd, int writefd,
+				  struct pw_client_node_transport *transport)
+{
+	struct stream *impl = data;
+	struct pw_stream *stream = &impl->this;
+	struct peer_info info = { readfd, writefd, transport };
+
+	if (direction != impl->direction || port_id != impl->port_id)
+		return;
+
+	unhandle_peer(stream);
+
+	if (transport == NULL) {
+		pw_log_info("stream %p: removed direct link", stream);
+		return;
+	}
+
+	pw_log_info("stream %p: direct link with transport %p and fds %d %d",
+			stream, transport, readfd, writefd);
+
+	pw_loop_invoke(stream->remote->core->data_loop,
+		       do_add_peer, 1, &info, sizeof(info), true, impl);
+}
+
 static const struct pw_client_node_proxy_events client_node_events = {
 	PW_VERSION_CLIENT_NODE_PROXY_EVENTS,
 	.add_mem = client_node_add_mem,
@@ -989,6 +1292,8 @@ static const struct pw_client_node_proxy_events client_node_events = {
 	.port_set_param = client_node_port_set_param,
 	.port_use_buffers = client_node_port_use_buffers,
 	.port_command = client_node_port_command,
+	.port_peer = client_node_port_peer,
+	.transport_segment = client_node_transport_segment,
 };
 
 static void on_node_proxy_destroy(void *data)
@@ -1033,6 +1338,9 @@ pw_stream_connect(struct pw_stream *stream,
 		pw_properties_set(stream->properties, PW_NODE_PROP_TARGET_NODE, port_path);
 	if (flags & PW_STREAM_FLAG_AUTOCONNECT)
 		pw_properties_set(stream->properties, PW_NODE_PROP_AUTOCONNECT, "1");
+	/* we can exchange buffers with a linked stream without the server */
+	if (!pw_properties_get(stream->properties, "pipewire.client.direct"))
+		pw_properties_set(stream->properties, "pipewire.client.direct", "1");
 
 	impl->node_proxy = pw_core_proxy_create_object(stream->remote->core_proxy,
 			       "client-node",
@@ -1087,7 +1395,9 @@ int pw_stream_disconnect(struct pw_stream *stream)
 
 	impl->disconnecting = true;
 
+	unhandle_peer(stream);
 	unhandle_socket(stream);
+	unhandle_timeout(stream);
 
 	if (impl->node_proxy) {
 		pw_client_node_proxy_destroy(impl->node_proxy);
@@ -1147,11 +1457,13 @@ int pw_stream_recycle_buffer(struct pw_stream *stream, uint32_t id)
 	bid->used = false;
 	spa_list_append(&impl->free, &bid->link);
 
-	if (impl->in_new_buffer) {
+	if (impl->in_new_buffer && impl->peer_trans) {
+		impl->peer_trans->outputs[0].io.buffer_id = id;
+	} else if (impl->in_new_buffer) {
 		int i;
 
 		for (i = 0; i < impl->trans->area->n_input_ports; i++) {
-			struct spa_io_buffers *input = &impl->trans->inputs[i];
+			struct spa_io_buffers *input = &impl->trans->inputs[i].io;
 			input->buffer_id = id;
 		}
 	} else {
@@ -1171,22 +1483,51 @@ struct spa_buffer *pw_stream_peek_buffer(struct pw_stream *stream, uint32_t id)
 	return NULL;
 }
 
+static int send_peer_buffer(struct pw_stream *stream, uint32_t id)
+{
+	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
+	struct spa_io_buffers *io = &impl->peer_trans->outputs[0].io;
+	struct buffer_id *bid;
+
+	if (io->status == SPA_STATUS_HAVE_BUFFER || io->buffer_id != SPA_ID_INVALID) {
+		pw_log_debug("can't send %u, pending buffer %u", id, io->buffer_id);
+		return -EIO;
+	}
+
+	if ((bid = find_buffer(stream, id)) && !bid->used) {
+		bid->used = true;
+		spa_list_remove(&bid->link);
+		io->buffer_id = id;
+		io->status = SPA_STATUS_HAVE_BUFFER;
+		pw_log_trace("stream %p: send buffer %d to peer", stream, id);
+		send_peer_message(impl,
+			&PW_CLIENT_NODE_MESSAGE_INIT(PW_CLIENT_NODE_MESSAGE_HAVE_OUTPUT));
+	} else {
+		pw_log_debug("stream %p: output %u was used", stream, id);
+	}
+
+	return 0;
+}
+
 int pw_stream_send_buffer(struct pw_stream *stream, uint32_t id)
 {
 	struct stream *impl = SPA_CONTAINER_OF(stream, struct stream, this);
 	struct buffer_id *bid;
 
-	if (impl->trans->outputs[0].buffer_id != SPA_ID_INVALID) {
+	if (impl->peer_trans)
+		return send_peer_buffer(stream, id);
+
+	if (impl->trans->outputs[0].io.buffer_id != SPA_ID_INVALID) {
 		pw_log_debug("can't send %u, pending buffer %u", id,
-			     impl->trans->outputs[0].buffer_id);
+			     impl->trans->outputs[0].io.buffer_id);
 		return -EIO;
 	}
 
 	if ((bid = find_buffer(stream, id)) && !bid->used) {
 		bid->used = true;
 		spa_list_remove(&bid->link);
-		impl->trans->outputs[0].buffer_id = id;
-		impl->trans->outputs[0].status = SPA_STATUS_HAVE_BUFFER;
+		impl->trans->outputs[0].io.buffer_id = id;
+		impl->trans->outputs[0].io.status = SPA_STATUS_HAVE_BUFFER;
 		pw_log_trace("stream %p: send buffer %d", stream, id);
 		if (!impl->in_need_buffer)
 			send_have_output(stream);
@@ -18,6 +18,7 @@
  */
 
 #include <string.h>
+#include <errno.h>
 
 #include <spa/support/type-map.h>
 #include <spa/utils/defs.h>
@@ -27,6 +28,7 @@
 #include <spa/monitor/monitor.h>
 
 #include "pipewire/pipewire.h"
+#include "pipewire/private.h"
 #include "pipewire/type.h"
 #include "pipewire/module.h"
 
@@ -66,3 +68,54 @@ int pw_type_init(struct pw_type *type)
 	spa_type_param_io_map(type->map, &type->param_io);
 	return 0;
 }
+
+/** Initialize a type translation table
+ * \param remap the table to initialize
+ *
+ * An empty table is the identity.
+ */
+void pw_type_remap_init(struct pw_type_remap *remap)
+{
+	pw_array_init(&remap->ids, 64 * sizeof(uint32_t));
+	remap->identity = true;
+}
+
+/** Free the memory of a type translation table */
+void pw_type_remap_clear(struct pw_type_remap *remap)
+{
+	pw_array_clear(&remap->ids);
+}
+
+/** Add types of the peer to a type translation table
+ * \param remap the table to update
+ * \param map our type map
+ * \param first_id the id of the first type of the peer
+ * \param types the type names of the peer
+ * \param n_types the number of types
+ * \return 0 on success, < 0 on error
+ *
+ * The types are looked up or added in \a map. The peer can only replace
+ * known types or append new ones, \a first_id can't skip ids.
+ */
+int pw_type_remap_update(struct pw_type_remap *remap, struct spa_type_map *map,
+			 uint32_t first_id, const char **types, uint32_t n_types)
+{
+	uint32_t i, len, *ids;
+
+	len = pw_array_get_len(&remap->ids, uint32_t);
+	if (first_id > len || n_types > UINT32_MAX - first_id)
+		return -EINVAL;
+
+	if (first_id + n_types > len &&
+	    pw_array_add(&remap->ids, (first_id + n_types - len) * sizeof(uint32_t)) == NULL)
+		return -ENOMEM;
+
+	ids = remap->ids.data;
+
+	for (i = 0; i < n_types; i++, first_id++) {
+		ids[first_id] = spa_type_map_get_id(map, types[i]);
+		if (ids[first_id] != first_id)
+			remap->identity = false;
+	}
+	return 0;
+}
@@ -0,0 +1,112 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Registers an increasing number of memblocks and checks that
+ * pw_memblock_find() returns the right block for pointers inside the
+ * blocks and nothing for pointers outside of them. The time per lookup
+ * is printed for each number of blocks, it should grow with the log of
+ * the number of blocks. */
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <pipewire/mem.h>
+
+#define BLOCK_SIZE	256
+#define LOOKUPS		(1 << 20)
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static int run_test(uint32_t n_blocks)
+{
+	struct pw_memblock **blocks;
+	uint64_t start, stop;
+	uint32_t i, idx;
+	int res = 0, outside;
+	const void *ptr;
+
+	blocks = calloc(n_blocks, sizeof(struct pw_memblock *));
+
+	for (i = 0; i < n_blocks; i++) {
+		if (pw_memblock_alloc(0, BLOCK_SIZE, &blocks[i]) < 0) {
+			printf("can't allocate block %u\n", i);
+			n_blocks = i;
+			res = -1;
+			goto done;
+		}
+	}
+
+	for (i = 0; i < n_blocks; i++) {
+		if (pw_memblock_find(blocks[i]->ptr) != blocks[i] ||
+		    pw_memblock_find(SPA_MEMBER(blocks[i]->ptr, BLOCK_SIZE - 1, void)) != blocks[i]) {
+			printf("block %u not found\n", i);
+			res = -1;
+			goto done;
+		}
+	}
+	if (pw_memblock_find(&outside) != NULL) {
+		printf("found a block for a pointer outside the blocks\n");
+		res = -1;
+		goto done;
+	}
+
+	start = get_time();
+	for (i = 0; i < LOOKUPS; i++) {
+		idx = (i * 2654435761u) % n_blocks;
+		ptr = SPA_MEMBER(blocks[idx]->ptr, i % BLOCK_SIZE, void);
+		if (pw_memblock_find(ptr) != blocks[idx]) {
+			printf("lookup %u found the wrong block\n", i);
+			res = -1;
+			goto done;
+		}
+	}
+	stop = get_time();
+
+	printf("blocks %6u: %6.1f ns/lookup\n", n_blocks, (double)(stop - start) / LOOKUPS);
+
+      done:
+	/* free from the middle of the index first */
+	for (i = 1; i < n_blocks; i += 2)
+		pw_memblock_free(blocks[i]);
+	for (i = 0; i < n_blocks; i += 2)
+		pw_memblock_free(blocks[i]);
+	free(blocks);
+
+	return res;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t n, max_blocks;
+
+	max_blocks = argc > 1 ? atoi(argv[1]) : 16384;
+
+	for (n = 16; n <= max_blocks; n *= 4) {
+		if (run_test(n) < 0)
+			return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,781 @@
+/* PipeWire
+ * Copyright (C) 2018 Wim Taymans <wim.taymans@gmail.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/* Records the native protocol traffic of clients and replays it against
+ * a daemon.
+ *
+ *   pipewire-bench record FILE [SOCKET]
+ *
+ * listens on SOCKET (default pipewire-record) in XDG_RUNTIME_DIR and
+ * forwards every client to the daemon of PIPEWIRE_REMOTE. The messages of
+ * the clients are written to FILE. Run clients with PIPEWIRE_REMOTE=SOCKET
+ * to record them.
+ *
+ *   pipewire-bench replay FILE [N_CLIENTS]
+ *
+ * connects N_CLIENTS clients to the daemon of PIPEWIRE_REMOTE, each
+ * replaying one of the recorded clients as fast as possible. Every message
+ * is followed by a core sync, the time until the done event is the latency
+ * of the message. Messages that came with fds can't be replayed and are
+ * skipped. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <spa/pod/builder.h>
+#include <spa/pod/parser.h>
+
+#include <pipewire/pipewire.h>
+#include <pipewire/interfaces.h>
+#include <pipewire/array.h>
+
+#define MAX_FDS			28
+#define READ_SIZE		(1024 * 64)
+
+#define RECORD_MAGIC		"PWRECORD"
+#define RECORD_VERSION		1
+
+/* matches the large message flag of the connection */
+#define OPCODE_FLAG_LARGE	(1 << 7)
+
+struct file_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t padding;
+};
+
+struct record {
+	uint64_t time;		/* nsec since the start of the recording */
+	uint32_t client;	/* index of the client */
+#define RECORD_FLAG_FDS		(1 << 0)	/* came with fds, not replayed */
+	uint32_t flags;
+	uint32_t dest_id;
+	uint32_t opcode;
+	uint32_t size;		/* size of the payload after the record */
+	uint32_t padding;
+};
+
+struct data {
+	struct pw_main_loop *loop;
+
+	const char *remote;
+	FILE *file;
+	int listen_fd;
+	char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	uint64_t start;
+
+	uint32_t n_clients;
+	uint64_t n_messages;
+	struct spa_list link_list;
+};
+
+/* a recorded client and its connection to the daemon */
+struct link {
+	struct spa_list link;
+	struct data *data;
+	uint32_t index;
+
+	int client_fd;
+	int daemon_fd;
+	struct spa_source *client_source;
+	struct spa_source *daemon_source;
+
+	struct pw_array buffer;		/* unparsed messages of the client */
+	bool with_fds;			/* fds came with the unparsed messages */
+};
+
+struct message {
+	uint32_t dest_id;
+	uint32_t opcode;
+	uint32_t size;
+	uint32_t flags;
+	void *payload;
+};
+
+struct session {
+	struct pw_array messages;	/* array of struct message */
+};
+
+struct replay {
+	pthread_t thread;
+	struct session *session;
+	int fd;
+
+	struct pw_array in;
+	uint32_t seq;
+
+	uint64_t *latencies;
+	uint32_t n_latencies;
+	uint32_t n_skipped;
+	uint32_t n_errors;
+	int res;
+};
+
+static uint64_t get_time(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return SPA_TIMESPEC_TO_TIME(&now);
+}
+
+static int make_address(const char *name, struct sockaddr_un *addr, socklen_t *len)
+{
+	const char *runtime_dir;
+	int name_size;
+
+	if ((runtime_dir = getenv("XDG_RUNTIME_DIR")) == NULL) {
+		fprintf(stderr, "XDG_RUNTIME_DIR not set in the environment\n");
+		return -ENOENT;
+	}
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_LOCAL;
+	name_size = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s",
+			     runtime_dir, name) + 1;
+	if (name_size > (int) sizeof(addr->sun_path)) {
+		fprintf(stderr, "socket path \"%s/%s\" too long\n", runtime_dir, name);
+		return -ENAMETOOLONG;
+	}
+	*len = offsetof(struct sockaddr_un, sun_path) + name_size;
+
+	return 0;
+}
+
+static int connect_daemon(const char *name)
+{
+	struct sockaddr_un addr;
+	socklen_t len;
+	int fd, res;
+
+	if ((res = make_address(name, &addr, &len)) < 0)
+		return res;
+
+	if ((fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+		return -errno;
+
+	if (connect(fd, (struct sockaddr *) &addr, len) < 0) {
+		res = -errno;
+		close(fd);
+		return res;
+	}
+	return fd;
+}
+
+/* read from \a from and write everything, with the fds, to \a to */
+static ssize_t forward(int from, int to, void *buffer, size_t size, bool *with_fds)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	int fds[MAX_FDS];
+	uint32_t i, n_fds = 0;
+	ssize_t len, sent, res;
+
+	iov.iov_base = buffer;
+	iov.iov_len = size;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	while ((len = recvmsg(from, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	if (len <= 0)
+		return len < 0 ? -errno : 0;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n_fds = (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
+		memcpy(fds, CMSG_DATA(cmsg), n_fds * sizeof(int));
+	}
+	*with_fds = n_fds > 0;
+
+	/* the fds go with the first part */
+	msg.msg_controllen = 0;
+	msg.msg_control = NULL;
+	if (n_fds > 0) {
+		msg.msg_control = cmsgbuf;
+		msg.msg_controllen = CMSG_SPACE(n_fds * sizeof(int));
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(n_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, n_fds * sizeof(int));
+	}
+	for (sent = 0; sent < len; sent += res) {
+		iov.iov_base = SPA_MEMBER(buffer, sent, void);
+		iov.iov_len = len - sent;
+		while ((res = sendmsg(to, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+		if (res < 0) {
+			len = -errno;
+			break;
+		}
+		msg.msg_controllen = 0;
+		msg.msg_control = NULL;
+	}
+	for (i = 0; i < n_fds; i++)
+		close(fds[i]);
+
+	return len;
+}
+
+static void write_messages(struct link *link)
+{
+	struct data *data = link->data;
+	struct pw_array *buf = &link->buffer;
+	struct record rec = { 0 };
+	uint32_t *p;
+	size_t offset = 0;
+
+	while (buf->size - offset >= 8) {
+		p = SPA_MEMBER(buf->data, offset, uint32_t);
+		rec.size = p[1] & 0xffffff;
+		if (buf->size - offset < 8 + rec.size)
+			break;
+
+		rec.time = get_time() - data->start;
+		rec.client = link->index;
+		rec.flags = link->with_fds ? RECORD_FLAG_FDS : 0;
+		rec.dest_id = p[0];
+		rec.opcode = p[1] >> 24;
+		if (rec.opcode & OPCODE_FLAG_LARGE)
+			rec.flags |= RECORD_FLAG_FDS;
+
+		if (fwrite(&rec, sizeof(rec), 1, data->file) != 1 ||
+		    fwrite(&p[2], 1, rec.size, data->file) != rec.size)
+			fprintf(stderr, "failed to write record: %m\n");
+
+		offset += 8 + rec.size;
+		data->n_messages++;
+	}
+	if (offset > 0) {
+		memmove(buf->data, SPA_MEMBER(buf->data, offset, void), buf->size - offset);
+		buf->size -= offset;
+		if (buf->size == 0)
+			link->with_fds = false;
+	}
+}
+
+static void link_destroy(struct link *link)
+{
+	struct pw_loop *l = pw_main_loop_get_loop(link->data->loop);
+
+	printf("client %u: disconnected\n", link->index);
+
+	spa_list_remove(&link->link);
+	pw_loop_destroy_source(l, link->client_source);
+	pw_loop_destroy_source(l, link->daemon_source);
+	close(link->client_fd);
+	close(link->daemon_fd);
+	pw_array_clear(&link->buffer);
+	free(link);
+}
+
+static void on_client_data(void *user_data, int fd, enum spa_io mask)
+{
+	struct link *link = user_data;
+	bool with_fds = false;
+	ssize_t len;
+	void *p;
+
+	if (mask & SPA_IO_IN) {
+		if ((p = pw_array_add(&link->buffer, READ_SIZE)) == NULL) {
+			link_destroy(link);
+			return;
+		}
+		len = forward(link->client_fd, link->daemon_fd, p, READ_SIZE, &with_fds);
+		link->buffer.size -= READ_SIZE - SPA_MAX(len, 0);
+		if (len <= 0) {
+			link_destroy(link);
+			return;
+		}
+		link->with_fds |= with_fds;
+		write_messages(link);
+	}
+	else if (mask & (SPA_IO_ERR | SPA_IO_HUP))
+		link_destroy(link);
+}
+
+static void on_daemon_data(void *user_data, int fd, enum spa_io mask)
+{
+	struct link *link = user_data;
+	uint8_t buffer[READ_SIZE];
+	bool with_fds;
+
+	if (mask & SPA_IO_IN) {
+		if (forward(link->daemon_fd, link->client_fd, buffer, sizeof(buffer), &with_fds) <= 0)
+			link_destroy(link);
+	}
+	else if (mask & (SPA_IO_ERR | SPA_IO_HUP))
+		link_destroy(link);
+}
+
+static void on_connect(void *user_data, int fd, enum spa_io mask)
+{
+	struct data *data = user_data;
+	struct pw_loop *l = pw_main_loop_get_loop(data->loop);
+	struct link *link;
+	int client_fd, daemon_fd;
+
+	if ((client_fd = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) < 0)
+		return;
+
+	if ((daemon_fd = connect_daemon(data->remote)) < 0) {
+		fprintf(stderr, "can't connect to %s: %s\n", data->remote, strerror(-daemon_fd));
+		close(client_fd);
+		return;
+	}
+
+	link = calloc(1, sizeof(struct link));
+	link->data = data;
+	link->index = data->n_clients++;
+	link->client_fd = client_fd;
+	link->daemon_fd = daemon_fd;
+	pw_array_init(&link->buffer, READ_SIZE);
+	link->client_source = pw_loop_add_io(l, client_fd, SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP,
+					     false, on_client_data, link);
+	link->daemon_source = pw_loop_add_io(l, daemon_fd, SPA_IO_IN | SPA_IO_ERR | SPA_IO_HUP,
+					     false, on_daemon_data, link);
+	spa_list_append(&data->link_list, &link->link);
+
+	printf("client %u: connected\n", link->index);
+}
+
+static void do_quit(void *user_data, int signal_number)
+{
+	struct data *data = user_data;
+	pw_main_loop_quit(data->loop);
+}
+
+static int do_record(struct data *data, const char *filename, const char *name)
+{
+	struct pw_loop *l;
+	struct sockaddr_un addr;
+	struct file_header header = { RECORD_MAGIC, RECORD_VERSION, };
+	struct link *link, *tmp;
+	socklen_t len;
+	int res;
+
+	if ((res = make_address(name, &addr, &len)) < 0)
+		return res;
+
+	if ((data->file = fopen(filename, "w")) == NULL) {
+		fprintf(stderr, "can't open %s: %m\n", filename);
+		return -errno;
+	}
+	if (fwrite(&header, sizeof(header), 1, data->file) != 1) {
+		res = -errno;
+		goto close_file;
+	}
+
+	if ((data->listen_fd = socket(PF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0) {
+		res = -errno;
+		goto close_file;
+	}
+	unlink(addr.sun_path);
+	if (bind(data->listen_fd, (struct sockaddr *) &addr, len) < 0 ||
+	    listen(data->listen_fd, 128) < 0) {
+		res = -errno;
+		fprintf(stderr, "can't listen on %s: %m\n", addr.sun_path);
+		goto close_socket;
+	}
+	strcpy(data->socket_path, addr.sun_path);
+
+	data->loop = pw_main_loop_new(NULL);
+	l = pw_main_loop_get_loop(data->loop);
+	pw_loop_add_signal(l, SIGINT, do_quit, data);
+	pw_loop_add_signal(l, SIGTERM, do_quit, data);
+	pw_loop_add_io(l, data->listen_fd, SPA_IO_IN, false, on_connect, data);
+
+	spa_list_init(&data->link_list);
+	data->start = get_time();
+
+	printf("recording clients of %s to %s, run clients with PIPEWIRE_REMOTE=%s\n",
+	       data->remote, filename, name);
+
+	pw_main_loop_run(data->loop);
+
+	spa_list_for_each_safe(link, tmp, &data->link_list, link)
+		link_destroy(link);
+
+	printf("recorded %"PRIu64" messages of %u clients\n", data->n_messages, data->n_clients);
+
+	pw_main_loop_destroy(data->loop);
+	unlink(data->socket_path);
+	res = 0;
+
+      close_socket:
+	close(data->listen_fd);
+      close_file:
+	fclose(data->file);
+	return res;
+}
+
+static int load_sessions(const char *filename, struct pw_array *sessions)
+{
+	struct file_header header;
+	struct record rec;
+	struct session *s;
+	struct message *m;
+	FILE *f;
+	uint32_t i, n_sessions;
+
+	if ((f = fopen(filename, "r")) == NULL) {
+		fprintf(stderr, "can't open %s: %m\n", filename);
+		return -errno;
+	}
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 ||
+	    header.version != RECORD_VERSION) {
+		fprintf(stderr, "%s is not a recording\n", filename);
+		fclose(f);
+		return -EINVAL;
+	}
+
+	while (fread(&rec, sizeof(rec), 1, f) == 1) {
+		n_sessions = pw_array_get_len(sessions, struct session);
+		for (i = n_sessions; i <= rec.client; i++) {
+			s = pw_array_add(sessions, sizeof(struct session));
+			pw_array_init(&s->messages, 64 * sizeof(struct message));
+		}
+		s = pw_array_get_unchecked(sessions, rec.client, struct session);
+
+		m = pw_array_add(&s->messages, sizeof(struct message));
+		m->dest_id = rec.dest_id;
+		m->opcode = rec.opcode;
+		m->size = rec.size;
+		m->flags = rec.flags;
+		m->payload = malloc(rec.size);
+		if (fread(m->payload, 1, rec.size, f) != rec.size) {
+			fprintf(stderr, "%s is truncated\n", filename);
+			s->messages.size -= sizeof(struct message);
+			free(m->payload);
+			break;
+		}
+	}
+	fclose(f);
+
+	return pw_array_get_len(sessions, struct session);
+}
+
+static int send_message(int fd, uint32_t dest_id, uint32_t opcode, const void *payload, uint32_t size)
+{
+	uint32_t header[2] = { dest_id, (opcode << 24) | (size & 0xffffff) };
+	struct iovec iov[2] = { { header, sizeof(header) }, { (void *) payload, size } };
+	struct msghdr msg = { 0 };
+	ssize_t len;
+
+	msg.msg_iov = iov;
+	msg.msg_iovlen = 2;
+
+	while ((len = sendmsg(fd, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR);
+	if (len < 0)
+		return -errno;
+	/* a blocking socket writes everything */
+	return 0;
+}
+
+static int send_sync(int fd, uint32_t seq)
+{
+	uint8_t buffer[64];
+	struct spa_pod_builder b = SPA_POD_BUILDER_INIT(buffer, sizeof(buffer));
+
+	spa_pod_builder_struct(&b, "i", seq);
+	return send_message(fd, 0, PW_CORE_PROXY_METHOD_SYNC, buffer, b.state.offset);
+}
+
+static int read_replies(struct replay *r)
+{
+	struct msghdr msg = { 0 };
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char cmsgbuf[CMSG_SPACE(MAX_FDS * sizeof(int))];
+	ssize_t len;
+	void *p;
+	int i, n_fds;
+
+	if ((p = pw_array_add(&r->in, READ_SIZE)) == NULL)
+		return -ENOMEM;
+
+	iov.iov_base = p;
+	iov.iov_len = READ_SIZE;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf;
+	msg.msg_controllen = sizeof(cmsgbuf);
+
+	while ((len = recvmsg(r->fd, &msg, MSG_CMSG_CLOEXEC)) < 0 && errno == EINTR);
+	r->in.size -= READ_SIZE - SPA_MAX(len, 0);
+	if (len <= 0)
+		return len < 0 ? -errno : -EPIPE;
+
+	/* we don't use the fds of the daemon */
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+		n_fds = (cmsg->cmsg_len - ((char *) CMSG_DATA(cmsg) - (char *) cmsg)) / sizeof(int);
+		for (i = 0; i < n_fds; i++)
+			close(((int *) CMSG_DATA(cmsg))[i]);
+	}
+	return 0;
+}
+
+/* read until the done event of \a seq */
+static int wait_done(struct replay *r, uint32_t seq)
+{
+	struct spa_pod_parser prs;
+	uint32_t *p, size, opcode, done;
+	size_t offset;
+	bool found = false;
+	int res;
+
+	while (!found) {
+		if ((res = read_replies(r)) < 0)
+			return res;
+
+		for (offset = 0; r->in.size - offset >= 8 && !found; offset += 8 + size) {
+			p = SPA_MEMBER(r->in.data, offset, uint32_t);
+			size = p[1] & 0xffffff;
+			if (r->in.size - offset < 8 + size)
+				break;
+
+			opcode = p[1] >> 24;
+			if (p[0] != 0)
+				continue;
+
+			if (opcode == PW_CORE_PROXY_EVENT_ERROR) {
+				r->n_errors++;
+			} else if (opcode == PW_CORE_PROXY_EVENT_DONE) {
+				spa_pod_parser_init(&prs, &p[2], size, 0);
+				if (spa_pod_parser_get(&prs, "[ i", &done, NULL) >= 0 && done == seq)
+					found = true;
+			}
+		}
+		memmove(r->in.data, SPA_MEMBER(r->in.data, offset, void), r->in.size - offset);
+		r->in.size -= offset;
+	}
+	return 0;
+}
+
+static void *replay_thread(void *user_data)
+{
+	struct replay *r = user_data;
+	struct message *m;
+	uint64_t start;
+
+	r->latencies = calloc(pw_array_get_len(&r->session->messages, struct message),
+			      sizeof(uint64_t));
+
+	pw_array_for_each(m, &r->session->messages) {
+		if (m->flags & RECORD_FLAG_FDS) {
+			r->n_skipped++;
+			continue;
+		}
+		start = get_time();
+
+		if ((r->res = send_message(r->fd, m->dest_id, m->opcode, m->payload, m->size)) < 0 ||
+		    (r->res = send_sync(r->fd, ++r->seq)) < 0 ||
+		    (r->res = wait_done(r, r->seq)) < 0)
+			break;
+
+		r->latencies[r->n_latencies++] = get_time() - start;
+	}
+	return NULL;
+}
+
+/* user and system time of \a pid in nsec */
+static uint64_t get_cpu_time(pid_t pid)
+{
+	char path[64], buffer[1024], *p;
+	unsigned long utime, stime;
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	if ((f = fopen(path, "r")) == NULL)
+		return 0;
+	p = fgets(buffer, sizeof(buffer), f);
+	fclose(f);
+
+	/* the name can contain spaces, skip to the state after it */
+	if (p == NULL || (p = strrchr(buffer, ')')) == NULL)
+		return 0;
+	for (i = 0; i < 12 && p; i++)
+		p = strchr(p + 1, ' ');
+	if (p == NULL || sscanf(p, "%lu %lu", &utime, &stime) != 2)
+		return 0;
+
+	return (uint64_t)(utime + stime) * SPA_NSEC_PER_SEC / sysconf(_SC_CLK_TCK);
+}
+
+static int compare_latency(const void *a, const void *b)
+{
+	uint64_t la = *(const uint64_t *) a, lb = *(const uint64_t *) b;
+	return la < lb ? -1 : la > lb;
+}
+
+static int do_replay(struct data *data, const char *filename, uint32_t n_clients)
+{
+	struct pw_array sessions = PW_ARRAY_INIT(16 * sizeof(struct session));
+	struct replay *replays;
+	struct session *s;
+	struct message *m;
+	struct ucred ucred;
+	socklen_t len = sizeof(ucred);
+	uint64_t start, stop, cpu_start, cpu_stop, *latencies;
+	uint32_t i, n_sessions, n_latencies = 0, n_skipped = 0, n_errors = 0;
+	int res;
+
+	if ((res = load_sessions(filename, &sessions)) <= 0) {
+		if (res == 0)
+			fprintf(stderr, "%s has no messages\n", filename);
+		return res < 0 ? res : -EINVAL;
+	}
+	n_sessions = res;
+
+	replays = calloc(n_clients, sizeof(struct replay));
+	for (i = 0; i < n_clients; i++) {
+		replays[i].session = pw_array_get_unchecked(&sessions, i % n_sessions, struct session);
+		pw_array_init(&replays[i].in, READ_SIZE);
+		if ((replays[i].fd = connect_daemon(data->remote)) < 0) {
+			fprintf(stderr, "can't connect to %s: %s\n", data->remote,
+				strerror(-replays[i].fd));
+			n_clients = i;
+			break;
+		}
+	}
+	if (n_clients == 0) {
+		res = -ECONNREFUSED;
+		goto done;
+	}
+
+	if (getsockopt(replays[0].fd, SOL_SOCKET, SO_PEERCRED, &ucred, &len) < 0)
+		ucred.pid = 0;
+
+	printf("replaying %u recorded clients with %u clients\n", n_sessions, n_clients);
+
+	cpu_start = ucred.pid ? get_cpu_time(ucred.pid) : 0;
+	start = get_time();
+
+	for (i = 0; i < n_clients; i++)
+		pthread_create(&replays[i].thread, NULL, replay_thread, &replays[i]);
+	for (i = 0; i < n_clients; i++)
+		pthread_join(replays[i].thread, NULL);
+
+	stop = get_time();
+	cpu_stop = ucred.pid ? get_cpu_time(ucred.pid) : 0;
+
+	for (i = 0; i < n_clients; i++) {
+		n_latencies += replays[i].n_latencies;
+		n_skipped += replays[i].n_skipped;
+		n_errors += replays[i].n_errors;
+		if (replays[i].res < 0)
+			fprintf(stderr, "client %u: %s\n", i, strerror(-replays[i].res));
+	}
+
+	latencies = malloc(SPA_MAX(n_latencies, 1) * sizeof(uint64_t));
+	for (i = 0, n_latencies = 0; i < n_clients; i++) {
+		memcpy(&latencies[n_latencies], replays[i].latencies,
+		       replays[i].n_latencies * sizeof(uint64_t));
+		n_latencies += replays[i].n_latencies;
+	}
+	qsort(latencies, n_latencies, sizeof(uint64_t), compare_latency);
+
+	printf("messages %u skipped %u errors %u in %.3f s: %.1f messages/s\n",
+	       n_latencies, n_skipped, n_errors, (double)(stop - start) / SPA_NSEC_PER_SEC,
+	       n_latencies * (double) SPA_NSEC_PER_SEC / (stop - start));
+	if (n_latencies > 0) {
+		printf("latency p50 %.1f us p90 %.1f us p99 %.1f us max %.1f us\n",
+		       latencies[n_latencies * 50 / 100] / 1000.0,
+		       latencies[n_latencies * 90 / 100] / 1000.0,
+		       latencies[n_latencies * 99 / 100] / 1000.0,
+		       latencies[n_latencies - 1] / 1000.0);
+	}
+	if (ucred.pid && n_latencies > 0)
+		printf("daemon %d cpu %.3f s: %.1f us/message\n", ucred.pid,
+		       (double)(cpu_stop - cpu_start) / SPA_NSEC_PER_SEC,
+		       (double)(cpu_stop - cpu_start) / 1000.0 / n_latencies);
+	else
+		printf("daemon cpu n/a\n");
+
+	free(latencies);
+	res = 0;
+
+      done:
+	for (i = 0; i < n_clients; i++) {
+		close(replays[i].fd);
+		free(replays[i].latencies);
+		pw_array_clear(&replays[i].in);
+	}
+	free(replays);
+	pw_array_for_each(s, &sessions) {
+		pw_array_for_each(m, &s->messages)
+			free(m->payload);
+		pw_array_clear(&s->messages);
+	}
+	pw_array_clear(&sessions);
+
+	return res;
+}
+
+static void show_help(const char *name)
+{
+	fprintf(stdout, "usage: %s record FILE [SOCKET]\n"
+			"       %s replay FILE [N_CLIENTS]\n", name, name);
+}
+
+int main(int argc, char *argv[])
+{
+	struct data data = { 0 };
+	int res;
+
+	pw_init(&argc, &argv);
+
+	if (argc < 3) {
+		show_help(argv[0]);
+		return -1;
+	}
+
+	if ((data.remote = getenv("PIPEWIRE_REMOTE")) == NULL)
+		data.remote = "pipewire-0";
+
+	if (strcmp(argv[1], "record") == 0) {
+		res = do_record(&data, argv[2], argc > 3 ? argv[3] : "pipewire-record");
+	} else if (strcmp(argv[1], "replay") == 0) {
+		res = do_replay(&data, argv[2], argc > 3 ? atoi(argv[3]) : 1);
+	} else {
+		show_help(argv[0]);
+		return -1;
+	}
+
+	return res < 0 ? -1 : 0;
+}